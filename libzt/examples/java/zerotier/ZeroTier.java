@@ -27,6 +27,7 @@
 package zerotier;
 
 import java.net.*;
+import java.nio.ByteBuffer;
 
 public class ZeroTier {
 
@@ -74,6 +75,25 @@ public class ZeroTier {
     public native int recvfrom(int fd, byte[] buf, int len, int flags, ZTSocketAddress addr);
     public native int read(int fd, byte[] buf, int len);
     public native int write(int fd, byte[] buf, int len);
+
+    // Same as above, but only the region [off, off+len) of buf is used
+    public native int sendto_range(int fd, byte[] buf, int off, int len, int flags, ZTSocketAddress addr);
+    public native int send_range(int fd, byte[] buf, int off, int len, int flags);
+    public native int recv_range(int fd, byte[] buf, int off, int len, int flags);
+    public native int recvfrom_range(int fd, byte[] buf, int off, int len, int flags, ZTSocketAddress addr);
+    public native int read_range(int fd, byte[] buf, int off, int len);
+    public native int write_range(int fd, byte[] buf, int off, int len);
+
+    // Zero-copy I/O on direct ByteBuffers (see ByteBuffer.allocateDirect()), positions are not changed
+    public native int sendto_direct(int fd, ByteBuffer buf, int off, int len, int flags, ZTSocketAddress addr);
+    public native int send_direct(int fd, ByteBuffer buf, int off, int len, int flags);
+    public native int recv_direct(int fd, ByteBuffer buf, int off, int len, int flags);
+    public native int recvfrom_direct(int fd, ByteBuffer buf, int off, int len, int flags, ZTSocketAddress addr);
+    public native int read_direct(int fd, ByteBuffer buf, int off, int len);
+    public native int write_direct(int fd, ByteBuffer buf, int off, int len);
+    public native int readv(int fd, ByteBuffer[] bufs);
+    public native int writev(int fd, ByteBuffer[] bufs);
+
     public native int shutdown(int fd, int how);
     public native boolean getsockname(int fd, ZTSocketAddress addr);
     public native int getpeername(int fd, ZTSocketAddress addr);
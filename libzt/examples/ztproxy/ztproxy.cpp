@@ -60,6 +60,7 @@ namespace ZeroTier {
 		:
 			_enabled(true),
 			_run(true),
+			_epfd(-1),
 			_proxy_listen_port(proxy_listen_port),
 			_internal_port(internal_port),
 			_nwid(nwid),
@@ -101,6 +102,9 @@ namespace ZeroTier {
 		_run = false;
 		_phy.whack();
 		Thread::join(_thread);
+		if (_epfd >= 0) {
+			zts_epoll_close(_epfd);
+		}
 		_phy.close(_tcpListenSocket,false);
 		_phy.close(_tcpListenSocket6,false);
 	}
@@ -117,11 +121,15 @@ namespace ZeroTier {
 		}
 
 		TcpConnection *conn = NULL;
-		uint32_t msecs = 1;
-		struct timeval tv;
-		tv.tv_sec = msecs / 1000;
-		tv.tv_usec = (msecs % 1000) * 1000;
+		int msecs = 1;
 		int ret = 0;
+		struct zts_epoll_event events[ZTPROXY_MAX_EVENTS];
+		// Connections are registered as they are established, so each pass only
+		// visits the ones libzt reports activity on rather than every connection
+		if ((_epfd = zts_epoll_create(0)) < 0) {
+			DEBUG_ERROR("unable to create epoll instance (errno=%d)", errno);
+			return;
+		}
   		// Main I/O loop
   		// Moves data between client application socket and libzt VirtualSocket 
 		while(_run) {
@@ -129,22 +137,13 @@ namespace ZeroTier {
 			_phy.poll(1);
 
 			conn_m.lock();
-			// build fd_sets to select upon
-			FD_ZERO(&read_set);
-  			FD_ZERO(&write_set);
-			nfds = 0;
-  			for (size_t i=0; i<clist.size(); i++) {
-  				FD_SET(clist[i]->zfd, &read_set);
-  				FD_SET(clist[i]->zfd, &write_set);
-  				nfds = clist[i]->zfd > nfds ? clist[i]->zfd : nfds;
-  			}
-
-  			ret = zts_select(nfds + 1, &read_set, &write_set, NULL, &tv);
+  			ret = zts_epoll_wait(_epfd, events, ZTPROXY_MAX_EVENTS, msecs);
 			if (ret > 0) {
-				for (int fd_i=0; fd_i<nfds+1; fd_i++) { // I/O needs to be handled on at least one fd
+				for (int ev_i=0; ev_i<ret; ev_i++) { // I/O needs to be handled on at least one fd
+					int fd_i = events[ev_i].data.fd;
 
 					// RX, Handle data incoming from libzt
-					if (FD_ISSET(fd_i, &read_set)) {
+					if (events[ev_i].events & (ZTS_EPOLLIN|ZTS_EPOLLERR)) {
 						int wr = 0, rd = 0;
 						conn = zmap[fd_i];
 						if (conn == NULL) {
@@ -176,11 +175,12 @@ namespace ZeroTier {
 					}
 
 					// TX, Handle data outgoing from client to libzt
-					if (FD_ISSET(fd_i, &write_set)) {
+					if (events[ev_i].events & ZTS_EPOLLOUT) {
 						int wr = 0;
 						conn = zmap[fd_i];
 						if (conn == NULL) {
 							DEBUG_ERROR("invalid conn, possibly closed before transmit was possible");
+							continue;
 						}
 						// read data from client and place it on ring buffer
 						conn->tx_m.lock();
@@ -195,6 +195,9 @@ namespace ZeroTier {
 								conn->TXbuf->consume(wr); // data is presumed sent, mark it as such in the ringbuffer
 							}
 						}
+						if (conn->TXbuf->count() == 0) {
+							setWriteInterest(conn, false); // nothing left to send, stop polling for writability
+						}
 						conn->tx_m.unlock();
 					}
 				}
@@ -203,6 +206,14 @@ namespace ZeroTier {
 		}
 	}
 
+	void ZTProxy::setWriteInterest(TcpConnection *conn, bool enabled)
+	{
+		struct zts_epoll_event ev;
+		ev.events = enabled ? (ZTS_EPOLLIN|ZTS_EPOLLOUT) : ZTS_EPOLLIN;
+		ev.data.fd = conn->zfd;
+		zts_epoll_ctl(_epfd, ZTS_EPOLL_CTL_MOD, conn->zfd, &ev);
+	}
+
 	bool isValidIPAddress(const char *ip)
 	{
 		struct sockaddr_in sa;
@@ -294,6 +305,12 @@ namespace ZeroTier {
 			conn->client_sock = sock;
 			cmap[conn->client_sock] = conn;	
 			zmap[zfd] = conn;
+			struct zts_epoll_event ev;
+			ev.events = ZTS_EPOLLIN;
+			ev.data.fd = zfd;
+			if (zts_epoll_ctl(_epfd, ZTS_EPOLL_CTL_ADD, zfd, &ev) < 0) {
+				DEBUG_ERROR("unable to watch fd=%d (errno=%d)", zfd, errno);
+			}
 			conn_m.unlock();			
 		}
 		// Write data coming from client TCP connection to its TX buffer, later emptied into libzt by threadMain I/O loop
@@ -303,6 +320,7 @@ namespace ZeroTier {
 		}
 		else {
 			// DEBUG_INFO("CLIENT -> TXBUFFER = %d bytes", wr);
+			setWriteInterest(conn, true);
 		}
 		conn->tx_m.unlock();
 	}
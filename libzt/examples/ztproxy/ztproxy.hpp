@@ -44,6 +44,8 @@
 
 #define BUF_SZ 1024*1024
 
+#define ZTPROXY_MAX_EVENTS 64
+
 namespace ZeroTier {
 
 	typedef void PhySocket;
@@ -101,13 +103,15 @@ namespace ZeroTier {
 
 	TcpConnection *getConnection(PhySocket *sock);
 
-	private:	
+	private:
+		// Toggle ZTS_EPOLLOUT for a connection depending on whether it has data waiting to go out
+		void setWriteInterest(TcpConnection *conn, bool enabled);
+
 		volatile bool _enabled;
 		volatile bool _run;	
 
 		Mutex conn_m;
-		fd_set read_set, write_set;
-		int nfds;
+		int _epfd; // zts_epoll instance watching every libzt connection
 
 		int _proxy_listen_port;
 		int _internal_port;
@@ -143,10 +143,8 @@ bool DB::get(const uint64_t networkId,nlohmann::json &network,const uint64_t mem
 	{
 		std::lock_guard<std::mutex> l2(nw->lock);
 		network = nw->config;
-		auto m = nw->members.find(memberId);
-		if (m == nw->members.end())
+		if (!_getMember(*nw,networkId,memberId,member))
 			return false;
-		member = m->second;
 	}
 	return true;
 }
@@ -165,11 +163,9 @@ bool DB::get(const uint64_t networkId,nlohmann::json &network,const uint64_t mem
 	{
 		std::lock_guard<std::mutex> l2(nw->lock);
 		network = nw->config;
-		_fillSummaryInfo(nw,info);
-		auto m = nw->members.find(memberId);
-		if (m == nw->members.end())
+		_fillSummaryInfo(nw,networkId,info,false);
+		if (!_getMember(*nw,networkId,memberId,member))
 			return false;
-		member = m->second;
 	}
 	return true;
 }
@@ -188,8 +184,7 @@ bool DB::get(const uint64_t networkId,nlohmann::json &network,std::vector<nlohma
 	{
 		std::lock_guard<std::mutex> l2(nw->lock);
 		network = nw->config;
-		for(auto m=nw->members.begin();m!=nw->members.end();++m)
-			members.push_back(m->second);
+		_getMembers(*nw,networkId,members);
 	}
 	return true;
 }
@@ -207,7 +202,47 @@ bool DB::summary(const uint64_t networkId,NetworkSummaryInfo &info)
 	}
 	{
 		std::lock_guard<std::mutex> l2(nw->lock);
-		_fillSummaryInfo(nw,info);
+		_fillSummaryInfo(nw,networkId,info,true);
+	}
+	return true;
+}
+
+bool DB::allocateIpv4(const uint64_t networkId,const uint32_t first,const uint32_t last,const uint32_t start,uint32_t &ip)
+{
+	waitForReady();
+	std::shared_ptr<_Network> nw;
+	{
+		std::lock_guard<std::mutex> l(_networks_l);
+		auto nwi = _networks.find(networkId);
+		if (nwi == _networks.end())
+			return false;
+		nw = nwi->second;
+	}
+	{
+		std::lock_guard<std::mutex> l2(nw->lock);
+		if (!nw->allocatedIps.findFreeIpv4(first,last,start,ip))
+			return false;
+		nw->allocatedIps.insert(InetAddress(Utils::hton(ip),0));
+	}
+	return true;
+}
+
+bool DB::allocateIp(const uint64_t networkId,const InetAddress &ip)
+{
+	waitForReady();
+	std::shared_ptr<_Network> nw;
+	{
+		std::lock_guard<std::mutex> l(_networks_l);
+		auto nwi = _networks.find(networkId);
+		if (nwi == _networks.end())
+			return false;
+		nw = nwi->second;
+	}
+	{
+		std::lock_guard<std::mutex> l2(nw->lock);
+		if (nw->allocatedIps.contains(ip))
+			return false;
+		nw->allocatedIps.insert(ip);
 	}
 	return true;
 }
@@ -221,6 +256,33 @@ void DB::networks(std::vector<uint64_t> &networks)
 		networks.push_back(n->first);
 }
 
+bool DB::_getMember(_Network &nw,const uint64_t networkId,const uint64_t memberId,nlohmann::json &member)
+{
+	auto m = nw.members.find(memberId);
+	if (m == nw.members.end())
+		return false;
+	member = m->second;
+	return true;
+}
+
+void DB::_getMembers(_Network &nw,const uint64_t networkId,std::vector<nlohmann::json> &members)
+{
+	for(auto m=nw.members.begin();m!=nw.members.end();++m)
+		members.push_back(m->second);
+}
+
+void DB::_setMember(_Network &nw,const uint64_t networkId,const uint64_t memberId,const nlohmann::json *member)
+{
+	if (member)
+		nw.members[memberId] = *member;
+	else nw.members.erase(memberId);
+}
+
+unsigned long DB::_memberCount(_Network &nw,const uint64_t networkId)
+{
+	return (unsigned long)nw.members.size();
+}
+
 void DB::_memberChanged(nlohmann::json &old,nlohmann::json &memberConfig,bool push)
 {
 	uint64_t memberId = 0;
@@ -278,7 +340,7 @@ void DB::_memberChanged(nlohmann::json &old,nlohmann::json &memberConfig,bool pu
 		{
 			std::lock_guard<std::mutex> l(nw->lock);
 
-			nw->members[memberId] = memberConfig;
+			_setMember(*nw,networkId,memberId,&memberConfig);
 
 			if (OSUtils::jsonBool(memberConfig["activeBridge"],false))
 				nw->activeBridgeMembers.insert(memberId);
@@ -305,12 +367,12 @@ void DB::_memberChanged(nlohmann::json &old,nlohmann::json &memberConfig,bool pu
 			}
 		}
 
-		if (push)
+		if ((push)&&(_controller))
 			_controller->onNetworkMemberUpdate(networkId,memberId);
 	} else if (memberId) {
 		if (nw) {
 			std::lock_guard<std::mutex> l(nw->lock);
-			nw->members.erase(memberId);
+			_setMember(*nw,networkId,memberId,(const nlohmann::json *)0);
 		}
 		if (networkId) {
 			std::lock_guard<std::mutex> l(_networks_l);
@@ -324,7 +386,7 @@ void DB::_memberChanged(nlohmann::json &old,nlohmann::json &memberConfig,bool pu
 		}
 	}
 
-	if ((push)&&((wasAuth)&&(!isAuth)&&(networkId)&&(memberId)))
+	if ((push)&&(_controller)&&((wasAuth)&&(!isAuth)&&(networkId)&&(memberId)))
 		_controller->onNetworkMemberDeauthorize(networkId,memberId);
 }
 
@@ -346,7 +408,7 @@ void DB::_networkChanged(nlohmann::json &old,nlohmann::json &networkConfig,bool
 				std::lock_guard<std::mutex> l2(nw->lock);
 				nw->config = networkConfig;
 			}
-			if (push)
+			if ((push)&&(_controller))
 				_controller->onNetworkUpdate(id);
 		}
 	} else if (old.is_object()) {
@@ -359,16 +421,17 @@ void DB::_networkChanged(nlohmann::json &old,nlohmann::json &networkConfig,bool
 	}
 }
 
-void DB::_fillSummaryInfo(const std::shared_ptr<_Network> &nw,NetworkSummaryInfo &info)
+void DB::_fillSummaryInfo(const std::shared_ptr<_Network> &nw,const uint64_t networkId,NetworkSummaryInfo &info,const bool includeAllocatedIps)
 {
 	for(auto ab=nw->activeBridgeMembers.begin();ab!=nw->activeBridgeMembers.end();++ab)
 		info.activeBridges.push_back(Address(*ab));
 	std::sort(info.activeBridges.begin(),info.activeBridges.end());
-	for(auto ip=nw->allocatedIps.begin();ip!=nw->allocatedIps.end();++ip)
-		info.allocatedIps.push_back(*ip);
-	std::sort(info.allocatedIps.begin(),info.allocatedIps.end());
+	if (includeAllocatedIps) {
+		nw->allocatedIps.list(info.allocatedIps);
+		std::sort(info.allocatedIps.begin(),info.allocatedIps.end());
+	}
 	info.authorizedMemberCount = (unsigned long)nw->authorizedMembers.size();
-	info.totalMemberCount = (unsigned long)nw->members.size();
+	info.totalMemberCount = _memberCount(*nw,networkId);
 	info.mostRecentDeauthTime = nw->mostRecentDeauthTime;
 }
 
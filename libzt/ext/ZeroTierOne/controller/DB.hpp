@@ -25,6 +25,8 @@
 #include "../osdep/OSUtils.hpp"
 #include "../osdep/BlockingQueue.hpp"
 
+#include "IPAllocator.hpp"
+
 #include <memory>
 #include <string>
 #include <thread>
@@ -52,7 +54,7 @@ public:
 	{
 		NetworkSummaryInfo() : authorizedMemberCount(0),totalMemberCount(0),mostRecentDeauthTime(0) {}
 		std::vector<Address> activeBridges;
-		std::vector<InetAddress> allocatedIps;
+		std::vector<InetAddress> allocatedIps; // sorted, only filled in by summary()
 		unsigned long authorizedMemberCount;
 		unsigned long totalMemberCount;
 		int64_t mostRecentDeauthTime;
@@ -97,6 +99,32 @@ public:
 
 	bool summary(const uint64_t networkId,NetworkSummaryInfo &info);
 
+	/**
+	 * Find and reserve a free IPv4 address in a range
+	 *
+	 * See IPAllocator::findFreeIpv4() for how the range is searched. The
+	 * address counts as allocated from now on, so it should be saved to a
+	 * member's ipAssignments. (If it isn't it stays reserved until members
+	 * are next loaded.)
+	 *
+	 * @param networkId Network ID
+	 * @param first First address in range (host byte order)
+	 * @param last Last address in range, inclusive (host byte order)
+	 * @param start Where to start looking
+	 * @param ip Set to reserved address (host byte order)
+	 * @return True if an address was reserved
+	 */
+	bool allocateIpv4(const uint64_t networkId,const uint32_t first,const uint32_t last,const uint32_t start,uint32_t &ip);
+
+	/**
+	 * Reserve an IP address if it is not already allocated
+	 *
+	 * @param networkId Network ID
+	 * @param ip IP address (port is ignored)
+	 * @return True if address was free and is now reserved
+	 */
+	bool allocateIp(const uint64_t networkId,const InetAddress &ip);
+
 	void networks(std::vector<uint64_t> &networks);
 
 	virtual void save(nlohmann::json *orig,nlohmann::json &record) = 0;
@@ -115,14 +143,25 @@ protected:
 		std::unordered_map<uint64_t,nlohmann::json> members;
 		std::unordered_set<uint64_t> activeBridgeMembers;
 		std::unordered_set<uint64_t> authorizedMembers;
-		std::unordered_set<InetAddress,InetAddress::Hasher> allocatedIps;
+		IPAllocator allocatedIps;
 		int64_t mostRecentDeauthTime;
 		std::mutex lock;
 	};
 
+	/**
+	 * Member storage, always called with the network's lock held
+	 *
+	 * By default members are kept as JSON in _Network::members. Backends
+	 * that keep them somewhere else (see MappedDB) override all of these.
+	 */
+	virtual bool _getMember(_Network &nw,const uint64_t networkId,const uint64_t memberId,nlohmann::json &member);
+	virtual void _getMembers(_Network &nw,const uint64_t networkId,std::vector<nlohmann::json> &members);
+	virtual void _setMember(_Network &nw,const uint64_t networkId,const uint64_t memberId,const nlohmann::json *member);
+	virtual unsigned long _memberCount(_Network &nw,const uint64_t networkId);
+
 	void _memberChanged(nlohmann::json &old,nlohmann::json &memberConfig,bool push);
 	void _networkChanged(nlohmann::json &old,nlohmann::json &networkConfig,bool push);
-	void _fillSummaryInfo(const std::shared_ptr<_Network> &nw,NetworkSummaryInfo &info);
+	void _fillSummaryInfo(const std::shared_ptr<_Network> &nw,const uint64_t networkId,NetworkSummaryInfo &info,const bool includeAllocatedIps);
 
 	EmbeddedNetworkController *const _controller;
 	const Identity _myId;
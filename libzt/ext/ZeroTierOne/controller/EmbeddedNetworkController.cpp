@@ -53,6 +53,9 @@ using json = nlohmann::json;
 // Min duration between requests for an address/nwid combo to prevent floods
 #define ZT_NETCONF_MIN_REQUEST_PERIOD 1000
 
+// Max time a built and signed config is reused (also capped at 1/4 of its credential time max delta)
+#define ZT_NETCONF_CONFIG_CACHE_MAX_AGE 1800000
+
 // Global maximum size of arrays in JSON objects
 #define ZT_CONTROLLER_MAX_ARRAY_SIZE 16384
 
@@ -460,14 +463,21 @@ EmbeddedNetworkController::EmbeddedNetworkController(Node *node,const char *dbPa
 	_startTime(OSUtils::now()),
 	_node(node),
 	_path(dbPath),
-	_sender((NetworkController::Sender *)0)
+	_sender((NetworkController::Sender *)0),
+	_threadsStarted(false),
+	_configCacheHits(0),
+	_configCacheMisses(0)
 {
+	const long hwc = std::max((long)std::thread::hardware_concurrency(),(long)1);
+	for(long t=0;t<hwc;++t)
+		_queues.emplace_back(new BlockingQueue<_RQEntry *>());
 }
 
 EmbeddedNetworkController::~EmbeddedNetworkController()
 {
 	std::lock_guard<std::mutex> l(_threads_l);
-	_queue.stop();
+	for(auto q=_queues.begin();q!=_queues.end();++q)
+		(*q)->stop();
 	for(auto t=_threads.begin();t!=_threads.end();++t)
 		t->join();
 }
@@ -481,6 +491,11 @@ void EmbeddedNetworkController::init(const Identity &signingId,Sender *sender)
 #ifdef ZT_CONTROLLER_USE_RETHINKDB
 	if ((_path.length() > 10)&&(_path.substr(0,10) == "rethinkdb:"))
 		_db.reset(new RethinkDB(this,_signingId,_path.c_str()));
+	else // else use MappedDB or FileDB after endif
+#endif
+#ifdef __UNIX_LIKE__
+	if ((_path.length() > 7)&&(_path.substr(0,7) == "mapped:"))
+		_db.reset(new MappedDB(this,_signingId,_path.c_str() + 7));
 	else // else use FileDB after endif
 #endif
 		_db.reset(new FileDB(this,_signingId,_path.c_str()));
@@ -504,7 +519,11 @@ void EmbeddedNetworkController::request(
 	qe->identity = identity;
 	qe->metaData = metaData;
 	qe->type = _RQEntry::RQENTRY_TYPE_REQUEST;
-	_queue.post(qe);
+
+	// Requests from the same member always go to the same worker so they are handled in order and never
+	// concurrently, while a network's members are spread across all workers so big networks still scale.
+	const uint64_t shard = (nwid ^ identity.address().toInt()) * 0x9e3779b97f4a7c15ULL;
+	_queues[(unsigned long)(shard >> 32) % _queues.size()]->post(qe);
 }
 
 unsigned int EmbeddedNetworkController::handleControlPlaneHttpGET(
@@ -597,7 +616,7 @@ unsigned int EmbeddedNetworkController::handleControlPlaneHttpGET(
 
 		char tmp[4096];
 		const bool dbOk = _db->isReady();
-		OSUtils::ztsnprintf(tmp,sizeof(tmp),"{\n\t\"controller\": true,\n\t\"apiVersion\": %d,\n\t\"clock\": %llu,\n\t\"databaseReady\": %s\n}\n",ZT_NETCONF_CONTROLLER_API_VERSION,(unsigned long long)OSUtils::now(),dbOk ? "true" : "false");
+		OSUtils::ztsnprintf(tmp,sizeof(tmp),"{\n\t\"controller\": true,\n\t\"apiVersion\": %d,\n\t\"clock\": %llu,\n\t\"databaseReady\": %s,\n\t\"configCacheHits\": %llu,\n\t\"configCacheMisses\": %llu\n}\n",ZT_NETCONF_CONTROLLER_API_VERSION,(unsigned long long)OSUtils::now(),dbOk ? "true" : "false",(unsigned long long)_configCacheHits,(unsigned long long)_configCacheMisses);
 		responseBody = tmp;
 		responseContentType = "application/json";
 		return dbOk ? 200 : 503;
@@ -1044,9 +1063,11 @@ unsigned int EmbeddedNetworkController::handleControlPlaneHttpDELETE(
 					json network,member;
 					_db->get(nwid,network,address,member);
 
-					{
-						std::lock_guard<std::mutex> l(_memberStatus_l);
-						_memberStatus.erase(_MemberStatusKey(nwid,address));
+					std::shared_ptr<_NetworkState> ns(_getNetworkState(nwid,false));
+					if (ns) {
+						std::lock_guard<std::mutex> l(ns->lock);
+						ns->memberStatus.erase(address);
+						ns->configCache.erase(address);
 					}
 
 					if (!member.size())
@@ -1061,12 +1082,8 @@ unsigned int EmbeddedNetworkController::handleControlPlaneHttpDELETE(
 				_db->eraseNetwork(nwid);
 
 				{
-					std::lock_guard<std::mutex> l(_memberStatus_l);
-					for(auto i=_memberStatus.begin();i!=_memberStatus.end();) {
-						if (i->first.networkId == nwid)
-							_memberStatus.erase(i++);
-						else ++i;
-					}
+					std::lock_guard<std::mutex> l(_networkStates_l);
+					_networkStates.erase(nwid);
 				}
 
 				if (!network.size())
@@ -1137,36 +1154,50 @@ void EmbeddedNetworkController::handleRemoteTrace(const ZT_RemoteTrace &rt)
 
 void EmbeddedNetworkController::onNetworkUpdate(const uint64_t networkId)
 {
+	_clearCachedConfigs(networkId);
+
 	// Send an update to all members of the network that are online
+	std::shared_ptr<_NetworkState> ns(_getNetworkState(networkId,false));
+	if (!ns)
+		return;
 	const int64_t now = OSUtils::now();
-	std::lock_guard<std::mutex> l(_memberStatus_l);
-	for(auto i=_memberStatus.begin();i!=_memberStatus.end();++i) {
-		if ((i->first.networkId == networkId)&&(i->second.online(now))&&(i->second.lastRequestMetaData))
+	std::lock_guard<std::mutex> l(ns->lock);
+	for(auto i=ns->memberStatus.begin();i!=ns->memberStatus.end();++i) {
+		if ((i->second.online(now))&&(i->second.lastRequestMetaData))
 			request(networkId,InetAddress(),0,i->second.identity,i->second.lastRequestMetaData);
 	}
 }
 
 void EmbeddedNetworkController::onNetworkMemberUpdate(const uint64_t networkId,const uint64_t memberId)
 {
+	std::shared_ptr<_NetworkState> ns(_getNetworkState(networkId,false));
+	if (!ns)
+		return;
+
 	// Push update to member if online
 	try {
-		std::lock_guard<std::mutex> l(_memberStatus_l);
-		_MemberStatus &ms = _memberStatus[_MemberStatusKey(networkId,memberId)];
-		if ((ms.online(OSUtils::now()))&&(ms.lastRequestMetaData))
-			request(networkId,InetAddress(),0,ms.identity,ms.lastRequestMetaData);
+		std::lock_guard<std::mutex> l(ns->lock);
+		ns->configCache.erase(memberId);
+		auto ms = ns->memberStatus.find(memberId);
+		if ((ms != ns->memberStatus.end())&&(ms->second.online(OSUtils::now()))&&(ms->second.lastRequestMetaData))
+			request(networkId,InetAddress(),0,ms->second.identity,ms->second.lastRequestMetaData);
 	} catch ( ... ) {}
 }
 
 void EmbeddedNetworkController::onNetworkMemberDeauthorize(const uint64_t networkId,const uint64_t memberId)
 {
+	// Everyone else's credentials must be reissued with the shorter time max delta that excludes this member
+	_clearCachedConfigs(networkId);
+
 	const int64_t now = OSUtils::now();
 	Revocation rev((uint32_t)_node->prng(),networkId,0,now,ZT_REVOCATION_FLAG_FAST_PROPAGATE,Address(memberId),Revocation::CREDENTIAL_TYPE_COM);
 	rev.sign(_signingId);
-	{
-		std::lock_guard<std::mutex> l(_memberStatus_l);
-		for(auto i=_memberStatus.begin();i!=_memberStatus.end();++i) {
-			if ((i->first.networkId == networkId)&&(i->second.online(now)))
-				_node->ncSendRevocation(Address(i->first.nodeId),rev);
+	std::shared_ptr<_NetworkState> ns(_getNetworkState(networkId,false));
+	if (ns) {
+		std::lock_guard<std::mutex> l(ns->lock);
+		for(auto i=ns->memberStatus.begin();i!=ns->memberStatus.end();++i) {
+			if (i->second.online(now))
+				_node->ncSendRevocation(Address(i->first),rev);
 		}
 	}
 }
@@ -1176,7 +1207,8 @@ void EmbeddedNetworkController::_request(
 	const InetAddress &fromAddr,
 	uint64_t requestPacketId,
 	const Identity &identity,
-	const Dictionary<ZT_NETWORKCONFIG_METADATA_DICT_CAPACITY> &metaData)
+	const Dictionary<ZT_NETWORKCONFIG_METADATA_DICT_CAPACITY> &metaData,
+	Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> &dconf)
 {
 	char nwids[24];
 	DB::NetworkSummaryInfo ns;
@@ -1189,10 +1221,11 @@ void EmbeddedNetworkController::_request(
 		return;
 
 	const int64_t now = OSUtils::now();
+	const std::shared_ptr<_NetworkState> nst(_getNetworkState(nwid,true));
 
 	if (requestPacketId) {
-		std::lock_guard<std::mutex> l(_memberStatus_l);
-		_MemberStatus &ms = _memberStatus[_MemberStatusKey(nwid,identity.address().toInt())];
+		std::lock_guard<std::mutex> l(nst->lock);
+		_MemberStatus &ms = nst->memberStatus[identity.address().toInt()];
 		if ((now - ms.lastRequestTime) <= ZT_NETCONF_MIN_REQUEST_PERIOD)
 			return;
 		ms.lastRequestTime = now;
@@ -1293,8 +1326,8 @@ void EmbeddedNetworkController::_request(
 			member["vProto"] = vProto;
 
 			{
-				std::lock_guard<std::mutex> l(_memberStatus_l);
-				_MemberStatus &ms = _memberStatus[_MemberStatusKey(nwid,identity.address().toInt())];
+				std::lock_guard<std::mutex> l(nst->lock);
+				_MemberStatus &ms = nst->memberStatus[identity.address().toInt()];
 
 				ms.vMajor = (int)vMajor;
 				ms.vMinor = (int)vMinor;
@@ -1329,8 +1362,50 @@ void EmbeddedNetworkController::_request(
 		}
 	}
 
+	const uint64_t networkRevision = OSUtils::jsonInt(network["revision"],0ULL);
+	const bool rulesEngine = (metaData.getUI(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_RULES_ENGINE_REV,0) > 0);
+
 	std::unique_ptr<NetworkConfig> nc(new NetworkConfig());
 
+	// If nothing this member's config is built from has changed, send the config we last built and
+	// signed again instead of rebuilding it and re-signing all its credentials. It gets a new timestamp
+	// so the member takes it as a fresh config, which only costs the signature on the config itself.
+	{
+		std::string cachedConfig;
+		{
+			std::lock_guard<std::mutex> l(nst->lock);
+			auto ce = nst->configCache.find(identity.address().toInt());
+			if (ce != nst->configCache.end()) {
+				if ( (ce->second.networkRevision == networkRevision) &&
+				     (ce->second.memberRevision == OSUtils::jsonInt(member["revision"],0ULL)) &&
+				     (ce->second.credentialTimeMaxDelta == credentialtmd) &&
+				     (ce->second.rulesEngine == rulesEngine) &&
+				     (ce->second.activeBridges == ns.activeBridges) &&
+				     ((now - ce->second.timestamp) < std::min((int64_t)ZT_NETCONF_CONFIG_CACHE_MAX_AGE,credentialtmd / 4)) ) {
+					cachedConfig = ce->second.config;
+				} else {
+					nst->configCache.erase(ce);
+				}
+			}
+		}
+		bool haveCachedConfig = false;
+		if ((cachedConfig.length() > 0)&&(cachedConfig.length() < dconf.capacity())) {
+			ZT_FAST_MEMCPY(dconf.unsafeData(),cachedConfig.c_str(),cachedConfig.length() + 1); // load() would write the whole capacity
+			haveCachedConfig = nc->fromDictionary(dconf);
+		}
+		if (haveCachedConfig) {
+			++_configCacheHits;
+			nc->timestamp = now;
+			DB::cleanMember(member);
+			_db->save(&origMember,member);
+			_sender->ncSendConfig(nwid,requestPacketId,identity.address(),*(nc.get()),metaData.getUI(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_VERSION,0) < 6);
+			return;
+		}
+		++_configCacheMisses;
+		if (cachedConfig.length() > 0)
+			nc.reset(new NetworkConfig());
+	}
+
 	nc->networkId = nwid;
 	nc->type = OSUtils::jsonBool(network["private"],true) ? ZT_NETWORK_TYPE_PRIVATE : ZT_NETWORK_TYPE_PUBLIC;
 	nc->timestamp = now;
@@ -1369,7 +1444,7 @@ void EmbeddedNetworkController::_request(
 	json &memberCapabilities = member["capabilities"];
 	json &memberTags = member["tags"];
 
-	if (metaData.getUI(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_RULES_ENGINE_REV,0) <= 0) {
+	if (!rulesEngine) {
 		// Old versions with no rules engine support get an allow everything rule.
 		// Since rules are enforced bidirectionally, newer versions *will* still
 		// enforce rules on the inbound side.
@@ -1581,10 +1656,10 @@ void EmbeddedNetworkController::_request(
 						}
 
 						// If it's routed, then try to claim and assign it and if successful end loop
-						if ( (routedNetmaskBits > 0) && (!std::binary_search(ns.allocatedIps.begin(),ns.allocatedIps.end(),ip6)) ) {
+						if (routedNetmaskBits > 0) {
 							char tmpip[64];
 							const std::string ipStr(ip6.toIpString(tmpip));
-							if (std::find(ipAssignments.begin(),ipAssignments.end(),ipStr) == ipAssignments.end()) {
+							if ( (std::find(ipAssignments.begin(),ipAssignments.end(),ipStr) == ipAssignments.end()) && (_db->allocateIp(nwid,ip6)) ) {
 								ipAssignments.push_back(ipStr);
 								member["ipAssignments"] = ipAssignments;
 								ip6.setPort((unsigned int)routedNetmaskBits);
@@ -1613,31 +1688,30 @@ void EmbeddedNetworkController::_request(
 						continue;
 					uint32_t ipRangeLen = ipRangeEnd - ipRangeStart;
 
-					// Start with the LSB of the member's address
-					uint32_t ipTrialCounter = (uint32_t)(identity.address().toInt() & 0xffffffff);
-
-					for(uint32_t k=ipRangeStart,trialCount=0;((k<=ipRangeEnd)&&(trialCount < 1000));++k,++trialCount) {
-						uint32_t ip = (ipRangeLen > 0) ? (ipRangeStart + (ipTrialCounter % ipRangeLen)) : ipRangeStart;
-						++ipTrialCounter;
-						if ((ip & 0x000000ff) == 0x000000ff)
-							continue; // don't allow addresses that end in .255
-
-						// Check if this IP is within a local-to-Ethernet routed network
-						int routedNetmaskBits = -1;
-						for(unsigned int rk=0;rk<nc->routeCount;++rk) {
-							if (nc->routes[rk].target.ss_family == AF_INET) {
-								uint32_t targetIp = Utils::ntoh((uint32_t)(reinterpret_cast<const struct sockaddr_in *>(&(nc->routes[rk].target))->sin_addr.s_addr));
-								int targetBits = Utils::ntoh((uint16_t)(reinterpret_cast<const struct sockaddr_in *>(&(nc->routes[rk].target))->sin_port));
-								if ((ip & (0xffffffff << (32 - targetBits))) == targetIp) {
-									routedNetmaskBits = targetBits;
-									break;
-								}
-							}
-						}
-
-						// If it's routed, then try to claim and assign it and if successful end loop
-						const InetAddress ip4(Utils::hton(ip),0);
-						if ( (routedNetmaskBits > 0) && (!std::binary_search(ns.allocatedIps.begin(),ns.allocatedIps.end(),ip4)) ) {
+					// Start with the LSB of the member's address so it tends to get the same IP each time
+					const uint32_t ipStart = (ipRangeLen > 0) ? (ipRangeStart + ((uint32_t)(identity.address().toInt() & 0xffffffff) % ipRangeLen)) : ipRangeStart;
+
+					// Only the part of the pool within a local route can be assigned, and an address takes its
+					// netmask bits from the first route containing it. Search each route's part of the pool in
+					// route order so that anything found is not also within an earlier route.
+					for(unsigned int rk=0;rk<nc->routeCount;++rk) {
+						if (nc->routes[rk].target.ss_family != AF_INET)
+							continue;
+						const uint32_t targetIp = Utils::ntoh((uint32_t)(reinterpret_cast<const struct sockaddr_in *>(&(nc->routes[rk].target))->sin_addr.s_addr));
+						const int targetBits = Utils::ntoh((uint16_t)(reinterpret_cast<const struct sockaddr_in *>(&(nc->routes[rk].target))->sin_port));
+						if ((targetBits <= 0)||(targetBits > 32))
+							continue;
+						const uint32_t targetMask = 0xffffffff << (32 - targetBits);
+						if ((targetIp & targetMask) != targetIp)
+							continue;
+						const uint32_t first = std::max(ipRangeStart,targetIp);
+						const uint32_t last = std::min(ipRangeEnd,targetIp | ~targetMask);
+						if (first > last)
+							continue;
+
+						uint32_t ip = 0;
+						if (_db->allocateIpv4(nwid,first,last,ipStart,ip)) {
+							const InetAddress ip4(Utils::hton(ip),0);
 							char tmpip[64];
 							const std::string ipStr(ip4.toIpString(tmpip));
 							if (std::find(ipAssignments.begin(),ipAssignments.end(),ipStr) == ipAssignments.end()) {
@@ -1646,7 +1720,7 @@ void EmbeddedNetworkController::_request(
 								if (nc->staticIpCount < ZT_MAX_ZT_ASSIGNED_ADDRESSES) {
 									struct sockaddr_in *const v4ip = reinterpret_cast<struct sockaddr_in *>(&(nc->staticIps[nc->staticIpCount++]));
 									v4ip->sin_family = AF_INET;
-									v4ip->sin_port = Utils::hton((uint16_t)routedNetmaskBits);
+									v4ip->sin_port = Utils::hton((uint16_t)targetBits);
 									v4ip->sin_addr.s_addr = Utils::hton(ip);
 								}
 								haveManagedIpv4AutoAssignment = true;
@@ -1678,24 +1752,75 @@ void EmbeddedNetworkController::_request(
 
 	DB::cleanMember(member);
 	_db->save(&origMember,member);
+
+	// Cache what we built unless an IP could not be auto-assigned, since that depends on other members
+	const bool autoAssignPending = ( (ipAssignmentPools.is_array()) && (!noAutoAssignIps) && (
+		((v6AssignMode.is_object())&&(OSUtils::jsonBool(v6AssignMode["zt"],false))&&(!haveManagedIpv6AutoAssignment)) ||
+		((v4AssignMode.is_object())&&(OSUtils::jsonBool(v4AssignMode["zt"],false))&&(!haveManagedIpv4AutoAssignment)) ) );
+	if ((!autoAssignPending)&&(nc->toDictionary(dconf,false))) {
+		std::lock_guard<std::mutex> l(nst->lock);
+		if ((now - nst->configCacheLastClean) >= ZT_NETCONF_CONFIG_CACHE_MAX_AGE) {
+			nst->configCacheLastClean = now;
+			for(auto i=nst->configCache.begin();i!=nst->configCache.end();) {
+				if ((now - i->second.timestamp) >= ZT_NETCONF_CONFIG_CACHE_MAX_AGE)
+					nst->configCache.erase(i++);
+				else ++i;
+			}
+		}
+		_ConfigCacheEntry &ce = nst->configCache[identity.address().toInt()];
+		ce.timestamp = now;
+		ce.networkRevision = networkRevision;
+		ce.memberRevision = OSUtils::jsonInt(member["revision"],0ULL);
+		ce.credentialTimeMaxDelta = credentialtmd;
+		ce.activeBridges = ns.activeBridges;
+		ce.rulesEngine = rulesEngine;
+		ce.config.assign(dconf.data(),dconf.sizeBytes());
+	}
+
 	_sender->ncSendConfig(nwid,requestPacketId,identity.address(),*(nc.get()),metaData.getUI(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_VERSION,0) < 6);
 }
 
+std::shared_ptr<EmbeddedNetworkController::_NetworkState> EmbeddedNetworkController::_getNetworkState(const uint64_t networkId,const bool create)
+{
+	std::lock_guard<std::mutex> l(_networkStates_l);
+	auto nst = _networkStates.find(networkId);
+	if (nst != _networkStates.end())
+		return nst->second;
+	if (!create)
+		return std::shared_ptr<_NetworkState>();
+	std::shared_ptr<_NetworkState> &nst2 = _networkStates[networkId];
+	nst2.reset(new _NetworkState());
+	return nst2;
+}
+
+void EmbeddedNetworkController::_clearCachedConfigs(const uint64_t networkId)
+{
+	std::shared_ptr<_NetworkState> ns(_getNetworkState(networkId,false));
+	if (ns) {
+		std::lock_guard<std::mutex> l(ns->lock);
+		ns->configCache.clear();
+	}
+}
+
 void EmbeddedNetworkController::_startThreads()
 {
+	if (_threadsStarted)
+		return;
 	std::lock_guard<std::mutex> l(_threads_l);
 	if (!_threads.empty())
 		return;
-	const long hwc = std::max((long)std::thread::hardware_concurrency(),(long)1);
-	for(long t=0;t<hwc;++t) {
-		_threads.emplace_back([this]() {
+	for(unsigned long t=0;t<_queues.size();++t) {
+		BlockingQueue<_RQEntry *> *const q = _queues[t].get();
+		_threads.emplace_back([this,q]() {
+			// Scratch space for serialized configs, kept for the life of the thread since it's large
+			std::unique_ptr< Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> > dconf(new Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY>());
 			for(;;) {
 				_RQEntry *qe = (_RQEntry *)0;
-				if (!_queue.get(qe))
+				if (!q->get(qe))
 					break;
 				try {
 					if (qe) {
-						_request(qe->nwid,qe->fromAddr,qe->requestPacketId,qe->identity,qe->metaData);
+						_request(qe->nwid,qe->fromAddr,qe->requestPacketId,qe->identity,qe->metaData,*dconf);
 						delete qe;
 					}
 				} catch (std::exception &e) {
@@ -1706,6 +1831,7 @@ void EmbeddedNetworkController::_startThreads()
 			}
 		});
 	}
+	_threadsStarted = true;
 }
 
 } // namespace ZeroTier
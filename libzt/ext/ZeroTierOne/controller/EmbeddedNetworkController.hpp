@@ -29,6 +29,8 @@
 #include <thread>
 #include <unordered_map>
 #include <atomic>
+#include <memory>
+#include <mutex>
 
 #include "../node/Constants.hpp"
 #include "../node/NetworkController.hpp"
@@ -44,6 +46,7 @@
 
 #include "DB.hpp"
 #include "FileDB.hpp"
+#include "MappedDB.hpp"
 #ifdef ZT_CONTROLLER_USE_RETHINKDB
 #include "RethinkDB.hpp"
 #endif
@@ -101,8 +104,9 @@ public:
 	void onNetworkMemberDeauthorize(const uint64_t networkId,const uint64_t memberId);
 
 private:
-	void _request(uint64_t nwid,const InetAddress &fromAddr,uint64_t requestPacketId,const Identity &identity,const Dictionary<ZT_NETWORKCONFIG_METADATA_DICT_CAPACITY> &metaData);
+	void _request(uint64_t nwid,const InetAddress &fromAddr,uint64_t requestPacketId,const Identity &identity,const Dictionary<ZT_NETWORKCONFIG_METADATA_DICT_CAPACITY> &metaData,Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> &dconf);
 	void _startThreads();
+	void _clearCachedConfigs(const uint64_t networkId);
 
 	struct _RQEntry
 	{
@@ -115,14 +119,6 @@ private:
 			RQENTRY_TYPE_REQUEST = 0
 		} type;
 	};
-	struct _MemberStatusKey
-	{
-		_MemberStatusKey() : networkId(0),nodeId(0) {}
-		_MemberStatusKey(const uint64_t nwid,const uint64_t nid) : networkId(nwid),nodeId(nid) {}
-		uint64_t networkId;
-		uint64_t nodeId;
-		inline bool operator==(const _MemberStatusKey &k) const { return ((k.networkId == networkId)&&(k.nodeId == nodeId)); }
-	};
 	struct _MemberStatus
 	{
 		_MemberStatus() : lastRequestTime(0),vMajor(-1),vMinor(-1),vRev(-1),vProto(-1) {}
@@ -132,13 +128,30 @@ private:
 		Identity identity;
 		inline bool online(const int64_t now) const { return ((now - lastRequestTime) < (ZT_NETWORK_AUTOCONF_DELAY * 2)); }
 	};
-	struct _MemberStatusHash
+	struct _ConfigCacheEntry
 	{
-		inline std::size_t operator()(const _MemberStatusKey &networkIdNodeId) const
-		{
-			return (std::size_t)(networkIdNodeId.networkId + networkIdNodeId.nodeId);
-		}
+		// Everything the config was built from that is not covered by the network and member revisions
+		int64_t timestamp;
+		uint64_t networkRevision;
+		uint64_t memberRevision;
+		int64_t credentialTimeMaxDelta;
+		std::vector<Address> activeBridges;
+		bool rulesEngine;
+
+		// Built and signed NetworkConfig in dictionary form
+		std::string config;
 	};
+	struct _NetworkState
+	{
+		// Member status and cached configs for one network, under the network's own lock
+		_NetworkState() : configCacheLastClean(0) {}
+		std::unordered_map< uint64_t,_MemberStatus > memberStatus;
+		std::unordered_map< uint64_t,_ConfigCacheEntry > configCache;
+		int64_t configCacheLastClean;
+		std::mutex lock;
+	};
+
+	std::shared_ptr<_NetworkState> _getNetworkState(const uint64_t networkId,const bool create);
 
 	const int64_t _startTime;
 	Node *const _node;
@@ -147,11 +160,14 @@ private:
 	std::string _signingIdAddressString;
 	NetworkController::Sender *_sender;
 	std::unique_ptr<DB> _db;
-	BlockingQueue< _RQEntry * > _queue;
+	std::vector< std::unique_ptr< BlockingQueue< _RQEntry * > > > _queues; // one per worker thread
 	std::vector<std::thread> _threads;
+	std::atomic<bool> _threadsStarted;
 	std::mutex _threads_l;
-	std::unordered_map< _MemberStatusKey,_MemberStatus,_MemberStatusHash > _memberStatus;
-	std::mutex _memberStatus_l;
+	std::unordered_map< uint64_t,std::shared_ptr<_NetworkState> > _networkStates;
+	std::mutex _networkStates_l;
+	std::atomic<uint64_t> _configCacheHits;
+	std::atomic<uint64_t> _configCacheMisses;
 };
 
 } // namespace ZeroTier
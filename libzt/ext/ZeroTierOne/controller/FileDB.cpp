@@ -22,6 +22,11 @@ namespace ZeroTier
 {
 
 FileDB::FileDB(EmbeddedNetworkController *const nc,const Identity &myId,const char *path) :
+	FileDB(nc,myId,path,true)
+{
+}
+
+FileDB::FileDB(EmbeddedNetworkController *const nc,const Identity &myId,const char *path,const bool loadMembers) :
 	DB(nc,myId,path),
 	_networksPath(_path + ZT_PATH_SEPARATOR_S + "network"),
 	_tracePath(_path + ZT_PATH_SEPARATOR_S + "trace")
@@ -42,6 +47,8 @@ FileDB::FileDB(EmbeddedNetworkController *const nc,const Identity &myId,const ch
 				if (nwids.length() == 16) {
 					nlohmann::json nullJson;
 					_networkChanged(nullJson,network,false);
+					if (!loadMembers)
+						continue;
 					std::string membersPath(_networksPath + ZT_PATH_SEPARATOR_S + nwids + ZT_PATH_SEPARATOR_S "member");
 					std::vector<std::string> members(OSUtils::listDirectory(membersPath.c_str(),false));
 					for(auto m=members.begin();m!=members.end();++m) {
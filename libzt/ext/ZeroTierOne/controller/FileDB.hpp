@@ -38,6 +38,8 @@ public:
 	virtual void nodeIsOnline(const uint64_t networkId,const uint64_t memberId,const InetAddress &physicalAddress);
 
 protected:
+	FileDB(EmbeddedNetworkController *const nc,const Identity &myId,const char *path,const bool loadMembers);
+
 	std::string _networksPath;
 	std::string _tracePath;
 };
@@ -0,0 +1,213 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ZT_CONTROLLER_IPALLOCATOR_HPP
+#define ZT_CONTROLLER_IPALLOCATOR_HPP
+
+#include "../node/Constants.hpp"
+#include "../node/InetAddress.hpp"
+#include "../node/Utils.hpp"
+
+#include <map>
+#include <unordered_set>
+#include <vector>
+
+namespace ZeroTier
+{
+
+/**
+ * The set of IP addresses allocated on a network
+ *
+ * IPv4 addresses are kept as an ordered map of ranges of consecutive
+ * allocated addresses, with adjacent ranges always merged. The first
+ * free address at or after any address is therefore the address itself
+ * or the one after the range containing it, so finding a free address
+ * in a pool takes one map lookup however full the pool is. Allocating
+ * and releasing addresses are also O(log n).
+ *
+ * IPv6 pools are large enough that random picks almost never collide,
+ * so other addresses are only kept in a hash set for lookups.
+ *
+ * Ports (used elsewhere to carry netmask bits) are ignored. This is not
+ * thread safe.
+ */
+class IPAllocator
+{
+public:
+	IPAllocator() : _v4Count(0) {}
+
+	inline bool contains(const InetAddress &ip) const
+	{
+		if (ip.ss_family == AF_INET) {
+			const uint32_t a = _v4(ip);
+			std::map<uint32_t,uint32_t>::const_iterator r(_v4Ranges.upper_bound(a));
+			if (r == _v4Ranges.begin())
+				return false;
+			--r;
+			return (a <= r->second);
+		}
+		InetAddress tmp(ip);
+		tmp.setPort(0);
+		return (_other.count(tmp) != 0);
+	}
+
+	inline void insert(const InetAddress &ip)
+	{
+		if (ip.ss_family == AF_INET) {
+			const uint32_t a = _v4(ip);
+			std::map<uint32_t,uint32_t>::iterator next(_v4Ranges.upper_bound(a));
+			if (next != _v4Ranges.begin()) {
+				std::map<uint32_t,uint32_t>::iterator prev(next);
+				--prev;
+				if (a <= prev->second)
+					return;
+				if ((prev->second + 1) == a) {
+					prev->second = a;
+					if ((next != _v4Ranges.end())&&(next->first == (a + 1))) {
+						prev->second = next->second;
+						_v4Ranges.erase(next);
+					}
+					++_v4Count;
+					return;
+				}
+			}
+			if ((next != _v4Ranges.end())&&(next->first == (a + 1))) {
+				const uint32_t e = next->second;
+				_v4Ranges.erase(next++);
+				_v4Ranges.insert(next,std::pair<uint32_t,uint32_t>(a,e));
+			} else {
+				_v4Ranges.insert(next,std::pair<uint32_t,uint32_t>(a,a));
+			}
+			++_v4Count;
+		} else {
+			InetAddress tmp(ip);
+			tmp.setPort(0);
+			_other.insert(tmp);
+		}
+	}
+
+	inline void erase(const InetAddress &ip)
+	{
+		if (ip.ss_family == AF_INET) {
+			const uint32_t a = _v4(ip);
+			std::map<uint32_t,uint32_t>::iterator r(_v4Ranges.upper_bound(a));
+			if (r == _v4Ranges.begin())
+				return;
+			--r;
+			if (a > r->second)
+				return;
+			const uint32_t e = r->second;
+			if (r->first == a) {
+				_v4Ranges.erase(r);
+			} else {
+				r->second = a - 1;
+			}
+			if (e > a)
+				_v4Ranges[a + 1] = e;
+			--_v4Count;
+		} else {
+			InetAddress tmp(ip);
+			tmp.setPort(0);
+			_other.erase(tmp);
+		}
+	}
+
+	/**
+	 * Find a free IPv4 address in a range
+	 *
+	 * The search goes upward from start and then wraps around to first, so
+	 * members that start from the same point each time tend to get the same
+	 * address back. Addresses ending in .255 are never returned. The address
+	 * is not allocated by this call.
+	 *
+	 * @param first First address in range (host byte order)
+	 * @param last Last address in range, inclusive (host byte order)
+	 * @param start Where to start looking, ignored if not within range
+	 * @param ip Set to free address if one is found (host byte order)
+	 * @return True if a free address was found
+	 */
+	inline bool findFreeIpv4(const uint32_t first,const uint32_t last,const uint32_t start,uint32_t &ip) const
+	{
+		if (first > last)
+			return false;
+		if ((start <= first)||(start > last))
+			return _findFreeIpv4(first,last,ip);
+		return ((_findFreeIpv4(start,last,ip))||(_findFreeIpv4(first,start - 1,ip)));
+	}
+
+	/**
+	 * @param ips Vector to fill with all allocated addresses (not sorted)
+	 */
+	inline void list(std::vector<InetAddress> &ips) const
+	{
+		ips.reserve(ips.size() + size());
+		for(std::map<uint32_t,uint32_t>::const_iterator r(_v4Ranges.begin());r!=_v4Ranges.end();++r) {
+			for(uint32_t a=r->first;;++a) {
+				ips.push_back(InetAddress(Utils::hton(a),0));
+				if (a == r->second)
+					break;
+			}
+		}
+		for(std::unordered_set<InetAddress,InetAddress::Hasher>::const_iterator i(_other.begin());i!=_other.end();++i)
+			ips.push_back(*i);
+	}
+
+	/**
+	 * @return Number of allocated addresses
+	 */
+	inline unsigned long size() const { return (_v4Count + (unsigned long)_other.size()); }
+
+	/**
+	 * @return Number of ranges of consecutive allocated IPv4 addresses
+	 */
+	inline unsigned long ipv4Ranges() const { return (unsigned long)_v4Ranges.size(); }
+
+private:
+	static inline uint32_t _v4(const InetAddress &ip) { return Utils::ntoh((uint32_t)reinterpret_cast<const struct sockaddr_in *>(&ip)->sin_addr.s_addr); }
+
+	inline bool _findFreeIpv4(uint32_t a,const uint32_t last,uint32_t &ip) const
+	{
+		// Each pass skips an allocated range or a .255 address
+		for(;;) {
+			std::map<uint32_t,uint32_t>::const_iterator r(_v4Ranges.upper_bound(a));
+			if (r != _v4Ranges.begin()) {
+				--r;
+				if (a <= r->second) {
+					if (r->second >= last)
+						return false;
+					a = r->second + 1;
+				}
+			}
+			if ((a & 0xff) != 0xff) {
+				ip = a;
+				return true;
+			}
+			if (a >= last)
+				return false;
+			++a;
+		}
+	}
+
+	std::map<uint32_t,uint32_t> _v4Ranges; // first -> last (inclusive)
+	unsigned long _v4Count;
+	std::unordered_set<InetAddress,InetAddress::Hasher> _other;
+};
+
+} // namespace ZeroTier
+
+#endif
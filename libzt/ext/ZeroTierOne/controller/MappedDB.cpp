@@ -0,0 +1,667 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "MappedDB.hpp"
+
+#ifdef __UNIX_LIKE__
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <algorithm>
+
+#define ZT_MAPPEDDB_SNAPSHOT_MAGIC "ZTMDB\x00\x00\x01"
+#define ZT_MAPPEDDB_SNAPSHOT_HEADER_SIZE 24
+#define ZT_MAPPEDDB_INDEX_ENTRY_SIZE 24
+#define ZT_MAPPEDDB_RECORD_HEADER_SIZE 35
+
+#define ZT_MAPPEDDB_FLAG_AUTHORIZED 0x01
+#define ZT_MAPPEDDB_FLAG_ACTIVE_BRIDGE 0x02
+#define ZT_MAPPEDDB_FLAG_ERASED 0x80
+
+namespace ZeroTier
+{
+
+/*
+ * Snapshot layout, integers big-endian:
+ *   [8] magic
+ *   [8] number of members
+ *   [8] offset of index
+ *   [...] records
+ *   [...] index entries of [8] network ID, [8] member ID, [8] record offset,
+ *         sorted by network ID and then member ID
+ *
+ * Record layout, used in both the snapshot and the change log:
+ *   [4] length of record including this field
+ *   [4] FNV-1a checksum of everything after this field
+ *   [8] network ID
+ *   [8] member ID
+ *   [1] flags (ZT_MAPPEDDB_FLAG_*)
+ *   [8] lastDeauthorizedTime
+ *   [2] number of assigned IPs
+ *   [...] each assigned IP as [1] length (4 or 16) and address bytes
+ *   [...] member as MessagePack (empty if erased)
+ */
+
+struct MappedDB::_Record
+{
+	uint64_t networkId;
+	uint64_t memberId;
+	uint64_t lastDeauthorizedTime;
+	const uint8_t *ips;
+	const uint8_t *body;
+	unsigned int length;
+	unsigned int flags;
+	unsigned int ipCount;
+	unsigned int bodyLength;
+};
+
+static inline uint16_t _get16(const uint8_t *p) { uint16_t x; memcpy(&x,p,2); return Utils::ntoh(x); }
+static inline uint32_t _get32(const uint8_t *p) { uint32_t x; memcpy(&x,p,4); return Utils::ntoh(x); }
+static inline uint64_t _get64(const uint8_t *p) { uint64_t x; memcpy(&x,p,8); return Utils::ntoh(x); }
+static inline void _put16(std::string &s,uint16_t x) { x = Utils::hton(x); s.append((const char *)&x,2); }
+static inline void _put32(std::string &s,uint32_t x) { x = Utils::hton(x); s.append((const char *)&x,4); }
+static inline void _put64(std::string &s,uint64_t x) { x = Utils::hton(x); s.append((const char *)&x,8); }
+
+static uint32_t _checksum(const uint8_t *p,unsigned int len)
+{
+	uint32_t h = 2166136261U;
+	for(unsigned int i=0;i<len;++i)
+		h = (h ^ (uint32_t)p[i]) * 16777619U;
+	return h;
+}
+
+// Encode a member record, or an erasure if member is NULL
+static void _encode(const uint64_t networkId,const uint64_t memberId,const nlohmann::json *member,std::string &r)
+{
+	unsigned int flags = ZT_MAPPEDDB_FLAG_ERASED;
+	uint64_t lastDeauthorizedTime = 0;
+	unsigned int ipCount = 0;
+	std::string ips;
+	std::vector<uint8_t> body;
+
+	if (member) {
+		flags = 0;
+		auto f = member->find("authorized");
+		if ((f != member->end())&&(OSUtils::jsonBool(*f,false)))
+			flags |= ZT_MAPPEDDB_FLAG_AUTHORIZED;
+		f = member->find("activeBridge");
+		if ((f != member->end())&&(OSUtils::jsonBool(*f,false)))
+			flags |= ZT_MAPPEDDB_FLAG_ACTIVE_BRIDGE;
+		f = member->find("lastDeauthorizedTime");
+		if (f != member->end())
+			lastDeauthorizedTime = OSUtils::jsonInt(*f,0ULL);
+		f = member->find("ipAssignments");
+		if ((f != member->end())&&(f->is_array())) {
+			for(unsigned long i=0;((i<f->size())&&(ipCount<0xffff));++i) {
+				const nlohmann::json &ipj = (*f)[i];
+				if (ipj.is_string()) {
+					const std::string ipstr = ipj;
+					InetAddress ip(ipstr.c_str());
+					const unsigned int l = (ip.ss_family == AF_INET) ? 4 : ((ip.ss_family == AF_INET6) ? 16 : 0);
+					if (l) {
+						ips.push_back((char)l);
+						ips.append((const char *)ip.rawIpData(),l);
+						++ipCount;
+					}
+				}
+			}
+		}
+		nlohmann::json::to_msgpack(*member,body);
+	}
+
+	r.clear();
+	r.reserve(ZT_MAPPEDDB_RECORD_HEADER_SIZE + ips.length() + body.size());
+	_put32(r,0);
+	_put32(r,0);
+	_put64(r,networkId);
+	_put64(r,memberId);
+	r.push_back((char)flags);
+	_put64(r,lastDeauthorizedTime);
+	_put16(r,(uint16_t)ipCount);
+	r.append(ips);
+	r.append((const char *)body.data(),body.size());
+
+	uint32_t x = Utils::hton((uint32_t)r.length());
+	memcpy(&(r[0]),&x,4);
+	x = Utils::hton(_checksum((const uint8_t *)r.data() + 8,(unsigned int)r.length() - 8));
+	memcpy(&(r[4]),&x,4);
+}
+
+MappedDB::MappedDB(EmbeddedNetworkController *const nc,const Identity &myId,const char *path) :
+	FileDB(nc,myId,path,false),
+	_snapshotPath(_path + ZT_PATH_SEPARATOR_S + "members.db"),
+	_logPath(_path + ZT_PATH_SEPARATOR_S + "members.log"),
+	_logFd(-1),
+	_snapshot((const uint8_t *)0),
+	_snapshotSize(0),
+	_snapshotCount(0),
+	_snapshotIndex((const uint8_t *)0),
+	_logRecords(0)
+{
+	const bool haveSnapshot = OSUtils::fileExists(_snapshotPath.c_str());
+	if ((haveSnapshot)&&(!_map())) {
+		// Set a damaged snapshot aside rather than compacting over it later
+		const std::string bad(_snapshotPath + ".bad");
+		OSUtils::rename(_snapshotPath.c_str(),bad.c_str());
+		fprintf(stderr,"WARNING: controller member store %s is damaged, moved to %s" ZT_EOL_S,_snapshotPath.c_str(),bad.c_str());
+	}
+
+	_replayLog();
+	_logFd = ::open(_logPath.c_str(),O_WRONLY|O_CREAT|O_APPEND,0600);
+	if (_logFd < 0)
+		fprintf(stderr,"WARNING: controller unable to write to path: %s" ZT_EOL_S,_logPath.c_str());
+
+	const bool import = ((!haveSnapshot)&&(_log.empty()));
+	if (import)
+		_importMemberFiles();
+
+	_Record r;
+	const uint8_t *rec;
+	uint64_t avail;
+	for(uint64_t i=0;i<_snapshotCount;++i) {
+		const uint8_t *const e = _snapshotIndex + (i * ZT_MAPPEDDB_INDEX_ENTRY_SIZE);
+		if (_log.count(std::pair<uint64_t,uint64_t>(_get64(e),_get64(e + 8))))
+			continue;
+		if ((_snapshotRecord(_get64(e + 16),rec,avail))&&(_parse(rec,avail,false,r)))
+			_index(r);
+	}
+	for(auto l=_log.begin();l!=_log.end();++l) {
+		if ((_parse((const uint8_t *)l->second.data(),l->second.length(),false,r))&&((r.flags & ZT_MAPPEDDB_FLAG_ERASED) == 0))
+			_index(r);
+	}
+
+	if ((import)&&(!_log.empty())) {
+		compact();
+	} else if ((_logRecords >= ZT_MAPPEDDB_COMPACT_THRESHOLD)&&(_logRecords >= (_snapshotCount / 4))) {
+		compact();
+	}
+}
+
+MappedDB::~MappedDB()
+{
+	_unmap();
+	if (_logFd >= 0)
+		::close(_logFd);
+}
+
+void MappedDB::save(nlohmann::json *orig,nlohmann::json &record)
+{
+	try {
+		if (OSUtils::jsonString(record["objtype"],"") != "member") {
+			FileDB::save(orig,record);
+			return;
+		}
+
+		if (orig) {
+			if (*orig != record) {
+				record["revision"] = OSUtils::jsonInt(record["revision"],0ULL) + 1;
+			}
+		} else {
+			record["revision"] = 1;
+		}
+
+		const uint64_t id = OSUtils::jsonIntHex(record["id"],0ULL);
+		const uint64_t nwid = OSUtils::jsonIntHex(record["nwid"],0ULL);
+		if ((id)&&(nwid)) {
+			nlohmann::json network,old;
+			get(nwid,network,id,old);
+
+			if ((!old.is_object())||(old != record)) {
+				std::vector<std::string> recs(1);
+				_encode(nwid,id,&record,recs[0]);
+				_append(recs);
+
+				_memberChanged(old,record,true);
+			}
+		}
+	} catch ( ... ) {} // drop invalid records missing fields
+}
+
+void MappedDB::eraseNetwork(const uint64_t networkId)
+{
+	std::vector<std::string> recs;
+	{
+		std::lock_guard<std::mutex> l(_store_l);
+		for(uint64_t i=_snapshotLowerBound(networkId,0);i<_snapshotCount;++i) {
+			const uint8_t *const e = _snapshotIndex + (i * ZT_MAPPEDDB_INDEX_ENTRY_SIZE);
+			if (_get64(e) != networkId)
+				break;
+			const uint64_t id = _get64(e + 8);
+			if (!_log.count(std::pair<uint64_t,uint64_t>(networkId,id))) {
+				recs.push_back(std::string());
+				_encode(networkId,id,(const nlohmann::json *)0,recs.back());
+			}
+		}
+		for(auto lr=_log.begin();lr!=_log.end();++lr) {
+			if ((lr->first.first == networkId)&&((lr->second[24] & ZT_MAPPEDDB_FLAG_ERASED) == 0)) {
+				recs.push_back(std::string());
+				_encode(networkId,lr->first.second,(const nlohmann::json *)0,recs.back());
+			}
+		}
+	}
+	if (!recs.empty())
+		_append(recs);
+
+	FileDB::eraseNetwork(networkId);
+}
+
+void MappedDB::eraseMember(const uint64_t networkId,const uint64_t memberId)
+{
+	nlohmann::json network,old,nullJson;
+	if (!get(networkId,network,memberId,old))
+		return;
+
+	std::vector<std::string> recs(1);
+	_encode(networkId,memberId,(const nlohmann::json *)0,recs[0]);
+	_append(recs);
+
+	_memberChanged(old,nullJson,true);
+}
+
+bool MappedDB::compact()
+{
+	std::lock_guard<std::mutex> l(_store_l);
+	return _compact();
+}
+
+bool MappedDB::_getMember(_Network &nw,const uint64_t networkId,const uint64_t memberId,nlohmann::json &member)
+{
+	std::lock_guard<std::mutex> l(_store_l);
+	const uint8_t *rec;
+	uint64_t avail;
+	_Record r;
+	if ((!_find(networkId,memberId,rec,avail))||(!_parse(rec,avail,false,r)))
+		return false;
+	return _decode(r,member);
+}
+
+void MappedDB::_getMembers(_Network &nw,const uint64_t networkId,std::vector<nlohmann::json> &members)
+{
+	std::lock_guard<std::mutex> l(_store_l);
+	const uint8_t *rec;
+	uint64_t avail;
+	_Record r;
+	for(uint64_t i=_snapshotLowerBound(networkId,0);i<_snapshotCount;++i) {
+		const uint8_t *const e = _snapshotIndex + (i * ZT_MAPPEDDB_INDEX_ENTRY_SIZE);
+		if (_get64(e) != networkId)
+			break;
+		if (_log.count(std::pair<uint64_t,uint64_t>(networkId,_get64(e + 8))))
+			continue;
+		if ((_snapshotRecord(_get64(e + 16),rec,avail))&&(_parse(rec,avail,false,r))) {
+			members.push_back(nlohmann::json());
+			if (!_decode(r,members.back()))
+				members.pop_back();
+		}
+	}
+	for(auto lr=_log.begin();lr!=_log.end();++lr) {
+		if ((lr->first.first == networkId)&&(_parse((const uint8_t *)lr->second.data(),lr->second.length(),false,r))&&((r.flags & ZT_MAPPEDDB_FLAG_ERASED) == 0)) {
+			members.push_back(nlohmann::json());
+			if (!_decode(r,members.back()))
+				members.pop_back();
+		}
+	}
+}
+
+void MappedDB::_setMember(_Network &nw,const uint64_t networkId,const uint64_t memberId,const nlohmann::json *member)
+{
+	// Nothing to do: save() and eraseMember() have already written the record
+}
+
+unsigned long MappedDB::_memberCount(_Network &nw,const uint64_t networkId)
+{
+	std::lock_guard<std::mutex> l(_store_l);
+	auto c = _memberCounts.find(networkId);
+	return ((c == _memberCounts.end()) ? 0 : c->second);
+}
+
+bool MappedDB::_parse(const uint8_t *p,const uint64_t avail,const bool verify,_Record &r)
+{
+	if (avail < ZT_MAPPEDDB_RECORD_HEADER_SIZE)
+		return false;
+	r.length = _get32(p);
+	if ((r.length < ZT_MAPPEDDB_RECORD_HEADER_SIZE)||((uint64_t)r.length > avail))
+		return false;
+	if ((verify)&&(_checksum(p + 8,r.length - 8) != _get32(p + 4)))
+		return false;
+	r.networkId = _get64(p + 8);
+	r.memberId = _get64(p + 16);
+	r.flags = p[24];
+	r.lastDeauthorizedTime = _get64(p + 25);
+	r.ipCount = _get16(p + 33);
+	unsigned int ptr = ZT_MAPPEDDB_RECORD_HEADER_SIZE;
+	r.ips = p + ptr;
+	for(unsigned int i=0;i<r.ipCount;++i) {
+		if (ptr >= r.length)
+			return false;
+		const unsigned int l = p[ptr];
+		if ((l != 4)&&(l != 16))
+			return false;
+		ptr += 1 + l;
+		if (ptr > r.length)
+			return false;
+	}
+	r.body = p + ptr;
+	r.bodyLength = r.length - ptr;
+	return true;
+}
+
+bool MappedDB::_decode(const _Record &r,nlohmann::json &member)
+{
+	try {
+		member = nlohmann::json::from_msgpack(r.body,r.body + r.bodyLength);
+		return member.is_object();
+	} catch ( ... ) {
+		return false;
+	}
+}
+
+bool MappedDB::_map()
+{
+	const int fd = ::open(_snapshotPath.c_str(),O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	void *m = MAP_FAILED;
+	if ((fstat(fd,&st) == 0)&&(st.st_size >= ZT_MAPPEDDB_SNAPSHOT_HEADER_SIZE))
+		m = mmap((void *)0,(size_t)st.st_size,PROT_READ,MAP_SHARED,fd,0);
+	::close(fd);
+	if (m == MAP_FAILED)
+		return false;
+
+	const uint8_t *const s = (const uint8_t *)m;
+	const uint64_t size = (uint64_t)st.st_size;
+	const uint64_t count = _get64(s + 8);
+	const uint64_t indexOffset = _get64(s + 16);
+	if ((memcmp(s,ZT_MAPPEDDB_SNAPSHOT_MAGIC,8) != 0)||(indexOffset < ZT_MAPPEDDB_SNAPSHOT_HEADER_SIZE)||(indexOffset > size)||(count > ((size - indexOffset) / ZT_MAPPEDDB_INDEX_ENTRY_SIZE))) {
+		munmap(m,(size_t)size);
+		return false;
+	}
+
+	_snapshot = s;
+	_snapshotSize = size;
+	_snapshotCount = count;
+	_snapshotIndex = s + indexOffset;
+	return true;
+}
+
+void MappedDB::_unmap()
+{
+	if (_snapshot)
+		munmap((void *)_snapshot,(size_t)_snapshotSize);
+	_snapshot = (const uint8_t *)0;
+	_snapshotSize = 0;
+	_snapshotCount = 0;
+	_snapshotIndex = (const uint8_t *)0;
+}
+
+void MappedDB::_replayLog()
+{
+	std::string buf;
+	if (!OSUtils::readFile(_logPath.c_str(),buf))
+		return;
+
+	const uint8_t *const b = (const uint8_t *)buf.data();
+	uint64_t ptr = 0;
+	_Record r;
+	while ((ptr < buf.length())&&(_parse(b + ptr,buf.length() - ptr,true,r))) {
+		_log[std::pair<uint64_t,uint64_t>(r.networkId,r.memberId)].assign((const char *)(b + ptr),r.length);
+		ptr += r.length;
+		++_logRecords;
+	}
+
+	if (ptr < buf.length()) {
+		// A write was cut short, so drop the torn tail and append after the last good record
+		fprintf(stderr,"WARNING: controller member log %s has %llu damaged bytes at its end, truncating" ZT_EOL_S,_logPath.c_str(),(unsigned long long)(buf.length() - ptr));
+		if (::truncate(_logPath.c_str(),(off_t)ptr) != 0)
+			fprintf(stderr,"WARNING: controller unable to write to path: %s" ZT_EOL_S,_logPath.c_str());
+	}
+}
+
+void MappedDB::_importMemberFiles()
+{
+	std::vector<uint64_t> networkIds;
+	networks(networkIds);
+
+	char p[4096];
+	std::string buf,rec;
+	for(auto n=networkIds.begin();n!=networkIds.end();++n) {
+		OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "%.16llx" ZT_PATH_SEPARATOR_S "member",_networksPath.c_str(),(unsigned long long)*n);
+		const std::string membersPath(p);
+		std::vector<std::string> members(OSUtils::listDirectory(membersPath.c_str(),false));
+		for(auto m=members.begin();m!=members.end();++m) {
+			buf.clear();
+			if ((m->length() == 15)&&(OSUtils::readFile((membersPath + ZT_PATH_SEPARATOR_S + *m).c_str(),buf))) {
+				try {
+					nlohmann::json member(OSUtils::jsonParse(buf));
+					const uint64_t id = OSUtils::jsonIntHex(member["id"],0ULL);
+					if ((id)&&(OSUtils::jsonIntHex(member["nwid"],0ULL) == *n)) {
+						_encode(*n,id,&member,rec);
+						_log[std::pair<uint64_t,uint64_t>(*n,id)] = rec;
+						++_logRecords;
+					}
+				} catch ( ... ) {}
+			}
+		}
+	}
+
+	if (_logRecords > 0)
+		fprintf(stderr,"INFO: controller imported %lu member JSON files into %s" ZT_EOL_S,_logRecords,_snapshotPath.c_str());
+}
+
+void MappedDB::_index(const _Record &r)
+{
+	std::shared_ptr<_Network> nw;
+	{
+		std::lock_guard<std::mutex> l(_networks_l);
+		auto nwi = _networks.find(r.networkId);
+		if (nwi == _networks.end())
+			return; // members of networks that no longer exist are dropped at the next compaction
+		nw = nwi->second;
+	}
+	{
+		std::lock_guard<std::mutex> l2(nw->lock);
+		if ((r.flags & ZT_MAPPEDDB_FLAG_ACTIVE_BRIDGE) != 0)
+			nw->activeBridgeMembers.insert(r.memberId);
+		if ((r.flags & ZT_MAPPEDDB_FLAG_AUTHORIZED) != 0) {
+			nw->authorizedMembers.insert(r.memberId);
+		} else if ((int64_t)r.lastDeauthorizedTime > nw->mostRecentDeauthTime) {
+			nw->mostRecentDeauthTime = (int64_t)r.lastDeauthorizedTime;
+		}
+		const uint8_t *ip = r.ips;
+		for(unsigned int i=0;i<r.ipCount;++i) {
+			nw->allocatedIps.insert(InetAddress(ip + 1,ip[0],0));
+			ip += 1 + ip[0];
+		}
+	}
+	++_memberCounts[r.networkId];
+}
+
+bool MappedDB::_snapshotRecord(const uint64_t offset,const uint8_t *&rec,uint64_t &avail) const
+{
+	const uint64_t end = (uint64_t)(_snapshotIndex - _snapshot);
+	if ((offset < ZT_MAPPEDDB_SNAPSHOT_HEADER_SIZE)||(offset >= end))
+		return false;
+	rec = _snapshot + offset;
+	avail = end - offset;
+	return true;
+}
+
+bool MappedDB::_find(const uint64_t networkId,const uint64_t memberId,const uint8_t *&rec,uint64_t &avail) const
+{
+	auto lr = _log.find(std::pair<uint64_t,uint64_t>(networkId,memberId));
+	if (lr != _log.end()) {
+		rec = (const uint8_t *)lr->second.data();
+		avail = lr->second.length();
+		return ((rec[24] & ZT_MAPPEDDB_FLAG_ERASED) == 0);
+	}
+	const uint64_t i = _snapshotLowerBound(networkId,memberId);
+	if (i < _snapshotCount) {
+		const uint8_t *const e = _snapshotIndex + (i * ZT_MAPPEDDB_INDEX_ENTRY_SIZE);
+		if ((_get64(e) == networkId)&&(_get64(e + 8) == memberId))
+			return _snapshotRecord(_get64(e + 16),rec,avail);
+	}
+	return false;
+}
+
+uint64_t MappedDB::_snapshotLowerBound(const uint64_t networkId,const uint64_t memberId) const
+{
+	uint64_t lo = 0,hi = _snapshotCount;
+	while (lo < hi) {
+		const uint64_t mid = lo + ((hi - lo) >> 1);
+		const uint8_t *const e = _snapshotIndex + (mid * ZT_MAPPEDDB_INDEX_ENTRY_SIZE);
+		const uint64_t n = _get64(e);
+		if ((n < networkId)||((n == networkId)&&(_get64(e + 8) < memberId)))
+			lo = mid + 1;
+		else hi = mid;
+	}
+	return lo;
+}
+
+void MappedDB::_append(const std::vector<std::string> &recs)
+{
+	std::string buf;
+	for(auto r=recs.begin();r!=recs.end();++r)
+		buf.append(*r);
+
+	std::lock_guard<std::mutex> l(_store_l);
+
+	bool ok = false;
+	if (_logFd >= 0) {
+		const off_t before = lseek(_logFd,0,SEEK_END);
+		ok = (::write(_logFd,buf.data(),buf.length()) == (ssize_t)buf.length());
+		if ((!ok)&&(before >= 0)&&(ftruncate(_logFd,before) != 0)) // don't leave a torn record in front of the next one
+			fprintf(stderr,"WARNING: controller member log %s may end in a torn record" ZT_EOL_S,_logPath.c_str());
+	}
+	if (!ok)
+		fprintf(stderr,"WARNING: controller unable to write to path: %s" ZT_EOL_S,_logPath.c_str());
+
+	const uint8_t *rec;
+	uint64_t avail;
+	for(auto r=recs.begin();r!=recs.end();++r) {
+		const uint8_t *const b = (const uint8_t *)r->data();
+		const std::pair<uint64_t,uint64_t> k(_get64(b + 8),_get64(b + 16));
+		const bool erased = ((b[24] & ZT_MAPPEDDB_FLAG_ERASED) != 0);
+		const bool existed = _find(k.first,k.second,rec,avail);
+		if ((!existed)&&(!erased))
+			++_memberCounts[k.first];
+		else if ((existed)&&(erased))
+			--_memberCounts[k.first];
+		_log[k] = *r;
+		++_logRecords;
+	}
+
+	if ((_logRecords >= ZT_MAPPEDDB_COMPACT_THRESHOLD)&&(_logRecords >= (_snapshotCount / 4)))
+		_compact();
+}
+
+bool MappedDB::_compact()
+{
+	std::unordered_set<uint64_t> networkIds;
+	{
+		std::lock_guard<std::mutex> l(_networks_l);
+		for(auto n=_networks.begin();n!=_networks.end();++n)
+			networkIds.insert(n->first);
+	}
+
+	// Gather live members of existing networks as (key, record) and sort them into index order
+	std::vector< std::pair< std::pair<uint64_t,uint64_t>,std::pair<const uint8_t *,unsigned int> > > live;
+	live.reserve((size_t)_snapshotCount + _log.size());
+	const uint8_t *rec;
+	uint64_t avail;
+	_Record r;
+	for(uint64_t i=0;i<_snapshotCount;++i) {
+		const uint8_t *const e = _snapshotIndex + (i * ZT_MAPPEDDB_INDEX_ENTRY_SIZE);
+		const std::pair<uint64_t,uint64_t> k(_get64(e),_get64(e + 8));
+		if ((_log.count(k))||(!networkIds.count(k.first)))
+			continue;
+		if ((_snapshotRecord(_get64(e + 16),rec,avail))&&(_parse(rec,avail,false,r)))
+			live.push_back(std::pair< std::pair<uint64_t,uint64_t>,std::pair<const uint8_t *,unsigned int> >(k,std::pair<const uint8_t *,unsigned int>(rec,r.length)));
+	}
+	for(auto lr=_log.begin();lr!=_log.end();++lr) {
+		if (!networkIds.count(lr->first.first))
+			continue;
+		rec = (const uint8_t *)lr->second.data();
+		if ((_parse(rec,lr->second.length(),false,r))&&((r.flags & ZT_MAPPEDDB_FLAG_ERASED) == 0))
+			live.push_back(std::pair< std::pair<uint64_t,uint64_t>,std::pair<const uint8_t *,unsigned int> >(lr->first,std::pair<const uint8_t *,unsigned int>(rec,r.length)));
+	}
+	std::sort(live.begin(),live.end());
+
+	uint64_t indexOffset = ZT_MAPPEDDB_SNAPSHOT_HEADER_SIZE;
+	for(auto m=live.begin();m!=live.end();++m)
+		indexOffset += m->second.second;
+
+	const std::string tmp(_snapshotPath + ".new");
+	FILE *f = fopen(tmp.c_str(),"wb");
+	if (!f) {
+		fprintf(stderr,"WARNING: controller unable to write to path: %s" ZT_EOL_S,tmp.c_str());
+		return false;
+	}
+	std::string hdr,index;
+	hdr.append(ZT_MAPPEDDB_SNAPSHOT_MAGIC,8);
+	_put64(hdr,(uint64_t)live.size());
+	_put64(hdr,indexOffset);
+	index.reserve(live.size() * ZT_MAPPEDDB_INDEX_ENTRY_SIZE);
+	bool ok = (fwrite(hdr.data(),hdr.length(),1,f) == 1);
+	uint64_t o = ZT_MAPPEDDB_SNAPSHOT_HEADER_SIZE;
+	for(auto m=live.begin();((ok)&&(m!=live.end()));++m) {
+		ok = (fwrite(m->second.first,m->second.second,1,f) == 1);
+		_put64(index,m->first.first);
+		_put64(index,m->first.second);
+		_put64(index,o);
+		o += m->second.second;
+	}
+	if ((ok)&&(!index.empty()))
+		ok = (fwrite(index.data(),index.length(),1,f) == 1);
+	ok = ((ok)&&(fflush(f) == 0)&&(fsync(fileno(f)) == 0));
+	fclose(f);
+	if ((!ok)||(!OSUtils::rename(tmp.c_str(),_snapshotPath.c_str()))) {
+		OSUtils::rm(tmp.c_str());
+		fprintf(stderr,"WARNING: controller unable to write to path: %s" ZT_EOL_S,_snapshotPath.c_str());
+		return false;
+	}
+
+	// Records in 'live' point into the old mapping and the log, so only release them now
+	_memberCounts.clear();
+	for(auto m=live.begin();m!=live.end();++m)
+		++_memberCounts[m->first.first];
+	_unmap();
+	if (!_map()) {
+		// Keep the log: it still holds every change since the old snapshot and
+		// is replayed on top of the new one at the next load
+		fprintf(stderr,"WARNING: controller unable to read back compacted member store %s" ZT_EOL_S,_snapshotPath.c_str());
+		return false;
+	}
+	if (_logFd >= 0) {
+		if (ftruncate(_logFd,0) != 0)
+			fprintf(stderr,"WARNING: controller unable to write to path: %s" ZT_EOL_S,_logPath.c_str());
+	}
+	_log.clear();
+	_logRecords = 0;
+
+	return true;
+}
+
+} // namespace ZeroTier
+
+#endif // __UNIX_LIKE__
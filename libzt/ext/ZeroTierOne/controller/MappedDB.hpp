@@ -0,0 +1,118 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ZT_CONTROLLER_MAPPEDDB_HPP
+#define ZT_CONTROLLER_MAPPEDDB_HPP
+
+#include "FileDB.hpp"
+
+#ifdef __UNIX_LIKE__
+
+/**
+ * Compact once the change log holds this many records (and at least a quarter as many as the snapshot)
+ */
+#define ZT_MAPPEDDB_COMPACT_THRESHOLD 4096
+
+namespace ZeroTier
+{
+
+/**
+ * A controller database that keeps members in a memory-mapped binary store
+ *
+ * Networks are few and stay JSON files exactly as in FileDB. Members are
+ * compact binary records: the fields network summaries are built from
+ * (authorization, bridging, IPs, last deauthorization) followed by the
+ * full member object as MessagePack. Records live in a snapshot file
+ * (members.db) that is mmap'd and ends with an index sorted by network
+ * and member ID, and in an append-only change log (members.log) whose
+ * latest record for a member overrides the snapshot. Startup only scans
+ * record headers, and members are decoded to JSON when they are asked
+ * for, so neither load time nor heap use grows with member JSON size.
+ * When the log gets large it is compacted into a new snapshot.
+ *
+ * This is selected with a controller DB path of "mapped:/path". Member
+ * JSON files left by FileDB at that path are imported on first start.
+ */
+class MappedDB : public FileDB
+{
+public:
+	MappedDB(EmbeddedNetworkController *const nc,const Identity &myId,const char *path);
+	virtual ~MappedDB();
+
+	virtual void save(nlohmann::json *orig,nlohmann::json &record);
+	virtual void eraseNetwork(const uint64_t networkId);
+	virtual void eraseMember(const uint64_t networkId,const uint64_t memberId);
+
+	/**
+	 * Write all current members to a new snapshot and empty the change log
+	 *
+	 * @return True on success
+	 */
+	bool compact();
+
+protected:
+	virtual bool _getMember(_Network &nw,const uint64_t networkId,const uint64_t memberId,nlohmann::json &member);
+	virtual void _getMembers(_Network &nw,const uint64_t networkId,std::vector<nlohmann::json> &members);
+	virtual void _setMember(_Network &nw,const uint64_t networkId,const uint64_t memberId,const nlohmann::json *member);
+	virtual unsigned long _memberCount(_Network &nw,const uint64_t networkId);
+
+private:
+	struct _Record;
+	struct _PairHasher
+	{
+		inline std::size_t operator()(const std::pair<uint64_t,uint64_t> &p) const { return (std::size_t)(p.first ^ p.second); }
+	};
+
+	static bool _parse(const uint8_t *p,const uint64_t avail,const bool verify,_Record &r);
+	static bool _decode(const _Record &r,nlohmann::json &member);
+
+	bool _map();
+	void _unmap();
+	void _replayLog();
+	void _importMemberFiles();
+	void _index(const _Record &r);
+	bool _snapshotRecord(const uint64_t offset,const uint8_t *&rec,uint64_t &avail) const;
+	bool _find(const uint64_t networkId,const uint64_t memberId,const uint8_t *&rec,uint64_t &avail) const;
+	uint64_t _snapshotLowerBound(const uint64_t networkId,const uint64_t memberId) const;
+	void _append(const std::vector<std::string> &recs);
+	bool _compact();
+
+	std::string _snapshotPath;
+	std::string _logPath;
+	int _logFd;
+
+	// Snapshot file: header, records, then index entries of (network ID, member ID, record offset)
+	const uint8_t *_snapshot;
+	uint64_t _snapshotSize;
+	uint64_t _snapshotCount;
+	const uint8_t *_snapshotIndex;
+
+	// Latest record from the change log for each member it mentions, including erasures
+	std::unordered_map< std::pair<uint64_t,uint64_t>,std::string,_PairHasher > _log;
+	unsigned long _logRecords;
+
+	std::unordered_map< uint64_t,unsigned long > _memberCounts;
+
+	mutable std::mutex _store_l;
+};
+
+} // namespace ZeroTier
+
+#endif // __UNIX_LIKE__
+
+#endif
@@ -1,14 +1,17 @@
-#include "crypto_sign.h"
+/*#include "crypto_sign.h"
 
 #include "crypto_verify_32.h"
 #include "crypto_hash_sha512.h"
-#include "randombytes.h"
+#include "randombytes.h"*/
 
 #include "ge25519.h"
 #include "hram.h"
 
 #define MAXBATCH 64
 
+/* Original */
+#if 0
+
 int crypto_sign_open_batch(
     unsigned char* const m[],unsigned long long mlen[],
     unsigned char* const sm[],const unsigned long long smlen[],
@@ -92,3 +95,76 @@ int crypto_sign_open_batch(
 
   return ret;
 }
+#endif
+
+extern void ZT_getSecureRandomInternal(void *buf,unsigned int bytes);
+extern int ed25519_amd64_asm_verify(const unsigned char *pk,const unsigned char *sig);
+
+/* Checks the ed25519 parts of many ZeroTier signatures (see ed25519_amd64_asm_verify()),
+ * setting valid[i] to 1 or 0. Groups of up to MAXBATCH are checked with one multi-scalar
+ * multiplication and only checked one at a time if the group fails. */
+extern void ed25519_amd64_asm_verify_batch(const unsigned char *const *pk,const unsigned char *const *sig,int *valid,unsigned long long num)
+{
+  unsigned long long i;
+  shortsc25519 r[MAXBATCH];
+  sc25519 scalars[2*MAXBATCH+1];
+  ge25519 points[2*MAXBATCH+1];
+  unsigned char hram[64];
+  unsigned char m[96];
+  unsigned long long batchsize;
+
+  while (num >= 3) {
+    batchsize = num;
+    if (batchsize > MAXBATCH) batchsize = MAXBATCH;
+
+    ZT_getSecureRandomInternal((unsigned char*)r,(unsigned int)(sizeof(shortsc25519) * batchsize));
+
+    /* Computing scalars[0] = ((r1s1 + r2s2 + ...)) */
+    for(i=0;i<batchsize;i++)
+    {
+      sc25519_from32bytes(&scalars[i], sig[i]+32);
+      sc25519_mul_shortsc(&scalars[i], &scalars[i], &r[i]);
+    }
+    for(i=1;i<batchsize;i++)
+      sc25519_add(&scalars[0], &scalars[0], &scalars[i]);
+
+    /* Computing scalars[1] ... scalars[batchsize] as r[i]*H(R[i],A[i],m[i]) */
+    for(i=0;i<batchsize;i++)
+    {
+      get_hram(hram, sig[i], pk[i], m, 96);
+      sc25519_from64bytes(&scalars[i+1],hram);
+      sc25519_mul_shortsc(&scalars[i+1],&scalars[i+1],&r[i]);
+    }
+    /* Setting scalars[batchsize+1] ... scalars[2*batchsize] to r[i] */
+    for(i=0;i<batchsize;i++)
+      sc25519_from_shortsc(&scalars[batchsize+i+1],&r[i]);
+
+    /* Computing points */
+    points[0] = ge25519_base;
+
+    for(i=0;i<batchsize;i++)
+      if (ge25519_unpackneg_vartime(&points[i+1], pk[i])) goto fallback;
+    for(i=0;i<batchsize;i++)
+      if (ge25519_unpackneg_vartime(&points[batchsize+i+1], sig[i])) goto fallback;
+
+    ge25519_multi_scalarmult_vartime(points, points, scalars, 2*batchsize+1);
+
+    if (ge25519_isneutral_vartime(points)) {
+      for(i=0;i<batchsize;i++)
+        valid[i] = 1;
+    } else {
+      fallback:
+
+      for (i = 0;i < batchsize;++i)
+        valid[i] = ed25519_amd64_asm_verify(pk[i], sig[i]);
+    }
+
+    pk += batchsize;
+    sig += batchsize;
+    valid += batchsize;
+    num -= batchsize;
+  }
+
+  for (i = 0;i < num;++i)
+    valid[i] = ed25519_amd64_asm_verify(pk[i], sig[i]);
+}
@@ -1,8 +1,12 @@
 #include <string.h>
-#include "crypto_sign.h"
+/*#include "crypto_sign.h"
 #include "crypto_verify_32.h"
-#include "crypto_hash_sha512.h"
+#include "crypto_hash_sha512.h"*/
 #include "ge25519.h"
+#include "hram.h"
+
+/* Original */
+#if 0
 
 int crypto_sign_open(
     unsigned char *m,unsigned long long *mlen,
@@ -47,3 +51,31 @@ badsig:
   memset(m,0,smlen);
   return -1;
 }
+#endif
+
+/* Checks the ed25519 part of a ZeroTier signature: R (32 bytes), S (32 bytes), then the
+ * 32-byte message digest that was signed. Caller checks the digest. Returns 1 if valid. */
+extern int ed25519_amd64_asm_verify(const unsigned char *pk,const unsigned char *sig)
+{
+  unsigned char m[96];
+  unsigned char hram[64];
+  unsigned char rcheck[32];
+  ge25519 get1, get2;
+  sc25519 schram, scs;
+  unsigned char d = 0;
+  unsigned int i;
+
+  if (ge25519_unpackneg_vartime(&get1,pk))
+    return 0;
+
+  get_hram(hram,sig,pk,m,96);
+  sc25519_from64bytes(&schram, hram);
+  sc25519_from32bytes(&scs, sig+32);
+
+  ge25519_double_scalarmult_vartime(&get2, &get1, &schram, &scs);
+  ge25519_pack(rcheck, &get2);
+
+  for(i=0;i<32;i++)
+    d |= rcheck[i] ^ sig[i];
+  return (d == 0);
+}
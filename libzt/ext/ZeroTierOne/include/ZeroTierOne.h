@@ -618,6 +618,36 @@ typedef struct
 	 * True if some kind of connectivity appears available
 	 */
 	int online;
+
+	/**
+	 * Number of packets reassembled from fragments
+	 */
+	uint64_t fragmentsReassembled;
+
+	/**
+	 * Number of partially received packets dropped to make room for others
+	 */
+	uint64_t fragmentsEvicted;
+
+	/**
+	 * Number of partially received packets whose remaining fragments never arrived
+	 */
+	uint64_t fragmentsExpired;
+
+	/**
+	 * Number of new peer identities that passed validation, including cache hits
+	 */
+	uint64_t identitiesValidated;
+
+	/**
+	 * Number of new peer identities accepted from the validated identity cache
+	 */
+	uint64_t identityCacheHits;
+
+	/**
+	 * Number of HELLOs from new peers rejected for an invalid identity or MAC
+	 */
+	uint64_t identityValidationsFailed;
 } ZT_NodeStatus;
 
 /**
@@ -934,6 +964,26 @@ typedef struct
 	uint16_t metric;
 } ZT_VirtualNetworkRoute;
 
+/**
+ * One contiguous piece of a virtual network frame's payload
+ *
+ * Frames coming from network stacks that keep packets in chained buffers
+ * can be passed as an ordered list of segments instead of being copied
+ * into one contiguous buffer first.
+ */
+typedef struct
+{
+	/**
+	 * Segment data
+	 */
+	const void *data;
+
+	/**
+	 * Segment length in bytes
+	 */
+	unsigned int len;
+} ZT_FrameSegment;
+
 /**
  * An Ethernet multicast group
  */
@@ -1196,6 +1246,51 @@ typedef struct
 	int preferred;
 } ZT_PeerPhysicalPath;
 
+/**
+ * Unicast frame compression statistics for a peer
+ *
+ * Frames are compressed adaptively: payloads that look random aren't tried,
+ * and after a frame that doesn't compress well the next 1, 2, 4 ... frames
+ * (up to a limit) aren't tried either.
+ */
+typedef struct
+{
+	/**
+	 * Frames sent compressed
+	 */
+	uint64_t framesCompressed;
+
+	/**
+	 * Frames that were tried but didn't get smaller
+	 */
+	uint64_t framesIncompressible;
+
+	/**
+	 * Frames not tried because they looked incompressible or during backoff
+	 */
+	uint64_t framesSkipped;
+
+	/**
+	 * Total uncompressed size of frames sent compressed
+	 */
+	uint64_t bytesIn;
+
+	/**
+	 * Total compressed size of frames sent compressed
+	 */
+	uint64_t bytesOut;
+
+	/**
+	 * Total bytes run through the compressor, a measure of the CPU cost of compression
+	 */
+	uint64_t bytesTried;
+
+	/**
+	 * Current backoff (frames skipped after each incompressible one), 0 if not backing off
+	 */
+	unsigned int backoff;
+} ZT_PeerCompressionStats;
+
 /**
  * Peer status result buffer
  */
@@ -1240,6 +1335,11 @@ typedef struct
 	 * Known network paths to peer
 	 */
 	ZT_PeerPhysicalPath paths[ZT_MAX_PEER_NETWORK_PATHS];
+
+	/**
+	 * Unicast frame compression statistics
+	 */
+	ZT_PeerCompressionStats compression;
 } ZT_Peer;
 
 /**
@@ -1313,7 +1413,16 @@ enum ZT_StateObjectType
 	 * Canonical path: <HOME>/networks.d/<NETWORKID>.conf (16-digit hex ID)
 	 * Persistence: required if network memberships should persist
 	 */
-	ZT_STATE_OBJECT_NETWORK_CONFIG = 6
+	ZT_STATE_OBJECT_NETWORK_CONFIG = 6,
+
+	/**
+	 * Hashes of peer identities that have already passed validation
+	 *
+	 * Object ID: this node's address
+	 * Canonical path: <HOME>/identities.cache
+	 * Persistence: optional, can be cleared at any time
+	 */
+	ZT_STATE_OBJECT_IDENTITY_CACHE = 7
 };
 
 /**
@@ -1645,6 +1754,39 @@ ZT_SDK_API enum ZT_ResultCode ZT_Node_processVirtualNetworkFrame(
 	unsigned int frameLength,
 	volatile int64_t *nextBackgroundTaskDeadline);
 
+/**
+ * Process a frame from a virtual network port (tap) given as a list of segments
+ *
+ * This is equivalent to ZT_Node_processVirtualNetworkFrame() with the
+ * segments concatenated in order, but unicast frames are gathered directly
+ * into the outgoing packet so the payload is copied only once.
+ *
+ * @param node Node instance
+ * @param tptr Thread pointer to pass to functions/callbacks resulting from this call
+ * @param now Current clock in milliseconds
+ * @param nwid ZeroTier 64-bit virtual network ID
+ * @param sourceMac Source MAC address (least significant 48 bits)
+ * @param destMac Destination MAC address (least significant 48 bits)
+ * @param etherType 16-bit Ethernet frame type
+ * @param vlanId 10-bit VLAN ID or 0 if none
+ * @param frameSegments Frame payload segments in order
+ * @param frameSegmentCount Number of frame payload segments
+ * @param nextBackgroundTaskDeadline Value/result: set to deadline for next call to processBackgroundTasks()
+ * @return OK (0) or error code if a fatal error condition has occurred
+ */
+ZT_SDK_API enum ZT_ResultCode ZT_Node_processVirtualNetworkFrameSegments(
+	ZT_Node *node,
+	void *tptr,
+	int64_t now,
+	uint64_t nwid,
+	uint64_t sourceMac,
+	uint64_t destMac,
+	unsigned int etherType,
+	unsigned int vlanId,
+	const ZT_FrameSegment *frameSegments,
+	unsigned int frameSegmentCount,
+	volatile int64_t *nextBackgroundTaskDeadline);
+
 /**
  * Perform periodic background operations
  *
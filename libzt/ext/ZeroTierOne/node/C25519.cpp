@@ -1997,10 +1997,16 @@ void get_hram(unsigned char *hram, const unsigned char *sm, const unsigned char
 
 #ifdef ZT_USE_FAST_X64_ED25519
 extern "C" void ed25519_amd64_asm_sign(const unsigned char *sk,const unsigned char *pk,const unsigned char *m,const unsigned int mlen,unsigned char *sig);
+extern "C" int ed25519_amd64_asm_verify(const unsigned char *pk,const unsigned char *sig);
+extern "C" void ed25519_amd64_asm_verify_batch(const unsigned char *const *pk,const unsigned char *const *sig,int *valid,unsigned long long num);
 #endif
 
 namespace ZeroTier {
 
+#ifdef ZT_USE_FAST_X64_ED25519
+bool C25519::useFastEd25519 = true;
+#endif
+
 void C25519::agree(const C25519::Private &mine,const C25519::Public &their,void *keybuf,unsigned int keylen)
 {
 	unsigned char rawkey[32];
@@ -2020,8 +2026,12 @@ void C25519::agree(const C25519::Private &mine,const C25519::Public &their,void
 void C25519::sign(const C25519::Private &myPrivate,const C25519::Public &myPublic,const void *msg,unsigned int len,void *signature)
 {
 #ifdef ZT_USE_FAST_X64_ED25519
-	ed25519_amd64_asm_sign(myPrivate.data + 32,myPublic.data + 32,(const unsigned char *)msg,len,(unsigned char *)signature);
-#else
+	if (useFastEd25519) {
+		ed25519_amd64_asm_sign(myPrivate.data + 32,myPublic.data + 32,(const unsigned char *)msg,len,(unsigned char *)signature);
+		return;
+	}
+#endif
+
 	sc25519 sck, scs, scsk;
 	ge25519 ger;
 	unsigned char r[32];
@@ -2066,16 +2076,10 @@ void C25519::sign(const C25519::Private &myPrivate,const C25519::Public &myPubli
 	sc25519_to32bytes(s,&scs); /* cat s */
 	for(unsigned int i=0;i<32;i++)
 		sig[32 + i] = s[i];
-#endif
 }
 
 bool C25519::verify(const C25519::Public &their,const void *msg,unsigned int len,const void *signature)
 {
-	unsigned char t2[32];
-	ge25519 get1, get2;
-	sc25519 schram, scs;
-	unsigned char hram[crypto_hash_sha512_BYTES];
-	unsigned char m[96];
 	unsigned char digest[64]; // we sign the first 32 bytes of SHA-512(msg)
 	const unsigned char *sig = (const unsigned char *)signature;
 
@@ -2084,6 +2088,79 @@ bool C25519::verify(const C25519::Public &their,const void *msg,unsigned int len
 	if (!Utils::secureEq(sig + 64,digest,32))
 		return false;
 
+	return _verifyEd(their,sig);
+}
+
+bool C25519::VerifyBatch::verify(const C25519::Public &their,const void *msg,unsigned int len,const void *signature)
+{
+	// The digest binds the signature to msg, so it is checked on both passes:
+	// a queued result only covers the (signature, key) pair, not the message.
+	unsigned char digest[64];
+	SHA512::hash(digest,msg,len);
+	if (!Utils::secureEq(reinterpret_cast<const uint8_t *>(signature) + 64,digest,32))
+		return false;
+
+	if (_done) {
+		for(std::vector<_Item>::const_iterator i(_items.begin());i!=_items.end();++i) {
+			if ((memcmp(i->sig,signature,ZT_C25519_SIGNATURE_LEN) == 0)&&(memcmp(i->pub.data,their.data,ZT_C25519_PUBLIC_KEY_LEN) == 0))
+				return i->valid;
+		}
+		return _verifyEd(their,reinterpret_cast<const uint8_t *>(signature)); // not queued before run()
+	}
+
+	_items.push_back(_Item());
+	_Item &i = _items.back();
+	memcpy(i.pub.data,their.data,ZT_C25519_PUBLIC_KEY_LEN);
+	memcpy(i.sig,signature,ZT_C25519_SIGNATURE_LEN);
+	i.valid = false;
+	return true;
+}
+
+bool C25519::VerifyBatch::run()
+{
+	_done = true;
+	if (_items.empty())
+		return true;
+
+#ifdef ZT_USE_FAST_X64_ED25519
+	if (useFastEd25519) {
+		std::vector<const unsigned char *> pk(_items.size()),sig(_items.size());
+		std::vector<int> valid(_items.size());
+		for(unsigned long i=0;i<_items.size();++i) {
+			pk[i] = _items[i].pub.data + 32;
+			sig[i] = _items[i].sig;
+		}
+		ed25519_amd64_asm_verify_batch(pk.data(),sig.data(),valid.data(),(unsigned long long)_items.size());
+		bool all = true;
+		for(unsigned long i=0;i<_items.size();++i) {
+			_items[i].valid = (valid[i] != 0);
+			all &= _items[i].valid;
+		}
+		return all;
+	}
+#endif
+
+	bool all = true;
+	for(std::vector<_Item>::iterator i(_items.begin());i!=_items.end();++i) {
+		i->valid = _verifyEd(i->pub,i->sig);
+		all &= i->valid;
+	}
+	return all;
+}
+
+bool C25519::_verifyEd(const C25519::Public &their,const uint8_t *sig)
+{
+#ifdef ZT_USE_FAST_X64_ED25519
+	if (useFastEd25519)
+		return (ed25519_amd64_asm_verify(their.data + 32,sig) != 0);
+#endif
+
+	unsigned char t2[32];
+	ge25519 get1, get2;
+	sc25519 schram, scs;
+	unsigned char hram[crypto_hash_sha512_BYTES];
+	unsigned char m[96];
+
 	if (ge25519_unpackneg_vartime(&get1,their.data + 32))
 		return false;
 
@@ -27,6 +27,8 @@
 #ifndef ZT_C25519_HPP
 #define ZT_C25519_HPP
 
+#include <vector>
+
 #include "Utils.hpp"
 
 namespace ZeroTier {
@@ -169,7 +171,84 @@ public:
 		return verify(their,msg,len,signature.data);
 	}
 
+	/**
+	 * Verifies many signatures at once
+	 *
+	 * Signatures are added with verify(), which checks each message digest
+	 * right away but queues the more expensive ed25519 check. Calling run()
+	 * checks everything queued. After that verify() with the same key and
+	 * signature returns the result from the batch, so code can be run once
+	 * to queue and again to act on results.
+	 *
+	 * With the amd64 ed25519 code this checks up to 64 signatures with one
+	 * multi-scalar multiplication and only checks them one by one if that
+	 * fails. Like other non-cofactored batch verifiers it could accept a
+	 * signature whose R differs from a valid one by a small-order point,
+	 * which proves nothing a valid signature does not. Otherwise this just
+	 * checks each signature in run().
+	 *
+	 * This class is not thread safe.
+	 */
+	class VerifyBatch
+	{
+	public:
+		VerifyBatch() : _done(false) {}
+
+		/**
+		 * Queue a signature or, after run(), get its result
+		 *
+		 * @param their Public key to verify against
+		 * @param msg Message to verify signature integrity against
+		 * @param len Length of message in bytes
+		 * @param signature 96-byte signature
+		 * @return Before run(): false if the message digest does not match, otherwise true. After run(): true if the digest matches and the signature is valid.
+		 */
+		bool verify(const Public &their,const void *msg,unsigned int len,const void *signature);
+
+		/**
+		 * Check all queued signatures
+		 *
+		 * @return True if all queued signatures are valid
+		 */
+		bool run();
+
+		/**
+		 * @return True if run() has been called
+		 */
+		inline bool done() const { return _done; }
+
+		/**
+		 * @return Number of queued signatures
+		 */
+		inline unsigned long size() const { return (unsigned long)_items.size(); }
+
+	private:
+		struct _Item
+		{
+			Public pub;
+			uint8_t sig[ZT_C25519_SIGNATURE_LEN];
+			bool valid;
+		};
+		std::vector<_Item> _items;
+		bool _done;
+	};
+
+#ifdef ZT_USE_FAST_X64_ED25519
+	/**
+	 * Use the amd64 assembly ed25519 code for signing and verification
+	 *
+	 * The assembly is chosen at build time with ZT_USE_FAST_X64_ED25519 and
+	 * only needs baseline x86-64, so there is no CPU detection and this is
+	 * always true in normal use. Tests clear it to compare against and
+	 * benchmark the portable code.
+	 */
+	static bool useFastEd25519;
+#endif
+
 private:
+	// check the ed25519 part of a signature whose digest has been checked
+	static bool _verifyEd(const Public &their,const uint8_t *sig);
+
 	// derive first 32 bytes of kp.pub from first 32 bytes of kp.priv
 	// this is the ECDH key
 	static void _calcPubDH(Pair &kp);
@@ -170,9 +170,10 @@ public:
 	 * Verify this capability's chain of custody and signatures
 	 *
 	 * @param RR Runtime environment to provide for peer lookup, etc.
+	 * @param batch If non-NULL, queue signatures in or get results from this batch (see C25519::VerifyBatch)
 	 * @return 0 == OK, 1 == waiting for WHOIS, -1 == BAD signature or chain
 	 */
-	int verify(const RuntimeEnvironment *RR,void *tPtr) const;
+	int verify(const RuntimeEnvironment *RR,void *tPtr,C25519::VerifyBatch *batch = (C25519::VerifyBatch *)0) const;
 
 	template<unsigned int C>
 	static inline void serializeRules(Buffer<C> &b,const ZT_VirtualNetworkRule *rules,unsigned int ruleCount)
@@ -267,9 +267,10 @@ public:
 	 *
 	 * @param RR Runtime environment for looking up peers
 	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param batch If non-NULL, queue signatures in or get results from this batch (see C25519::VerifyBatch)
 	 * @return 0 == OK, 1 == waiting for WHOIS, -1 == BAD signature or credential
 	 */
-	int verify(const RuntimeEnvironment *RR,void *tPtr) const;
+	int verify(const RuntimeEnvironment *RR,void *tPtr,C25519::VerifyBatch *batch = (C25519::VerifyBatch *)0) const;
 
 	/**
 	 * @return True if signed
@@ -34,7 +34,7 @@
 
 namespace ZeroTier {
 
-int CertificateOfOwnership::verify(const RuntimeEnvironment *RR,void *tPtr) const
+int CertificateOfOwnership::verify(const RuntimeEnvironment *RR,void *tPtr,C25519::VerifyBatch *batch) const
 {
 	if ((!_signedBy)||(_signedBy != Network::controllerFor(_networkId)))
 		return -1;
@@ -46,7 +46,7 @@ int CertificateOfOwnership::verify(const RuntimeEnvironment *RR,void *tPtr) cons
 	try {
 		Buffer<(sizeof(CertificateOfOwnership) + 64)> tmp;
 		this->serialize(tmp,true);
-		return (id.verify(tmp.data(),tmp.size(),_signature) ? 0 : -1);
+		return (id.verify(tmp.data(),tmp.size(),_signature,batch) ? 0 : -1);
 	} catch ( ... ) {
 		return -1;
 	}
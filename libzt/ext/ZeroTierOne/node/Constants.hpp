@@ -186,20 +186,38 @@
 #define ZT_MAX_PACKET_FRAGMENTS 7
 
 /**
- * Size of RX queue
+ * Maximum size of RX queue (fragment reassembly and packets waiting for WHOIS)
  *
- * This is about 2mb, and can be decreased for small devices. A queue smaller
- * than about 4 is probably going to cause a lot of lost packets.
+ * Entries are about 20kb each and are allocated as needed, so this is about
+ * 5mb at most. It can be decreased for small devices. A queue smaller than
+ * about 4 is probably going to cause a lot of lost packets.
  */
-#define ZT_RX_QUEUE_SIZE 64
+#define ZT_RX_QUEUE_SIZE 256
 
 /**
- * Size of TX queue
+ * Maximum RX queue entries for packets from any one physical source address
  *
- * This is about 2mb, and can be decreased for small devices. A queue smaller
- * than about 4 is probably going to cause a lot of lost packets.
+ * When a source hits this its oldest entry is recycled, so one busy or
+ * lossy sender can't push everyone else's in-flight packets out of the queue.
  */
-#define ZT_TX_QUEUE_SIZE 64
+#define ZT_RX_QUEUE_MAX_PER_SOURCE 32
+
+/**
+ * Size of TX queue (packets waiting for WHOIS or a path to their destination)
+ *
+ * Entries are about 10kb each and are allocated as needed, so this is about
+ * 2.5mb at most. It can be decreased for small devices. A queue smaller than
+ * about 4 is probably going to cause a lot of lost packets.
+ */
+#define ZT_TX_QUEUE_SIZE 256
+
+/**
+ * Maximum TX queue entries waiting for any one destination
+ *
+ * When a destination hits this its oldest packet is dropped, so one
+ * unreachable peer can't push packets to everyone else out of the queue.
+ */
+#define ZT_TX_QUEUE_MAX_PER_DEST 32
 
 /**
  * Length of secret key in bytes -- 256-bit -- do not change
@@ -397,6 +415,14 @@
  */
 #define ZT_PEER_GENERAL_RATE_LIMIT 1000
 
+/**
+ * Maximum number of frames to a peer sent without trying compression after incompressible ones
+ *
+ * Each incompressible frame doubles the number skipped up to this, and
+ * one frame that compresses well resets it.
+ */
+#define ZT_PEER_COMPRESSION_MAX_BACKOFF 256
+
 /**
  * Don't do expensive identity validation more often than this
  *
@@ -417,6 +443,38 @@
 #endif
 #endif
 
+/**
+ * Maximum number of threads validating new peers' identities at once
+ *
+ * Threads are started as validations are queued and exit when there is
+ * nothing left to do, so none exist except during bursts of new peers.
+ * Each one uses ZT_IDENTITY_GEN_MEMORY (2mb) while it works.
+ */
+#define ZT_IDENTITY_VALIDATOR_MAX_THREADS 4
+
+/**
+ * Maximum number of new peers' HELLOs being validated at once
+ *
+ * Each one waits in the Switch RX queue until its validation finishes, so
+ * this is kept well below ZT_RX_QUEUE_SIZE to leave room there for other
+ * traffic and fragment reassembly during a storm of new peers. HELLOs from
+ * new peers beyond this are dropped, and the peers will try again later.
+ */
+#define ZT_IDENTITY_VALIDATOR_QUEUE_SIZE 64
+
+/**
+ * Number of validated identity hashes remembered so validation can be skipped
+ *
+ * Entries are 16 bytes each and the cache is saved with the node's state,
+ * so peers that reconnect after a restart can skip the expensive check.
+ */
+#define ZT_IDENTITY_VALIDATOR_CACHE_SIZE 65536
+
+/**
+ * How often to save the validated identity cache if it has changed
+ */
+#define ZT_IDENTITY_VALIDATOR_CACHE_SAVE_INTERVAL 60000
+
 /**
  * How long is a path or peer considered to have a trust relationship with us (for e.g. relay policy) since last trusted established packet?
  */
@@ -32,7 +32,9 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include <new>
 #include <stdexcept>
 #include <vector>
 #include <utility>
@@ -40,30 +42,55 @@
 
 namespace ZeroTier {
 
+/**
+ * Minimum number of slots allocated once a Hashtable holds anything (power of two)
+ */
+#define ZT_HASHTABLE_MIN_CAPACITY 8
+
 /**
  * A minimal hash table implementation for the ZeroTier core
+ *
+ * This is an open addressing table with linear probing. Keys and values live
+ * inline in one slot array and a parallel array of one byte control words
+ * (empty, deleted, or full plus seven bits of the hash) lets most probes
+ * skip non-matching slots without touching keys at all. Erased slots become
+ * tombstones so erasing never moves other entries; tombstones are dropped
+ * whenever the table is rebuilt.
+ *
+ * Unlike a chained table, entries move when the table grows or is rebuilt.
+ * Pointers and references returned by get(), set() and operator[] remain
+ * valid until the next insertion of a new key or until the entry is erased.
+ *
+ * So never hold a V* or V& from get(), set() or operator[] across a set()
+ * or operator[] that may insert a new key, unless reserve() was called
+ * first with room for every insertion made while it is held. Look the
+ * entry up again after inserting instead.
  */
 template<typename K,typename V>
 class Hashtable
 {
 private:
-	struct _Bucket
+	struct _Slot
 	{
-		_Bucket(const K &k,const V &v) : k(k),v(v) {}
-		_Bucket(const K &k) : k(k),v() {}
-		_Bucket(const _Bucket &b) : k(b.k),v(b.v) {}
-		inline _Bucket &operator=(const _Bucket &b) { k = b.k; v = b.v; return *this; }
+		_Slot(const K &k,const V &v) : k(k),v(v) {}
+		_Slot(const K &k) : k(k),v() {}
 		K k;
 		V v;
-		_Bucket *next; // must be set manually for each _Bucket
+	};
+
+	enum {
+		_CTRL_EMPTY = 0x00,
+		_CTRL_DELETED = 0x01,
+		_CTRL_FULL = 0x80 // OR'd with 7 bits of hash
 	};
 
 public:
 	/**
 	 * A simple forward iterator (different from STL)
 	 *
-	 * It's safe to erase the last key, but not others. Don't use set() since that
-	 * may rehash and invalidate the iterator. Note the erasing the key will destroy
+	 * It's safe to erase keys (including the one last returned) while iterating,
+	 * but don't use set() or operator[] to add keys since that may rebuild the
+	 * table and invalidate the iterator. Note the erasing the key will destroy
 	 * the targets of the pointers returned by next().
 	 */
 	class Iterator
@@ -74,8 +101,7 @@ public:
 		 */
 		Iterator(Hashtable &ht) :
 			_idx(0),
-			_ht(&ht),
-			_b(ht._t[0])
+			_ht(&ht)
 		{
 		}
 
@@ -86,58 +112,58 @@ public:
 		 */
 		inline bool next(K *&kptr,V *&vptr)
 		{
-			for(;;) {
-				if (_b) {
-					kptr = &(_b->k);
-					vptr = &(_b->v);
-					_b = _b->next;
+			while (_idx < _ht->_bc) {
+				const unsigned long i = _idx++;
+				if ((_ht->_ctrl[i] & _CTRL_FULL) != 0) {
+					kptr = &(_ht->_t[i].k);
+					vptr = &(_ht->_t[i].v);
 					return true;
 				}
-				++_idx;
-				if (_idx >= _ht->_bc)
-					return false;
-				_b = _ht->_t[_idx];
 			}
+			return false;
 		}
 
 	private:
 		unsigned long _idx;
 		Hashtable *_ht;
-		_Bucket *_b;
 	};
 	//friend class Hashtable<K,V>::Iterator;
 
 	/**
-	 * @param bc Initial capacity in buckets (default: 64, must be nonzero)
+	 * @param bc Initial capacity in entries (default: 0, storage is allocated on first insert)
 	 */
-	Hashtable(unsigned long bc = 64) :
-		_t(reinterpret_cast<_Bucket **>(::malloc(sizeof(_Bucket *) * bc))),
-		_bc(bc),
-		_s(0)
+	Hashtable(unsigned long bc = 0) :
+		_t((_Slot *)0),
+		_ctrl((uint8_t *)0),
+		_bc(0),
+		_bits(0),
+		_s(0),
+		_d(0)
 	{
-		if (!_t)
-			throw ZT_EXCEPTION_OUT_OF_MEMORY;
-		for(unsigned long i=0;i<bc;++i)
-			_t[i] = (_Bucket *)0;
+		if (bc)
+			_rebuild(_capacityFor(bc));
 	}
 
 	Hashtable(const Hashtable<K,V> &ht) :
-		_t(reinterpret_cast<_Bucket **>(::malloc(sizeof(_Bucket *) * ht._bc))),
-		_bc(ht._bc),
-		_s(ht._s)
+		_t((_Slot *)0),
+		_ctrl((uint8_t *)0),
+		_bc(0),
+		_bits(0),
+		_s(0),
+		_d(0)
 	{
-		if (!_t)
-			throw ZT_EXCEPTION_OUT_OF_MEMORY;
-		for(unsigned long i=0;i<_bc;++i)
-			_t[i] = (_Bucket *)0;
-		for(unsigned long i=0;i<_bc;++i) {
-			const _Bucket *b = ht._t[i];
-			while (b) {
-				_Bucket *nb = new _Bucket(*b);
-				nb->next = _t[i];
-				_t[i] = nb;
-				b = b->next;
+		if (ht._s) {
+			_alloc(ht._bc,ht._bits);
+			for(unsigned long i=0;i<_bc;++i) {
+				if ((ht._ctrl[i] & _CTRL_FULL) != 0) {
+					new (_t + i) _Slot(ht._t[i]);
+					_ctrl[i] = ht._ctrl[i];
+				} else if (ht._ctrl[i] == _CTRL_DELETED) {
+					_ctrl[i] = _CTRL_DELETED;
+				}
 			}
+			_s = ht._s;
+			_d = ht._d;
 		}
 	}
 
@@ -145,17 +171,18 @@ public:
 	{
 		this->clear();
 		::free(_t);
+		::free(_ctrl);
 	}
 
 	inline Hashtable &operator=(const Hashtable<K,V> &ht)
 	{
-		this->clear();
-		if (ht._s) {
-			for(unsigned long i=0;i<ht._bc;++i) {
-				const _Bucket *b = ht._t[i];
-				while (b) {
-					this->set(b->k,b->v);
-					b = b->next;
+		if (this != &ht) {
+			this->clear();
+			if (ht._s) {
+				reserve(ht._s);
+				for(unsigned long i=0;i<ht._bc;++i) {
+					if ((ht._ctrl[i] & _CTRL_FULL) != 0)
+						this->set(ht._t[i].k,ht._t[i].v);
 				}
 			}
 		}
@@ -167,20 +194,33 @@ public:
 	 */
 	inline void clear()
 	{
-		if (_s) {
+		if ((_s)||(_d)) {
 			for(unsigned long i=0;i<_bc;++i) {
-				_Bucket *b = _t[i];
-				while (b) {
-					_Bucket *const nb = b->next;
-					delete b;
-					b = nb;
-				}
-				_t[i] = (_Bucket *)0;
+				if ((_ctrl[i] & _CTRL_FULL) != 0)
+					_t[i].~_Slot();
 			}
+			memset(_ctrl,_CTRL_EMPTY,_bc);
 			_s = 0;
+			_d = 0;
 		}
 	}
 
+	/**
+	 * Make room for at least this many entries
+	 *
+	 * After this returns, inserting new keys until size() reaches n will not
+	 * move any existing entries.
+	 *
+	 * @param n Total number of entries to make room for
+	 */
+	inline void reserve(unsigned long n)
+	{
+		if (n < _s)
+			n = _s;
+		if ((n + _d) > _maxLoad(_bc))
+			_rebuild(_capacityFor(n));
+	}
+
 	/**
 	 * @return Vector of all keys
 	 */
@@ -190,11 +230,8 @@ public:
 		if (_s) {
 			k.reserve(_s);
 			for(unsigned long i=0;i<_bc;++i) {
-				_Bucket *b = _t[i];
-				while (b) {
-					k.push_back(b->k);
-					b = b->next;
-				}
+				if ((_ctrl[i] & _CTRL_FULL) != 0)
+					k.push_back(_t[i].k);
 			}
 		}
 		return k;
@@ -211,11 +248,8 @@ public:
 	{
 		if (_s) {
 			for(unsigned long i=0;i<_bc;++i) {
-				_Bucket *b = _t[i];
-				while (b) {
-					v.push_back(b->k);
-					b = b->next;
-				}
+				if ((_ctrl[i] & _CTRL_FULL) != 0)
+					v.push_back(_t[i].k);
 			}
 		}
 	}
@@ -229,11 +263,8 @@ public:
 		if (_s) {
 			k.reserve(_s);
 			for(unsigned long i=0;i<_bc;++i) {
-				_Bucket *b = _t[i];
-				while (b) {
-					k.push_back(std::pair<K,V>(b->k,b->v));
-					b = b->next;
-				}
+				if ((_ctrl[i] & _CTRL_FULL) != 0)
+					k.push_back(std::pair<K,V>(_t[i].k,_t[i].v));
 			}
 		}
 		return k;
@@ -245,13 +276,8 @@ public:
 	 */
 	inline V *get(const K &k)
 	{
-		_Bucket *b = _t[_hc(k) % _bc];
-		while (b) {
-			if (b->k == k)
-				return &(b->v);
-			b = b->next;
-		}
-		return (V *)0;
+		const unsigned long i = _find(k,_hash(k));
+		return (i < _bc) ? &(_t[i].v) : (V *)0;
 	}
 	inline const V *get(const K &k) const { return const_cast<Hashtable *>(this)->get(k); }
 
@@ -262,13 +288,10 @@ public:
 	 */
 	inline bool get(const K &k,V &v) const
 	{
-		_Bucket *b = _t[_hc(k) % _bc];
-		while (b) {
-			if (b->k == k) {
-				v = b->v;
-				return true;
-			}
-			b = b->next;
+		const unsigned long i = _find(k,_hash(k));
+		if (i < _bc) {
+			v = _t[i].v;
+			return true;
 		}
 		return false;
 	}
@@ -279,13 +302,7 @@ public:
 	 */
 	inline bool contains(const K &k) const
 	{
-		_Bucket *b = _t[_hc(k) % _bc];
-		while (b) {
-			if (b->k == k)
-				return true;
-			b = b->next;
-		}
-		return false;
+		return (_find(k,_hash(k)) < _bc);
 	}
 
 	/**
@@ -294,20 +311,26 @@ public:
 	 */
 	inline bool erase(const K &k)
 	{
-		const unsigned long bidx = _hc(k) % _bc;
-		_Bucket *lastb = (_Bucket *)0;
-		_Bucket *b = _t[bidx];
-		while (b) {
-			if (b->k == k) {
-				if (lastb)
-					lastb->next = b->next;
-				else _t[bidx] = b->next;
-				delete b;
-				--_s;
-				return true;
+		const unsigned long i = _find(k,_hash(k));
+		if (i < _bc) {
+			_t[i].~_Slot();
+			// A tombstone is only needed if a probe could continue past this slot
+			if (_ctrl[(i + 1) & (_bc - 1)] == _CTRL_EMPTY) {
+				_ctrl[i] = _CTRL_EMPTY;
+				unsigned long j = i;
+				for(;;) {
+					j = (j - 1) & (_bc - 1);
+					if (_ctrl[j] != _CTRL_DELETED)
+						break;
+					_ctrl[j] = _CTRL_EMPTY;
+					--_d;
+				}
+			} else {
+				_ctrl[i] = _CTRL_DELETED;
+				++_d;
 			}
-			lastb = b;
-			b = b->next;
+			--_s;
+			return true;
 		}
 		return false;
 	}
@@ -319,28 +342,15 @@ public:
 	 */
 	inline V &set(const K &k,const V &v)
 	{
-		const unsigned long h = _hc(k);
-		unsigned long bidx = h % _bc;
-
-		_Bucket *b = _t[bidx];
-		while (b) {
-			if (b->k == k) {
-				b->v = v;
-				return b->v;
-			}
-			b = b->next;
-		}
-
-		if (_s >= _bc) {
-			_grow();
-			bidx = h % _bc;
+		const uint64_t h = _hash(k);
+		const unsigned long i = _find(k,h);
+		if (i < _bc) {
+			_t[i].v = v;
+			return _t[i].v;
 		}
-
-		b = new _Bucket(k,v);
-		b->next = _t[bidx];
-		_t[bidx] = b;
-		++_s;
-		return b->v;
+		_Slot *const s = _insertSlot(h);
+		new (s) _Slot(k,v);
+		return s->v;
 	}
 
 	/**
@@ -349,26 +359,13 @@ public:
 	 */
 	inline V &operator[](const K &k)
 	{
-		const unsigned long h = _hc(k);
-		unsigned long bidx = h % _bc;
-
-		_Bucket *b = _t[bidx];
-		while (b) {
-			if (b->k == k)
-				return b->v;
-			b = b->next;
-		}
-
-		if (_s >= _bc) {
-			_grow();
-			bidx = h % _bc;
-		}
-
-		b = new _Bucket(k);
-		b->next = _t[bidx];
-		_t[bidx] = b;
-		++_s;
-		return b->v;
+		const uint64_t h = _hash(k);
+		const unsigned long i = _find(k,h);
+		if (i < _bc)
+			return _t[i].v;
+		_Slot *const s = _insertSlot(h);
+		new (s) _Slot(k);
+		return s->v;
 	}
 
 	/**
@@ -400,32 +397,116 @@ private:
 		return ((unsigned long)i * (unsigned long)0x9e3779b1);
 	}
 
-	inline void _grow()
+	// Fibonacci hashing spreads even weak hash codes over the high bits, which
+	// pick the slot; the control byte is taken from bits below those.
+	template<typename O>
+	static inline uint64_t _hash(const O &obj) { return ((uint64_t)_hc(obj) * 0x9e3779b97f4a7c15ULL); }
+	inline unsigned long _home(const uint64_t h) const { return (unsigned long)(h >> (64 - _bits)); }
+	static inline uint8_t _tag(const uint64_t h) { return (uint8_t)(_CTRL_FULL | ((unsigned int)(h >> 24) & 0x7f)); }
+
+	static inline unsigned long _maxLoad(const unsigned long bc) { return (bc - (bc >> 2)); } // 3/4
+	static inline unsigned long _capacityFor(const unsigned long n)
+	{
+		unsigned long bc = ZT_HASHTABLE_MIN_CAPACITY;
+		while (_maxLoad(bc) < n)
+			bc <<= 1;
+		return bc;
+	}
+
+	// Returns slot index of key or _bc if not found
+	inline unsigned long _find(const K &k,const uint64_t h) const
 	{
-		const unsigned long nc = _bc * 2;
-		_Bucket **nt = reinterpret_cast<_Bucket **>(::malloc(sizeof(_Bucket *) * nc));
-		if (nt) {
-			for(unsigned long i=0;i<nc;++i)
-				nt[i] = (_Bucket *)0;
-			for(unsigned long i=0;i<_bc;++i) {
-				_Bucket *b = _t[i];
-				while (b) {
-					_Bucket *const nb = b->next;
-					const unsigned long nidx = _hc(b->k) % nc;
-					b->next = nt[nidx];
-					nt[nidx] = b;
-					b = nb;
-				}
+		if (_s) {
+			const uint8_t tag = _tag(h);
+			unsigned long i = _home(h);
+			for(;;) {
+				const uint8_t c = _ctrl[i];
+				if ((c == tag)&&(_t[i].k == k))
+					return i;
+				if (c == _CTRL_EMPTY)
+					return _bc;
+				i = (i + 1) & (_bc - 1);
 			}
-			::free(_t);
-			_t = nt;
-			_bc = nc;
 		}
+		return _bc;
+	}
+
+	// Claims a free slot for a key known not to be present; caller must construct into it
+	inline _Slot *_insertSlot(const uint64_t h)
+	{
+		if ((_s + _d + 1) > _maxLoad(_bc))
+			_rebuild(_capacityFor((_s + 1) + ((_s + 1) >> 1))); // leave headroom so alternating insert/erase doesn't rebuild constantly
+		unsigned long i = _home(h);
+		for(;;) {
+			const uint8_t c = _ctrl[i];
+			if (c == _CTRL_DELETED) {
+				--_d;
+				break;
+			}
+			if (c == _CTRL_EMPTY)
+				break;
+			i = (i + 1) & (_bc - 1);
+		}
+		_ctrl[i] = _tag(h);
+		++_s;
+		return (_t + i);
+	}
+
+	inline void _alloc(const unsigned long bc,const unsigned int bits)
+	{
+		_Slot *const t = reinterpret_cast<_Slot *>(::malloc(sizeof(_Slot) * bc));
+		uint8_t *const ctrl = reinterpret_cast<uint8_t *>(::malloc(bc));
+		if ((!t)||(!ctrl)) {
+			::free(t);
+			::free(ctrl);
+			throw ZT_EXCEPTION_OUT_OF_MEMORY;
+		}
+		memset(ctrl,_CTRL_EMPTY,bc);
+		_t = t;
+		_ctrl = ctrl;
+		_bc = bc;
+		_bits = bits;
+	}
+
+	// Moves all entries into a new table of nc (power of two) slots, dropping tombstones
+	inline void _rebuild(const unsigned long nc)
+	{
+		unsigned int nbits = 0;
+		while ((1UL << nbits) < nc)
+			++nbits;
+
+		_Slot *const ot = _t;
+		uint8_t *const octrl = _ctrl;
+		const unsigned long obc = _bc;
+		_alloc(nc,nbits);
+
+		for(unsigned long i=0;i<obc;++i) {
+			if ((octrl[i] & _CTRL_FULL) != 0) {
+				const uint64_t h = _hash(ot[i].k);
+				unsigned long j = _home(h);
+				while (_ctrl[j] != _CTRL_EMPTY)
+					j = (j + 1) & (_bc - 1);
+#if __cplusplus >= 201103L
+				new (_t + j) _Slot(std::move(ot[i]));
+#else
+				new (_t + j) _Slot(ot[i]);
+#endif
+				_ctrl[j] = _tag(h);
+				ot[i].~_Slot();
+			}
+		}
+		_d = 0;
+
+		::free(ot);
+		::free(octrl);
 	}
 
-	_Bucket **_t;
+	_Slot *_t;
+	uint8_t *_ctrl;
 	unsigned long _bc;
+	unsigned int _bits;
 	unsigned long _s;
+	unsigned long _d;
 };
 
 } // namespace ZeroTier
@@ -179,6 +179,22 @@ public:
 		return C25519::verify(_publicKey,data,len,signature);
 	}
 
+	/**
+	 * Verify a message signature against this identity, possibly as part of a batch
+	 *
+	 * @param data Data to check
+	 * @param len Length of data
+	 * @param signature Signature
+	 * @param batch Batch to queue in or get the result from, or NULL to verify now
+	 * @return True if signature validates and data integrity checks (see C25519::VerifyBatch::verify())
+	 */
+	inline bool verify(const void *data,unsigned int len,const C25519::Signature &signature,C25519::VerifyBatch *batch) const
+	{
+		if (batch)
+			return batch->verify(_publicKey,data,len,signature.data);
+		return C25519::verify(_publicKey,data,len,signature);
+	}
+
 	/**
 	 * Shortcut method to perform key agreement with another identity
 	 *
@@ -0,0 +1,324 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Constants.hpp"
+#include "IdentityValidator.hpp"
+#include "RuntimeEnvironment.hpp"
+#include "IncomingPacket.hpp"
+#include "Node.hpp"
+#include "Peer.hpp"
+#include "Path.hpp"
+#include "SHA512.hpp"
+#include "Utils.hpp"
+
+#include "../osdep/Thread.hpp"
+
+namespace ZeroTier {
+
+struct IdentityValidator::_Worker
+{
+	_Worker(IdentityValidator *p) : parent(p),done(false) {}
+	IdentityValidator *const parent;
+	Thread thread;
+	bool done; // set under parent's lock just before thread exits
+	inline void threadMain() throw() { parent->_work(this); }
+};
+
+IdentityValidator::IdentityValidator(const RuntimeEnvironment *renv,void *tPtr) :
+	RR(renv),
+	_hasCompleted(false),
+	_running(0),
+	_run(true),
+	_cacheNext(0),
+	_cacheDirty(false),
+	_lastCacheSave(0),
+	_validated(0),
+	_cacheHits(0),
+	_failed(0)
+{
+	const unsigned int maxlen = 1 + (ZT_IDENTITY_VALIDATOR_CACHE_SIZE * 16);
+	uint8_t *const buf = reinterpret_cast<uint8_t *>(::malloc(maxlen));
+	if (buf) {
+		uint64_t idtmp[2]; idtmp[0] = RR->identity.address().toInt(); idtmp[1] = 0;
+		const int len = RR->node->stateObjectGet(tPtr,ZT_STATE_OBJECT_IDENTITY_CACHE,idtmp,buf,maxlen);
+		if ((len > 1)&&(buf[0] == 1)) {
+			Mutex::Lock _l(_lock);
+			for(int p=1;(p+16)<=len;p+=16) {
+				uint64_t h[2];
+				memcpy(h,buf + p,16);
+				h[0] = Utils::ntoh(h[0]);
+				h[1] = Utils::ntoh(h[1]);
+				_cacheAdd(h);
+			}
+			_cacheDirty = false;
+		}
+		::free(buf);
+	}
+}
+
+IdentityValidator::~IdentityValidator()
+{
+	std::vector< _Worker * > workers;
+	{
+		Mutex::Lock _l(_lock);
+		_run = false;
+		workers = _workers;
+		_workers.clear();
+	}
+	for(std::vector< _Worker * >::iterator w(workers.begin());w!=workers.end();++w) {
+		Thread::join((*w)->thread);
+		delete *w;
+	}
+	for(std::list< _Job * >::iterator j(_queue.begin());j!=_queue.end();++j)
+		delete *j;
+	// The cache is not saved here since there's no thread pointer to hand to the state store
+}
+
+bool IdentityValidator::validate(const Identity &id,const IncomingPacket &hello,const SharedPtr<Path> &path)
+{
+	_Job *const j = new _Job();
+	j->id = id;
+	_hash(id,j->hash);
+	j->path = path;
+	j->packetId = hello.packetId();
+	j->hops = hello.hops();
+	j->packet.assign(reinterpret_cast<const uint8_t *>(hello.data()),reinterpret_cast<const uint8_t *>(hello.data()) + hello.size());
+
+	Mutex::Lock _l(_lock);
+	const _Pending *const p = _pending.get(j->hash[0]);
+	if ((p)&&(p->hash == j->hash[1])) {
+		delete j;
+		return true;
+	}
+	if ((p)||(_pending.size() >= ZT_IDENTITY_VALIDATOR_QUEUE_SIZE)||(!_run)) {
+		delete j;
+		return false;
+	}
+	_Pending &np = _pending[j->hash[0]];
+	np.hash = j->hash[1];
+	np.packetId = j->packetId;
+	_queue.push_back(j);
+	if (_running < ZT_IDENTITY_VALIDATOR_MAX_THREADS)
+		_startWorker();
+	return true;
+}
+
+bool IdentityValidator::pending(const Identity &id,uint64_t &packetId)
+{
+	uint64_t h[2];
+	_hash(id,h);
+	Mutex::Lock _l(_lock);
+	const _Pending *const p = _pending.get(h[0]);
+	if ((p)&&(p->hash == h[1])) {
+		packetId = p->packetId;
+		return true;
+	}
+	return false;
+}
+
+void IdentityValidator::completed(std::vector<Completed> &c)
+{
+	Mutex::Lock _l(_lock);
+	for(std::vector<Completed>::iterator i(_completed.begin());i!=_completed.end();++i) {
+		if (i->peer) {
+			uint64_t h[2];
+			_hash(i->peer->identity(),h);
+			_pending.erase(h[0]);
+		}
+		c.push_back(*i);
+	}
+	_completed.clear();
+	_hasCompleted = false;
+}
+
+void IdentityValidator::doTimerTasks(void *tPtr,int64_t now)
+{
+	bool save = false;
+	{
+		Mutex::Lock _l(_lock);
+		if ((_running == 0)&&(!_queue.empty()))
+			_startWorker(); // only happens if starting a thread failed earlier
+		if ((_cacheDirty)&&((now - _lastCacheSave) >= ZT_IDENTITY_VALIDATOR_CACHE_SAVE_INTERVAL)) {
+			_lastCacheSave = now;
+			save = true;
+		}
+	}
+	if (save)
+		_cacheSave(tPtr);
+}
+
+void IdentityValidator::counters(uint64_t &validated,uint64_t &cacheHits,uint64_t &failed)
+{
+	Mutex::Lock _l(_lock);
+	validated = _validated;
+	cacheHits = _cacheHits;
+	failed = _failed;
+}
+
+void IdentityValidator::_hash(const Identity &id,uint64_t h[2])
+{
+	uint8_t tmp[ZT_ADDRESS_LENGTH + ZT_C25519_PUBLIC_KEY_LEN];
+	uint64_t digest[8];
+	id.address().copyTo(tmp,ZT_ADDRESS_LENGTH);
+	memcpy(tmp + ZT_ADDRESS_LENGTH,id.publicKey().data,ZT_C25519_PUBLIC_KEY_LEN);
+	SHA512::hash(digest,tmp,sizeof(tmp));
+	h[0] = digest[0];
+	h[1] = digest[1];
+}
+
+void IdentityValidator::_work(_Worker *w)
+{
+	for(;;) {
+		_Job *j;
+		{
+			Mutex::Lock _l(_lock);
+			if ((!_run)||(_queue.empty())) {
+				w->done = true;
+				--_running;
+				return;
+			}
+			j = _queue.front();
+			_queue.pop_front();
+		}
+
+		Completed c;
+		c.source = j->id.address();
+		c.path = j->path;
+		c.packetId = j->packetId;
+		c.hops = j->hops;
+		c.result = RESULT_INVALID_IDENTITY;
+		try {
+			c.peer.set(new Peer(RR,RR->identity,j->id)); // does key agreement, throws if it fails
+			Packet *const p = new Packet(j->packet.data(),(unsigned int)j->packet.size());
+			const bool macOk = p->dearmor(c.peer->key()); // checking the MAC is cheaper so it filters out junk first
+			delete p;
+			if (!macOk) {
+				c.result = RESULT_INVALID_MAC;
+			} else {
+				bool cached;
+				{
+					Mutex::Lock _l(_lock);
+					cached = _cacheContains(j->hash);
+				}
+				if ((cached)||(j->id.locallyValidate())) {
+					c.result = RESULT_VALID;
+					Mutex::Lock _l(_lock);
+					if (cached)
+						++_cacheHits;
+					else _cacheAdd(j->hash);
+				}
+			}
+		} catch ( ... ) {
+			c.peer.zero();
+		}
+
+		{
+			Mutex::Lock _l(_lock);
+			if (c.result == RESULT_VALID)
+				++_validated;
+			else ++_failed;
+			if (!c.peer)
+				_pending.erase(j->hash[0]); // can't be found again in completed() without a peer
+			_completed.push_back(c);
+			_hasCompleted = true;
+		}
+		delete j;
+	}
+}
+
+void IdentityValidator::_startWorker()
+{
+	// Reap workers that have exited, which only takes as long as their return
+	for(std::vector< _Worker * >::iterator w(_workers.begin());w!=_workers.end();) {
+		if ((*w)->done) {
+			Thread::join((*w)->thread);
+			delete *w;
+			w = _workers.erase(w);
+		} else ++w;
+	}
+
+	_Worker *const w = new _Worker(this);
+	try {
+		++_running;
+		w->thread = Thread::start(w);
+		_workers.push_back(w);
+	} catch ( ... ) {
+		--_running;
+		delete w;
+	}
+}
+
+bool IdentityValidator::_cacheContains(const uint64_t h[2])
+{
+	const uint64_t *const c = _cache.get(h[0]);
+	return ((c)&&(*c == h[1]));
+}
+
+void IdentityValidator::_cacheAdd(const uint64_t h[2])
+{
+	if (_cacheContains(h))
+		return;
+	if (_cacheOrder.size() < ZT_IDENTITY_VALIDATOR_CACHE_SIZE) {
+		_cacheOrder.push_back(std::pair<uint64_t,uint64_t>(h[0],h[1]));
+	} else {
+		std::pair<uint64_t,uint64_t> &oldest = _cacheOrder[_cacheNext];
+		const uint64_t *const c = _cache.get(oldest.first);
+		if ((c)&&(*c == oldest.second))
+			_cache.erase(oldest.first);
+		oldest.first = h[0];
+		oldest.second = h[1];
+		_cacheNext = (_cacheNext + 1) % ZT_IDENTITY_VALIDATOR_CACHE_SIZE;
+	}
+	_cache.set(h[0],h[1]);
+	_cacheDirty = true;
+}
+
+void IdentityValidator::_cacheSave(void *tPtr)
+{
+	std::vector<uint8_t> buf;
+	{
+		Mutex::Lock _l(_lock);
+		// Oldest first so eviction order survives a reload
+		buf.resize(1 + (_cacheOrder.size() * 16));
+		buf[0] = 1;
+		uint8_t *p = buf.data() + 1;
+		for(unsigned long i=0;i<_cacheOrder.size();++i) {
+			const std::pair<uint64_t,uint64_t> &e = _cacheOrder[(_cacheNext + i) % _cacheOrder.size()];
+			const uint64_t h[2] = { Utils::hton(e.first),Utils::hton(e.second) };
+			memcpy(p,h,16);
+			p += 16;
+		}
+		_cacheDirty = false;
+	}
+	uint64_t idtmp[2]; idtmp[0] = RR->identity.address().toInt(); idtmp[1] = 0;
+	RR->node->stateObjectPut(tPtr,ZT_STATE_OBJECT_IDENTITY_CACHE,idtmp,buf.data(),(unsigned int)buf.size());
+}
+
+} // namespace ZeroTier
@@ -0,0 +1,200 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_IDENTITYVALIDATOR_HPP
+#define ZT_IDENTITYVALIDATOR_HPP
+
+#include <stdint.h>
+
+#include <list>
+#include <vector>
+
+#include "Constants.hpp"
+#include "Identity.hpp"
+#include "Address.hpp"
+#include "SharedPtr.hpp"
+#include "Hashtable.hpp"
+#include "Mutex.hpp"
+
+namespace ZeroTier {
+
+class RuntimeEnvironment;
+class IncomingPacket;
+class Peer;
+class Path;
+
+/**
+ * Validates the identities of new peers and agrees on keys with them in the background
+ *
+ * Checking that an identity's address was derived from its public key is
+ * deliberately expensive, and key agreement isn't cheap either. When many
+ * unknown peers say HELLO at once, e.g. when everyone reconnects after a
+ * root restarts, doing these inline would stall packet processing. Instead
+ * HELLOs from unknown peers are queued here and handled by a small number
+ * of threads that exist only while there is work. The HELLOs themselves
+ * wait in the Switch's receive queue, and Switch::doIdentityValidations()
+ * picks up finished validations, adds the new peers, and decodes them.
+ *
+ * Identities that pass are remembered by hash so a peer seen before only
+ * costs a key agreement. This cache is saved with other node state as a
+ * ZT_STATE_OBJECT_IDENTITY_CACHE object and loaded on startup. It is only
+ * saved from doTimerTasks(), at most every
+ * ZT_IDENTITY_VALIDATOR_CACHE_SAVE_INTERVAL, so identities validated since
+ * the last save are forgotten when the node is deleted.
+ */
+class IdentityValidator
+{
+public:
+	enum Result
+	{
+		RESULT_VALID = 0,
+		RESULT_INVALID_IDENTITY = 1,
+		RESULT_INVALID_MAC = 2
+	};
+
+	/**
+	 * A finished validation
+	 */
+	struct Completed
+	{
+		SharedPtr<Peer> peer; // new peer (not yet added to topology) or NULL if key agreement failed
+		Address source;
+		SharedPtr<Path> path;
+		uint64_t packetId;
+		unsigned int hops;
+		Result result;
+	};
+
+	/**
+	 * @param renv Runtime environment
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 */
+	IdentityValidator(const RuntimeEnvironment *renv,void *tPtr);
+
+	~IdentityValidator();
+
+	/**
+	 * Queue a HELLO from an unknown peer for validation
+	 *
+	 * The HELLO's MAC is checked against a copy of the packet before the
+	 * identity itself, so the caller should keep the packet for decoding
+	 * once the peer is known.
+	 *
+	 * @param id Identity from HELLO
+	 * @param hello HELLO packet, not yet dearmored
+	 * @param path Path HELLO arrived on
+	 * @return True if queued or if the same identity is already queued, false if ZT_IDENTITY_VALIDATOR_QUEUE_SIZE validations are already pending
+	 */
+	bool validate(const Identity &id,const IncomingPacket &hello,const SharedPtr<Path> &path);
+
+	/**
+	 * @param id Identity to check
+	 * @param packetId Set to the packet ID of the HELLO being validated for this identity
+	 * @return True if this identity is already waiting for validation
+	 */
+	bool pending(const Identity &id,uint64_t &packetId);
+
+	/**
+	 * @return True if there may be finished validations to pick up
+	 */
+	inline bool hasCompleted() const { return _hasCompleted; }
+
+	/**
+	 * Get and remove finished validations
+	 *
+	 * @param c Vector to fill
+	 */
+	void completed(std::vector<Completed> &c);
+
+	/**
+	 * Save the validated identity cache if it has changed and restart stalled work
+	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param now Current time
+	 */
+	void doTimerTasks(void *tPtr,int64_t now);
+
+	/**
+	 * Get validation counters
+	 *
+	 * @param validated Set to number of identities that passed validation including cache hits
+	 * @param cacheHits Set to number of identities that passed because they were cached
+	 * @param failed Set to number of HELLOs rejected for an invalid identity or MAC
+	 */
+	void counters(uint64_t &validated,uint64_t &cacheHits,uint64_t &failed);
+
+private:
+	struct _Job
+	{
+		Identity id;
+		uint64_t hash[2];
+		SharedPtr<Path> path;
+		uint64_t packetId;
+		unsigned int hops;
+		std::vector<uint8_t> packet;
+	};
+	struct _Pending
+	{
+		uint64_t hash; // second half of identity hash
+		uint64_t packetId;
+	};
+	struct _Worker;
+
+	static void _hash(const Identity &id,uint64_t h[2]);
+	void _work(_Worker *w);
+	void _startWorker(); // assumes _lock is locked
+	bool _cacheContains(const uint64_t h[2]); // assumes _lock is locked
+	void _cacheAdd(const uint64_t h[2]); // assumes _lock is locked
+	void _cacheSave(void *tPtr);
+
+	const RuntimeEnvironment *const RR;
+
+	std::list< _Job * > _queue;
+	Hashtable< uint64_t,_Pending > _pending; // first half of hashes of queued identities -> rest
+	std::vector< Completed > _completed;
+	volatile bool _hasCompleted;
+
+	std::vector< _Worker * > _workers;
+	unsigned int _running;
+	bool _run;
+
+	// Validated identity hashes, first half to second, and the order they were added in for eviction
+	Hashtable< uint64_t,uint64_t > _cache;
+	std::vector< std::pair<uint64_t,uint64_t> > _cacheOrder;
+	unsigned long _cacheNext;
+	bool _cacheDirty;
+	int64_t _lastCacheSave;
+
+	uint64_t _validated;
+	uint64_t _cacheHits;
+	uint64_t _failed;
+
+	Mutex _lock;
+};
+
+} // namespace ZeroTier
+
+#endif
@@ -48,6 +48,7 @@
 #include "Tag.hpp"
 #include "Revocation.hpp"
 #include "Trace.hpp"
+#include "IdentityValidator.hpp"
 
 namespace ZeroTier {
 
@@ -271,12 +272,31 @@ bool IncomingPacket::_doHELLO(const RuntimeEnvironment *RR,void *tPtr,const bool
 			return true;
 		}
 
+		// A HELLO from this identity is already being validated and will be answered. If this
+		// is that HELLO keep waiting in the RX queue, otherwise don't hold another entry there.
+		uint64_t validatingPacketId = 0;
+		if ((RR->iv)&&(RR->iv->pending(id,validatingPacketId))) {
+			if (validatingPacketId == pid)
+				return false;
+			RR->t->incomingPacketDroppedHELLO(tPtr,_path,pid,fromAddress,"identity validation already pending");
+			return true;
+		}
+
 		// Check rate limits
 		if (!RR->node->rateGateIdentityVerification(now,_path->address())) {
 			RR->t->incomingPacketDroppedHELLO(tPtr,_path,pid,fromAddress,"rate limit exceeded");
 			return true;
 		}
 
+		// Validate in the background and wait in the RX queue (see Switch::doIdentityValidations)
+		if (RR->iv) {
+			if (!RR->iv->validate(id,*this,_path)) {
+				RR->t->incomingPacketDroppedHELLO(tPtr,_path,pid,fromAddress,"identity validation queue full");
+				return true;
+			}
+			return false;
+		}
+
 		// Check packet integrity and MAC (this is faster than locallyValidate() so do it first to filter out total crap)
 		SharedPtr<Peer> newPeer(new Peer(RR,RR->identity,id));
 		if (!dearmor(newPeer->key())) {
@@ -756,113 +776,169 @@ bool IncomingPacket::_doNETWORK_CREDENTIALS(const RuntimeEnvironment *RR,void *t
 	Revocation revocation;
 	CertificateOfOwnership coo;
 	bool trustEstablished = false;
+	bool truncated = false;
 	SharedPtr<Network> network;
 
-	unsigned int p = ZT_PACKET_IDX_PAYLOAD;
-	while ((p < size())&&((*this)[p] != 0)) {
-		p += com.deserialize(*this,p);
-		if (com) {
-			network = RR->node->network(com.networkId());
-			if (network) {
-				switch (network->addCredential(tPtr,com)) {
-					case Membership::ADD_REJECTED:
-						break;
-					case Membership::ADD_ACCEPTED_NEW:
-					case Membership::ADD_ACCEPTED_REDUNDANT:
-						trustEstablished = true;
-						break;
-					case Membership::ADD_DEFERRED_FOR_WHOIS:
-						return false;
+	// The first pass queues the signatures of credentials that pass all other
+	// checks in a batch. If any were queued the batch is run and the second
+	// pass adds only those deferred credentials using its results.
+	C25519::VerifyBatch batch;
+	std::vector<bool> deferred;
+	for(unsigned int pass=0;pass<2;++pass) {
+		if (pass == 1) {
+			if (batch.size() == 0)
+				break;
+			batch.run();
+		}
+		unsigned int credIdx = 0;
+
+		unsigned int p = ZT_PACKET_IDX_PAYLOAD;
+		while ((p < size())&&((*this)[p] != 0)) {
+			p += com.deserialize(*this,p);
+			const unsigned int ci = credIdx++;
+			if (pass == 0)
+				deferred.push_back(false);
+			if (com) {
+				network = RR->node->network(com.networkId());
+				if ((network)&&((pass == 0)||(deferred[ci]))) {
+					switch (network->addCredential(tPtr,com,&batch)) {
+						case Membership::ADD_REJECTED:
+							break;
+						case Membership::ADD_DEFERRED_FOR_BATCH:
+							deferred[ci] = true;
+							break;
+						case Membership::ADD_ACCEPTED_NEW:
+						case Membership::ADD_ACCEPTED_REDUNDANT:
+							trustEstablished = true;
+							break;
+						case Membership::ADD_DEFERRED_FOR_WHOIS:
+							return false;
+					}
+				} else if (pass == 0) {
+					RR->mc->addCredential(tPtr,com,false);
 				}
-			} else RR->mc->addCredential(tPtr,com,false);
+			}
 		}
-	}
-	++p; // skip trailing 0 after COMs if present
-
-	if (p < size()) { // older ZeroTier versions do not send capabilities, tags, or revocations
-		const unsigned int numCapabilities = at<uint16_t>(p); p += 2;
-		for(unsigned int i=0;i<numCapabilities;++i) {
-			p += cap.deserialize(*this,p);
-			if ((!network)||(network->id() != cap.networkId()))
-				network = RR->node->network(cap.networkId());
-			if (network) {
-				switch (network->addCredential(tPtr,cap)) {
-					case Membership::ADD_REJECTED:
-						break;
-					case Membership::ADD_ACCEPTED_NEW:
-					case Membership::ADD_ACCEPTED_REDUNDANT:
-						trustEstablished = true;
-						break;
-					case Membership::ADD_DEFERRED_FOR_WHOIS:
-						return false;
+		++p; // skip trailing 0 after COMs if present
+
+		// older ZeroTier versions do not send capabilities, tags, or revocations
+		if (p < size()) {
+			const unsigned int numCapabilities = at<uint16_t>(p); p += 2;
+			for(unsigned int i=0;i<numCapabilities;++i) {
+				p += cap.deserialize(*this,p);
+				const unsigned int ci = credIdx++;
+				if (pass == 0)
+					deferred.push_back(false);
+				if ((!network)||(network->id() != cap.networkId()))
+					network = RR->node->network(cap.networkId());
+				if ((network)&&((pass == 0)||(deferred[ci]))) {
+					switch (network->addCredential(tPtr,cap,&batch)) {
+						case Membership::ADD_REJECTED:
+							break;
+						case Membership::ADD_DEFERRED_FOR_BATCH:
+							deferred[ci] = true;
+							break;
+						case Membership::ADD_ACCEPTED_NEW:
+						case Membership::ADD_ACCEPTED_REDUNDANT:
+							trustEstablished = true;
+							break;
+						case Membership::ADD_DEFERRED_FOR_WHOIS:
+							return false;
+					}
 				}
 			}
+			truncated = (p >= size());
 		}
 
-		if (p >= size()) return true;
-
-		const unsigned int numTags = at<uint16_t>(p); p += 2;
-		for(unsigned int i=0;i<numTags;++i) {
-			p += tag.deserialize(*this,p);
-			if ((!network)||(network->id() != tag.networkId()))
-				network = RR->node->network(tag.networkId());
-			if (network) {
-				switch (network->addCredential(tPtr,tag)) {
-					case Membership::ADD_REJECTED:
-						break;
-					case Membership::ADD_ACCEPTED_NEW:
-					case Membership::ADD_ACCEPTED_REDUNDANT:
-						trustEstablished = true;
-						break;
-					case Membership::ADD_DEFERRED_FOR_WHOIS:
-						return false;
+		if (p < size()) {
+			const unsigned int numTags = at<uint16_t>(p); p += 2;
+			for(unsigned int i=0;i<numTags;++i) {
+				p += tag.deserialize(*this,p);
+				const unsigned int ci = credIdx++;
+				if (pass == 0)
+					deferred.push_back(false);
+				if ((!network)||(network->id() != tag.networkId()))
+					network = RR->node->network(tag.networkId());
+				if ((network)&&((pass == 0)||(deferred[ci]))) {
+					switch (network->addCredential(tPtr,tag,&batch)) {
+						case Membership::ADD_REJECTED:
+							break;
+						case Membership::ADD_DEFERRED_FOR_BATCH:
+							deferred[ci] = true;
+							break;
+						case Membership::ADD_ACCEPTED_NEW:
+						case Membership::ADD_ACCEPTED_REDUNDANT:
+							trustEstablished = true;
+							break;
+						case Membership::ADD_DEFERRED_FOR_WHOIS:
+							return false;
+					}
 				}
 			}
+			truncated = (p >= size());
 		}
 
-		if (p >= size()) return true;
-
-		const unsigned int numRevocations = at<uint16_t>(p); p += 2;
-		for(unsigned int i=0;i<numRevocations;++i) {
-			p += revocation.deserialize(*this,p);
-			if ((!network)||(network->id() != revocation.networkId()))
-				network = RR->node->network(revocation.networkId());
-			if (network) {
-				switch(network->addCredential(tPtr,peer->address(),revocation)) {
-					case Membership::ADD_REJECTED:
-						break;
-					case Membership::ADD_ACCEPTED_NEW:
-					case Membership::ADD_ACCEPTED_REDUNDANT:
-						trustEstablished = true;
-						break;
-					case Membership::ADD_DEFERRED_FOR_WHOIS:
-						return false;
+		if (p < size()) {
+			const unsigned int numRevocations = at<uint16_t>(p); p += 2;
+			for(unsigned int i=0;i<numRevocations;++i) {
+				p += revocation.deserialize(*this,p);
+				const unsigned int ci = credIdx++;
+				if (pass == 0)
+					deferred.push_back(false);
+				if ((!network)||(network->id() != revocation.networkId()))
+					network = RR->node->network(revocation.networkId());
+				if ((network)&&((pass == 0)||(deferred[ci]))) {
+					switch(network->addCredential(tPtr,peer->address(),revocation,&batch)) {
+						case Membership::ADD_REJECTED:
+							break;
+						case Membership::ADD_DEFERRED_FOR_BATCH:
+							deferred[ci] = true;
+							break;
+						case Membership::ADD_ACCEPTED_NEW:
+						case Membership::ADD_ACCEPTED_REDUNDANT:
+							trustEstablished = true;
+							break;
+						case Membership::ADD_DEFERRED_FOR_WHOIS:
+							return false;
+					}
 				}
 			}
+			truncated = (p >= size());
 		}
 
-		if (p >= size()) return true;
-
-		const unsigned int numCoos = at<uint16_t>(p); p += 2;
-		for(unsigned int i=0;i<numCoos;++i) {
-			p += coo.deserialize(*this,p);
-			if ((!network)||(network->id() != coo.networkId()))
-				network = RR->node->network(coo.networkId());
-			if (network) {
-				switch(network->addCredential(tPtr,coo)) {
-					case Membership::ADD_REJECTED:
-						break;
-					case Membership::ADD_ACCEPTED_NEW:
-					case Membership::ADD_ACCEPTED_REDUNDANT:
-						trustEstablished = true;
-						break;
-					case Membership::ADD_DEFERRED_FOR_WHOIS:
-						return false;
+		if (p < size()) {
+			const unsigned int numCoos = at<uint16_t>(p); p += 2;
+			for(unsigned int i=0;i<numCoos;++i) {
+				p += coo.deserialize(*this,p);
+				const unsigned int ci = credIdx++;
+				if (pass == 0)
+					deferred.push_back(false);
+				if ((!network)||(network->id() != coo.networkId()))
+					network = RR->node->network(coo.networkId());
+				if ((network)&&((pass == 0)||(deferred[ci]))) {
+					switch(network->addCredential(tPtr,coo,&batch)) {
+						case Membership::ADD_REJECTED:
+							break;
+						case Membership::ADD_DEFERRED_FOR_BATCH:
+							deferred[ci] = true;
+							break;
+						case Membership::ADD_ACCEPTED_NEW:
+						case Membership::ADD_ACCEPTED_REDUNDANT:
+							trustEstablished = true;
+							break;
+						case Membership::ADD_DEFERRED_FOR_WHOIS:
+							return false;
+					}
 				}
 			}
 		}
 	}
 
+	// A packet that ends right after its capabilities, tags or revocations is
+	// truncated, so its credentials are used but it isn't counted as received
+	if (truncated)
+		return true;
+
 	peer->received(tPtr,_path,hops(),packetId(),Packet::VERB_NETWORK_CREDENTIALS,0,Packet::VERB_NOP,trustEstablished,(network) ? network->id() : 0);
 
 	return true;
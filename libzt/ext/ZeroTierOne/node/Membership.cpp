@@ -125,7 +125,7 @@ void Membership::pushCredentials(const RuntimeEnvironment *RR,void *tPtr,const i
 	}
 }
 
-Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const CertificateOfMembership &com)
+Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const CertificateOfMembership &com,C25519::VerifyBatch *batch)
 {
 	const int64_t newts = com.timestamp();
 	if (newts <= _comRevocationThreshold) {
@@ -141,11 +141,13 @@ Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironme
 	if ((newts == oldts)&&(_com == com))
 		return ADD_ACCEPTED_REDUNDANT;
 
-	switch(com.verify(RR,tPtr)) {
+	switch(com.verify(RR,tPtr,batch)) {
 		default:
 			RR->t->credentialRejected(tPtr,com,"invalid");
 			return ADD_REJECTED;
 		case 0:
+			if ((batch)&&(!batch->done()))
+				return ADD_DEFERRED_FOR_BATCH;
 			_com = com;
 			return ADD_ACCEPTED_NEW;
 		case 1:
@@ -155,7 +157,7 @@ Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironme
 
 // Template out addCredential() for many cred types to avoid copypasta
 template<typename C>
-static Membership::AddCredentialResult _addCredImpl(Hashtable<uint32_t,C> &remoteCreds,const Hashtable<uint64_t,int64_t> &revocations,const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const C &cred)
+static Membership::AddCredentialResult _addCredImpl(Hashtable<uint32_t,C> &remoteCreds,const Hashtable<uint64_t,int64_t> &revocations,const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const C &cred,C25519::VerifyBatch *batch)
 {
 	C *rc = remoteCreds.get(cred.id());
 	if (rc) {
@@ -173,11 +175,13 @@ static Membership::AddCredentialResult _addCredImpl(Hashtable<uint32_t,C> &remot
 		return Membership::ADD_REJECTED;
 	}
 
-	switch(cred.verify(RR,tPtr)) {
+	switch(cred.verify(RR,tPtr,batch)) {
 		default:
 			RR->t->credentialRejected(tPtr,cred,"invalid");
 			return Membership::ADD_REJECTED;
 		case 0:
+			if ((batch)&&(!batch->done()))
+				return Membership::ADD_DEFERRED_FOR_BATCH;
 			if (!rc)
 				rc = &(remoteCreds[cred.id()]);
 			*rc = cred;
@@ -187,18 +191,20 @@ static Membership::AddCredentialResult _addCredImpl(Hashtable<uint32_t,C> &remot
 	}
 }
 
-Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const Tag &tag) { return _addCredImpl<Tag>(_remoteTags,_revocations,RR,tPtr,nconf,tag); }
-Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const Capability &cap) { return _addCredImpl<Capability>(_remoteCaps,_revocations,RR,tPtr,nconf,cap); }
-Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const CertificateOfOwnership &coo) { return _addCredImpl<CertificateOfOwnership>(_remoteCoos,_revocations,RR,tPtr,nconf,coo); }
+Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const Tag &tag,C25519::VerifyBatch *batch) { return _addCredImpl<Tag>(_remoteTags,_revocations,RR,tPtr,nconf,tag,batch); }
+Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const Capability &cap,C25519::VerifyBatch *batch) { return _addCredImpl<Capability>(_remoteCaps,_revocations,RR,tPtr,nconf,cap,batch); }
+Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const CertificateOfOwnership &coo,C25519::VerifyBatch *batch) { return _addCredImpl<CertificateOfOwnership>(_remoteCoos,_revocations,RR,tPtr,nconf,coo,batch); }
 
-Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const Revocation &rev)
+Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const Revocation &rev,C25519::VerifyBatch *batch)
 {
 	int64_t *rt;
-	switch(rev.verify(RR,tPtr)) {
+	switch(rev.verify(RR,tPtr,batch)) {
 		default:
 			RR->t->credentialRejected(tPtr,rev,"invalid");
 			return ADD_REJECTED;
 		case 0: {
+			if ((batch)&&(!batch->done()))
+				return ADD_DEFERRED_FOR_BATCH;
 			const Credential::Type ct = rev.type();
 			switch(ct) {
 				case Credential::CREDENTIAL_TYPE_COM:
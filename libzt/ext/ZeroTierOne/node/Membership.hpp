@@ -61,7 +61,8 @@ public:
 		ADD_REJECTED,
 		ADD_ACCEPTED_NEW,
 		ADD_ACCEPTED_REDUNDANT,
-		ADD_DEFERRED_FOR_WHOIS
+		ADD_DEFERRED_FOR_WHOIS,
+		ADD_DEFERRED_FOR_BATCH
 	};
 
 	Membership();
@@ -151,28 +152,33 @@ public:
 
 	/**
 	 * Validate and add a credential if signature is okay and it's otherwise good
+	 *
+	 * If batch is non-NULL and has not been run, a credential that passes all
+	 * other checks has its signature queued in the batch and is not added yet;
+	 * this returns ADD_DEFERRED_FOR_BATCH and the credential should be added
+	 * again with the same batch after it is run.
 	 */
-	AddCredentialResult addCredential(const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const CertificateOfMembership &com);
+	AddCredentialResult addCredential(const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const CertificateOfMembership &com,C25519::VerifyBatch *batch = (C25519::VerifyBatch *)0);
 
 	/**
 	 * Validate and add a credential if signature is okay and it's otherwise good
 	 */
-	AddCredentialResult addCredential(const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const Tag &tag);
+	AddCredentialResult addCredential(const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const Tag &tag,C25519::VerifyBatch *batch = (C25519::VerifyBatch *)0);
 
 	/**
 	 * Validate and add a credential if signature is okay and it's otherwise good
 	 */
-	AddCredentialResult addCredential(const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const Capability &cap);
+	AddCredentialResult addCredential(const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const Capability &cap,C25519::VerifyBatch *batch = (C25519::VerifyBatch *)0);
 
 	/**
 	 * Validate and add a credential if signature is okay and it's otherwise good
 	 */
-	AddCredentialResult addCredential(const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const CertificateOfOwnership &coo);
+	AddCredentialResult addCredential(const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const CertificateOfOwnership &coo,C25519::VerifyBatch *batch = (C25519::VerifyBatch *)0);
 
 	/**
 	 * Validate and add a credential if signature is okay and it's otherwise good
 	 */
-	AddCredentialResult addCredential(const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const Revocation &rev);
+	AddCredentialResult addCredential(const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const Revocation &rev,C25519::VerifyBatch *batch = (C25519::VerifyBatch *)0);
 
 	/**
 	 * Clean internal databases of stale entries
@@ -68,20 +68,24 @@ void Multicaster::remove(uint64_t nwid,const MulticastGroup &mg,const Address &m
 	Mutex::Lock _l(_groups_m);
 	MulticastGroupStatus *s = _groups.get(Multicaster::Key(nwid,mg));
 	if (s) {
-		for(std::vector<MulticastGroupMember>::iterator m(s->members.begin());m!=s->members.end();++m) {
-			if (m->address == member) {
-				s->members.erase(m);
-				break;
+		unsigned long i = 0;
+		if (s->memberIndex.get(member,i)) {
+			s->memberIndex.erase(member);
+			const unsigned long last = (unsigned long)s->members.size() - 1;
+			if (i != last) {
+				s->members[i] = s->members[last];
+				s->memberIndex.set(s->members[i].address,i);
 			}
+			s->members.pop_back();
 		}
 	}
 }
 
-unsigned int Multicaster::gather(const Address &queryingPeer,uint64_t nwid,const MulticastGroup &mg,Buffer<ZT_PROTO_MAX_PACKET_LENGTH> &appendTo,unsigned int limit) const
+unsigned int Multicaster::gather(const Address &queryingPeer,uint64_t nwid,const MulticastGroup &mg,Buffer<ZT_PROTO_MAX_PACKET_LENGTH> &appendTo,unsigned int limit)
 {
 	unsigned char *p;
-	unsigned int added = 0,i,k,rptr,totalKnown = 0;
-	uint64_t a,picked[(ZT_PROTO_MAX_PACKET_LENGTH / 5) + 2];
+	unsigned int added = 0,totalKnown = 0;
+	uint64_t a;
 
 	if (!limit)
 		return 0;
@@ -104,25 +108,15 @@ unsigned int Multicaster::gather(const Address &queryingPeer,uint64_t nwid,const
 
 	Mutex::Lock _l(_groups_m);
 
-	const MulticastGroupStatus *s = _groups.get(Multicaster::Key(nwid,mg));
+	MulticastGroupStatus *s = _groups.get(Multicaster::Key(nwid,mg));
 	if ((s)&&(!s->members.empty())) {
 		totalKnown += (unsigned int)s->members.size();
 
 		// Members are returned in random order so that repeated gather queries
 		// will return different subsets of a large multicast group.
-		k = 0;
+		unsigned long k = 0;
 		while ((added < limit)&&(k < s->members.size())&&((appendTo.size() + ZT_ADDRESS_LENGTH) <= ZT_PROTO_MAX_PACKET_LENGTH)) {
-			rptr = (unsigned int)RR->node->prng();
-
-restart_member_scan:
-			a = s->members[rptr % (unsigned int)s->members.size()].address.toInt();
-			for(i=0;i<k;++i) {
-				if (picked[i] == a) {
-					++rptr;
-					goto restart_member_scan;
-				}
-			}
-			picked[k++] = a;
+			a = _pick(*s,k++).toInt();
 
 			if (queryingPeer.toInt() != a) { // do not return the peer that is making the request as a result
 				p = (unsigned char *)appendTo.appendField(ZT_ADDRESS_LENGTH);
@@ -168,9 +162,6 @@ void Multicaster::send(
 	const void *data,
 	unsigned int len)
 {
-	unsigned long idxbuf[4096];
-	unsigned long *indexes = idxbuf;
-
 	// If we're in hub-and-spoke designated multicast replication mode, see if we
 	// have a multicast replicator active. If so, pick the best and send it
 	// there. If we are a multicast replicator or if none are alive, fall back
@@ -220,21 +211,8 @@ void Multicaster::send(
 		Mutex::Lock _l(_groups_m);
 		MulticastGroupStatus &gs = _groups[Multicaster::Key(network->id(),mg)];
 
-		if (!gs.members.empty()) {
-			// Allocate a memory buffer if group is monstrous
-			if (gs.members.size() > (sizeof(idxbuf) / sizeof(unsigned long)))
-				indexes = new unsigned long[gs.members.size()];
-
-			// Generate a random permutation of member indexes
-			for(unsigned long i=0;i<gs.members.size();++i)
-				indexes[i] = i;
-			for(unsigned long i=(unsigned long)gs.members.size()-1;i>0;--i) {
-				unsigned long j = (unsigned long)RR->node->prng() % (i + 1);
-				unsigned long tmp = indexes[j];
-				indexes[j] = indexes[i];
-				indexes[i] = tmp;
-			}
-		}
+		// Members are visited in random order with _pick(), which only shuffles
+		// as far as we actually get before hitting the limit.
 
 		Address activeBridges[ZT_MAX_NETWORK_SPECIALISTS];
 		const unsigned int activeBridgeCount = network->config().activeBridges(activeBridges);
@@ -269,7 +247,7 @@ void Multicaster::send(
 
 			unsigned long idx = 0;
 			while ((count < limit)&&(idx < gs.members.size())) {
-				const Address ma(gs.members[indexes[idx++]].address);
+				const Address ma(_pick(gs,idx++));
 				if ((std::find(activeBridges,activeBridges + activeBridgeCount,ma) == (activeBridges + activeBridgeCount))&&(ma != origin)) {
 					out.sendOnly(RR,tPtr,ma); // optimization: don't use dedup log if it's a one-pass send
 					++count;
@@ -364,18 +342,14 @@ void Multicaster::send(
 
 			unsigned long idx = 0;
 			while ((count < limit)&&(idx < gs.members.size())) {
-				Address ma(gs.members[indexes[idx++]].address);
+				Address ma(_pick(gs,idx++));
 				if (std::find(activeBridges,activeBridges + activeBridgeCount,ma) == (activeBridges + activeBridgeCount)) {
 					out.sendAndLog(RR,tPtr,ma);
 					++count;
 				}
 			}
 		}
-	} catch ( ... ) {} // this is a sanity check to catch any failures and make sure indexes[] still gets deleted
-
-	// Free allocated memory buffer if any
-	if (indexes != idxbuf)
-		delete [] indexes;
+	} catch ( ... ) {} // this is a sanity check to catch any failures
 }
 
 void Multicaster::clean(int64_t now)
@@ -393,16 +367,15 @@ void Multicaster::clean(int64_t now)
 			}
 
 			unsigned long count = 0;
-			{
-				std::vector<MulticastGroupMember>::iterator reader(s->members.begin());
-				std::vector<MulticastGroupMember>::iterator writer(reader);
-				while (reader != s->members.end()) {
-					if ((now - reader->timestamp) < ZT_MULTICAST_LIKE_EXPIRE) {
-						*writer = *reader;
-						++writer;
-						++count;
+			for(unsigned long reader=0;reader<s->members.size();++reader) {
+				if ((now - s->members[reader].timestamp) < ZT_MULTICAST_LIKE_EXPIRE) {
+					if (reader != count) {
+						s->members[count] = s->members[reader];
+						s->memberIndex.set(s->members[count].address,count);
 					}
-					++reader;
+					++count;
+				} else {
+					s->memberIndex.erase(s->members[reader].address);
 				}
 			}
 
@@ -412,6 +385,7 @@ void Multicaster::clean(int64_t now)
 				_groups.erase(*k);
 			} else {
 				s->members.clear();
+				s->memberIndex.clear();
 			}
 		}
 	}
@@ -444,13 +418,13 @@ void Multicaster::_add(void *tPtr,int64_t now,uint64_t nwid,const MulticastGroup
 	if (member == RR->identity.address())
 		return;
 
-	for(std::vector<MulticastGroupMember>::iterator m(gs.members.begin());m!=gs.members.end();++m) {
-		if (m->address == member) {
-			m->timestamp = now;
-			return;
-		}
+	const unsigned long *const i = gs.memberIndex.get(member);
+	if (i) {
+		gs.members[*i].timestamp = now;
+		return;
 	}
 
+	gs.memberIndex.set(member,(unsigned long)gs.members.size());
 	gs.members.push_back(MulticastGroupMember(member,now));
 
 	for(std::list<OutboundMulticast>::iterator tx(gs.txQueue.begin());tx!=gs.txQueue.end();) {
@@ -465,4 +439,17 @@ void Multicaster::_add(void *tPtr,int64_t now,uint64_t nwid,const MulticastGroup
 	}
 }
 
+const Address &Multicaster::_pick(MulticastGroupStatus &gs,const unsigned long i)
+{
+	const unsigned long j = i + (unsigned long)(RR->node->prng() % (uint64_t)(gs.members.size() - i));
+	if (j != i) {
+		const MulticastGroupMember tmp(gs.members[i]);
+		gs.members[i] = gs.members[j];
+		gs.members[j] = tmp;
+		gs.memberIndex.set(gs.members[i].address,i);
+		gs.memberIndex.set(gs.members[j].address,j);
+	}
+	return gs.members[i].address;
+}
+
 } // namespace ZeroTier
@@ -116,7 +116,7 @@ public:
 	 * @return Number of addresses appended
 	 * @throws std::out_of_range Buffer overflow writing to packet
 	 */
-	unsigned int gather(const Address &queryingPeer,uint64_t nwid,const MulticastGroup &mg,Buffer<ZT_PROTO_MAX_PACKET_LENGTH> &appendTo,unsigned int limit) const;
+	unsigned int gather(const Address &queryingPeer,uint64_t nwid,const MulticastGroup &mg,Buffer<ZT_PROTO_MAX_PACKET_LENGTH> &appendTo,unsigned int limit);
 
 	/**
 	 * Get subscribers to a multicast group
@@ -213,11 +213,18 @@ private:
 
 		uint64_t lastExplicitGather;
 		std::list<OutboundMulticast> txQueue; // pending outbound multicasts
-		std::vector<MulticastGroupMember> members; // members of this group
+		std::vector<MulticastGroupMember> members; // members of this group (in no particular order)
+		Hashtable<Address,unsigned long> memberIndex; // address -> index in members[]
 	};
 
 	void _add(void *tPtr,int64_t now,uint64_t nwid,const MulticastGroup &mg,MulticastGroupStatus &gs,const Address &member);
 
+	// Swaps a random member from members[i..] into members[i] and returns it (assumes _groups_m is locked)
+	//
+	// Calling this for i = 0, 1, 2 ... is a lazy Fisher-Yates shuffle, so the
+	// first k members picked are a uniform random sample with no repeats.
+	const Address &_pick(MulticastGroupStatus &gs,const unsigned long i);
+
 	const RuntimeEnvironment *const RR;
 
 	Hashtable<Multicaster::Key,MulticastGroupStatus> _groups;
@@ -34,6 +34,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <pthread.h>
+#include <sched.h>
 
 namespace ZeroTier {
 
@@ -98,6 +99,117 @@ private:
 	uint16_t nowServing;
 };
 
+#define ZT_RWMUTEX_WRITER 0x80000000U
+#define ZT_RWMUTEX_WRITER_WAITING 0x40000000U
+#define ZT_RWMUTEX_SPINS_BEFORE_YIELD 1024
+
+// Inline reader/writer spin lock for read-mostly data -- readers never wait on each other, and a
+// waiting writer holds off new readers so it can't be starved. Waiters yield after a short spin
+// since a lock holder may be descheduled.
+class RWMutex
+{
+public:
+	RWMutex() :
+		_s(0)
+	{
+	}
+
+	inline void rlock() const
+	{
+		unsigned int spins = 0;
+		for(;;) {
+			const uint32_t s = _s;
+			if (((s & (ZT_RWMUTEX_WRITER|ZT_RWMUTEX_WRITER_WAITING)) == 0)&&(__sync_bool_compare_and_swap(&(const_cast<RWMutex *>(this)->_s),s,s + 1)))
+				return;
+			_wait(spins);
+		}
+	}
+
+	inline void runlock() const
+	{
+		__sync_fetch_and_sub(&(const_cast<RWMutex *>(this)->_s),1);
+	}
+
+	inline void lock() const
+	{
+		unsigned int spins = 0;
+		for(;;) {
+			const uint32_t s = _s;
+			if ((s & ~ZT_RWMUTEX_WRITER_WAITING) == 0) {
+				if (__sync_bool_compare_and_swap(&(const_cast<RWMutex *>(this)->_s),s,ZT_RWMUTEX_WRITER))
+					return;
+			} else if ((s & ZT_RWMUTEX_WRITER_WAITING) == 0) {
+				__sync_bool_compare_and_swap(&(const_cast<RWMutex *>(this)->_s),s,s | ZT_RWMUTEX_WRITER_WAITING);
+			}
+			_wait(spins);
+		}
+	}
+
+	inline void unlock() const
+	{
+		__sync_fetch_and_and(&(const_cast<RWMutex *>(this)->_s),~ZT_RWMUTEX_WRITER);
+	}
+
+	/**
+	 * Uses C++ contexts and constructor/destructor to lock/unlock for reading automatically
+	 */
+	class RLock
+	{
+	public:
+		RLock(const RWMutex &m) :
+			_m(&m)
+		{
+			m.rlock();
+		}
+
+		~RLock()
+		{
+			_m->runlock();
+		}
+
+	private:
+		const RWMutex *const _m;
+	};
+
+	/**
+	 * Uses C++ contexts and constructor/destructor to lock/unlock for writing automatically
+	 */
+	class Lock
+	{
+	public:
+		Lock(const RWMutex &m) :
+			_m(&m)
+		{
+			m.lock();
+		}
+
+		~Lock()
+		{
+			_m->unlock();
+		}
+
+	private:
+		const RWMutex *const _m;
+	};
+
+private:
+	RWMutex(const RWMutex &) {}
+	const RWMutex &operator=(const RWMutex &) { return *this; }
+
+	static inline void _wait(unsigned int &spins)
+	{
+		if (++spins >= ZT_RWMUTEX_SPINS_BEFORE_YIELD) {
+			sched_yield();
+			spins = 0;
+		} else {
+			__asm__ __volatile__("rep;nop"::);
+		}
+		__asm__ __volatile__("":::"memory");
+	}
+
+	volatile uint32_t _s;
+};
+
 #else
 
 // libpthread based mutex lock
@@ -155,6 +267,83 @@ private:
 	pthread_mutex_t _mh;
 };
 
+// libpthread based reader/writer lock
+class RWMutex
+{
+public:
+	RWMutex()
+	{
+		pthread_rwlock_init(&_rw,(const pthread_rwlockattr_t *)0);
+	}
+
+	~RWMutex()
+	{
+		pthread_rwlock_destroy(&_rw);
+	}
+
+	inline void rlock() const
+	{
+		pthread_rwlock_rdlock(&((const_cast <RWMutex *> (this))->_rw));
+	}
+
+	inline void runlock() const
+	{
+		pthread_rwlock_unlock(&((const_cast <RWMutex *> (this))->_rw));
+	}
+
+	inline void lock() const
+	{
+		pthread_rwlock_wrlock(&((const_cast <RWMutex *> (this))->_rw));
+	}
+
+	inline void unlock() const
+	{
+		pthread_rwlock_unlock(&((const_cast <RWMutex *> (this))->_rw));
+	}
+
+	class RLock
+	{
+	public:
+		RLock(const RWMutex &m) :
+			_m(&m)
+		{
+			m.rlock();
+		}
+
+		~RLock()
+		{
+			_m->runlock();
+		}
+
+	private:
+		const RWMutex *const _m;
+	};
+
+	class Lock
+	{
+	public:
+		Lock(const RWMutex &m) :
+			_m(&m)
+		{
+			m.lock();
+		}
+
+		~Lock()
+		{
+			_m->unlock();
+		}
+
+	private:
+		const RWMutex *const _m;
+	};
+
+private:
+	RWMutex(const RWMutex &) {}
+	const RWMutex &operator=(const RWMutex &) { return *this; }
+
+	pthread_rwlock_t _rw;
+};
+
 #endif
 
 } // namespace ZeroTier
@@ -233,6 +422,78 @@ private:
 	CRITICAL_SECTION _cs;
 };
 
+// Windows slim reader/writer lock
+class RWMutex
+{
+public:
+	RWMutex()
+	{
+		InitializeSRWLock(&_l);
+	}
+
+	inline void rlock() const
+	{
+		AcquireSRWLockShared(&((const_cast <RWMutex *> (this))->_l));
+	}
+
+	inline void runlock() const
+	{
+		ReleaseSRWLockShared(&((const_cast <RWMutex *> (this))->_l));
+	}
+
+	inline void lock() const
+	{
+		AcquireSRWLockExclusive(&((const_cast <RWMutex *> (this))->_l));
+	}
+
+	inline void unlock() const
+	{
+		ReleaseSRWLockExclusive(&((const_cast <RWMutex *> (this))->_l));
+	}
+
+	class RLock
+	{
+	public:
+		RLock(const RWMutex &m) :
+			_m(&m)
+		{
+			m.rlock();
+		}
+
+		~RLock()
+		{
+			_m->runlock();
+		}
+
+	private:
+		const RWMutex *const _m;
+	};
+
+	class Lock
+	{
+	public:
+		Lock(const RWMutex &m) :
+			_m(&m)
+		{
+			m.lock();
+		}
+
+		~Lock()
+		{
+			_m->unlock();
+		}
+
+	private:
+		const RWMutex *const _m;
+	};
+
+private:
+	RWMutex(const RWMutex &) {}
+	const RWMutex &operator=(const RWMutex &) { return *this; }
+
+	SRWLOCK _l;
+};
+
 } // namespace ZeroTier
 
 #endif // _WIN32
@@ -542,8 +542,119 @@ static _doZtFilterResult _doZtFilter(
 	return DOZTFILTER_NO_MATCH;
 }
 
+// What a MATCH rule is known to return for any frame of a given ethertype: 0 or 1, or 2 if it depends on the frame
+static uint8_t _ruleMatchForEtherType(const ZT_VirtualNetworkRule &rule,const unsigned int etherType)
+{
+	switch((ZT_VirtualNetworkRuleType)(rule.t & 0x3f)) {
+		case ZT_NETWORK_RULE_MATCH_ETHERTYPE:
+			return (uint8_t)((unsigned int)rule.v.etherType == etherType);
+		case ZT_NETWORK_RULE_MATCH_IPV4_SOURCE:
+		case ZT_NETWORK_RULE_MATCH_IPV4_DEST:
+			return (etherType == ZT_ETHERTYPE_IPV4) ? 2 : 0;
+		case ZT_NETWORK_RULE_MATCH_IPV6_SOURCE:
+		case ZT_NETWORK_RULE_MATCH_IPV6_DEST:
+			return (etherType == ZT_ETHERTYPE_IPV6) ? 2 : 0;
+		case ZT_NETWORK_RULE_MATCH_IP_TOS:
+		case ZT_NETWORK_RULE_MATCH_IP_PROTOCOL:
+		case ZT_NETWORK_RULE_MATCH_ICMP:
+		case ZT_NETWORK_RULE_MATCH_IP_SOURCE_PORT_RANGE:
+		case ZT_NETWORK_RULE_MATCH_IP_DEST_PORT_RANGE:
+			return ((etherType == ZT_ETHERTYPE_IPV4)||(etherType == ZT_ETHERTYPE_IPV6)) ? 2 : 0;
+		default:
+			return 2;
+	}
+}
+
+// True if a rule's outcome depends only on what Network::_FlowKey captures (and never forwards the frame)
+static bool _ruleIsFlowDetermined(const ZT_VirtualNetworkRule &rule)
+{
+	switch((ZT_VirtualNetworkRuleType)(rule.t & 0x3f)) {
+		case ZT_NETWORK_RULE_ACTION_TEE:
+		case ZT_NETWORK_RULE_ACTION_WATCH:
+		case ZT_NETWORK_RULE_ACTION_REDIRECT:
+		case ZT_NETWORK_RULE_MATCH_CHARACTERISTICS:
+		case ZT_NETWORK_RULE_MATCH_FRAME_SIZE_RANGE:
+		case ZT_NETWORK_RULE_MATCH_RANDOM:
+		case ZT_NETWORK_RULE_MATCH_TAGS_DIFFERENCE:
+		case ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_AND:
+		case ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_OR:
+		case ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_XOR:
+		case ZT_NETWORK_RULE_MATCH_TAGS_EQUAL:
+		case ZT_NETWORK_RULE_MATCH_TAG_SENDER:
+		case ZT_NETWORK_RULE_MATCH_TAG_RECEIVER:
+		case ZT_NETWORK_RULE_MATCH_INTEGER_RANGE:
+			return false;
+		default:
+			return true;
+	}
+}
+
 } // anonymous namespace
 
+void Network::_FlowKey::init(const bool inbound,const Address &zs,const Address &zd,const MAC &ms,const MAC &md,const uint8_t *frameData,const unsigned int frameLen,const unsigned int et,const unsigned int vid)
+{
+	// This must read exactly the bytes _doZtFilter() reads for flow determined rules
+	memset(this,0,sizeof(_FlowKey));
+	ztSource = zs.toInt();
+	ztDest = zd.toInt();
+	macSource = ms.toInt();
+	macDest = md.toInt();
+	sourcePort = -1;
+	destPort = -1;
+	ipProtocol = -1;
+	icmpType = -1;
+	icmpCode = -1;
+	etherType = (uint16_t)et;
+	vlanId = (uint16_t)vid;
+	flags = (inbound) ? 0x01 : 0x00;
+
+	unsigned int pos = 0,proto = 0;
+	if ((et == ZT_ETHERTYPE_IPV4)&&(frameLen >= 20)) {
+		flags |= 0x02;
+		memcpy(ipSource,frameData + 12,4);
+		memcpy(ipDest,frameData + 16,4);
+		tos = frameData[1];
+		pos = 4 * (frameData[0] & 0xf);
+		proto = frameData[9];
+	} else if (et == ZT_ETHERTYPE_IPV6) {
+		if (frameLen >= 40) {
+			flags |= 0x04;
+			memcpy(ipSource,frameData + 8,16);
+			memcpy(ipDest,frameData + 24,16);
+			tos = (uint8_t)(((frameData[0] << 4) & 0xf0) | ((frameData[1] >> 4) & 0x0f));
+		}
+		if (!_ipv6GetPayload(frameData,frameLen,pos,proto))
+			return;
+	} else {
+		return;
+	}
+
+	ipProtocol = (int16_t)proto;
+	switch(proto) {
+		case 0x01: // ICMP
+			if ((et == ZT_ETHERTYPE_IPV4)&&(frameLen >= (pos + 2))) {
+				icmpType = frameData[pos];
+				icmpCode = frameData[pos + 1];
+			}
+			break;
+		case 0x3a: // ICMPv6
+			if ((et == ZT_ETHERTYPE_IPV6)&&(frameLen >= (pos + 2))) {
+				icmpType = frameData[pos];
+				icmpCode = frameData[pos + 1];
+			}
+			break;
+		case 0x06: // TCP
+		case 0x11: // UDP
+		case 0x84: // SCTP
+		case 0x88: // UDPLite
+			if (frameLen > (pos + 4)) {
+				sourcePort = ((int32_t)frameData[pos] << 8) | (int32_t)frameData[pos + 1];
+				destPort = ((int32_t)frameData[pos + 2] << 8) | (int32_t)frameData[pos + 3];
+			}
+			break;
+	}
+}
+
 const ZeroTier::MulticastGroup Network::BROADCAST(ZeroTier::MAC(0xffffffffffffULL),0);
 
 Network::Network(const RuntimeEnvironment *renv,void *tPtr,uint64_t nwid,void *uptr,const NetworkConfig *nconf) :
@@ -560,6 +671,7 @@ Network::Network(const RuntimeEnvironment *renv,void *tPtr,uint64_t nwid,void *u
 {
 	for(int i=0;i<ZT_NETWORK_MAX_INCOMING_UPDATES;++i)
 		_incomingConfigChunks[i].ts = 0;
+	_compileRules();
 
 	if (nconf) {
 		this->setConfiguration(tPtr,*nconf,false);
@@ -611,6 +723,96 @@ Network::~Network()
 	}
 }
 
+void Network::_compileRules()
+{
+	_compiledRules.clear();
+	_flowCache.clear();
+
+	std::vector<unsigned int> ets;
+	ets.push_back(ZT_ETHERTYPE_IPV4);
+	ets.push_back(ZT_ETHERTYPE_IPV6);
+	for(unsigned int rn=0;rn<_config.ruleCount;++rn) {
+		if ((_config.rules[rn].t & 0x3f) == ZT_NETWORK_RULE_MATCH_ETHERTYPE)
+			ets.push_back((unsigned int)_config.rules[rn].v.etherType);
+	}
+	std::sort(ets.begin(),ets.end());
+	ets.erase(std::unique(ets.begin(),ets.end()),ets.end());
+	ets.push_back(0x10000); // matches no ETHERTYPE rule, so stands in for every ethertype not listed
+
+	bool anyFlowCacheable = false;
+	_compiledRules.resize(ets.size());
+	for(unsigned long e=0;e<ets.size();++e) {
+		_CompiledRules &cr = _compiledRules[e];
+		cr.etherType = ets[e];
+		cr.flowCacheable = true;
+
+		// Walk the rules set by set (a run of MATCHes and the ACTION ending it) as _doZtFilter()
+		// would, with matches known to be 0 or 1 for this ethertype or 2 if not known. Sets that
+		// can never match are dropped. A set that can't match has no effect and every set starts
+		// out true, so this doesn't change the outcome. TEE, WATCH, and REDIRECT are always kept
+		// since on inbound frames they can mark us a super-accepting target without matching.
+		unsigned int setStart = 0;
+		uint8_t setMatches = 1;
+		for(unsigned int rn=0;rn<_config.ruleCount;++rn) {
+			const ZT_VirtualNetworkRule &r = _config.rules[rn];
+			const ZT_VirtualNetworkRuleType rt = (ZT_VirtualNetworkRuleType)(r.t & 0x3f);
+			if ((unsigned int)rt <= (unsigned int)ZT_NETWORK_RULE_ACTION__MAX_ID) {
+				if ((setMatches)||(rt == ZT_NETWORK_RULE_ACTION_TEE)||(rt == ZT_NETWORK_RULE_ACTION_WATCH)||(rt == ZT_NETWORK_RULE_ACTION_REDIRECT)) {
+					for(unsigned int i=setStart;i<=rn;++i) {
+						cr.rules.push_back(_config.rules[i]);
+						if (!_ruleIsFlowDetermined(_config.rules[i]))
+							cr.flowCacheable = false;
+					}
+				}
+				setStart = rn + 1;
+				setMatches = 1;
+			} else {
+				uint8_t m = _ruleMatchForEtherType(r,cr.etherType);
+				if (m != 2)
+					m ^= (r.t >> 7) & 1;
+				if ((r.t & 0x40)) // OR
+					setMatches = ((setMatches == 1)||(m == 1)) ? 1 : (((setMatches == 0)&&(m == 0)) ? 0 : 2);
+				else setMatches = ((setMatches == 0)||(m == 0)) ? 0 : (((setMatches == 1)&&(m == 1)) ? 1 : 2);
+			}
+		}
+
+		if (cr.rules.size() < ZT_NETWORK_FLOW_CACHE_MIN_RULES)
+			cr.flowCacheable = false;
+		anyFlowCacheable |= cr.flowCacheable;
+	}
+
+	if (anyFlowCacheable)
+		_flowCache.resize(ZT_NETWORK_FLOW_CACHE_SIZE);
+}
+
+int Network::_doCompiledZtFilter(Trace::RuleResultLog &rrl,const Membership *membership,const bool inbound,const Address &ztSource,Address &ztDest,const MAC &macSource,const MAC &macDest,const uint8_t *const frameData,const unsigned int frameLen,const unsigned int etherType,const unsigned int vlanId,Address &cc,unsigned int &ccLength,bool &ccWatch)
+{
+	// Remote traces report results by rule number, so they get the original rule set
+	if ((_config.remoteTraceTarget)||(_compiledRules.empty()))
+		return (int)_doZtFilter(RR,rrl,_config,membership,inbound,ztSource,ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId,_config.rules,_config.ruleCount,cc,ccLength,ccWatch);
+
+	const _CompiledRules *cr = &(_compiledRules[0]);
+	while (cr->etherType < etherType)
+		++cr;
+	if (cr->etherType != etherType)
+		cr = &(_compiledRules.back());
+	const ZT_VirtualNetworkRule *const rules = (cr->rules.empty()) ? _config.rules : &(cr->rules[0]);
+
+	if (!cr->flowCacheable)
+		return (int)_doZtFilter(RR,rrl,_config,membership,inbound,ztSource,ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId,rules,(unsigned int)cr->rules.size(),cc,ccLength,ccWatch);
+
+	// Flow cacheable rule sets can't TEE or REDIRECT, so the verdict is all there is to remember
+	_FlowKey k;
+	k.init(inbound,ztSource,ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId);
+	_FlowVerdict &fv = _flowCache[k.hashCode() & (ZT_NETWORK_FLOW_CACHE_SIZE - 1)];
+	if ((fv.verdict != 0xff)&&(fv.k == k))
+		return (int)fv.verdict;
+	const _doZtFilterResult r = _doZtFilter(RR,rrl,_config,membership,inbound,ztSource,ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId,rules,(unsigned int)cr->rules.size(),cc,ccLength,ccWatch);
+	fv.k = k;
+	fv.verdict = (unsigned int)r;
+	return (int)r;
+}
+
 bool Network::filterOutgoingPacket(
 	void *tPtr,
 	const bool noTee,
@@ -634,9 +836,11 @@ bool Network::filterOutgoingPacket(
 
 	Mutex::Lock _l(_lock);
 
+	// Memberships may be created below while this one is held
+	_memberships.reserve(_memberships.size() + ZT_NETWORK_FILTER_MAX_NEW_MEMBERSHIPS);
 	Membership *const membership = (ztDest) ? _memberships.get(ztDest) : (Membership *)0;
 
-	switch(_doZtFilter(RR,rrl,_config,membership,false,ztSource,ztFinalDest,macSource,macDest,frameData,frameLen,etherType,vlanId,_config.rules,_config.ruleCount,cc,ccLength,ccWatch)) {
+	switch((_doZtFilterResult)_doCompiledZtFilter(rrl,membership,false,ztSource,ztFinalDest,macSource,macDest,frameData,frameLen,etherType,vlanId,cc,ccLength,ccWatch)) {
 
 		case DOZTFILTER_NO_MATCH: {
 			for(unsigned int c=0;c<_config.capabilityCount;++c) {
@@ -761,9 +965,12 @@ int Network::filterIncomingPacket(
 
 	Mutex::Lock _l(_lock);
 
+	// The sender's membership and others may be created below while it and its
+	// capabilities are referenced
+	_memberships.reserve(_memberships.size() + ZT_NETWORK_FILTER_MAX_NEW_MEMBERSHIPS);
 	Membership &membership = _membership(sourcePeer->address());
 
-	switch (_doZtFilter(RR,rrl,_config,&membership,true,sourcePeer->address(),ztFinalDest,macSource,macDest,frameData,frameLen,etherType,vlanId,_config.rules,_config.ruleCount,cc,ccLength,ccWatch)) {
+	switch ((_doZtFilterResult)_doCompiledZtFilter(rrl,&membership,true,sourcePeer->address(),ztFinalDest,macSource,macDest,frameData,frameLen,etherType,vlanId,cc,ccLength,ccWatch)) {
 
 		case DOZTFILTER_NO_MATCH: {
 			Membership::CapabilityIterator mci(membership,_config);
@@ -1033,6 +1240,7 @@ int Network::setConfiguration(void *tPtr,const NetworkConfig &nconf,bool saveToD
 			Mutex::Lock _l(_lock);
 
 			_config = nconf;
+			_compileRules();
 			_lastConfigUpdate = RR->node->now();
 			_netconfFailure = NETCONF_FAILURE_NONE;
 
@@ -1350,14 +1558,14 @@ void Network::learnBridgedMulticastGroup(void *tPtr,const MulticastGroup &mg,int
 		_sendUpdatesToMembers(tPtr,&mg);
 }
 
-Membership::AddCredentialResult Network::addCredential(void *tPtr,const CertificateOfMembership &com)
+Membership::AddCredentialResult Network::addCredential(void *tPtr,const CertificateOfMembership &com,C25519::VerifyBatch *batch)
 {
 	if (com.networkId() != _id)
 		return Membership::ADD_REJECTED;
 	const Address a(com.issuedTo());
 	Mutex::Lock _l(_lock);
 	Membership &m = _membership(a);
-	const Membership::AddCredentialResult result = m.addCredential(RR,tPtr,_config,com);
+	const Membership::AddCredentialResult result = m.addCredential(RR,tPtr,_config,com,batch);
 	if ((result == Membership::ADD_ACCEPTED_NEW)||(result == Membership::ADD_ACCEPTED_REDUNDANT)) {
 		m.pushCredentials(RR,tPtr,RR->node->now(),a,_config,-1,false);
 		RR->mc->addCredential(tPtr,com,true);
@@ -1365,7 +1573,7 @@ Membership::AddCredentialResult Network::addCredential(void *tPtr,const Certific
 	return result;
 }
 
-Membership::AddCredentialResult Network::addCredential(void *tPtr,const Address &sentFrom,const Revocation &rev)
+Membership::AddCredentialResult Network::addCredential(void *tPtr,const Address &sentFrom,const Revocation &rev,C25519::VerifyBatch *batch)
 {
 	if (rev.networkId() != _id)
 		return Membership::ADD_REJECTED;
@@ -1373,7 +1581,7 @@ Membership::AddCredentialResult Network::addCredential(void *tPtr,const Address
 	Mutex::Lock _l(_lock);
 	Membership &m = _membership(rev.target());
 
-	const Membership::AddCredentialResult result = m.addCredential(RR,tPtr,_config,rev);
+	const Membership::AddCredentialResult result = m.addCredential(RR,tPtr,_config,rev,batch);
 
 	if ((result == Membership::ADD_ACCEPTED_NEW)&&(rev.fastPropagate())) {
 		Address *a = (Address *)0;
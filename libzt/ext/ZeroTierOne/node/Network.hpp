@@ -28,6 +28,7 @@
 #define ZT_NETWORK_HPP
 
 #include <stdint.h>
+#include <string.h>
 
 #include "../include/ZeroTierOne.h"
 
@@ -50,10 +51,32 @@
 #include "Membership.hpp"
 #include "NetworkConfig.hpp"
 #include "CertificateOfMembership.hpp"
+#include "Trace.hpp"
 
 #define ZT_NETWORK_MAX_INCOMING_UPDATES 3
 #define ZT_NETWORK_MAX_UPDATE_CHUNKS ((ZT_NETWORKCONFIG_DICT_CAPACITY / 1024) + 1)
 
+/**
+ * Size of the per-network flow verdict cache (must be a power of two)
+ */
+#define ZT_NETWORK_FLOW_CACHE_SIZE 1024
+
+/**
+ * Minimum compiled rules for an ethertype before its verdicts are cached
+ *
+ * Below this, running the rules costs about as much as a cache lookup.
+ */
+#define ZT_NETWORK_FLOW_CACHE_MIN_RULES 16
+
+/**
+ * Most memberships one packet filter pass may create
+ *
+ * The sender's (inbound only), and the TEE, capability TEE and REDIRECT
+ * targets. Filters reserve this much room in _memberships up front so the
+ * Membership they hold is not moved by those insertions.
+ */
+#define ZT_NETWORK_FILTER_MAX_NEW_MEMBERSHIPS 4
+
 namespace ZeroTier {
 
 class RuntimeEnvironment;
@@ -309,44 +332,44 @@ public:
 	/**
 	 * Validate a credential and learn it if it passes certificate and other checks
 	 */
-	Membership::AddCredentialResult addCredential(void *tPtr,const CertificateOfMembership &com);
+	Membership::AddCredentialResult addCredential(void *tPtr,const CertificateOfMembership &com,C25519::VerifyBatch *batch = (C25519::VerifyBatch *)0);
 
 	/**
 	 * Validate a credential and learn it if it passes certificate and other checks
 	 */
-	inline Membership::AddCredentialResult addCredential(void *tPtr,const Capability &cap)
+	inline Membership::AddCredentialResult addCredential(void *tPtr,const Capability &cap,C25519::VerifyBatch *batch = (C25519::VerifyBatch *)0)
 	{
 		if (cap.networkId() != _id)
 			return Membership::ADD_REJECTED;
 		Mutex::Lock _l(_lock);
-		return _membership(cap.issuedTo()).addCredential(RR,tPtr,_config,cap);
+		return _membership(cap.issuedTo()).addCredential(RR,tPtr,_config,cap,batch);
 	}
 
 	/**
 	 * Validate a credential and learn it if it passes certificate and other checks
 	 */
-	inline Membership::AddCredentialResult addCredential(void *tPtr,const Tag &tag)
+	inline Membership::AddCredentialResult addCredential(void *tPtr,const Tag &tag,C25519::VerifyBatch *batch = (C25519::VerifyBatch *)0)
 	{
 		if (tag.networkId() != _id)
 			return Membership::ADD_REJECTED;
 		Mutex::Lock _l(_lock);
-		return _membership(tag.issuedTo()).addCredential(RR,tPtr,_config,tag);
+		return _membership(tag.issuedTo()).addCredential(RR,tPtr,_config,tag,batch);
 	}
 
 	/**
 	 * Validate a credential and learn it if it passes certificate and other checks
 	 */
-	Membership::AddCredentialResult addCredential(void *tPtr,const Address &sentFrom,const Revocation &rev);
+	Membership::AddCredentialResult addCredential(void *tPtr,const Address &sentFrom,const Revocation &rev,C25519::VerifyBatch *batch = (C25519::VerifyBatch *)0);
 
 	/**
 	 * Validate a credential and learn it if it passes certificate and other checks
 	 */
-	inline Membership::AddCredentialResult addCredential(void *tPtr,const CertificateOfOwnership &coo)
+	inline Membership::AddCredentialResult addCredential(void *tPtr,const CertificateOfOwnership &coo,C25519::VerifyBatch *batch = (C25519::VerifyBatch *)0)
 	{
 		if (coo.networkId() != _id)
 			return Membership::ADD_REJECTED;
 		Mutex::Lock _l(_lock);
-		return _membership(coo.issuedTo()).addCredential(RR,tPtr,_config,coo);
+		return _membership(coo.issuedTo()).addCredential(RR,tPtr,_config,coo,batch);
 	}
 
 	/**
@@ -394,6 +417,8 @@ private:
 	void _announceMulticastGroupsTo(void *tPtr,const Address &peer,const std::vector<MulticastGroup> &allMulticastGroups);
 	std::vector<MulticastGroup> _allMulticastGroups() const;
 	Membership &_membership(const Address &a);
+	void _compileRules(); // assumes _lock is locked
+	int _doCompiledZtFilter(Trace::RuleResultLog &rrl,const Membership *membership,const bool inbound,const Address &ztSource,Address &ztDest,const MAC &macSource,const MAC &macDest,const uint8_t *const frameData,const unsigned int frameLen,const unsigned int etherType,const unsigned int vlanId,Address &cc,unsigned int &ccLength,bool &ccWatch);
 
 	const RuntimeEnvironment *const RR;
 	void *_uPtr;
@@ -409,6 +434,60 @@ private:
 	NetworkConfig _config;
 	uint64_t _lastConfigUpdate;
 
+	// The network's rules reduced to what can match a given ethertype, built
+	// by _compileRules() whenever the config changes. Sorted by ethertype; the
+	// last entry has etherType 0x10000 and covers all ethertypes not listed.
+	struct _CompiledRules
+	{
+		unsigned int etherType;
+		bool flowCacheable; // true if verdicts depend only on fields in _FlowKey
+		std::vector<ZT_VirtualNetworkRule> rules;
+	};
+	std::vector<_CompiledRules> _compiledRules;
+
+	// Every header field a flow cacheable rule set can look at
+	struct _FlowKey
+	{
+		void init(const bool inbound,const Address &zs,const Address &zd,const MAC &ms,const MAC &md,const uint8_t *frameData,const unsigned int frameLen,const unsigned int et,const unsigned int vid);
+
+		inline unsigned long hashCode() const
+		{
+			uint64_t h = 0;
+			for(unsigned int i=0;i<(sizeof(_FlowKey) / 8);++i) {
+				uint64_t w;
+				memcpy(&w,reinterpret_cast<const uint8_t *>(this) + (i * 8),8);
+				h = (h ^ w) * 0x100000001b3ULL;
+			}
+			return (unsigned long)(h ^ (h >> 29));
+		}
+
+		inline bool operator==(const _FlowKey &k) const { return (memcmp(this,&k,sizeof(_FlowKey)) == 0); }
+
+		uint64_t ztSource;
+		uint64_t ztDest;
+		uint64_t macSource;
+		uint64_t macDest;
+		uint8_t ipSource[16];
+		uint8_t ipDest[16];
+		int32_t sourcePort; // -1 if not TCP/UDP/SCTP/UDPLite or truncated
+		int32_t destPort;
+		int16_t ipProtocol; // -1 if not IP or unparseable
+		int16_t icmpType; // -1 if not ICMP
+		int16_t icmpCode;
+		uint16_t etherType;
+		uint16_t vlanId;
+		uint8_t tos;
+		uint8_t flags; // 0x01 inbound, 0x02 IPv4 header present, 0x04 IPv6 header present
+		uint8_t pad[4];
+	};
+	struct _FlowVerdict
+	{
+		_FlowVerdict() : verdict(0xff) { memset(&k,0,sizeof(k)); }
+		_FlowKey k;
+		unsigned int verdict; // 0xff if empty
+	};
+	std::vector<_FlowVerdict> _flowCache; // empty unless some compiled rule set is flow cacheable
+
 	struct _IncomingConfigChunk
 	{
 		_IncomingConfigChunk() { memset(this,0,sizeof(_IncomingConfigChunk)); }
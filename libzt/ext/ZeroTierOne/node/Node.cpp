@@ -45,6 +45,7 @@
 #include "Address.hpp"
 #include "Identity.hpp"
 #include "SelfAwareness.hpp"
+#include "IdentityValidator.hpp"
 #include "Network.hpp"
 #include "Trace.hpp"
 
@@ -114,8 +115,9 @@ Node::Node(void *uptr,void *tptr,const struct ZT_Node_Callbacks *callbacks,int64
 		const unsigned long mcs = sizeof(Multicaster) + (((sizeof(Multicaster) & 0xf) != 0) ? (16 - (sizeof(Multicaster) & 0xf)) : 0);
 		const unsigned long topologys = sizeof(Topology) + (((sizeof(Topology) & 0xf) != 0) ? (16 - (sizeof(Topology) & 0xf)) : 0);
 		const unsigned long sas = sizeof(SelfAwareness) + (((sizeof(SelfAwareness) & 0xf) != 0) ? (16 - (sizeof(SelfAwareness) & 0xf)) : 0);
+		const unsigned long ivs = sizeof(IdentityValidator) + (((sizeof(IdentityValidator) & 0xf) != 0) ? (16 - (sizeof(IdentityValidator) & 0xf)) : 0);
 
-		m = reinterpret_cast<char *>(::malloc(16 + ts + sws + mcs + topologys + sas));
+		m = reinterpret_cast<char *>(::malloc(16 + ts + sws + mcs + topologys + sas + ivs));
 		if (!m)
 			throw std::bad_alloc();
 		RR->rtmem = m;
@@ -130,7 +132,10 @@ Node::Node(void *uptr,void *tptr,const struct ZT_Node_Callbacks *callbacks,int64
 		RR->topology = new (m) Topology(RR,tptr);
 		m += topologys;
 		RR->sa = new (m) SelfAwareness(RR);
+		m += sas;
+		RR->iv = new (m) IdentityValidator(RR,tptr);
 	} catch ( ... ) {
+		if (RR->iv) RR->iv->~IdentityValidator();
 		if (RR->sa) RR->sa->~SelfAwareness();
 		if (RR->topology) RR->topology->~Topology();
 		if (RR->mc) RR->mc->~Multicaster();
@@ -149,6 +154,7 @@ Node::~Node()
 		Mutex::Lock _l(_networks_m);
 		_networks.clear(); // destroy all networks before shutdown
 	}
+	if (RR->iv) RR->iv->~IdentityValidator();
 	if (RR->sa) RR->sa->~SelfAwareness();
 	if (RR->topology) RR->topology->~Topology();
 	if (RR->mc) RR->mc->~Multicaster();
@@ -168,6 +174,8 @@ ZT_ResultCode Node::processWirePacket(
 {
 	_now = now;
 	RR->sw->onRemotePacket(tptr,localSocket,*(reinterpret_cast<const InetAddress *>(remoteAddress)),packetData,packetLength);
+	if (RR->iv->hasCompleted())
+		RR->sw->doIdentityValidations(tptr,now);
 	return ZT_RESULT_OK;
 }
 
@@ -191,6 +199,26 @@ ZT_ResultCode Node::processVirtualNetworkFrame(
 	} else return ZT_RESULT_ERROR_NETWORK_NOT_FOUND;
 }
 
+ZT_ResultCode Node::processVirtualNetworkFrame(
+	void *tptr,
+	int64_t now,
+	uint64_t nwid,
+	uint64_t sourceMac,
+	uint64_t destMac,
+	unsigned int etherType,
+	unsigned int vlanId,
+	const ZT_FrameSegment *frameSegments,
+	unsigned int frameSegmentCount,
+	volatile int64_t *nextBackgroundTaskDeadline)
+{
+	_now = now;
+	SharedPtr<Network> nw(this->network(nwid));
+	if (nw) {
+		RR->sw->onLocalEthernet(tptr,nw,MAC(sourceMac),MAC(destMac),etherType,vlanId,frameSegments,frameSegmentCount);
+		return ZT_RESULT_OK;
+	} else return ZT_RESULT_ERROR_NETWORK_NOT_FOUND;
+}
+
 // Closure used to ping upstream and active/online peers
 class _PingPeersThatNeedPing
 {
@@ -296,6 +324,7 @@ ZT_ResultCode Node::processBackgroundTasks(void *tptr,int64_t now,volatile int64
 			}
 
 			// Ping active peers, upstreams, and others that we should always contact
+			// (eachPeer() works on a snapshot; doPeriodicTasks() can't expire peers meanwhile as it runs under _backgroundTasksLock too)
 			_PingPeersThatNeedPing pfunc(RR,tptr,alwaysContact,now);
 			RR->topology->eachPeer<_PingPeersThatNeedPing &>(pfunc);
 
@@ -344,6 +373,9 @@ ZT_ResultCode Node::processBackgroundTasks(void *tptr,int64_t now,volatile int64
 	}
 
 	try {
+		if (RR->iv->hasCompleted())
+			RR->sw->doIdentityValidations(tptr,now);
+		RR->iv->doTimerTasks(tptr,now);
 		*nextBackgroundTaskDeadline = now + (int64_t)std::max(std::min(timeUntilNextPingCheck,RR->sw->doTimerTasks(tptr,now)),(unsigned long)ZT_CORE_TIMER_TASK_GRANULARITY);
 	} catch ( ... ) {
 		return ZT_RESULT_FATAL_ERROR_INTERNAL;
@@ -433,6 +465,8 @@ void Node::status(ZT_NodeStatus *status) const
 	status->publicIdentity = RR->publicIdentityStr;
 	status->secretIdentity = RR->secretIdentityStr;
 	status->online = _online ? 1 : 0;
+	RR->sw->rxQueueCounters(status->fragmentsReassembled,status->fragmentsEvicted,status->fragmentsExpired);
+	RR->iv->counters(status->identitiesValidated,status->identityCacheHits,status->identityValidationsFailed);
 }
 
 ZT_PeerList *Node::peers() const
@@ -476,6 +510,8 @@ ZT_PeerList *Node::peers() const
 			p->paths[p->pathCount].preferred = ((*path) == bestp) ? 1 : 0;
 			++p->pathCount;
 		}
+
+		pi->second->compressionStats(p->compression);
 	}
 
 	return pl;
@@ -792,6 +828,28 @@ enum ZT_ResultCode ZT_Node_processVirtualNetworkFrame(
 	}
 }
 
+enum ZT_ResultCode ZT_Node_processVirtualNetworkFrameSegments(
+	ZT_Node *node,
+	void *tptr,
+	int64_t now,
+	uint64_t nwid,
+	uint64_t sourceMac,
+	uint64_t destMac,
+	unsigned int etherType,
+	unsigned int vlanId,
+	const ZT_FrameSegment *frameSegments,
+	unsigned int frameSegmentCount,
+	volatile int64_t *nextBackgroundTaskDeadline)
+{
+	try {
+		return reinterpret_cast<ZeroTier::Node *>(node)->processVirtualNetworkFrame(tptr,now,nwid,sourceMac,destMac,etherType,vlanId,frameSegments,frameSegmentCount,nextBackgroundTaskDeadline);
+	} catch (std::bad_alloc &exc) {
+		return ZT_RESULT_FATAL_ERROR_OUT_OF_MEMORY;
+	} catch ( ... ) {
+		return ZT_RESULT_FATAL_ERROR_INTERNAL;
+	}
+}
+
 enum ZT_ResultCode ZT_Node_processBackgroundTasks(ZT_Node *node,void *tptr,int64_t now,volatile int64_t *nextBackgroundTaskDeadline)
 {
 	try {
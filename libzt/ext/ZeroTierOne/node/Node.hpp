@@ -94,6 +94,17 @@ public:
 		const void *frameData,
 		unsigned int frameLength,
 		volatile int64_t *nextBackgroundTaskDeadline);
+	ZT_ResultCode processVirtualNetworkFrame(
+		void *tptr,
+		int64_t now,
+		uint64_t nwid,
+		uint64_t sourceMac,
+		uint64_t destMac,
+		unsigned int etherType,
+		unsigned int vlanId,
+		const ZT_FrameSegment *frameSegments,
+		unsigned int frameSegmentCount,
+		volatile int64_t *nextBackgroundTaskDeadline);
 	ZT_ResultCode processBackgroundTasks(void *tptr,int64_t now,volatile int64_t *nextBackgroundTaskDeadline);
 	ZT_ResultCode join(uint64_t nwid,void *uptr,void *tptr);
 	ZT_ResultCode leave(uint64_t nwid,void **uptr,void *tptr);
@@ -30,6 +30,8 @@
 #include <stdlib.h>
 #include <stdio.h>
 
+#include <algorithm>
+
 #include "Packet.hpp"
 
 #ifdef ZT_USE_X64_ASM_SALSA2012
@@ -48,15 +50,22 @@
 #define FORCE_INLINE static inline
 #endif
 
+// Payload bytes enciphered and authenticated per step of armor()/dearmor()
+#define ZT_PACKET_CRYPTO_CHUNK_SIZE 512
+
 namespace ZeroTier {
 
 /************************************************************************** */
 
 /* Set up macros for fast single-pass ASM Salsa20/12 crypto, if we have it */
 
-// x64 SSE crypto
+// x64 SSE crypto (the 8-way AVX2 code in Salsa20 is faster when the CPU has it)
 #ifdef ZT_USE_X64_ASM_SALSA2012
+#ifdef ZT_SALSA20_AVX2
+#define ZT_HAS_FAST_CRYPTO() (!Salsa20::useAVX2)
+#else
 #define ZT_HAS_FAST_CRYPTO() (true)
+#endif
 #define ZT_FAST_SINGLE_PASS_SALSA2012(b,l,n,k) zt_salsa2012_amd64_xmm6(reinterpret_cast<unsigned char *>(b),(l),reinterpret_cast<const unsigned char *>(n),reinterpret_cast<const unsigned char *>(k))
 #endif
 
@@ -893,36 +902,51 @@ void Packet::armor(const void *key,bool encryptPayload)
 {
 	uint8_t mangledKey[32];
 	uint8_t *const data = reinterpret_cast<uint8_t *>(unsafeData());
+	uint8_t *const payload = data + ZT_PACKET_IDX_VERB;
+	const unsigned int payloadLen = size() - ZT_PACKET_IDX_VERB;
 
 	// Set flag now, since it affects key mangle function
 	setCipher(encryptPayload ? ZT_PROTO_CIPHER_SUITE__C25519_POLY1305_SALSA2012 : ZT_PROTO_CIPHER_SUITE__C25519_POLY1305_NONE);
 
 	_salsa20MangleKey((const unsigned char *)key,mangledKey);
 
+	// Encrypt and MAC in one sweep, chunk by chunk, so each chunk of ciphertext
+	// is authenticated while it's still in L1 cache.
+	uint64_t mac[2];
 	if (ZT_HAS_FAST_CRYPTO()) {
-		const unsigned int encryptLen = (encryptPayload) ? (size() - ZT_PACKET_IDX_VERB) : 0;
+		// The ASM kernel can't resume mid-stream, so its key stream is made in one call
+		const unsigned int encryptLen = (encryptPayload) ? payloadLen : 0;
 		uint64_t keyStream[(ZT_PROTO_MAX_PACKET_LENGTH + 64 + 8) / 8];
 		ZT_FAST_SINGLE_PASS_SALSA2012(keyStream,encryptLen + 64,(data + ZT_PACKET_IDX_IV),mangledKey);
-		Salsa20::memxor(data + ZT_PACKET_IDX_VERB,reinterpret_cast<const uint8_t *>(keyStream + 8),encryptLen);
-		uint64_t mac[2];
-		Poly1305::compute(mac,data + ZT_PACKET_IDX_VERB,size() - ZT_PACKET_IDX_VERB,keyStream);
-#ifdef ZT_NO_TYPE_PUNNING
-		memcpy(data + ZT_PACKET_IDX_MAC,mac,8);
-#else
-		(*reinterpret_cast<uint64_t *>(data + ZT_PACKET_IDX_MAC)) = mac[0];
-#endif
+		Poly1305 poly(keyStream);
+		if (encryptPayload) {
+			const uint8_t *const ks = reinterpret_cast<const uint8_t *>(keyStream + 8);
+			for(unsigned int i=0;i<payloadLen;i+=ZT_PACKET_CRYPTO_CHUNK_SIZE) {
+				const unsigned int n = std::min(payloadLen - i,(unsigned int)ZT_PACKET_CRYPTO_CHUNK_SIZE);
+				Salsa20::memxor(payload + i,ks + i,n);
+				poly.update(payload + i,n);
+			}
+		} else {
+			poly.update(payload,payloadLen);
+		}
+		poly.finish(mac);
 	} else {
 		Salsa20 s20(mangledKey,data + ZT_PACKET_IDX_IV);
 		uint64_t macKey[4];
 		s20.crypt12(ZERO_KEY,macKey,sizeof(macKey));
-		uint8_t *const payload = data + ZT_PACKET_IDX_VERB;
-		const unsigned int payloadLen = size() - ZT_PACKET_IDX_VERB;
-		if (encryptPayload)
-			s20.crypt12(payload,payload,payloadLen);
-		uint64_t mac[2];
-		Poly1305::compute(mac,payload,payloadLen,macKey);
-		ZT_FAST_MEMCPY(data + ZT_PACKET_IDX_MAC,mac,8);
+		Poly1305 poly(macKey);
+		if (encryptPayload) {
+			for(unsigned int i=0;i<payloadLen;i+=ZT_PACKET_CRYPTO_CHUNK_SIZE) {
+				const unsigned int n = std::min(payloadLen - i,(unsigned int)ZT_PACKET_CRYPTO_CHUNK_SIZE);
+				s20.crypt12(payload + i,payload + i,n);
+				poly.update(payload + i,n);
+			}
+		} else {
+			poly.update(payload,payloadLen);
+		}
+		poly.finish(mac);
 	}
+	ZT_FAST_MEMCPY(data + ZT_PACKET_IDX_MAC,mac,8);
 }
 
 bool Packet::dearmor(const void *key)
@@ -935,35 +959,65 @@ bool Packet::dearmor(const void *key)
 
 	if ((cs == ZT_PROTO_CIPHER_SUITE__C25519_POLY1305_NONE)||(cs == ZT_PROTO_CIPHER_SUITE__C25519_POLY1305_SALSA2012)) {
 		_salsa20MangleKey((const unsigned char *)key,mangledKey);
+
+		// Authenticate and decrypt in one sweep like armor(): each chunk of
+		// ciphertext is fed to Poly1305 and then decrypted in place. If the
+		// MAC turns out to be wrong the key stream is applied again so that a
+		// rejected packet is left exactly as it was received.
+		const bool decrypt = (cs == ZT_PROTO_CIPHER_SUITE__C25519_POLY1305_SALSA2012);
+		uint64_t mac[2];
 		if (ZT_HAS_FAST_CRYPTO()) {
+			// The ASM kernel can't resume mid-stream, so its key stream is made in one call
 			uint64_t keyStream[(ZT_PROTO_MAX_PACKET_LENGTH + 64 + 8) / 8];
-			ZT_FAST_SINGLE_PASS_SALSA2012(keyStream,((cs == ZT_PROTO_CIPHER_SUITE__C25519_POLY1305_SALSA2012) ? (payloadLen + 64) : 64),(data + ZT_PACKET_IDX_IV),mangledKey);
-			uint64_t mac[2];
-			Poly1305::compute(mac,payload,payloadLen,keyStream);
+			ZT_FAST_SINGLE_PASS_SALSA2012(keyStream,((decrypt) ? (payloadLen + 64) : 64),(data + ZT_PACKET_IDX_IV),mangledKey);
+			Poly1305 poly(keyStream);
+			const uint8_t *const ks = reinterpret_cast<const uint8_t *>(keyStream + 8);
+			if (decrypt) {
+				for(unsigned int i=0;i<payloadLen;i+=ZT_PACKET_CRYPTO_CHUNK_SIZE) {
+					const unsigned int n = std::min(payloadLen - i,(unsigned int)ZT_PACKET_CRYPTO_CHUNK_SIZE);
+					poly.update(payload + i,n);
+					Salsa20::memxor(payload + i,ks + i,n);
+				}
+			} else {
+				poly.update(payload,payloadLen);
+			}
+			poly.finish(mac);
 #ifdef ZT_NO_TYPE_PUNNING
-			if (!Utils::secureEq(mac,data + ZT_PACKET_IDX_MAC,8))
-				return false;
+			if (!Utils::secureEq(mac,data + ZT_PACKET_IDX_MAC,8)) {
 #else
-			if ((*reinterpret_cast<const uint64_t *>(data + ZT_PACKET_IDX_MAC)) != mac[0]) // also secure, constant time
-				return false;
+			if ((*reinterpret_cast<const uint64_t *>(data + ZT_PACKET_IDX_MAC)) != mac[0]) { // also secure, constant time
 #endif
-			if (cs == ZT_PROTO_CIPHER_SUITE__C25519_POLY1305_SALSA2012)
-				Salsa20::memxor(data + ZT_PACKET_IDX_VERB,reinterpret_cast<const uint8_t *>(keyStream + 8),payloadLen);
+				if (decrypt)
+					Salsa20::memxor(payload,ks,payloadLen);
+				return false;
+			}
 		} else {
 			Salsa20 s20(mangledKey,data + ZT_PACKET_IDX_IV);
 			uint64_t macKey[4];
 			s20.crypt12(ZERO_KEY,macKey,sizeof(macKey));
-			uint64_t mac[2];
-			Poly1305::compute(mac,payload,payloadLen,macKey);
+			Poly1305 poly(macKey);
+			if (decrypt) {
+				for(unsigned int i=0;i<payloadLen;i+=ZT_PACKET_CRYPTO_CHUNK_SIZE) {
+					const unsigned int n = std::min(payloadLen - i,(unsigned int)ZT_PACKET_CRYPTO_CHUNK_SIZE);
+					poly.update(payload + i,n);
+					s20.crypt12(payload + i,payload + i,n);
+				}
+			} else {
+				poly.update(payload,payloadLen);
+			}
+			poly.finish(mac);
 #ifdef ZT_NO_TYPE_PUNNING
-			if (!Utils::secureEq(mac,data + ZT_PACKET_IDX_MAC,8))
-				return false;
+			if (!Utils::secureEq(mac,data + ZT_PACKET_IDX_MAC,8)) {
 #else
-			if ((*reinterpret_cast<const uint64_t *>(data + ZT_PACKET_IDX_MAC)) != mac[0]) // also secure, constant time
-				return false;
+			if ((*reinterpret_cast<const uint64_t *>(data + ZT_PACKET_IDX_MAC)) != mac[0]) { // also secure, constant time
 #endif
-			if (cs == ZT_PROTO_CIPHER_SUITE__C25519_POLY1305_SALSA2012)
-				s20.crypt12(payload,payload,payloadLen);
+				if (decrypt) {
+					Salsa20 undo(mangledKey,data + ZT_PACKET_IDX_IV);
+					undo.crypt12(ZERO_KEY,macKey,sizeof(macKey)); // skip the block used for the MAC key
+					undo.crypt12(payload,payload,payloadLen);
+				}
+				return false;
+			}
 		}
 
 		return true;
@@ -985,11 +1039,12 @@ void Packet::cryptField(const void *key,unsigned int start,unsigned int len)
 bool Packet::compress()
 {
 	char *const data = reinterpret_cast<char *>(unsafeData());
-	char buf[ZT_PROTO_MAX_PACKET_LENGTH * 2];
+	char buf[ZT_PROTO_MAX_PACKET_LENGTH];
 
 	if ((!compressed())&&(size() > (ZT_PACKET_IDX_PAYLOAD + 64))) { // don't bother compressing tiny packets
 		int pl = (int)(size() - ZT_PACKET_IDX_PAYLOAD);
-		int cl = LZ4_compress_fast(data + ZT_PACKET_IDX_PAYLOAD,buf,pl,ZT_PROTO_MAX_PACKET_LENGTH * 2,2);
+		// Limiting output to less than the input makes LZ4 give up early on incompressible data
+		int cl = LZ4_compress_fast(data + ZT_PACKET_IDX_PAYLOAD,buf,pl,pl - 1,2);
 		if ((cl > 0)&&(cl < pl)) {
 			data[ZT_PACKET_IDX_VERB] |= (char)ZT_PROTO_VERB_FLAG_COMPRESSED;
 			setSize((unsigned int)cl + ZT_PACKET_IDX_PAYLOAD);
@@ -1002,6 +1057,51 @@ bool Packet::compress()
 	return false;
 }
 
+// Staging is possible if LZ4 output limited to one byte less than the
+// payload can't reach the staged copy at the end of the buffer.
+static inline bool _canStage(const unsigned int payloadLen,const unsigned int capacity)
+{
+	return (((payloadLen * 2) - 1) <= (capacity - ZT_PACKET_IDX_PAYLOAD));
+}
+
+void *Packet::appendStaged(unsigned int len)
+{
+	const unsigned int pl = (size() - ZT_PACKET_IDX_PAYLOAD) + len;
+	if (_canStage(pl,capacity())) {
+		uint8_t *const data = reinterpret_cast<uint8_t *>(unsafeData());
+		uint8_t *const stage = data + (capacity() - pl);
+		memcpy(stage,data + ZT_PACKET_IDX_PAYLOAD,size() - ZT_PACKET_IDX_PAYLOAD);
+		return (stage + (pl - len));
+	}
+	return appendField(len);
+}
+
+unsigned int Packet::finishStaged(unsigned int len,bool tryCompress)
+{
+	char *const data = reinterpret_cast<char *>(unsafeData());
+	const unsigned int pl = (size() - ZT_PACKET_IDX_PAYLOAD) + len;
+	if (_canStage(pl,capacity())) {
+		// Size hasn't changed yet, so payload is still staged at the end of the buffer
+		const char *const stage = data + (capacity() - pl);
+		if ((tryCompress)&&(pl > 64)) {
+			const int cl = LZ4_compress_fast(stage,data + ZT_PACKET_IDX_PAYLOAD,(int)pl,(int)pl - 1,2);
+			if ((cl > 0)&&(cl < (int)pl)) {
+				data[ZT_PACKET_IDX_VERB] |= (char)ZT_PROTO_VERB_FLAG_COMPRESSED;
+				setSize((unsigned int)cl + ZT_PACKET_IDX_PAYLOAD);
+				return (unsigned int)cl;
+			}
+		}
+		memmove(data + ZT_PACKET_IDX_PAYLOAD,stage,pl);
+		setSize(pl + ZT_PACKET_IDX_PAYLOAD);
+		data[ZT_PACKET_IDX_VERB] &= (char)(~ZT_PROTO_VERB_FLAG_COMPRESSED);
+		return 0;
+	}
+	// Too big to stage so it was appended normally (jumbo frames only)
+	if ((tryCompress)&&(compress()))
+		return (size() - ZT_PACKET_IDX_PAYLOAD);
+	return 0;
+}
+
 bool Packet::uncompress()
 {
 	char *const data = reinterpret_cast<char *>(unsafeData());
@@ -1242,6 +1242,10 @@ public:
 	 * for these. These are handled in IncomingPacket if the sending physical
 	 * address and MAC field match a trusted path.
 	 *
+	 * The payload is authenticated and decrypted in one pass. If the MAC check
+	 * fails the decryption is undone, so if this returns false the packet is
+	 * left unmodified.
+	 *
 	 * @param key 32-byte key
 	 * @return False if packet is invalid or failed MAC authenticity check
 	 */
@@ -1274,6 +1278,29 @@ public:
 	 */
 	bool compress();
 
+	/**
+	 * Append len bytes of payload that will be compressed in place by finishStaged()
+	 *
+	 * If there's room, the payload so far is copied to the end of the buffer
+	 * and the new bytes go right after it, so LZ4 can later write straight to
+	 * the payload's real position without a temporary buffer. Otherwise this
+	 * is a plain append. Nothing else may be appended until finishStaged().
+	 *
+	 * @param len Number of bytes the caller will write at the returned pointer
+	 * @return Pointer to write len bytes of payload to
+	 * @throws std::out_of_range Packet would exceed capacity
+	 */
+	void *appendStaged(unsigned int len);
+
+	/**
+	 * Finish a payload started with appendStaged(), compressing it if asked
+	 *
+	 * @param len Same length given to appendStaged()
+	 * @param tryCompress If true, compress payload if this makes it smaller
+	 * @return Compressed payload length, or 0 if payload was left uncompressed
+	 */
+	unsigned int finishStaged(unsigned int len,bool tryCompress);
+
 	/**
 	 * Attempt to decompress payload if it is compressed (must be unencrypted)
 	 *
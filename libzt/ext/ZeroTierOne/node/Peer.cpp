@@ -59,7 +59,15 @@ Peer::Peer(const RuntimeEnvironment *renv,const Identity &myIdentity,const Ident
 	_vRevision(0),
 	_id(peerIdentity),
 	_directPathPushCutoffCount(0),
-	_credentialsCutoffCount(0)
+	_credentialsCutoffCount(0),
+	_compressBackoff(0),
+	_compressSkip(0),
+	_compressFramesCompressed(0),
+	_compressFramesIncompressible(0),
+	_compressFramesSkipped(0),
+	_compressBytesIn(0),
+	_compressBytesOut(0),
+	_compressBytesTried(0)
 {
 	if (!myIdentity.agree(peerIdentity,_key,ZT_PEER_SECRET_KEY_LENGTH))
 		throw ZT_EXCEPTION_INVALID_ARGUMENT;
@@ -232,6 +240,63 @@ void Peer::received(
 	}
 }
 
+bool Peer::shouldCompressFrame(const void *data,unsigned int len)
+{
+	{
+		Mutex::Lock _l(_compress_m);
+		if (_compressSkip) {
+			--_compressSkip;
+			++_compressFramesSkipped;
+			return false;
+		}
+	}
+
+	// Count distinct byte values in an evenly spaced sample of up to 64 bytes.
+	// Compressed or encrypted data looks random and hits about 90% of them,
+	// while text and most protocol headers hit far fewer.
+	const unsigned int samples = std::min(len,(unsigned int)64);
+	if (samples >= 32) {
+		const uint8_t *const p = reinterpret_cast<const uint8_t *>(data);
+		const unsigned long step = ((unsigned long)len << 16) / samples; // 16.16 fixed point
+		unsigned long pos = 0;
+		uint64_t seen[4] = { 0,0,0,0 };
+		for(unsigned int i=0;i<samples;++i,pos+=step) {
+			const unsigned int b = p[pos >> 16];
+			seen[b >> 6] |= 1ULL << (b & 63);
+		}
+		const unsigned int distinct = (unsigned int)(Utils::countBits(seen[0]) + Utils::countBits(seen[1]) + Utils::countBits(seen[2]) + Utils::countBits(seen[3]));
+		if (distinct > ((samples * 3) / 4)) {
+			Mutex::Lock _l(_compress_m);
+			++_compressFramesSkipped;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void Peer::frameCompressed(unsigned int len,unsigned int compressedLen)
+{
+	Mutex::Lock _l(_compress_m);
+	_compressBytesTried += len;
+	if (compressedLen) {
+		++_compressFramesCompressed;
+		_compressBytesIn += len;
+		_compressBytesOut += compressedLen;
+	} else {
+		++_compressFramesIncompressible;
+	}
+
+	// Back off if the probe let through something that didn't shrink by at
+	// least 1/16, since that's not worth the CPU on either end.
+	if ((compressedLen)&&(compressedLen <= (len - (len >> 4)))) {
+		_compressBackoff = 0;
+	} else {
+		_compressBackoff = (_compressBackoff) ? std::min(_compressBackoff * 2,(unsigned int)ZT_PEER_COMPRESSION_MAX_BACKOFF) : 1;
+		_compressSkip = _compressBackoff;
+	}
+}
+
 SharedPtr<Path> Peer::getBestPath(int64_t now,bool includeExpired) const
 {
 	Mutex::Lock _l(_paths_m);
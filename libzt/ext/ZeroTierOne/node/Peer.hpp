@@ -417,6 +417,45 @@ public:
 		return false;
 	}
 
+	/**
+	 * Decide whether a unicast frame payload to this peer is worth compressing
+	 *
+	 * This skips compression while backing off after incompressible frames,
+	 * and otherwise samples the payload to guess whether it's already
+	 * compressed or encrypted. Call frameCompressed() with the result if
+	 * this returns true.
+	 *
+	 * @param data Payload
+	 * @param len Length of payload
+	 * @return True to try compressing it
+	 */
+	bool shouldCompressFrame(const void *data,unsigned int len);
+
+	/**
+	 * Record the result of compressing a unicast frame payload
+	 *
+	 * @param len Uncompressed payload length
+	 * @param compressedLen Compressed payload length or 0 if it didn't get smaller
+	 */
+	void frameCompressed(unsigned int len,unsigned int compressedLen);
+
+	/**
+	 * Get unicast frame compression statistics
+	 *
+	 * @param s Structure to fill
+	 */
+	inline void compressionStats(ZT_PeerCompressionStats &s) const
+	{
+		Mutex::Lock _l(_compress_m);
+		s.framesCompressed = _compressFramesCompressed;
+		s.framesIncompressible = _compressFramesIncompressible;
+		s.framesSkipped = _compressFramesSkipped;
+		s.bytesIn = _compressBytesIn;
+		s.bytesOut = _compressBytesOut;
+		s.bytesTried = _compressBytesTried;
+		s.backoff = _compressBackoff;
+	}
+
 	/**
 	 * Serialize a peer for storage in local cache
 	 *
@@ -529,6 +568,18 @@ private:
 	unsigned int _directPathPushCutoffCount;
 	unsigned int _credentialsCutoffCount;
 
+	// Adaptive unicast frame compression (see shouldCompressFrame()), frames
+	// to one peer can be sent from several threads at once so this is locked
+	unsigned int _compressBackoff; // frames skipped after the last incompressible one, 0 if compressing
+	unsigned int _compressSkip; // frames left to skip
+	uint64_t _compressFramesCompressed;
+	uint64_t _compressFramesIncompressible;
+	uint64_t _compressFramesSkipped;
+	uint64_t _compressBytesIn; // uncompressed size of frames sent compressed
+	uint64_t _compressBytesOut; // compressed size of frames sent compressed
+	uint64_t _compressBytesTried; // everything run through LZ4, i.e. what compression has cost
+	Mutex _compress_m;
+
 	AtomicCounter __refCount;
 };
 
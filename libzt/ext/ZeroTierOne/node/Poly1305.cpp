@@ -12,6 +12,10 @@ Public domain.
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef ZT_POLY1305_AVX2
+#include <immintrin.h>
+#endif
+
 #ifdef __WINDOWS__
 #pragma warning(disable: 4146)
 #endif
@@ -131,7 +135,7 @@ namespace {
 
 typedef struct poly1305_context {
   size_t aligner;
-  unsigned char opaque[136];
+  unsigned char opaque[(ZT_POLY1305_STATE_SIZE * 8) - sizeof(size_t)];
 } poly1305_context;
 
 #if (defined(_MSC_VER) || defined(__GNUC__)) && (defined(__amd64) || defined(__amd64__) || defined(__x86_64) || defined(__x86_64__) || defined(__AMD64) || defined(__AMD64__) || defined(_M_X64))
@@ -172,7 +176,7 @@ typedef struct poly1305_context {
 
 #define poly1305_block_size 16
 
-/* 17 + sizeof(size_t) + 8*sizeof(unsigned long long) */
+/* 18 + sizeof(size_t) + 28*sizeof(unsigned long long) */
 typedef struct poly1305_state_internal_t {
   unsigned long long r[3];
   unsigned long long h[3];
@@ -180,6 +184,8 @@ typedef struct poly1305_state_internal_t {
   size_t leftover;
   unsigned char buffer[poly1305_block_size];
   unsigned char final;
+  unsigned char rpowready; /* rpow[] computed (AVX2 only) */
+  unsigned long long rpow[4][5]; /* r^1..r^4 in 26-bit limbs (AVX2 only) */
 } poly1305_state_internal_t;
 
 #if defined(ZT_NO_TYPE_PUNNING) || (__BYTE_ORDER != __LITTLE_ENDIAN)
@@ -239,6 +245,7 @@ poly1305_init(poly1305_context *ctx, const unsigned char key[32]) {
 
   st->leftover = 0;
   st->final = 0;
+  st->rpowready = 0;
 }
 
 static inline void
@@ -362,8 +369,164 @@ poly1305_finish(poly1305_context *ctx, unsigned char mac[16]) {
   st->r[2] = 0;
   st->pad[0] = 0;
   st->pad[1] = 0;
+  if (st->rpowready) {
+    st->rpowready = 0;
+    memset(st->rpow, 0, sizeof(st->rpow));
+  }
+}
+
+#ifdef ZT_POLY1305_AVX2
+
+//////////////////////////////////////////////////////////////////////////////
+// 4-way AVX2 block function using 26-bit limbs
+//
+// Lane j accumulates blocks j, j+4, j+8, ... as h_j = h_j*r^4 + m, and the
+// lanes are folded back together at the end by multiplying them by r^4,
+// r^3, r^2 and r respectively. The result is handed back to the scalar
+// code in its 44-bit limb representation.
+
+#define POLY1305_AVX2 __attribute__((target("avx2")))
+
+/* o = a * b (partially reduced), all in 44-bit limbs */
+static inline void
+poly1305_mul44(unsigned long long o[3], const unsigned long long a[3], const unsigned long long b[3]) {
+  const unsigned long long s1 = b[1] * (5 << 2);
+  const unsigned long long s2 = b[2] * (5 << 2);
+  unsigned long long c;
+  uint128_t d0,d1,d2,d;
+  MUL(d0, a[0], b[0]); MUL(d, a[1], s2); ADD(d0, d); MUL(d, a[2], s1); ADD(d0, d);
+  MUL(d1, a[0], b[1]); MUL(d, a[1], b[0]); ADD(d1, d); MUL(d, a[2], s2); ADD(d1, d);
+  MUL(d2, a[0], b[2]); MUL(d, a[1], b[1]); ADD(d2, d); MUL(d, a[2], b[0]); ADD(d2, d);
+                c = SHR(d0, 44); o[0] = LO(d0) & 0xfffffffffff;
+  ADDLO(d1, c); c = SHR(d1, 44); o[1] = LO(d1) & 0xfffffffffff;
+  ADDLO(d2, c); c = SHR(d2, 42); o[2] = LO(d2) & 0x3ffffffffff;
+  o[0] += c * 5; c = (o[0] >> 44); o[0] &= 0xfffffffffff;
+  o[1] += c;
+}
+
+/* 44-bit limbs to 26-bit limbs (top limb may exceed 26 bits slightly) */
+static inline void
+poly1305_44to26(unsigned long long o[5], const unsigned long long a[3]) {
+  unsigned long long a0 = a[0], a1 = a[1], a2 = a[2], c;
+  c = (a0 >> 44); a0 &= 0xfffffffffff; a1 += c;
+  c = (a1 >> 44); a1 &= 0xfffffffffff; a2 += c;
+  o[0] = ( a0                ) & 0x3ffffff;
+  o[1] = ((a0 >> 26) | (a1 << 18)) & 0x3ffffff;
+  o[2] = ( a1 >>  8          ) & 0x3ffffff;
+  o[3] = ((a1 >> 34) | (a2 << 10)) & 0x3ffffff;
+  o[4] = ( a2 >> 16          );
+}
+
+/* h = h * r (partially reduced), 4 lanes of 26-bit limbs; s[i] = r[i] * 5 */
+static inline POLY1305_AVX2 void
+poly1305_avx2_mul(__m256i h[5], const __m256i r[5], const __m256i s[5]) {
+  const __m256i mask = _mm256_set1_epi64x(0x3ffffff);
+  __m256i d0,d1,d2,d3,d4,c;
+  d0 = _mm256_add_epi64(_mm256_add_epi64(_mm256_add_epi64(_mm256_add_epi64(_mm256_mul_epu32(h[0],r[0]),_mm256_mul_epu32(h[1],s[4])),_mm256_mul_epu32(h[2],s[3])),_mm256_mul_epu32(h[3],s[2])),_mm256_mul_epu32(h[4],s[1]));
+  d1 = _mm256_add_epi64(_mm256_add_epi64(_mm256_add_epi64(_mm256_add_epi64(_mm256_mul_epu32(h[0],r[1]),_mm256_mul_epu32(h[1],r[0])),_mm256_mul_epu32(h[2],s[4])),_mm256_mul_epu32(h[3],s[3])),_mm256_mul_epu32(h[4],s[2]));
+  d2 = _mm256_add_epi64(_mm256_add_epi64(_mm256_add_epi64(_mm256_add_epi64(_mm256_mul_epu32(h[0],r[2]),_mm256_mul_epu32(h[1],r[1])),_mm256_mul_epu32(h[2],r[0])),_mm256_mul_epu32(h[3],s[4])),_mm256_mul_epu32(h[4],s[3]));
+  d3 = _mm256_add_epi64(_mm256_add_epi64(_mm256_add_epi64(_mm256_add_epi64(_mm256_mul_epu32(h[0],r[3]),_mm256_mul_epu32(h[1],r[2])),_mm256_mul_epu32(h[2],r[1])),_mm256_mul_epu32(h[3],r[0])),_mm256_mul_epu32(h[4],s[4]));
+  d4 = _mm256_add_epi64(_mm256_add_epi64(_mm256_add_epi64(_mm256_add_epi64(_mm256_mul_epu32(h[0],r[4]),_mm256_mul_epu32(h[1],r[3])),_mm256_mul_epu32(h[2],r[2])),_mm256_mul_epu32(h[3],r[1])),_mm256_mul_epu32(h[4],r[0]));
+                              c = _mm256_srli_epi64(d0,26); h[0] = _mm256_and_si256(d0,mask);
+  d1 = _mm256_add_epi64(d1,c); c = _mm256_srli_epi64(d1,26); h[1] = _mm256_and_si256(d1,mask);
+  d2 = _mm256_add_epi64(d2,c); c = _mm256_srli_epi64(d2,26); h[2] = _mm256_and_si256(d2,mask);
+  d3 = _mm256_add_epi64(d3,c); c = _mm256_srli_epi64(d3,26); h[3] = _mm256_and_si256(d3,mask);
+  d4 = _mm256_add_epi64(d4,c); c = _mm256_srli_epi64(d4,26); h[4] = _mm256_and_si256(d4,mask);
+  h[0] = _mm256_add_epi64(h[0],_mm256_add_epi64(c,_mm256_slli_epi64(c,2)));
+  c = _mm256_srli_epi64(h[0],26); h[0] = _mm256_and_si256(h[0],mask);
+  h[1] = _mm256_add_epi64(h[1],c);
+}
+
+/* h += four message blocks at m, one per lane */
+static inline POLY1305_AVX2 void
+poly1305_avx2_add(__m256i h[5], const unsigned char *m) {
+  const __m256i mask = _mm256_set1_epi64x(0x3ffffff);
+  const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(m));
+  const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(m + 32));
+  const __m256i t0 = _mm256_permute4x64_epi64(_mm256_unpacklo_epi64(a,b),0xd8);
+  const __m256i t1 = _mm256_permute4x64_epi64(_mm256_unpackhi_epi64(a,b),0xd8);
+  h[0] = _mm256_add_epi64(h[0],_mm256_and_si256(t0,mask));
+  h[1] = _mm256_add_epi64(h[1],_mm256_and_si256(_mm256_srli_epi64(t0,26),mask));
+  h[2] = _mm256_add_epi64(h[2],_mm256_and_si256(_mm256_or_si256(_mm256_srli_epi64(t0,52),_mm256_slli_epi64(t1,12)),mask));
+  h[3] = _mm256_add_epi64(h[3],_mm256_and_si256(_mm256_srli_epi64(t1,14),mask));
+  h[4] = _mm256_add_epi64(h[4],_mm256_or_si256(_mm256_srli_epi64(t1,40),_mm256_set1_epi64x(1 << 24)));
+}
+
+/* process bytes (a multiple of 64) of non-final blocks */
+static POLY1305_AVX2 void
+poly1305_blocks_avx2(poly1305_state_internal_t *st, const unsigned char *m, size_t bytes) {
+  unsigned long long lh[5];
+  __m256i h[5],r[5],s[5];
+
+  /* powers of r are computed once per key, since update() may be called per chunk */
+  if (!st->rpowready) {
+    unsigned long long r1[3],r2[3],r3[3],r4[3];
+    r1[0] = st->r[0]; r1[1] = st->r[1]; r1[2] = st->r[2];
+    poly1305_mul44(r2, r1, r1);
+    poly1305_mul44(r3, r2, r1);
+    poly1305_mul44(r4, r2, r2);
+    poly1305_44to26(st->rpow[0], r1);
+    poly1305_44to26(st->rpow[1], r2);
+    poly1305_44to26(st->rpow[2], r3);
+    poly1305_44to26(st->rpow[3], r4);
+    st->rpowready = 1;
+  }
+  const unsigned long long *const l1 = st->rpow[0];
+  const unsigned long long *const l2 = st->rpow[1];
+  const unsigned long long *const l3 = st->rpow[2];
+  const unsigned long long *const l4 = st->rpow[3];
+  poly1305_44to26(lh, st->h);
+
+  /* lane 0 carries in the running h */
+  for (int i = 0; i < 5; i++)
+    h[i] = _mm256_set_epi64x(0, 0, 0, (long long)lh[i]);
+  poly1305_avx2_add(h, m);
+  m += 64;
+  bytes -= 64;
+
+  for (int i = 0; i < 5; i++) {
+    r[i] = _mm256_set1_epi64x((long long)l4[i]);
+    s[i] = _mm256_set1_epi64x((long long)(l4[i] * 5));
+  }
+  while (bytes >= 64) {
+    poly1305_avx2_mul(h, r, s);
+    poly1305_avx2_add(h, m);
+    m += 64;
+    bytes -= 64;
+  }
+
+  for (int i = 0; i < 5; i++) {
+    r[i] = _mm256_set_epi64x((long long)l1[i], (long long)l2[i], (long long)l3[i], (long long)l4[i]);
+    s[i] = _mm256_set_epi64x((long long)(l1[i] * 5), (long long)(l2[i] * 5), (long long)(l3[i] * 5), (long long)(l4[i] * 5));
+  }
+  poly1305_avx2_mul(h, r, s);
+
+  /* sum lanes and convert back to 44-bit limbs */
+  unsigned long long t[5],c;
+  for (int i = 0; i < 5; i++) {
+    unsigned long long lanes[4];
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes), h[i]);
+    t[i] = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+  }
+               c = (t[0] >> 26); t[0] &= 0x3ffffff;
+  t[1] += c;   c = (t[1] >> 26); t[1] &= 0x3ffffff;
+  t[2] += c;   c = (t[2] >> 26); t[2] &= 0x3ffffff;
+  t[3] += c;   c = (t[3] >> 26); t[3] &= 0x3ffffff;
+  t[4] += c;   c = (t[4] >> 26); t[4] &= 0x3ffffff;
+  t[0] += c * 5;
+  c = t[0] + (t[1] << 26);           st->h[0] = c & 0xfffffffffff;
+  c = (c >> 44) + (t[2] << 8) + (t[3] << 34); st->h[1] = c & 0xfffffffffff;
+  st->h[2] = (c >> 44) + (t[4] << 16);
+}
+
+static inline bool
+poly1305_cpu_has_avx2() {
+  __builtin_cpu_init();
+  return (__builtin_cpu_supports("avx2") != 0);
 }
 
+#endif // ZT_POLY1305_AVX2
+
 //////////////////////////////////////////////////////////////////////////////
 
 #else
@@ -603,6 +766,16 @@ poly1305_update(poly1305_context *ctx, const unsigned char *m, size_t bytes) {
     st->leftover = 0;
   }
 
+#ifdef ZT_POLY1305_AVX2
+  /* process groups of four blocks in parallel */
+  if ((bytes >= 256)&&(Poly1305::useAVX2)) {
+    size_t want = (bytes & ~(size_t)63);
+    poly1305_blocks_avx2(st, m, want);
+    m += want;
+    bytes -= want;
+  }
+#endif
+
   /* process full blocks */
   if (bytes >= poly1305_block_size) {
     size_t want = (bytes & ~(poly1305_block_size - 1));
@@ -621,6 +794,10 @@ poly1305_update(poly1305_context *ctx, const unsigned char *m, size_t bytes) {
 
 } // anonymous namespace
 
+#ifdef ZT_POLY1305_AVX2
+bool Poly1305::useAVX2 = poly1305_cpu_has_avx2();
+#endif
+
 void Poly1305::compute(void *auth,const void *data,unsigned int len,const void *key)
 {
   poly1305_context ctx;
@@ -629,4 +806,19 @@ void Poly1305::compute(void *auth,const void *data,unsigned int len,const void *
   poly1305_finish(&ctx,reinterpret_cast<unsigned char *>(auth));
 }
 
+void Poly1305::init(const void *key)
+{
+  poly1305_init(reinterpret_cast<poly1305_context *>(_state),reinterpret_cast<const unsigned char *>(key));
+}
+
+void Poly1305::update(const void *data,unsigned int len)
+{
+  poly1305_update(reinterpret_cast<poly1305_context *>(_state),reinterpret_cast<const unsigned char *>(data),(size_t)len);
+}
+
+void Poly1305::finish(void *auth)
+{
+  poly1305_finish(reinterpret_cast<poly1305_context *>(_state),reinterpret_cast<unsigned char *>(auth));
+}
+
 } // namespace ZeroTier
@@ -27,11 +27,21 @@
 #ifndef ZT_POLY1305_HPP
 #define ZT_POLY1305_HPP
 
+#include <stdint.h>
+
+// 4-way AVX2 block function, compiled in on x64 GCC/clang and selected at runtime
+#if (!defined(ZT_POLY1305_AVX2)) && (!defined(ZT_POLY1305_NO_AVX2)) && defined(__GNUC__) && defined(__SIZEOF_INT128__) && (defined(__x86_64__) || defined(__amd64__))
+#define ZT_POLY1305_AVX2 1
+#endif
+
 namespace ZeroTier {
 
 #define ZT_POLY1305_KEY_LEN 32
 #define ZT_POLY1305_MAC_LEN 16
 
+// Size of incremental MAC state in 64-bit words
+#define ZT_POLY1305_STATE_SIZE 40
+
 /**
  * Poly1305 one-time authentication code
  *
@@ -46,6 +56,38 @@ namespace ZeroTier {
 class Poly1305
 {
 public:
+	Poly1305() {}
+
+	/**
+	 * @param key 32-byte one-time use key (must not be reused)
+	 */
+	Poly1305(const void *key) { init(key); }
+
+	/**
+	 * Start computing a new authentication code incrementally
+	 *
+	 * @param key 32-byte one-time use key (must not be reused)
+	 */
+	void init(const void *key);
+
+	/**
+	 * Authenticate more data
+	 *
+	 * Data may be fed in pieces of any size, though multiples of 16 bytes
+	 * (and 64 for the AVX2 code) avoid buffering.
+	 *
+	 * @param data Data to authenticate
+	 * @param len Length of data in bytes
+	 */
+	void update(const void *data,unsigned int len);
+
+	/**
+	 * Finish and output authentication code (also wipes key material)
+	 *
+	 * @param auth Buffer to receive code -- MUST be 16 bytes in length
+	 */
+	void finish(void *auth);
+
 	/**
 	 * Compute a one-time authentication code
 	 *
@@ -55,6 +97,19 @@ public:
 	 * @param key 32-byte one-time use key to authenticate data (must not be reused)
 	 */
 	static void compute(void *auth,const void *data,unsigned int len,const void *key);
+
+#ifdef ZT_POLY1305_AVX2
+	/**
+	 * Use 4-way AVX2 code for inputs of 256 bytes or more
+	 *
+	 * This is set at startup if CPUID reports AVX2 and may be cleared to
+	 * force the scalar code path (e.g. for benchmarking).
+	 */
+	static bool useAVX2;
+#endif
+
+private:
+	uint64_t _state[ZT_POLY1305_STATE_SIZE];
 };
 
 } // namespace ZeroTier
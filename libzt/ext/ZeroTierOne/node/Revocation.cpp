@@ -34,7 +34,7 @@
 
 namespace ZeroTier {
 
-int Revocation::verify(const RuntimeEnvironment *RR,void *tPtr) const
+int Revocation::verify(const RuntimeEnvironment *RR,void *tPtr,C25519::VerifyBatch *batch) const
 {
 	if ((!_signedBy)||(_signedBy != Network::controllerFor(_networkId)))
 		return -1;
@@ -46,7 +46,7 @@ int Revocation::verify(const RuntimeEnvironment *RR,void *tPtr) const
 	try {
 		Buffer<sizeof(Revocation) + 64> tmp;
 		this->serialize(tmp,true);
-		return (id.verify(tmp.data(),tmp.size(),_signature) ? 0 : -1);
+		return (id.verify(tmp.data(),tmp.size(),_signature,batch) ? 0 : -1);
 	} catch ( ... ) {
 		return -1;
 	}
@@ -43,6 +43,7 @@ class Multicaster;
 class NetworkController;
 class SelfAwareness;
 class Trace;
+class IdentityValidator;
 
 /**
  * Holds global state for an instance of ZeroTier::Node
@@ -54,10 +55,12 @@ public:
 		node(n)
 		,localNetworkController((NetworkController *)0)
 		,rtmem((void *)0)
+		,t((Trace *)0)
 		,sw((Switch *)0)
 		,mc((Multicaster *)0)
 		,topology((Topology *)0)
 		,sa((SelfAwareness *)0)
+		,iv((IdentityValidator *)0)
 	{
 		publicIdentityStr[0] = (char)0;
 		secretIdentityStr[0] = (char)0;
@@ -88,6 +91,7 @@ public:
 	Multicaster *mc;
 	Topology *topology;
 	SelfAwareness *sa;
+	IdentityValidator *iv; // NULL if HELLOs from new peers are validated inline
 
 	// This node's identity and string representations thereof
 	Identity identity;
@@ -64,8 +64,158 @@ public:
 static const _s20sseconsts _S20SSECONSTANTS;
 #endif
 
+#ifdef ZT_SALSA20_AVX2
+#include <immintrin.h>
+
+#define ZT_S20_AVX2 __attribute__((target("avx2")))
+#define ZT_S20_AVX2_R(a,b,c,r) { const __m256i _t = _mm256_add_epi32(b,c); a = _mm256_xor_si256(a,_mm256_or_si256(_mm256_slli_epi32(_t,r),_mm256_srli_epi32(_t,32 - r))); }
+
+// Word order of the SSE state layout relative to standard Salsa20 state order
+static const unsigned int _S20AVX2_SSE_TO_STD[16] = { 0,5,10,15,4,9,14,3,8,13,2,7,12,1,6,11 };
+
+// 8x8 transpose of 32-bit words: on return v[b] holds block b's words
+static inline ZT_S20_AVX2 void _s20Avx2Transpose(__m256i *v)
+{
+	const __m256i t0 = _mm256_unpacklo_epi32(v[0],v[1]);
+	const __m256i t1 = _mm256_unpackhi_epi32(v[0],v[1]);
+	const __m256i t2 = _mm256_unpacklo_epi32(v[2],v[3]);
+	const __m256i t3 = _mm256_unpackhi_epi32(v[2],v[3]);
+	const __m256i t4 = _mm256_unpacklo_epi32(v[4],v[5]);
+	const __m256i t5 = _mm256_unpackhi_epi32(v[4],v[5]);
+	const __m256i t6 = _mm256_unpacklo_epi32(v[6],v[7]);
+	const __m256i t7 = _mm256_unpackhi_epi32(v[6],v[7]);
+	const __m256i u0 = _mm256_unpacklo_epi64(t0,t2);
+	const __m256i u1 = _mm256_unpackhi_epi64(t0,t2);
+	const __m256i u2 = _mm256_unpacklo_epi64(t1,t3);
+	const __m256i u3 = _mm256_unpackhi_epi64(t1,t3);
+	const __m256i u4 = _mm256_unpacklo_epi64(t4,t6);
+	const __m256i u5 = _mm256_unpackhi_epi64(t4,t6);
+	const __m256i u6 = _mm256_unpacklo_epi64(t5,t7);
+	const __m256i u7 = _mm256_unpackhi_epi64(t5,t7);
+	v[0] = _mm256_permute2x128_si256(u0,u4,0x20);
+	v[1] = _mm256_permute2x128_si256(u1,u5,0x20);
+	v[2] = _mm256_permute2x128_si256(u2,u6,0x20);
+	v[3] = _mm256_permute2x128_si256(u3,u7,0x20);
+	v[4] = _mm256_permute2x128_si256(u0,u4,0x31);
+	v[5] = _mm256_permute2x128_si256(u1,u5,0x31);
+	v[6] = _mm256_permute2x128_si256(u2,u6,0x31);
+	v[7] = _mm256_permute2x128_si256(u3,u7,0x31);
+}
+
+// XOR 512 bytes (8 blocks starting at block counter ctr) of Salsa20/ROUNDS keystream from m into c
+template<unsigned int ROUNDS>
+static ZT_S20_AVX2 void _s20Avx2Blocks8(const uint32_t *const st,const uint64_t ctr,const uint8_t *const m,uint8_t *const c)
+{
+	__m256i x[16],j[16];
+	for(unsigned int k=0;k<16;++k)
+		j[k] = _mm256_set1_epi32((int)st[k]);
+	{
+		uint32_t lo[8],hi[8];
+		for(unsigned int b=0;b<8;++b) {
+			lo[b] = (uint32_t)(ctr + b);
+			hi[b] = (uint32_t)((ctr + b) >> 32);
+		}
+		j[8] = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(lo));
+		j[9] = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(hi));
+	}
+	for(unsigned int k=0;k<16;++k)
+		x[k] = j[k];
+
+	for(unsigned int r=0;r<ROUNDS;r+=2) {
+		ZT_S20_AVX2_R(x[4],x[0],x[12],7);
+		ZT_S20_AVX2_R(x[8],x[4],x[0],9);
+		ZT_S20_AVX2_R(x[12],x[8],x[4],13);
+		ZT_S20_AVX2_R(x[0],x[12],x[8],18);
+		ZT_S20_AVX2_R(x[9],x[5],x[1],7);
+		ZT_S20_AVX2_R(x[13],x[9],x[5],9);
+		ZT_S20_AVX2_R(x[1],x[13],x[9],13);
+		ZT_S20_AVX2_R(x[5],x[1],x[13],18);
+		ZT_S20_AVX2_R(x[14],x[10],x[6],7);
+		ZT_S20_AVX2_R(x[2],x[14],x[10],9);
+		ZT_S20_AVX2_R(x[6],x[2],x[14],13);
+		ZT_S20_AVX2_R(x[10],x[6],x[2],18);
+		ZT_S20_AVX2_R(x[3],x[15],x[11],7);
+		ZT_S20_AVX2_R(x[7],x[3],x[15],9);
+		ZT_S20_AVX2_R(x[11],x[7],x[3],13);
+		ZT_S20_AVX2_R(x[15],x[11],x[7],18);
+
+		ZT_S20_AVX2_R(x[1],x[0],x[3],7);
+		ZT_S20_AVX2_R(x[2],x[1],x[0],9);
+		ZT_S20_AVX2_R(x[3],x[2],x[1],13);
+		ZT_S20_AVX2_R(x[0],x[3],x[2],18);
+		ZT_S20_AVX2_R(x[6],x[5],x[4],7);
+		ZT_S20_AVX2_R(x[7],x[6],x[5],9);
+		ZT_S20_AVX2_R(x[4],x[7],x[6],13);
+		ZT_S20_AVX2_R(x[5],x[4],x[7],18);
+		ZT_S20_AVX2_R(x[11],x[10],x[9],7);
+		ZT_S20_AVX2_R(x[8],x[11],x[10],9);
+		ZT_S20_AVX2_R(x[9],x[8],x[11],13);
+		ZT_S20_AVX2_R(x[10],x[9],x[8],18);
+		ZT_S20_AVX2_R(x[12],x[15],x[14],7);
+		ZT_S20_AVX2_R(x[13],x[12],x[15],9);
+		ZT_S20_AVX2_R(x[14],x[13],x[12],13);
+		ZT_S20_AVX2_R(x[15],x[14],x[13],18);
+	}
+
+	for(unsigned int k=0;k<16;++k)
+		x[k] = _mm256_add_epi32(x[k],j[k]);
+	_s20Avx2Transpose(x);
+	_s20Avx2Transpose(x + 8);
+	for(unsigned int b=0;b<8;++b) {
+		const __m256i *const mb = reinterpret_cast<const __m256i *>(m + (b * 64));
+		__m256i *const cb = reinterpret_cast<__m256i *>(c + (b * 64));
+		_mm256_storeu_si256(cb,_mm256_xor_si256(x[b],_mm256_loadu_si256(mb)));
+		_mm256_storeu_si256(cb + 1,_mm256_xor_si256(x[b + 8],_mm256_loadu_si256(mb + 1)));
+	}
+}
+
+// Encrypt as much of bytes as is worth doing 8 blocks at a time, returning bytes left for the SSE loop
+template<unsigned int ROUNDS>
+static inline unsigned int _s20Avx2Crypt(uint32_t *const sseState,const uint8_t *&m,uint8_t *&c,unsigned int bytes)
+{
+	uint32_t st[16];
+	for(unsigned int k=0;k<16;++k)
+		st[_S20AVX2_SSE_TO_STD[k]] = sseState[k];
+	uint64_t ctr = (uint64_t)sseState[8] | ((uint64_t)sseState[5] << 32);
+
+	while (bytes >= 512) {
+		_s20Avx2Blocks8<ROUNDS>(st,ctr,m,c);
+		ctr += 8;
+		m += 512;
+		c += 512;
+		bytes -= 512;
+	}
+
+	// A tail of four or more blocks is still cheaper as one padded 8-way pass
+	if (bytes > 192) {
+		uint8_t tmp[512];
+		memcpy(tmp,m,bytes);
+		_s20Avx2Blocks8<ROUNDS>(st,ctr,tmp,tmp);
+		memcpy(c,tmp,bytes);
+		ctr += (bytes + 63) / 64;
+		m += bytes;
+		c += bytes;
+		bytes = 0;
+	}
+
+	sseState[8] = (uint32_t)ctr;
+	sseState[5] = (uint32_t)(ctr >> 32);
+	return bytes;
+}
+
+static inline bool _s20CpuHasAvx2()
+{
+	__builtin_cpu_init();
+	return (__builtin_cpu_supports("avx2") != 0);
+}
+#endif // ZT_SALSA20_AVX2
+
 namespace ZeroTier {
 
+#ifdef ZT_SALSA20_AVX2
+bool Salsa20::useAVX2 = _s20CpuHasAvx2();
+#endif
+
 void Salsa20::init(const void *key,const void *iv)
 {
 #ifdef ZT_SALSA20_SSE
@@ -121,6 +271,11 @@ void Salsa20::crypt12(const void *in,void *out,unsigned int bytes)
 	uint32_t j0, j1, j2, j3, j4, j5, j6, j7, j8, j9, j10, j11, j12, j13, j14, j15;
 #endif
 
+#ifdef ZT_SALSA20_AVX2
+	if ((bytes > 192)&&(useAVX2))
+		bytes = _s20Avx2Crypt<12>(_state.i,m,c,bytes);
+#endif
+
 	if (!bytes)
 		return;
 
@@ -620,6 +775,11 @@ void Salsa20::crypt20(const void *in,void *out,unsigned int bytes)
 	uint32_t j0, j1, j2, j3, j4, j5, j6, j7, j8, j9, j10, j11, j12, j13, j14, j15;
 #endif
 
+#ifdef ZT_SALSA20_AVX2
+	if ((bytes > 192)&&(useAVX2))
+		bytes = _s20Avx2Crypt<20>(_state.i,m,c,bytes);
+#endif
+
 	if (!bytes)
 		return;
 
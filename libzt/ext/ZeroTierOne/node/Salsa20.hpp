@@ -23,6 +23,11 @@
 #include <emmintrin.h>
 #endif // ZT_SALSA20_SSE
 
+// 8-way AVX2 keystream generation, compiled in on x64 GCC/clang and selected at runtime
+#if (!defined(ZT_SALSA20_AVX2)) && (!defined(ZT_SALSA20_NO_AVX2)) && defined(ZT_SALSA20_SSE) && defined(__GNUC__) && (defined(__x86_64__) || defined(__amd64__))
+#define ZT_SALSA20_AVX2 1
+#endif
+
 namespace ZeroTier {
 
 /**
@@ -145,6 +150,16 @@ public:
 	 */
 	void crypt20(const void *in,void *out,unsigned int bytes);
 
+#ifdef ZT_SALSA20_AVX2
+	/**
+	 * Use 8-way AVX2 code for inputs over 192 bytes
+	 *
+	 * This is set at startup if CPUID reports AVX2 and may be cleared to
+	 * force the SSE code path (e.g. for benchmarking).
+	 */
+	static bool useAVX2;
+#endif
+
 private:
 	union {
 #ifdef ZT_SALSA20_SSE
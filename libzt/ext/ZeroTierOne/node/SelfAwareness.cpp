@@ -101,7 +101,8 @@ void SelfAwareness::iam(void *tPtr,const Address &reporter,const int64_t receive
 			}
 		}
 
-		// Reset all paths within this scope and address family
+		// Reset all paths within this scope and address family (a peer expired
+		// while eachPeer() runs may still be visited, which is harmless here)
 		_ResetWithinScope rset(tPtr,now,myPhysicalAddress.ss_family,(InetAddress::IpScope)scope);
 		RR->topology->eachPeer<_ResetWithinScope &>(rset);
 	} else {
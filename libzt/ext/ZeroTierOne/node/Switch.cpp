@@ -44,6 +44,7 @@
 #include "SelfAwareness.hpp"
 #include "Packet.hpp"
 #include "Trace.hpp"
+#include "IdentityValidator.hpp"
 
 namespace ZeroTier {
 
@@ -51,10 +52,23 @@ Switch::Switch(const RuntimeEnvironment *renv) :
 	RR(renv),
 	_lastBeaconResponse(0),
 	_lastCheckedQueues(0),
+	_rxReassembled(0),
+	_rxEvicted(0),
+	_rxExpired(0),
+	_txQueueOldest((TXQueueEntry *)0),
+	_txQueueNewest((TXQueueEntry *)0),
 	_lastUniteAttempt(8) // only really used on root servers and upstreams, and it'll grow there just fine
 {
 }
 
+Switch::~Switch()
+{
+	for(std::vector< RXQueueEntry * >::iterator rq(_rxQueue.begin());rq!=_rxQueue.end();++rq)
+		delete *rq;
+	for(std::vector< TXQueueEntry * >::iterator tx(_txQueue.begin());tx!=_txQueue.end();++tx)
+		delete *tx;
+}
+
 void Switch::onRemotePacket(void *tPtr,const int64_t localSocket,const InetAddress &fromAddr,const void *data,unsigned int len)
 {
 	try {
@@ -120,36 +134,48 @@ void Switch::onRemotePacket(void *tPtr,const int64_t localSocket,const InetAddre
 						// Total fragments must be more than 1, otherwise why are we
 						// seeing a Packet::Fragment?
 
-						RXQueueEntry *const rq = _findRXQueueEntry(fragmentPacketId);
-						Mutex::Lock rql(rq->lock);
-						if (rq->packetId != fragmentPacketId) {
-							// No packet found, so we received a fragment without its head.
-
-							rq->timestamp = now;
-							rq->packetId = fragmentPacketId;
-							rq->frags[fragmentNumber - 1] = fragment;
-							rq->totalFragments = totalFragments; // total fragment count is known
-							rq->haveFragments = 1 << fragmentNumber; // we have only this fragment
-							rq->complete = false;
-						} else if (!(rq->haveFragments & (1 << fragmentNumber))) {
-							// We have other fragments and maybe the head, so add this one and check
-
-							rq->frags[fragmentNumber - 1] = fragment;
-							rq->totalFragments = totalFragments;
-
-							if (Utils::countBits(rq->haveFragments |= (1 << fragmentNumber)) == totalFragments) {
-								// We have all fragments -- assemble and process full Packet
-
-								for(unsigned int f=1;f<totalFragments;++f)
-									rq->frag0.append(rq->frags[f - 1].payload(),rq->frags[f - 1].payloadLength());
-
-								if (rq->frag0.tryDecode(RR,tPtr)) {
-									rq->timestamp = 0; // packet decoded, free entry
-								} else {
-									rq->complete = true; // set complete flag but leave entry since it probably needs WHOIS or something
+						RXQueueEntry *rq = (RXQueueEntry *)0;
+						{
+							Mutex::Lock _l(_rxQueue_m);
+							const Path::HashKey rxSource(localSocket,fromAddr);
+							RXQueueEntry **const existing = _rxQueueByPacketId.get(_RXQueueKey(fragmentPacketId,rxSource));
+							if (!existing) {
+								// No packet found, so we received a fragment without its head.
+
+								RXQueueEntry *const nrq = _rxQueueNew(now,fragmentPacketId,rxSource);
+								if (nrq) {
+									nrq->frags[fragmentNumber - 1] = fragment;
+									nrq->totalFragments = totalFragments; // total fragment count is known
+									nrq->haveFragments = 1 << fragmentNumber; // we have only this fragment
+									nrq->complete = false;
 								}
+							} else if (!((*existing)->haveFragments & (1 << fragmentNumber))) {
+								// We have other fragments and maybe the head, so add this one and check
+
+								(*existing)->frags[fragmentNumber - 1] = fragment;
+								(*existing)->totalFragments = totalFragments;
+
+								if (Utils::countBits((*existing)->haveFragments |= (1 << fragmentNumber)) == totalFragments) {
+									// We have all fragments, so take the entry out of the table to assemble and decode it
+									rq = *existing;
+									_rxQueueUnlink(rq);
+									++_rxReassembled;
+								}
+							} // else this is a duplicate fragment, ignore
+						}
+
+						if (rq) {
+							for(unsigned int f=1;f<totalFragments;++f)
+								rq->frag0.append(rq->frags[f - 1].payload(),rq->frags[f - 1].payloadLength());
+
+							if (rq->frag0.tryDecode(RR,tPtr)) {
+								Mutex::Lock _l(_rxQueue_m);
+								_rxQueueRelease(rq); // packet decoded, free entry
+							} else {
+								rq->complete = true; // set complete flag and keep entry since it probably needs WHOIS or something
+								_rxQueueRequeue(rq);
 							}
-						} // else this is a duplicate fragment, ignore
+						}
 					}
 				}
 
@@ -203,49 +229,64 @@ void Switch::onRemotePacket(void *tPtr,const int64_t localSocket,const InetAddre
 						((uint64_t)reinterpret_cast<const uint8_t *>(data)[7])
 					);
 
-					RXQueueEntry *const rq = _findRXQueueEntry(packetId);
-					Mutex::Lock rql(rq->lock);
-					if (rq->packetId != packetId) {
-						// If we have no other fragments yet, create an entry and save the head
-
-						rq->timestamp = now;
-						rq->packetId = packetId;
-						rq->frag0.init(data,len,path,now);
-						rq->totalFragments = 0;
-						rq->haveFragments = 1;
-						rq->complete = false;
-					} else if (!(rq->haveFragments & 1)) {
-						// If we have other fragments but no head, see if we are complete with the head
-
-						if ((rq->totalFragments > 1)&&(Utils::countBits(rq->haveFragments |= 1) == rq->totalFragments)) {
-							// We have all fragments -- assemble and process full Packet
-
-							rq->frag0.init(data,len,path,now);
-							for(unsigned int f=1;f<rq->totalFragments;++f)
-								rq->frag0.append(rq->frags[f - 1].payload(),rq->frags[f - 1].payloadLength());
-
-							if (rq->frag0.tryDecode(RR,tPtr)) {
-								rq->timestamp = 0; // packet decoded, free entry
+					RXQueueEntry *rq = (RXQueueEntry *)0;
+					{
+						Mutex::Lock _l(_rxQueue_m);
+						const Path::HashKey rxSource(localSocket,fromAddr);
+						RXQueueEntry **const existing = _rxQueueByPacketId.get(_RXQueueKey(packetId,rxSource));
+						if (!existing) {
+							// If we have no other fragments yet, create an entry and save the head
+
+							RXQueueEntry *const nrq = _rxQueueNew(now,packetId,rxSource);
+							if (nrq) {
+								nrq->frag0.init(data,len,path,now);
+								nrq->totalFragments = 0;
+								nrq->haveFragments = 1;
+								nrq->complete = false;
+							}
+						} else if (!((*existing)->haveFragments & 1)) {
+							// If we have other fragments but no head, see if we are complete with the head
+
+							(*existing)->frag0.init(data,len,path,now);
+							if (((*existing)->totalFragments > 1)&&(Utils::countBits((*existing)->haveFragments |= 1) == (*existing)->totalFragments)) {
+								// We have all fragments, so take the entry out of the table to assemble and decode it
+								rq = *existing;
+								_rxQueueUnlink(rq);
+								++_rxReassembled;
 							} else {
-								rq->complete = true; // set complete flag but leave entry since it probably needs WHOIS or something
+								// Still waiting on more fragments, but keep the head
+								(*existing)->haveFragments |= 1;
 							}
+						} // else this is a duplicate head, ignore
+					}
+
+					if (rq) {
+						for(unsigned int f=1;f<rq->totalFragments;++f)
+							rq->frag0.append(rq->frags[f - 1].payload(),rq->frags[f - 1].payloadLength());
+
+						if (rq->frag0.tryDecode(RR,tPtr)) {
+							Mutex::Lock _l(_rxQueue_m);
+							_rxQueueRelease(rq); // packet decoded, free entry
 						} else {
-							// Still waiting on more fragments, but keep the head
-							rq->frag0.init(data,len,path,now);
+							rq->complete = true; // set complete flag and keep entry since it probably needs WHOIS or something
+							_rxQueueRequeue(rq);
 						}
-					} // else this is a duplicate head, ignore
+					}
 				} else {
 					// Packet is unfragmented, so just process it
 					IncomingPacket packet(data,len,path,now);
 					if (!packet.tryDecode(RR,tPtr)) {
-						RXQueueEntry *const rq = _nextRXQueueEntry();
-						Mutex::Lock rql(rq->lock);
-						rq->timestamp = now;
-						rq->packetId = packet.packetId();
-						rq->frag0 = packet;
-						rq->totalFragments = 1;
-						rq->haveFragments = 1;
-						rq->complete = true;
+						Mutex::Lock _l(_rxQueue_m);
+						const Path::HashKey rxSource(localSocket,fromAddr);
+						if (!_rxQueueByPacketId.contains(_RXQueueKey(packet.packetId(),rxSource))) {
+							RXQueueEntry *const rq = _rxQueueNew(now,packet.packetId(),rxSource);
+							if (rq) {
+								rq->frag0 = packet;
+								rq->totalFragments = 1;
+								rq->haveFragments = 1;
+								rq->complete = true;
+							}
+						}
 					}
 				}
 
@@ -422,17 +463,13 @@ void Switch::onLocalEthernet(void *tPtr,const SharedPtr<Network> &network,const
 			to.appendTo(outp);
 			from.appendTo(outp);
 			outp.append((uint16_t)etherType);
-			outp.append(data,len);
-			if (!network->config().disableCompression())
-				outp.compress();
+			_appendFrame(network,toPeer,outp,data,len);
 			send(tPtr,outp,true);
 		} else {
 			Packet outp(toZT,RR->identity.address(),Packet::VERB_FRAME);
 			outp.append(network->id());
 			outp.append((uint16_t)etherType);
-			outp.append(data,len);
-			if (!network->config().disableCompression())
-				outp.compress();
+			_appendFrame(network,toPeer,outp,data,len);
 			send(tPtr,outp,true);
 		}
 
@@ -487,9 +524,7 @@ void Switch::onLocalEthernet(void *tPtr,const SharedPtr<Network> &network,const
 				to.appendTo(outp);
 				from.appendTo(outp);
 				outp.append((uint16_t)etherType);
-				outp.append(data,len);
-				if (!network->config().disableCompression())
-					outp.compress();
+				_appendFrame(network,RR->topology->getPeer(tPtr,bridges[b]),outp,data,len);
 				send(tPtr,outp,true);
 			} else {
 				RR->t->outgoingNetworkFrameDropped(tPtr,network,from,to,etherType,vlanId,len,"filter blocked (bridge replication)");
@@ -498,6 +533,63 @@ void Switch::onLocalEthernet(void *tPtr,const SharedPtr<Network> &network,const
 	}
 }
 
+void Switch::onLocalEthernet(void *tPtr,const SharedPtr<Network> &network,const MAC &from,const MAC &to,unsigned int etherType,unsigned int vlanId,const ZT_FrameSegment *segments,unsigned int segmentCount)
+{
+	unsigned int len = 0;
+	for(unsigned int s=0;s<segmentCount;++s)
+		len += segments[s].len;
+	if (len > ZT_MAX_MTU) {
+		RR->t->outgoingNetworkFrameDropped(tPtr,network,from,to,etherType,vlanId,len,"frame too large");
+		return;
+	}
+	if (segmentCount == 1) {
+		onLocalEthernet(tPtr,network,from,to,etherType,vlanId,segments[0].data,len);
+		return;
+	}
+
+	if ((network->hasConfig())&&(!to.isMulticast())&&(to != network->mac())&&(to[0] == MAC::firstOctetForNetwork(network->id()))) {
+		// Destination is another ZeroTier peer on the same network (see onLocalEthernet() above)
+		const bool fromBridged = (from != network->mac());
+		if ((!fromBridged)||(network->config().permitsBridging(RR->identity.address()))) {
+			const Address toZT(to.toAddress(network->id()));
+			Packet outp(toZT,RR->identity.address(),(fromBridged) ? Packet::VERB_EXT_FRAME : Packet::VERB_FRAME);
+			outp.append(network->id());
+			if (fromBridged) {
+				outp.append((unsigned char)0x00);
+				to.appendTo(outp);
+				from.appendTo(outp);
+			}
+			outp.append((uint16_t)etherType);
+			const unsigned int payloadLen = (outp.size() - ZT_PACKET_IDX_PAYLOAD) + len;
+			uint8_t *const frame = reinterpret_cast<uint8_t *>(outp.appendStaged(len));
+			unsigned int ptr = 0;
+			for(unsigned int s=0;s<segmentCount;++s) {
+				ZT_FAST_MEMCPY(frame + ptr,segments[s].data,segments[s].len);
+				ptr += segments[s].len;
+			}
+
+			// The filter only needs a contiguous view of the frame, so let it read the copy inside the packet
+			if (!network->filterOutgoingPacket(tPtr,false,RR->identity.address(),toZT,from,to,frame,len,etherType,vlanId)) {
+				RR->t->outgoingNetworkFrameDropped(tPtr,network,from,to,etherType,vlanId,len,"filter blocked");
+				return;
+			}
+
+			_finishFrame(network,RR->topology->getPeer(tPtr,toZT),outp,frame,len,payloadLen);
+			send(tPtr,outp,true);
+			return;
+		}
+	}
+
+	// Multicast, bridged and local frames need the whole frame in one place
+	uint8_t frame[ZT_MAX_MTU];
+	unsigned int ptr = 0;
+	for(unsigned int s=0;s<segmentCount;++s) {
+		ZT_FAST_MEMCPY(frame + ptr,segments[s].data,segments[s].len);
+		ptr += segments[s].len;
+	}
+	onLocalEthernet(tPtr,network,from,to,etherType,vlanId,frame,len);
+}
+
 void Switch::send(void *tPtr,Packet &packet,bool encrypt)
 {
 	const Address dest(packet.destination());
@@ -506,10 +598,10 @@ void Switch::send(void *tPtr,Packet &packet,bool encrypt)
 	if (!_trySend(tPtr,packet,encrypt)) {
 		{
 			Mutex::Lock _l(_txQueue_m);
-			if (_txQueue.size() >= ZT_TX_QUEUE_SIZE) {
-				_txQueue.pop_front();
-			}
-			_txQueue.push_back(TXQueueEntry(dest,RR->node->now(),packet,encrypt));
+			TXQueueEntry *const tx = _txQueueNew(dest);
+			tx->creationTime = RR->node->now();
+			tx->packet.copyFrom(packet.data(),packet.size());
+			tx->encrypt = encrypt;
 		}
 		if (!RR->topology->getPeer(tPtr,dest))
 			requestWhois(tPtr,RR->node->now(),dest);
@@ -546,26 +638,103 @@ void Switch::doAnythingWaitingForPeer(void *tPtr,const SharedPtr<Peer> &peer)
 	}
 
 	const int64_t now = RR->node->now();
-	for(unsigned int ptr=0;ptr<ZT_RX_QUEUE_SIZE;++ptr) {
-		RXQueueEntry *const rq = &(_rxQueue[ptr]);
-		Mutex::Lock rql(rq->lock);
-		if ((rq->timestamp)&&(rq->complete)) {
-			if ((rq->frag0.tryDecode(RR,tPtr))||((now - rq->timestamp) > ZT_RECEIVE_QUEUE_TIMEOUT))
-				rq->timestamp = 0;
+	std::vector< RXQueueEntry * > waiting;
+	{
+		Mutex::Lock _l(_rxQueue_m);
+		for(std::vector< RXQueueEntry * >::const_iterator rq(_rxQueue.begin());rq!=_rxQueue.end();++rq) {
+			if (((*rq)->timestamp)&&((*rq)->complete)&&(!(*rq)->busy)) {
+				_rxQueueUnlink(*rq);
+				waiting.push_back(*rq);
+			}
+		}
+	}
+	for(std::vector< RXQueueEntry * >::const_iterator rq(waiting.begin());rq!=waiting.end();++rq) {
+		if (((*rq)->frag0.tryDecode(RR,tPtr))||((now - (*rq)->timestamp) > ZT_RECEIVE_QUEUE_TIMEOUT)) {
+			Mutex::Lock _l(_rxQueue_m);
+			_rxQueueRelease(*rq);
+		} else {
+			_rxQueueRequeue(*rq);
 		}
 	}
 
 	{
 		Mutex::Lock _l(_txQueue_m);
-		for(std::list< TXQueueEntry >::iterator txi(_txQueue.begin());txi!=_txQueue.end();) {
-			if (txi->dest == peer->address()) {
-				if (_trySend(tPtr,txi->packet,txi->encrypt)) {
-					_txQueue.erase(txi++);
-				} else {
-					++txi;
-				}
-			} else {
-				++txi;
+		TXQueueDest *const d = _txQueueByDest.get(peer->address());
+		if (d) {
+			_txQueueService(tPtr,*d,now,true);
+			if (!d->count)
+				_txQueueByDest.erase(peer->address());
+		}
+	}
+}
+
+void Switch::doIdentityValidations(void *tPtr,int64_t now)
+{
+	std::vector<IdentityValidator::Completed> done;
+	RR->iv->completed(done);
+
+	Hashtable< Address,SharedPtr<Peer> > learned;
+	for(std::vector<IdentityValidator::Completed>::const_iterator c(done.begin());c!=done.end();++c) {
+		if (c->result == IdentityValidator::RESULT_VALID) {
+			const SharedPtr<Peer> peer(RR->topology->addPeer(tPtr,c->peer));
+			learned.set(peer->address(),peer);
+		} else {
+			if (c->result == IdentityValidator::RESULT_INVALID_MAC)
+				RR->t->incomingPacketMessageAuthenticationFailure(tPtr,c->path,c->packetId,c->source,c->hops,"invalid MAC");
+			else RR->t->incomingPacketDroppedHELLO(tPtr,c->path,c->packetId,c->source,"invalid identity");
+			Mutex::Lock _l(_rxQueue_m);
+			RXQueueEntry **const rq = _rxQueueByPacketId.get(_RXQueueKey(c->packetId,Path::HashKey(c->path->localSocket(),c->path->address())));
+			if (rq) {
+				RXQueueEntry *const dead = *rq;
+				_rxQueueUnlink(dead);
+				_rxQueueRelease(dead);
+			}
+		}
+	}
+	if (!learned.size())
+		return;
+
+	// Same as doAnythingWaitingForPeer() but for a batch of peers, so a storm of
+	// new peers doesn't walk the RX queue once per peer.
+	{
+		Mutex::Lock _l(_lastSentWhoisRequest_m);
+		Hashtable< Address,SharedPtr<Peer> >::Iterator i(learned);
+		Address *a = (Address *)0;
+		SharedPtr<Peer> *p = (SharedPtr<Peer> *)0;
+		while (i.next(a,p))
+			_lastSentWhoisRequest.erase(*a);
+	}
+
+	std::vector< RXQueueEntry * > waiting;
+	{
+		Mutex::Lock _l(_rxQueue_m);
+		for(std::vector< RXQueueEntry * >::const_iterator rq(_rxQueue.begin());rq!=_rxQueue.end();++rq) {
+			if (((*rq)->timestamp)&&((*rq)->complete)&&(!(*rq)->busy)&&(learned.contains((*rq)->frag0.source()))) {
+				_rxQueueUnlink(*rq);
+				waiting.push_back(*rq);
+			}
+		}
+	}
+	for(std::vector< RXQueueEntry * >::const_iterator rq(waiting.begin());rq!=waiting.end();++rq) {
+		if (((*rq)->frag0.tryDecode(RR,tPtr))||((now - (*rq)->timestamp) > ZT_RECEIVE_QUEUE_TIMEOUT)) {
+			Mutex::Lock _l(_rxQueue_m);
+			_rxQueueRelease(*rq);
+		} else {
+			_rxQueueRequeue(*rq);
+		}
+	}
+
+	{
+		Mutex::Lock _l(_txQueue_m);
+		Hashtable< Address,SharedPtr<Peer> >::Iterator i(learned);
+		Address *a = (Address *)0;
+		SharedPtr<Peer> *p = (SharedPtr<Peer> *)0;
+		while (i.next(a,p)) {
+			TXQueueDest *const d = _txQueueByDest.get(*a);
+			if (d) {
+				_txQueueService(tPtr,*d,now,true);
+				if (!d->count)
+					_txQueueByDest.erase(*a);
 			}
 		}
 	}
@@ -581,34 +750,51 @@ unsigned long Switch::doTimerTasks(void *tPtr,int64_t now)
 	std::vector<Address> needWhois;
 	{
 		Mutex::Lock _l(_txQueue_m);
-		for(std::list< TXQueueEntry >::iterator txi(_txQueue.begin());txi!=_txQueue.end();) {
-			if (_trySend(tPtr,txi->packet,txi->encrypt)) {
-				_txQueue.erase(txi++);
-			} else if ((now - txi->creationTime) > ZT_TRANSMIT_QUEUE_TIMEOUT) {
-				_txQueue.erase(txi++);
-			} else {
-				if (!RR->topology->getPeer(tPtr,txi->dest))
-					needWhois.push_back(txi->dest);
-				++txi;
+		Hashtable< Address,TXQueueDest >::Iterator i(_txQueueByDest);
+		Address *dest = (Address *)0;
+		TXQueueDest *d = (TXQueueDest *)0;
+		while (i.next(dest,d)) {
+			// Nothing can be sent to a destination we don't have an identity for yet
+			const bool known = (bool)RR->topology->getPeer(tPtr,*dest);
+			_txQueueService(tPtr,*d,now,known);
+			if (!d->count) {
+				_txQueueByDest.erase(*dest);
+			} else if (!known) {
+				needWhois.push_back(*dest);
 			}
 		}
 	}
 	for(std::vector<Address>::const_iterator i(needWhois.begin());i!=needWhois.end();++i)
 		requestWhois(tPtr,now,*i);
 
-	for(unsigned int ptr=0;ptr<ZT_RX_QUEUE_SIZE;++ptr) {
-		RXQueueEntry *const rq = &(_rxQueue[ptr]);
-		Mutex::Lock rql(rq->lock);
-		if ((rq->timestamp)&&(rq->complete)) {
-			if ((rq->frag0.tryDecode(RR,tPtr))||((now - rq->timestamp) > ZT_RECEIVE_QUEUE_TIMEOUT)) {
-				rq->timestamp = 0;
-			} else {
-				const Address src(rq->frag0.source());
-				if (!RR->topology->getPeer(tPtr,src))
-					requestWhois(tPtr,now,src);
+	std::vector< RXQueueEntry * > waiting;
+	{
+		Mutex::Lock _l(_rxQueue_m);
+		for(std::vector< RXQueueEntry * >::const_iterator rq(_rxQueue.begin());rq!=_rxQueue.end();++rq) {
+			if (((*rq)->timestamp)&&(!(*rq)->busy)) {
+				if ((*rq)->complete) {
+					_rxQueueUnlink(*rq);
+					waiting.push_back(*rq);
+				} else if ((now - (*rq)->timestamp) > ZT_RECEIVE_QUEUE_TIMEOUT) {
+					// Some fragments never arrived
+					_rxQueueUnlink(*rq);
+					_rxQueueRelease(*rq);
+					++_rxExpired;
+				}
 			}
 		}
 	}
+	for(std::vector< RXQueueEntry * >::const_iterator rq(waiting.begin());rq!=waiting.end();++rq) {
+		if (((*rq)->frag0.tryDecode(RR,tPtr))||((now - (*rq)->timestamp) > ZT_RECEIVE_QUEUE_TIMEOUT)) {
+			Mutex::Lock _l(_rxQueue_m);
+			_rxQueueRelease(*rq);
+		} else {
+			const Address src((*rq)->frag0.source());
+			_rxQueueRequeue(*rq);
+			if (!RR->topology->getPeer(tPtr,src))
+				requestWhois(tPtr,now,src);
+		}
+	}
 
 	{
 		Mutex::Lock _l(_lastUniteAttempt_m);
@@ -635,6 +821,186 @@ unsigned long Switch::doTimerTasks(void *tPtr,int64_t now)
 	return ZT_WHOIS_RETRY_DELAY;
 }
 
+Switch::RXQueueEntry *Switch::_rxQueueNew(const int64_t now,const uint64_t packetId,const Path::HashKey &source)
+{
+	RXQueueEntry *rq = (RXQueueEntry *)0;
+
+	// A sender at its limit recycles its own oldest entry so it can't crowd out others
+	const unsigned int *const sourceCount = _rxQueueSourceCount.get(source);
+	const bool sourceFull = ((sourceCount)&&(*sourceCount >= ZT_RX_QUEUE_MAX_PER_SOURCE));
+
+	if ((sourceFull)||((_rxQueueFree.empty())&&(_rxQueue.size() >= ZT_RX_QUEUE_SIZE))) {
+		// Otherwise take something that has expired, or failing that the oldest
+		// entry from whichever sender is using the most of the table.
+		RXQueueEntry *victim = (RXQueueEntry *)0;
+		unsigned int victimSourceCount = 0;
+		bool victimExpired = false;
+		for(std::vector< RXQueueEntry * >::const_iterator e(_rxQueue.begin());e!=_rxQueue.end();++e) {
+			if ((!(*e)->timestamp)||((*e)->busy))
+				continue;
+			if (sourceFull) {
+				if (((*e)->source == source)&&((!victim)||((*e)->timestamp < victim->timestamp)))
+					victim = *e;
+			} else {
+				const bool expired = ((now - (*e)->timestamp) > ZT_RECEIVE_QUEUE_TIMEOUT);
+				const unsigned int *const c = _rxQueueSourceCount.get((*e)->source);
+				const unsigned int cnt = (c) ? *c : 0;
+				if ( (!victim) ||
+				     ((expired)&&(!victimExpired)) ||
+				     ((expired == victimExpired)&&((cnt > victimSourceCount)||((cnt == victimSourceCount)&&((*e)->timestamp < victim->timestamp)))) ) {
+					victim = *e;
+					victimSourceCount = cnt;
+					victimExpired = expired;
+				}
+			}
+		}
+		if (victim) {
+			if (!victim->complete)
+				++_rxEvicted;
+			_rxQueueUnlink(victim);
+			rq = victim;
+		}
+	}
+
+	if (!rq) {
+		if (!_rxQueueFree.empty()) {
+			rq = _rxQueueFree.back();
+			_rxQueueFree.pop_back();
+		} else if (_rxQueue.size() < ZT_RX_QUEUE_SIZE) {
+			rq = new RXQueueEntry();
+			_rxQueue.push_back(rq);
+		} else {
+			++_rxEvicted; // everything is mid-decode, so drop this one
+			return (RXQueueEntry *)0;
+		}
+	}
+
+	rq->timestamp = now;
+	rq->packetId = packetId;
+	rq->source = source;
+	rq->busy = false;
+	_rxQueueByPacketId.set(_RXQueueKey(packetId,source),rq);
+	++_rxQueueSourceCount[source];
+	return rq;
+}
+
+void Switch::_appendFrame(const SharedPtr<Network> &network,const SharedPtr<Peer> &peer,Packet &outp,const void *data,unsigned int len)
+{
+	const unsigned int payloadLen = (outp.size() - ZT_PACKET_IDX_PAYLOAD) + len;
+	void *const frame = outp.appendStaged(len);
+	ZT_FAST_MEMCPY(frame,data,len);
+	_finishFrame(network,peer,outp,frame,len,payloadLen);
+}
+
+void Switch::_finishFrame(const SharedPtr<Network> &network,const SharedPtr<Peer> &peer,Packet &outp,const void *frame,unsigned int len,unsigned int payloadLen)
+{
+	bool tryCompress = ((payloadLen > 64)&&(!network->config().disableCompression()));
+	if ((tryCompress)&&(peer))
+		tryCompress = peer->shouldCompressFrame(frame,len);
+	const unsigned int compressedLen = outp.finishStaged(len,tryCompress);
+	if ((tryCompress)&&(peer))
+		peer->frameCompressed(payloadLen,compressedLen);
+}
+
+Switch::TXQueueEntry *Switch::_txQueueNew(const Address &dest)
+{
+	// A destination at its limit drops its own oldest packet, otherwise when
+	// the queue is full the oldest packet of all goes. Both are list heads.
+	TXQueueDest *d = _txQueueByDest.get(dest);
+	if ((d)&&(d->count >= ZT_TX_QUEUE_MAX_PER_DEST)) {
+		_txQueueDelete(*d,(TXQueueEntry *)0,d->head);
+	} else if ((_txQueueFree.empty())&&(_txQueue.size() >= ZT_TX_QUEUE_SIZE)&&(_txQueueOldest)) {
+		const Address oldestDest(_txQueueOldest->dest);
+		TXQueueDest *const od = _txQueueByDest.get(oldestDest);
+		_txQueueDelete(*od,(TXQueueEntry *)0,_txQueueOldest);
+		if (!od->count)
+			_txQueueByDest.erase(oldestDest);
+	}
+
+	TXQueueEntry *tx;
+	if (!_txQueueFree.empty()) {
+		tx = _txQueueFree.back();
+		_txQueueFree.pop_back();
+	} else {
+		tx = new TXQueueEntry();
+		_txQueue.push_back(tx);
+	}
+
+	tx->dest = dest;
+	tx->prev = _txQueueNewest;
+	tx->next = (TXQueueEntry *)0;
+	tx->nextForDest = (TXQueueEntry *)0;
+	if (_txQueueNewest)
+		_txQueueNewest->next = tx;
+	else _txQueueOldest = tx;
+	_txQueueNewest = tx;
+
+	d = &(_txQueueByDest[dest]); // looked up again since the erase above may have been of this destination
+	if (d->tail)
+		d->tail->nextForDest = tx;
+	else d->head = tx;
+	d->tail = tx;
+	++d->count;
+
+	return tx;
+}
+
+void Switch::_txQueueDelete(TXQueueDest &d,TXQueueEntry *prevForDest,TXQueueEntry *tx)
+{
+	if (prevForDest)
+		prevForDest->nextForDest = tx->nextForDest;
+	else d.head = tx->nextForDest;
+	if (d.tail == tx)
+		d.tail = prevForDest;
+	--d.count;
+
+	if (tx->prev)
+		tx->prev->next = tx->next;
+	else _txQueueOldest = tx->next;
+	if (tx->next)
+		tx->next->prev = tx->prev;
+	else _txQueueNewest = tx->prev;
+
+	_txQueueFree.push_back(tx);
+}
+
+void Switch::_txQueueService(void *tPtr,TXQueueDest &d,const int64_t now,const bool trySend)
+{
+	TXQueueEntry *prev = (TXQueueEntry *)0;
+	TXQueueEntry *tx = d.head;
+	while (tx) {
+		TXQueueEntry *const next = tx->nextForDest;
+		if ( ((trySend)&&(_trySend(tPtr,tx->packet,tx->encrypt))) || ((now - tx->creationTime) > ZT_TRANSMIT_QUEUE_TIMEOUT) ) {
+			_txQueueDelete(d,prev,tx);
+		} else {
+			prev = tx;
+		}
+		tx = next;
+	}
+}
+
+void Switch::_rxQueueUnlink(RXQueueEntry *rq)
+{
+	_rxQueueByPacketId.erase(_RXQueueKey(rq->packetId,rq->source));
+	unsigned int *const c = _rxQueueSourceCount.get(rq->source);
+	if ((c)&&(--*c == 0))
+		_rxQueueSourceCount.erase(rq->source);
+	rq->busy = true;
+}
+
+void Switch::_rxQueueRequeue(RXQueueEntry *rq)
+{
+	Mutex::Lock _l(_rxQueue_m);
+	const _RXQueueKey k(rq->packetId,rq->source);
+	if (_rxQueueByPacketId.contains(k)) {
+		_rxQueueRelease(rq); // a duplicate arrived while we were decoding
+	} else {
+		rq->busy = false;
+		_rxQueueByPacketId.set(k,rq);
+		++_rxQueueSourceCount[rq->source];
+	}
+}
+
 bool Switch::_shouldUnite(const int64_t now,const Address &source,const Address &destination)
 {
 	Mutex::Lock _l(_lastUniteAttempt_m);
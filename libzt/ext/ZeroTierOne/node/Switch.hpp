@@ -61,6 +61,7 @@ class Switch
 {
 public:
 	Switch(const RuntimeEnvironment *renv);
+	~Switch();
 
 	/**
 	 * Called when a packet is received from the real network
@@ -87,6 +88,24 @@ public:
 	 */
 	void onLocalEthernet(void *tPtr,const SharedPtr<Network> &network,const MAC &from,const MAC &to,unsigned int etherType,unsigned int vlanId,const void *data,unsigned int len);
 
+	/**
+	 * Called when a packet comes from a local Ethernet tap as a list of segments
+	 *
+	 * Unicast frames to other peers on the same network are gathered straight
+	 * into the outgoing packet, so the payload is copied only once. Anything
+	 * else is linearized and handed to the contiguous version above.
+	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param network Which network's TAP did this packet come from?
+	 * @param from Originating MAC address
+	 * @param to Destination MAC address
+	 * @param etherType Ethernet packet type
+	 * @param vlanId VLAN ID or 0 if none
+	 * @param segments Ethernet payload segments in order
+	 * @param segmentCount Number of segments
+	 */
+	void onLocalEthernet(void *tPtr,const SharedPtr<Network> &network,const MAC &from,const MAC &to,unsigned int etherType,unsigned int vlanId,const ZT_FrameSegment *segments,unsigned int segmentCount);
+
 	/**
 	 * Send a packet to a ZeroTier address (destination in packet)
 	 *
@@ -124,6 +143,17 @@ public:
 	 */
 	void doAnythingWaitingForPeer(void *tPtr,const SharedPtr<Peer> &peer);
 
+	/**
+	 * Learn peers whose HELLOs passed background identity validation
+	 *
+	 * Valid peers are added to the topology and anything waiting for them
+	 * is decoded or sent. HELLOs that failed are dropped from the RX queue.
+	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param now Current time
+	 */
+	void doIdentityValidations(void *tPtr,int64_t now);
+
 	/**
 	 * Perform retries and other periodic timer tasks
 	 *
@@ -136,10 +166,30 @@ public:
 	 */
 	unsigned long doTimerTasks(void *tPtr,int64_t now);
 
+	/**
+	 * Get fragment reassembly counters
+	 *
+	 * @param reassembled Set to number of packets successfully reassembled from fragments
+	 * @param evicted Set to number of partial packets dropped to make room for others
+	 * @param expired Set to number of partial packets whose fragments did not all arrive in time
+	 */
+	inline void rxQueueCounters(uint64_t &reassembled,uint64_t &evicted,uint64_t &expired)
+	{
+		Mutex::Lock _l(_rxQueue_m);
+		reassembled = _rxReassembled;
+		evicted = _rxEvicted;
+		expired = _rxExpired;
+	}
+
 private:
 	bool _shouldUnite(const int64_t now,const Address &source,const Address &destination);
 	bool _trySend(void *tPtr,Packet &packet,bool encrypt); // packet is modified if return is true
 
+	// Appends a frame to a FRAME or EXT_FRAME for peer (may be NULL) and compresses the payload if that looks worthwhile
+	void _appendFrame(const SharedPtr<Network> &network,const SharedPtr<Peer> &peer,Packet &outp,const void *data,unsigned int len);
+	// Second half of the above for frames copied in by the caller at Packet::appendStaged()
+	void _finishFrame(const SharedPtr<Network> &network,const SharedPtr<Peer> &peer,Packet &outp,const void *frame,unsigned int len,unsigned int payloadLen);
+
 	const RuntimeEnvironment *const RR;
 	int64_t _lastBeaconResponse;
 	volatile int64_t _lastCheckedQueues;
@@ -151,56 +201,83 @@ private:
 	// Packets waiting for WHOIS replies or other decode info or missing fragments
 	struct RXQueueEntry
 	{
-		RXQueueEntry() : timestamp(0) {}
-		volatile int64_t timestamp; // 0 if entry is not in use
-		volatile uint64_t packetId;
+		RXQueueEntry() : timestamp(0),busy(false) {}
+		int64_t timestamp; // 0 if entry is not in use
+		uint64_t packetId;
+		Path::HashKey source; // physical path the first piece arrived on, for per-source limits
 		IncomingPacket frag0; // head of packet
 		Packet::Fragment frags[ZT_MAX_PACKET_FRAGMENTS - 1]; // later fragments (if any)
 		unsigned int totalFragments; // 0 if only frag0 received, waiting for frags
 		uint32_t haveFragments; // bit mask, LSB to MSB
-		volatile bool complete; // if true, packet is complete
-		Mutex lock;
+		bool complete; // if true, packet is complete
+		bool busy; // if true, entry has been taken out of the table and is being decoded
 	};
-	RXQueueEntry _rxQueue[ZT_RX_QUEUE_SIZE];
-	AtomicCounter _rxQueuePtr;
-
-	// Returns matching or next available RX queue entry
-	inline RXQueueEntry *_findRXQueueEntry(uint64_t packetId)
+	// RX queue entries are keyed by packet ID and the physical path it arrived on, so a
+	// packet ID seen from another path can't be merged into or displace an entry
+	struct _RXQueueKey
 	{
-		const unsigned int current = static_cast<unsigned int>(_rxQueuePtr.load());
-		for(unsigned int k=1;k<=ZT_RX_QUEUE_SIZE;++k) {
-			RXQueueEntry *rq = &(_rxQueue[(current - k) % ZT_RX_QUEUE_SIZE]);
-			if ((rq->packetId == packetId)&&(rq->timestamp))
-				return rq;
-		}
-		++_rxQueuePtr;
-		return &(_rxQueue[static_cast<unsigned int>(current) % ZT_RX_QUEUE_SIZE]);
-	}
+		_RXQueueKey() : packetId(0),source() {}
+		_RXQueueKey(const uint64_t p,const Path::HashKey &s) : packetId(p),source(s) {}
+		inline unsigned long hashCode() const { return ((unsigned long)packetId ^ source.hashCode()); }
+		inline bool operator==(const _RXQueueKey &k) const { return ((packetId == k.packetId)&&(source == k.source)); }
+		uint64_t packetId;
+		Path::HashKey source;
+	};
+	std::vector< RXQueueEntry * > _rxQueue; // all entries, allocated on demand up to ZT_RX_QUEUE_SIZE
+	std::vector< RXQueueEntry * > _rxQueueFree;
+	Hashtable< _RXQueueKey,RXQueueEntry * > _rxQueueByPacketId;
+	Hashtable< Path::HashKey,unsigned int > _rxQueueSourceCount;
+	uint64_t _rxReassembled;
+	uint64_t _rxEvicted;
+	uint64_t _rxExpired;
+	Mutex _rxQueue_m;
 
-	// Returns current entry in rx queue ring buffer and increments ring pointer
-	inline RXQueueEntry *_nextRXQueueEntry()
+	// These assume _rxQueue_m is locked
+	RXQueueEntry *_rxQueueNew(const int64_t now,const uint64_t packetId,const Path::HashKey &source);
+	void _rxQueueUnlink(RXQueueEntry *rq);
+	inline void _rxQueueRelease(RXQueueEntry *rq)
 	{
-		return &(_rxQueue[static_cast<unsigned int>((++_rxQueuePtr) - 1) % ZT_RX_QUEUE_SIZE]);
+		rq->timestamp = 0;
+		rq->busy = false;
+		_rxQueueFree.push_back(rq);
 	}
 
-	// ZeroTier-layer TX queue entry
+	// Puts a complete but undecodable entry back into the table or releases it if it's a duplicate (locks _rxQueue_m)
+	void _rxQueueRequeue(RXQueueEntry *rq);
+
+	// ZeroTier-layer TX queue entry, linked into both a global oldest-first
+	// list and its destination's list (which is therefore also oldest-first)
 	struct TXQueueEntry
 	{
-		TXQueueEntry() {}
-		TXQueueEntry(Address d,uint64_t ct,const Packet &p,bool enc) :
-			dest(d),
-			creationTime(ct),
-			packet(p),
-			encrypt(enc) {}
+		TXQueueEntry() : prev((TXQueueEntry *)0),next((TXQueueEntry *)0),nextForDest((TXQueueEntry *)0) {}
 
+		TXQueueEntry *prev;
+		TXQueueEntry *next;
+		TXQueueEntry *nextForDest;
 		Address dest;
-		uint64_t creationTime;
+		int64_t creationTime;
 		Packet packet; // unencrypted/unMAC'd packet -- this is done at send time
 		bool encrypt;
 	};
-	std::list< TXQueueEntry > _txQueue;
+	struct TXQueueDest
+	{
+		TXQueueDest() : head((TXQueueEntry *)0),tail((TXQueueEntry *)0),count(0) {}
+		TXQueueEntry *head;
+		TXQueueEntry *tail;
+		unsigned int count;
+	};
+	std::vector< TXQueueEntry * > _txQueue; // all entries, allocated on demand up to ZT_TX_QUEUE_SIZE
+	std::vector< TXQueueEntry * > _txQueueFree;
+	Hashtable< Address,TXQueueDest > _txQueueByDest;
+	TXQueueEntry *_txQueueOldest;
+	TXQueueEntry *_txQueueNewest;
 	Mutex _txQueue_m;
 
+	// These assume _txQueue_m is locked
+	TXQueueEntry *_txQueueNew(const Address &dest);
+	void _txQueueDelete(TXQueueDest &d,TXQueueEntry *prevForDest,TXQueueEntry *tx); // tx must follow prevForDest, or be the head if it's NULL
+	void _txQueueService(void *tPtr,TXQueueDest &d,const int64_t now,const bool trySend); // sends (if trySend) and drops expired packets
+
 	// Tracks sending of VERB_RENDEZVOUS to relaying peers
 	struct _LastUniteKey
 	{
@@ -90,19 +90,22 @@ Topology::Topology(const RuntimeEnvironment *renv,void *tPtr) :
 
 Topology::~Topology()
 {
-	Hashtable< Address,SharedPtr<Peer> >::Iterator i(_peers);
-	Address *a = (Address *)0;
-	SharedPtr<Peer> *p = (SharedPtr<Peer> *)0;
-	while (i.next(a,p))
-		_savePeer((void *)0,*p);
+	for(unsigned int s=0;s<ZT_TOPOLOGY_SHARDS;++s) {
+		Hashtable< Address,SharedPtr<Peer> >::Iterator i(_peerShards[s].peers);
+		Address *a = (Address *)0;
+		SharedPtr<Peer> *p = (SharedPtr<Peer> *)0;
+		while (i.next(a,p))
+			_savePeer((void *)0,*p);
+	}
 }
 
 SharedPtr<Peer> Topology::addPeer(void *tPtr,const SharedPtr<Peer> &peer)
 {
 	SharedPtr<Peer> np;
 	{
-		Mutex::Lock _l(_peers_m);
-		SharedPtr<Peer> &hp = _peers[peer->address()];
+		_PeerShard &s = _peerShard(peer->address());
+		RWMutex::Lock _l(s.lock);
+		SharedPtr<Peer> &hp = s.peers[peer->address()];
 		if (!hp)
 			hp = peer;
 		np = hp;
@@ -115,9 +118,10 @@ SharedPtr<Peer> Topology::getPeer(void *tPtr,const Address &zta)
 	if (zta == RR->identity.address())
 		return SharedPtr<Peer>();
 
+	_PeerShard &s = _peerShard(zta);
 	{
-		Mutex::Lock _l(_peers_m);
-		const SharedPtr<Peer> *const ap = _peers.get(zta);
+		RWMutex::RLock _l(s.lock);
+		const SharedPtr<Peer> *const ap = s.peers.get(zta);
 		if (ap)
 			return *ap;
 	}
@@ -128,13 +132,13 @@ SharedPtr<Peer> Topology::getPeer(void *tPtr,const Address &zta)
 		int len = RR->node->stateObjectGet(tPtr,ZT_STATE_OBJECT_PEER,idbuf,buf.unsafeData(),ZT_PEER_MAX_SERIALIZED_STATE_SIZE);
 		if (len > 0) {
 			buf.setSize(len);
-			Mutex::Lock _l(_peers_m);
-			SharedPtr<Peer> &ap = _peers[zta];
+			RWMutex::Lock _l(s.lock);
+			SharedPtr<Peer> &ap = s.peers[zta];
 			if (ap)
 				return ap;
 			ap = Peer::deserializeFromCache(RR->node->now(),tPtr,buf,RR);
 			if (!ap) {
-				_peers.erase(zta);
+				s.peers.erase(zta);
 			}
 			return SharedPtr<Peer>();
 		}
@@ -148,8 +152,9 @@ Identity Topology::getIdentity(void *tPtr,const Address &zta)
 	if (zta == RR->identity.address()) {
 		return RR->identity;
 	} else {
-		Mutex::Lock _l(_peers_m);
-		const SharedPtr<Peer> *const ap = _peers.get(zta);
+		_PeerShard &s = _peerShard(zta);
+		RWMutex::RLock _l(s.lock);
+		const SharedPtr<Peer> *const ap = s.peers.get(zta);
 		if (ap)
 			return (*ap)->identity();
 	}
@@ -160,25 +165,24 @@ SharedPtr<Peer> Topology::getUpstreamPeer()
 {
 	const int64_t now = RR->node->now();
 	unsigned int bestq = ~((unsigned int)0);
-	const SharedPtr<Peer> *best = (const SharedPtr<Peer> *)0;
+	SharedPtr<Peer> best;
 
-	Mutex::Lock _l2(_peers_m);
 	Mutex::Lock _l1(_upstreams_m);
 
 	for(std::vector<Address>::const_iterator a(_upstreamAddresses.begin());a!=_upstreamAddresses.end();++a) {
-		const SharedPtr<Peer> *p = _peers.get(*a);
+		_PeerShard &s = _peerShard(*a);
+		RWMutex::RLock _l2(s.lock);
+		const SharedPtr<Peer> *p = s.peers.get(*a);
 		if (p) {
 			const unsigned int q = (*p)->relayQuality(now);
 			if (q <= bestq) {
 				bestq = q;
-				best = p;
+				best = *p;
 			}
 		}
 	}
 
-	if (!best)
-		return SharedPtr<Peer>();
-	return *best;
+	return best;
 }
 
 bool Topology::isUpstream(const Identity &id) const
@@ -252,7 +256,6 @@ bool Topology::addWorld(void *tPtr,const World &newWorld,bool alwaysAcceptNew)
 	if ((newWorld.type() != World::TYPE_PLANET)&&(newWorld.type() != World::TYPE_MOON))
 		return false;
 
-	Mutex::Lock _l2(_peers_m);
 	Mutex::Lock _l1(_upstreams_m);
 
 	World *existing = (World *)0;
@@ -341,7 +344,6 @@ void Topology::addMoon(void *tPtr,const uint64_t id,const Address &seed)
 
 void Topology::removeMoon(void *tPtr,const uint64_t id)
 {
-	Mutex::Lock _l2(_peers_m);
 	Mutex::Lock _l1(_upstreams_m);
 
 	std::vector<World> nm;
@@ -368,35 +370,42 @@ void Topology::removeMoon(void *tPtr,const uint64_t id)
 
 void Topology::doPeriodicTasks(void *tPtr,int64_t now)
 {
+	std::vector< SharedPtr<Peer> > expired;
 	{
-		Mutex::Lock _l1(_peers_m);
-		Mutex::Lock _l2(_upstreams_m);
-		Hashtable< Address,SharedPtr<Peer> >::Iterator i(_peers);
-		Address *a = (Address *)0;
-		SharedPtr<Peer> *p = (SharedPtr<Peer> *)0;
-		while (i.next(a,p)) {
-			if ( (!(*p)->isAlive(now)) && (std::find(_upstreamAddresses.begin(),_upstreamAddresses.end(),*a) == _upstreamAddresses.end()) ) {
-				_savePeer(tPtr,*p);
-				_peers.erase(*a);
+		Mutex::Lock _l1(_upstreams_m);
+		for(unsigned int s=0;s<ZT_TOPOLOGY_SHARDS;++s) {
+			RWMutex::Lock _l2(_peerShards[s].lock);
+			Hashtable< Address,SharedPtr<Peer> >::Iterator i(_peerShards[s].peers);
+			Address *a = (Address *)0;
+			SharedPtr<Peer> *p = (SharedPtr<Peer> *)0;
+			while (i.next(a,p)) {
+				if ( (!(*p)->isAlive(now)) && (std::find(_upstreamAddresses.begin(),_upstreamAddresses.end(),*a) == _upstreamAddresses.end()) ) {
+					expired.push_back(*p);
+					_peerShards[s].peers.erase(*a);
+				}
 			}
 		}
 	}
 
-	{
-		Mutex::Lock _l(_paths_m);
-		Hashtable< Path::HashKey,SharedPtr<Path> >::Iterator i(_paths);
+	// Write expired peers to the cache after releasing locks, since this calls out to the state store
+	for(std::vector< SharedPtr<Peer> >::const_iterator p(expired.begin());p!=expired.end();++p)
+		_savePeer(tPtr,*p);
+
+	for(unsigned int s=0;s<ZT_TOPOLOGY_SHARDS;++s) {
+		RWMutex::Lock _l(_pathShards[s].lock);
+		Hashtable< Path::HashKey,SharedPtr<Path> >::Iterator i(_pathShards[s].paths);
 		Path::HashKey *k = (Path::HashKey *)0;
 		SharedPtr<Path> *p = (SharedPtr<Path> *)0;
 		while (i.next(k,p)) {
 			if (p->references() <= 1)
-				_paths.erase(*k);
+				_pathShards[s].paths.erase(*k);
 		}
 	}
 }
 
 void Topology::_memoizeUpstreams(void *tPtr)
 {
-	// assumes _upstreams_m and _peers_m are locked
+	// assumes _upstreams_m is locked; peer shards are locked here as needed
 	_upstreamAddresses.clear();
 	_amUpstream = false;
 
@@ -405,7 +414,9 @@ void Topology::_memoizeUpstreams(void *tPtr)
 			_amUpstream = true;
 		} else if (std::find(_upstreamAddresses.begin(),_upstreamAddresses.end(),i->identity.address()) == _upstreamAddresses.end()) {
 			_upstreamAddresses.push_back(i->identity.address());
-			SharedPtr<Peer> &hp = _peers[i->identity.address()];
+			_PeerShard &s = _peerShard(i->identity.address());
+			RWMutex::Lock _l(s.lock);
+			SharedPtr<Peer> &hp = s.peers[i->identity.address()];
 			if (!hp)
 				hp = new Peer(RR,RR->identity,i->identity);
 		}
@@ -417,7 +428,9 @@ void Topology::_memoizeUpstreams(void *tPtr)
 				_amUpstream = true;
 			} else if (std::find(_upstreamAddresses.begin(),_upstreamAddresses.end(),i->identity.address()) == _upstreamAddresses.end()) {
 				_upstreamAddresses.push_back(i->identity.address());
-				SharedPtr<Peer> &hp = _peers[i->identity.address()];
+				_PeerShard &s = _peerShard(i->identity.address());
+				RWMutex::Lock _l(s.lock);
+				SharedPtr<Peer> &hp = s.peers[i->identity.address()];
 				if (!hp)
 					hp = new Peer(RR,RR->identity,i->identity);
 			}
@@ -47,6 +47,11 @@
 #include "Hashtable.hpp"
 #include "World.hpp"
 
+/**
+ * Number of independently locked shards for peers and paths (must be a power of two)
+ */
+#define ZT_TOPOLOGY_SHARDS 16
+
 namespace ZeroTier {
 
 class RuntimeEnvironment;
@@ -100,8 +105,9 @@ public:
 	 */
 	inline SharedPtr<Peer> getPeerNoCache(const Address &zta)
 	{
-		Mutex::Lock _l(_peers_m);
-		const SharedPtr<Peer> *const ap = _peers.get(zta);
+		_PeerShard &s = _peerShard(zta);
+		RWMutex::RLock _l(s.lock);
+		const SharedPtr<Peer> *const ap = s.peers.get(zta);
 		if (ap)
 			return *ap;
 		return SharedPtr<Peer>();
@@ -116,8 +122,16 @@ public:
 	 */
 	inline SharedPtr<Path> getPath(const int64_t l,const InetAddress &r)
 	{
-		Mutex::Lock _l(_paths_m);
-		SharedPtr<Path> &p = _paths[Path::HashKey(l,r)];
+		const Path::HashKey k(l,r);
+		_PathShard &s = _pathShard(k);
+		{
+			RWMutex::RLock _l(s.lock);
+			const SharedPtr<Path> *const p = s.paths.get(k);
+			if (p)
+				return *p;
+		}
+		RWMutex::Lock _l(s.lock);
+		SharedPtr<Path> &p = s.paths[k];
 		if (!p)
 			p.set(new Path(l,r));
 		return p;
@@ -294,14 +308,16 @@ public:
 	inline unsigned long countActive(int64_t now) const
 	{
 		unsigned long cnt = 0;
-		Mutex::Lock _l(_peers_m);
-		Hashtable< Address,SharedPtr<Peer> >::Iterator i(const_cast<Topology *>(this)->_peers);
-		Address *a = (Address *)0;
-		SharedPtr<Peer> *p = (SharedPtr<Peer> *)0;
-		while (i.next(a,p)) {
-			const SharedPtr<Path> pp((*p)->getBestPath(now,false));
-			if (pp)
-				++cnt;
+		for(unsigned int s=0;s<ZT_TOPOLOGY_SHARDS;++s) {
+			RWMutex::RLock _l(_peerShards[s].lock);
+			Hashtable< Address,SharedPtr<Peer> >::Iterator i(const_cast<Topology *>(this)->_peerShards[s].peers);
+			Address *a = (Address *)0;
+			SharedPtr<Peer> *p = (SharedPtr<Peer> *)0;
+			while (i.next(a,p)) {
+				const SharedPtr<Path> pp((*p)->getBestPath(now,false));
+				if (pp)
+					++cnt;
+			}
 		}
 		return cnt;
 	}
@@ -309,19 +325,43 @@ public:
 	/**
 	 * Apply a function or function object to all peers
 	 *
+	 * The function is called on a snapshot of the peer table taken shard by
+	 * shard, with no locks held while it runs, so it may call back into
+	 * Topology. This means:
+	 *  - a peer added after its shard was copied is not visited;
+	 *  - a peer expired by doPeriodicTasks() while this runs is still
+	 *    visited, and stays alive until the snapshot is released;
+	 *  - the set of peers is not a consistent cut across shards.
+	 *
+	 * Callers and why that is fine for them:
+	 *  - Node::processBackgroundTasks() (_PingPeersThatNeedPing) holds the
+	 *    background tasks lock, which doPeriodicTasks() also runs under, so
+	 *    it never sees an expired peer. A peer added meanwhile is pinged on
+	 *    the next pass.
+	 *  - SelfAwareness::iam() (_ResetWithinScope) may reset paths on a peer
+	 *    that was just expired. That only marks its paths stale and sends a
+	 *    probe to each, which does no harm. A new peer has no stale paths to reset.
+	 *
+	 * New callers must tolerate the same.
+	 *
 	 * @param f Function to apply
 	 * @tparam F Function or function object type
 	 */
 	template<typename F>
 	inline void eachPeer(F f)
 	{
-		Mutex::Lock _l(_peers_m);
-		Hashtable< Address,SharedPtr<Peer> >::Iterator i(_peers);
-		Address *a = (Address *)0;
-		SharedPtr<Peer> *p = (SharedPtr<Peer> *)0;
-		while (i.next(a,p)) {
-			f(*this,*((const SharedPtr<Peer> *)p));
+		std::vector< SharedPtr<Peer> > ps;
+		for(unsigned int s=0;s<ZT_TOPOLOGY_SHARDS;++s) {
+			RWMutex::RLock _l(_peerShards[s].lock);
+			ps.reserve(ps.size() + _peerShards[s].peers.size());
+			Hashtable< Address,SharedPtr<Peer> >::Iterator i(_peerShards[s].peers);
+			Address *a = (Address *)0;
+			SharedPtr<Peer> *p = (SharedPtr<Peer> *)0;
+			while (i.next(a,p))
+				ps.push_back(*p);
 		}
+		for(std::vector< SharedPtr<Peer> >::const_iterator p(ps.begin());p!=ps.end();++p)
+			f(*this,*p);
 	}
 
 	/**
@@ -329,8 +369,13 @@ public:
 	 */
 	inline std::vector< std::pair< Address,SharedPtr<Peer> > > allPeers() const
 	{
-		Mutex::Lock _l(_peers_m);
-		return _peers.entries();
+		std::vector< std::pair< Address,SharedPtr<Peer> > > ap;
+		for(unsigned int s=0;s<ZT_TOPOLOGY_SHARDS;++s) {
+			RWMutex::RLock _l(_peerShards[s].lock);
+			const std::vector< std::pair< Address,SharedPtr<Peer> > > e(_peerShards[s].peers.entries());
+			ap.insert(ap.end(),e.begin(),e.end());
+		}
+		return ap;
 	}
 
 	/**
@@ -441,6 +486,30 @@ public:
 	}
 
 private:
+	// Peers and paths are spread across ZT_TOPOLOGY_SHARDS tables, each with its
+	// own reader/writer lock, so lookups from many threads don't wait on each
+	// other and inserts or expiry only stall readers of one shard. A shard lock
+	// may be taken while holding _upstreams_m but never the other way around,
+	// and only one shard lock is held at a time.
+	struct _PeerShard
+	{
+		Hashtable< Address,SharedPtr<Peer> > peers;
+		RWMutex lock;
+		char pad[64]; // keep each shard's lock on its own cache line
+	};
+	struct _PathShard
+	{
+		Hashtable< Path::HashKey,SharedPtr<Path> > paths;
+		RWMutex lock;
+		char pad[64];
+	};
+
+	// Hashtable picks buckets from the low bits of the same hash code, so the
+	// shard comes from the high bits of a multiplicative mix instead.
+	static inline unsigned int _shardIndex(const unsigned long h) { return (unsigned int)((((uint64_t)h) * 0x9e3779b97f4a7c15ULL) >> 32) & (ZT_TOPOLOGY_SHARDS - 1); }
+	inline _PeerShard &_peerShard(const Address &a) { return _peerShards[_shardIndex(a.hashCode())]; }
+	inline _PathShard &_pathShard(const Path::HashKey &k) { return _pathShards[_shardIndex(k.hashCode())]; }
+
 	Identity _getIdentity(void *tPtr,const Address &zta);
 	void _memoizeUpstreams(void *tPtr);
 	void _savePeer(void *tPtr,const SharedPtr<Peer> &peer);
@@ -450,11 +519,8 @@ private:
 	std::pair<InetAddress,ZT_PhysicalPathConfiguration> _physicalPathConfig[ZT_MAX_CONFIGURABLE_PATHS];
 	volatile unsigned int _numConfiguredPhysicalPaths;
 
-	Hashtable< Address,SharedPtr<Peer> > _peers;
-	Mutex _peers_m;
-
-	Hashtable< Path::HashKey,SharedPtr<Path> > _paths;
-	Mutex _paths_m;
+	_PeerShard _peerShards[ZT_TOPOLOGY_SHARDS];
+	_PathShard _pathShards[ZT_TOPOLOGY_SHARDS];
 
 	World _planet;
 	std::vector<World> _moons;
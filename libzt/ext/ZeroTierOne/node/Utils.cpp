@@ -172,3 +172,10 @@ void Utils::getSecureRandom(void *buf,unsigned int bytes)
 }
 
 } // namespace ZeroTier
+
+// Internally re-export to included C code, which includes some fast crypto code ported in on some platforms.
+// The amd64 ed25519 batch verifier uses this for its random coefficients.
+extern "C" void ZT_getSecureRandomInternal(void *buf,unsigned int bytes)
+{
+	ZeroTier::Utils::getSecureRandom(buf,bytes);
+}
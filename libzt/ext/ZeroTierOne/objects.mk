@@ -4,6 +4,7 @@ CORE_OBJS=\
 	node/CertificateOfMembership.o \
 	node/CertificateOfOwnership.o \
 	node/Identity.o \
+	node/IdentityValidator.o \
 	node/IncomingPacket.o \
 	node/InetAddress.o \
 	node/Membership.o \
@@ -30,6 +31,7 @@ ONE_OBJS=\
 	controller/EmbeddedNetworkController.o \
 	controller/DB.o \
 	controller/FileDB.o \
+	controller/MappedDB.o \
 	controller/RethinkDB.o \
 	osdep/ManagedRoute.o \
 	osdep/Http.o \
@@ -413,6 +413,8 @@ public:
 
 	/**
 	 * Send from all bound UDP sockets
+	 *
+	 * Sends without a TTL may be batched, see Phy<>::udpSendBatched().
 	 */
 	template<typename PHY_HANDLER_TYPE>
 	inline bool udpSendAll(Phy<PHY_HANDLER_TYPE> &phy,const struct sockaddr_storage *addr,const void *data,unsigned int len,unsigned int ttl)
@@ -420,9 +422,13 @@ public:
 		bool r = false;
 		Mutex::Lock _l(_lock);
 		for(unsigned int b=0,c=_bindingCount;b<c;++b) {
-			if (ttl) phy.setIp4UdpTtl(_bindings[b].udpSock,ttl);
-			if (phy.udpSend(_bindings[b].udpSock,(const struct sockaddr *)addr,data,len)) r = true;
-			if (ttl) phy.setIp4UdpTtl(_bindings[b].udpSock,255);
+			if (ttl) {
+				phy.setIp4UdpTtl(_bindings[b].udpSock,ttl);
+				if (phy.udpSend(_bindings[b].udpSock,(const struct sockaddr *)addr,data,len)) r = true;
+				phy.setIp4UdpTtl(_bindings[b].udpSock,255);
+			} else if (phy.udpSendBatched(_bindings[b].udpSock,(const struct sockaddr *)addr,data,len)) {
+				r = true;
+			}
 		}
 		return r;
 	}
@@ -37,6 +37,8 @@
 #include <sys/ioctl.h>
 #include <sys/wait.h>
 #include <sys/select.h>
+#include <sys/uio.h>
+#include <poll.h>
 #include <netinet/in.h>
 #include <net/if_arp.h>
 #include <arpa/inet.h>
@@ -57,6 +59,23 @@
 #include "OSUtils.hpp"
 #include "LinuxEthernetTap.hpp"
 
+// struct virtio_net_hdr and constants from linux/virtio_net.h, which does not compile as C++
+struct _VirtioNetHdr
+{
+	uint8_t flags;
+	uint8_t gso_type;
+	uint16_t hdr_len;
+	uint16_t gso_size;
+	uint16_t csum_start;
+	uint16_t csum_offset;
+};
+#define ZT_VIRTIO_NET_HDR_F_NEEDS_CSUM 1
+#define ZT_VIRTIO_NET_HDR_GSO_NONE 0
+#define ZT_VIRTIO_NET_HDR_GSO_TCPV4 1
+#define ZT_VIRTIO_NET_HDR_GSO_UDP 3
+#define ZT_VIRTIO_NET_HDR_GSO_TCPV6 4
+#define ZT_VIRTIO_NET_HDR_GSO_ECN 0x80
+
 // ff:ff:ff:ff:ff:ff with no ADI
 static const ZeroTier::MulticastGroup _blindWildcardMulticastGroup(ZeroTier::MAC(0xff),0);
 
@@ -64,6 +83,18 @@ namespace ZeroTier {
 
 static Mutex __tapCreateLock;
 
+unsigned int LinuxEthernetTap::queues = 0;
+bool LinuxEthernetTap::vnetHdr = false;
+
+struct LinuxEthernetTap::_Queue
+{
+	_Queue(LinuxEthernetTap *p,int f) : parent(p),fd(f) {}
+	LinuxEthernetTap *const parent;
+	const int fd;
+	Thread thread;
+	inline void threadMain() throw() { parent->_queueMain(this); }
+};
+
 static const char _base32_chars[32] = { 'a','b','c','d','e','f','g','h','i','j','k','l','m','n','o','p','q','r','s','t','u','v','w','x','y','z','2','3','4','5','6','7' };
 static void _base32_5_to_8(const uint8_t *in,char *out)
 {
@@ -92,6 +123,7 @@ LinuxEthernetTap::LinuxEthernetTap(
 	_homePath(homePath),
 	_mtu(mtu),
 	_fd(0),
+	_vnetHdr(vnetHdr),
 	_enabled(true)
 {
 	char procpath[128],nwids[32];
@@ -166,16 +198,36 @@ LinuxEthernetTap::LinuxEthernetTap(
 #endif
 	}
 
-	ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+	unsigned int queueCount = std::min(std::max(queues,1U),(unsigned int)ZT_LINUX_TAP_MAX_QUEUES);
+	char ifname[IFNAMSIZ];
+	memcpy(ifname,ifr.ifr_name,IFNAMSIZ);
+	ifr.ifr_flags = IFF_TAP | IFF_NO_PI | ((queueCount > 1) ? IFF_MULTI_QUEUE : 0) | ((_vnetHdr) ? IFF_VNET_HDR : 0);
 	if (ioctl(_fd,TUNSETIFF,(void *)&ifr) < 0) {
-		::close(_fd);
-		throw std::runtime_error("unable to configure TUN/TAP device for TAP operation");
+		// Kernels without multi-queue or vnet header support get a plain tap
+		memcpy(ifr.ifr_name,ifname,IFNAMSIZ);
+		ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+		queueCount = 1;
+		_vnetHdr = false;
+		if (ioctl(_fd,TUNSETIFF,(void *)&ifr) < 0) {
+			::close(_fd);
+			throw std::runtime_error("unable to configure TUN/TAP device for TAP operation");
+		}
 	}
 
 	_dev = ifr.ifr_name;
 
 	::ioctl(_fd,TUNSETPERSIST,0); // valgrind may generate a false alarm here
 
+	if (_vnetHdr) {
+		// Ask for TSO and UFO super-frames and unchecksummed frames, or as much of that as we can get
+		int vnetHdrSize = (int)sizeof(_VirtioNetHdr);
+		::ioctl(_fd,TUNSETVNETHDRSZ,&vnetHdrSize);
+		if (::ioctl(_fd,TUNSETOFFLOAD,(unsigned long)(TUN_F_CSUM | TUN_F_TSO4 | TUN_F_TSO6 | TUN_F_TSO_ECN | TUN_F_UFO)) < 0) {
+			if (::ioctl(_fd,TUNSETOFFLOAD,(unsigned long)(TUN_F_CSUM | TUN_F_TSO4 | TUN_F_TSO6 | TUN_F_TSO_ECN)) < 0)
+				::ioctl(_fd,TUNSETOFFLOAD,(unsigned long)TUN_F_CSUM);
+		}
+	}
+
 	// Open an arbitrary socket to talk to netlink
 	int sock = socket(AF_INET,SOCK_DGRAM,0);
 	if (sock <= 0) {
@@ -201,7 +253,9 @@ LinuxEthernetTap::LinuxEthernetTap(
 		throw std::runtime_error("unable to configure TAP MTU");
 	}
 
-	if (fcntl(_fd,F_SETFL,fcntl(_fd,F_GETFL) & ~O_NONBLOCK) == -1) {
+	// Queue threads drain their fds until EAGAIN, the single-queue thread blocks in read()
+	const bool queueMode = ((queueCount > 1)||(_vnetHdr));
+	if (fcntl(_fd,F_SETFL,(queueMode) ? (fcntl(_fd,F_GETFL) | O_NONBLOCK) : (fcntl(_fd,F_GETFL) & ~O_NONBLOCK)) == -1) {
 		::close(_fd);
 		throw std::runtime_error("unable to set flags on file descriptor for TAP device");
 	}
@@ -239,13 +293,44 @@ LinuxEthernetTap::LinuxEthernetTap(
 	}
 	*/
 
-	_thread = Thread::start(this);
+	if (queueMode) {
+		_queues.push_back(new _Queue(this,_fd));
+		while (_queues.size() < queueCount) {
+			const int qfd = ::open("/dev/net/tun",O_RDWR);
+			if (qfd <= 0)
+				break;
+			struct ifreq qifr;
+			memset(&qifr,0,sizeof(qifr));
+			memcpy(qifr.ifr_name,ifr.ifr_name,IFNAMSIZ);
+			qifr.ifr_flags = IFF_TAP | IFF_NO_PI | IFF_MULTI_QUEUE | ((_vnetHdr) ? IFF_VNET_HDR : 0);
+			if (ioctl(qfd,TUNSETIFF,(void *)&qifr) < 0) {
+				::close(qfd);
+				break; // run with the queues we have
+			}
+			::fcntl(qfd,F_SETFL,fcntl(qfd,F_GETFL) | O_NONBLOCK);
+			::fcntl(qfd,F_SETFD,fcntl(qfd,F_GETFD) | FD_CLOEXEC);
+			_queues.push_back(new _Queue(this,qfd));
+		}
+		for(std::vector<_Queue *>::iterator q(_queues.begin());q!=_queues.end();++q)
+			(*q)->thread = Thread::start(*q);
+	} else {
+		_thread = Thread::start(this);
+	}
 }
 
 LinuxEthernetTap::~LinuxEthernetTap()
 {
-	(void)::write(_shutdownSignalPipe[1],"\0",1); // causes thread to exit
-	Thread::join(_thread);
+	(void)::write(_shutdownSignalPipe[1],"\0",1); // causes thread(s) to exit
+	if (_queues.empty()) {
+		Thread::join(_thread);
+	} else {
+		for(std::vector<_Queue *>::iterator q(_queues.begin());q!=_queues.end();++q) {
+			Thread::join((*q)->thread);
+			if ((*q)->fd != _fd)
+				::close((*q)->fd);
+			delete *q;
+		}
+	}
 	::close(_fd);
 	::close(_shutdownSignalPipe[0]);
 	::close(_shutdownSignalPipe[1]);
@@ -420,14 +505,25 @@ std::vector<InetAddress> LinuxEthernetTap::ips() const
 
 void LinuxEthernetTap::put(const MAC &from,const MAC &to,unsigned int etherType,const void *data,unsigned int len)
 {
-	char putBuf[ZT_MAX_MTU + 64];
 	if ((_fd > 0)&&(len <= _mtu)&&(_enabled)) {
-		to.copyTo(putBuf,6);
-		from.copyTo(putBuf + 6,6);
-		*((uint16_t *)(putBuf + 12)) = htons((uint16_t)etherType);
-		memcpy(putBuf + 14,data,len);
-		len += 14;
-		(void)::write(_fd,putBuf,len);
+		_VirtioNetHdr vh;
+		uint8_t eh[14];
+		struct iovec iov[3];
+		int iovcnt = 0;
+		if (_vnetHdr) {
+			memset(&vh,0,sizeof(vh)); // no offloads, frame is complete and checksummed
+			iov[iovcnt].iov_base = &vh;
+			iov[iovcnt++].iov_len = sizeof(vh);
+		}
+		to.copyTo(eh,6);
+		from.copyTo(eh + 6,6);
+		eh[12] = (uint8_t)(etherType >> 8);
+		eh[13] = (uint8_t)etherType;
+		iov[iovcnt].iov_base = eh;
+		iov[iovcnt++].iov_len = 14;
+		iov[iovcnt].iov_base = const_cast<void *>(data);
+		iov[iovcnt++].iov_len = len;
+		(void)::writev(_fd,iov,iovcnt);
 	}
 }
 
@@ -556,4 +652,231 @@ void LinuxEthernetTap::threadMain()
 	}
 }
 
+void LinuxEthernetTap::_queueMain(_Queue *q)
+{
+	uint8_t *const getBuf = new uint8_t[ZT_LINUX_TAP_READ_BUF_SIZE];
+	uint8_t *const segBuf = new uint8_t[ZT_MAX_MTU + 64];
+	struct pollfd pfd[2];
+
+	Thread::sleep(500);
+
+	pfd[0].fd = _shutdownSignalPipe[0];
+	pfd[0].events = POLLIN;
+	pfd[1].fd = q->fd;
+	pfd[1].events = POLLIN;
+
+	for(;;) {
+		pfd[0].revents = 0;
+		pfd[1].revents = 0;
+		if (::poll(pfd,2,-1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		if (pfd[0].revents) // writes to shutdown pipe terminate thread
+			break;
+		if (pfd[1].revents & POLLNVAL)
+			break;
+
+		bool failed = false;
+		for(unsigned int k=0;k<ZT_LINUX_TAP_READ_BATCH;++k) {
+			const long n = (long)::read(q->fd,getBuf,ZT_LINUX_TAP_READ_BUF_SIZE);
+			if (n <= 0) {
+				failed = ((n < 0)&&(errno != EAGAIN)&&(errno != EWOULDBLOCK)&&(errno != EINTR)&&(errno != ETIMEDOUT));
+				break;
+			}
+			if (_vnetHdr)
+				segment(getBuf,(unsigned int)n,_mtu,segBuf,&LinuxEthernetTap::_deliverSegment,this);
+			else _deliver(getBuf,(unsigned int)n);
+		}
+		if (failed)
+			break;
+	}
+
+	delete [] segBuf;
+	delete [] getBuf;
+}
+
+void LinuxEthernetTap::_deliver(const uint8_t *frame,unsigned int len)
+{
+	if ((len > 14)&&(len <= (_mtu + 14))&&(_enabled)) {
+		const MAC to(frame,6);
+		const MAC from(frame + 6,6);
+		const unsigned int etherType = ((unsigned int)frame[12] << 8) | (unsigned int)frame[13];
+		// TODO: VLAN support
+		_handler(_arg,(void *)0,_nwid,from,to,etherType,0,(const void *)(frame + 14),len - 14);
+	}
+}
+
+void LinuxEthernetTap::_deliverSegment(void *tap,const uint8_t *frame,unsigned int len)
+{
+	reinterpret_cast<LinuxEthernetTap *>(tap)->_deliver(frame,len);
+}
+
+static inline uint64_t _csumAdd(uint64_t sum,const uint8_t *p,unsigned int len)
+{
+	while (len > 1) {
+		sum += ((uint64_t)p[0] << 8) | (uint64_t)p[1];
+		p += 2;
+		len -= 2;
+	}
+	if (len)
+		sum += (uint64_t)p[0] << 8;
+	return sum;
+}
+
+static inline unsigned int _csumFinish(uint64_t sum)
+{
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return (unsigned int)(~sum & 0xffff);
+}
+
+static inline void _set16(uint8_t *p,unsigned int v)
+{
+	p[0] = (uint8_t)(v >> 8);
+	p[1] = (uint8_t)v;
+}
+
+static inline void _set32(uint8_t *p,uint32_t v)
+{
+	p[0] = (uint8_t)(v >> 24);
+	p[1] = (uint8_t)(v >> 16);
+	p[2] = (uint8_t)(v >> 8);
+	p[3] = (uint8_t)v;
+}
+
+unsigned int LinuxEthernetTap::segment(uint8_t *frame,unsigned int len,unsigned int mtu,uint8_t *buf,void (*handler)(void *,const uint8_t *,unsigned int),void *arg)
+{
+	_VirtioNetHdr vh;
+	if (len < (sizeof(vh) + 14))
+		return 0;
+	memcpy(&vh,frame,sizeof(vh));
+	uint8_t *const f = frame + sizeof(vh);
+	len -= sizeof(vh);
+	const unsigned int etherType = ((unsigned int)f[12] << 8) | (unsigned int)f[13];
+	const unsigned int gsoType = vh.gso_type & ~ZT_VIRTIO_NET_HDR_GSO_ECN;
+	const unsigned int l4 = vh.csum_start; // for super-frames the kernel always sets NEEDS_CSUM and points this at the L4 header
+
+	if (vh.flags & ZT_VIRTIO_NET_HDR_F_NEEDS_CSUM) {
+		const unsigned int cp = l4 + vh.csum_offset;
+		if ((l4 < 14)||((cp + 2) > len))
+			return 0;
+		if ((gsoType != ZT_VIRTIO_NET_HDR_GSO_TCPV4)&&(gsoType != ZT_VIRTIO_NET_HDR_GSO_TCPV6)) { // TCP segments are checksummed below
+			// The kernel leaves the pseudo-header sum in the checksum field, so this just sums from L4 onward
+			unsigned int c = _csumFinish(_csumAdd(0,f + l4,len - l4));
+			if ((c == 0)&&(vh.csum_offset == 6))
+				c = 0xffff; // UDP sends a checksum of zero as all ones
+			_set16(f + cp,c);
+		}
+	} else if (gsoType != ZT_VIRTIO_NET_HDR_GSO_NONE) {
+		return 0;
+	}
+
+	switch(gsoType) {
+
+		case ZT_VIRTIO_NET_HDR_GSO_NONE:
+			if (len > (mtu + 14))
+				return 0;
+			handler(arg,f,len);
+			return 1;
+
+		case ZT_VIRTIO_NET_HDR_GSO_TCPV4:
+		case ZT_VIRTIO_NET_HDR_GSO_TCPV6: {
+			const bool v4 = (gsoType == ZT_VIRTIO_NET_HDR_GSO_TCPV4);
+			if ((v4) ? ((etherType != ZT_ETHERTYPE_IPV4)||(l4 < 34)) : ((etherType != ZT_ETHERTYPE_IPV6)||(l4 < 54)))
+				return 0;
+			if ((l4 + 20) > len)
+				return 0;
+			const unsigned int hlen = l4 + ((f[l4 + 12] >> 4) * 4);
+			const unsigned int mss = vh.gso_size;
+			if ((hlen > len)||(mss == 0)||((hlen - 14 + mss) > mtu))
+				return 0;
+			const uint32_t seq = ((uint32_t)f[l4 + 4] << 24) | ((uint32_t)f[l4 + 5] << 16) | ((uint32_t)f[l4 + 6] << 8) | (uint32_t)f[l4 + 7];
+			const unsigned int ipId = ((unsigned int)f[18] << 8) | (unsigned int)f[19];
+
+			unsigned int n = 0;
+			memcpy(buf,f,hlen);
+			uint8_t *const tcp = buf + l4;
+			for(unsigned int off=hlen;off<len;off+=mss) {
+				const unsigned int plen = std::min(mss,len - off);
+				const unsigned int tcpLen = (hlen - l4) + plen;
+				memcpy(buf + hlen,f + off,plen);
+
+				_set32(tcp + 4,seq + (uint32_t)(off - hlen));
+				tcp[13] = f[l4 + 13];
+				if ((off + plen) < len)
+					tcp[13] &= ~0x09; // FIN and PSH only go on the last segment
+				if (n > 0)
+					tcp[13] &= ~0x80; // CWR only goes on the first
+
+				uint64_t sum;
+				if (v4) {
+					_set16(buf + 16,(hlen - 14) + plen);
+					_set16(buf + 18,ipId + n);
+					_set16(buf + 24,0);
+					_set16(buf + 24,_csumFinish(_csumAdd(0,buf + 14,(buf[14] & 0xf) * 4)));
+					sum = _csumAdd(0,buf + 26,8);
+				} else {
+					_set16(buf + 18,(hlen - 54) + plen);
+					sum = _csumAdd(0,buf + 22,32);
+				}
+				sum += 6 + tcpLen; // protocol and length in pseudo-header
+				_set16(tcp + 16,0);
+				_set16(tcp + 16,_csumFinish(_csumAdd(sum,tcp,tcpLen)));
+
+				handler(arg,buf,hlen + plen);
+				++n;
+			}
+			return n;
+		}
+
+		case ZT_VIRTIO_NET_HDR_GSO_UDP: {
+			// UDP super-frames go out as IP fragments of one checksummed datagram
+			unsigned int n = 0;
+			if ((etherType == ZT_ETHERTYPE_IPV4)&&(len >= 34)) {
+				const unsigned int hlen = 14 + ((f[14] & 0xf) * 4);
+				const unsigned int maxFrag = (mtu - (hlen - 14)) & ~7U;
+				if ((hlen > len)||(hlen < 34)||(maxFrag == 0))
+					return 0;
+				memcpy(buf,f,hlen);
+				for(unsigned int off=hlen;off<len;off+=maxFrag) {
+					const unsigned int plen = std::min(maxFrag,len - off);
+					memcpy(buf + hlen,f + off,plen);
+					_set16(buf + 16,(hlen - 14) + plen);
+					_set16(buf + 20,((off - hlen) >> 3) | (((off + plen) < len) ? 0x2000 : 0)); // also clears DF
+					_set16(buf + 24,0);
+					_set16(buf + 24,_csumFinish(_csumAdd(0,buf + 14,hlen - 14)));
+					handler(arg,buf,hlen + plen);
+					++n;
+				}
+			} else if ((etherType == ZT_ETHERTYPE_IPV6)&&(len >= 54)&&(f[20] == 17)) { // only without extension headers
+				const unsigned int maxFrag = (mtu - 48) & ~7U;
+				if (mtu < 56)
+					return 0;
+				uint32_t ident;
+				Utils::getSecureRandom(&ident,sizeof(ident));
+				memcpy(buf,f,54);
+				buf[20] = 44; // fragment header
+				buf[54] = 17;
+				buf[55] = 0;
+				_set32(buf + 58,ident);
+				for(unsigned int off=54;off<len;off+=maxFrag) {
+					const unsigned int plen = std::min(maxFrag,len - off);
+					memcpy(buf + 62,f + off,plen);
+					_set16(buf + 18,8 + plen);
+					_set16(buf + 56,(off - 54) | (((off + plen) < len) ? 1 : 0));
+					handler(arg,buf,62 + plen);
+					++n;
+				}
+			}
+			return n;
+		}
+
+	}
+
+	return 0;
+}
+
 } // namespace ZeroTier
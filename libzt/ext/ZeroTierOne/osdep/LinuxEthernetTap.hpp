@@ -37,6 +37,21 @@
 #include "../node/MulticastGroup.hpp"
 #include "Thread.hpp"
 
+/**
+ * Maximum number of IFF_MULTI_QUEUE queues (each with its own reader thread) per tap
+ */
+#define ZT_LINUX_TAP_MAX_QUEUES 16
+
+/**
+ * Maximum number of frames a queue's reader thread reads per wakeup
+ */
+#define ZT_LINUX_TAP_READ_BATCH 64
+
+/**
+ * Size of read buffer for a queue, enough for a 64KiB GSO frame and its headers
+ */
+#define ZT_LINUX_TAP_READ_BUF_SIZE 65664
+
 namespace ZeroTier {
 
 /**
@@ -74,7 +89,48 @@ public:
 	void threadMain()
 		throw();
 
+	/**
+	 * Number of queues for taps created after this is set
+	 *
+	 * If this is more than one the tap is opened with IFF_MULTI_QUEUE and
+	 * each queue is read by its own thread, which reads up to
+	 * ZT_LINUX_TAP_READ_BATCH frames per wakeup. The kernel spreads received
+	 * frames across queues by flow. The default of 0 opens a single queue.
+	 */
+	static unsigned int queues;
+
+	/**
+	 * If true, taps created after this is set use IFF_VNET_HDR and offloads
+	 *
+	 * This lets the kernel hand over TCP and UDP super-frames (TSO/UFO) and
+	 * frames without checksums, which are split and checksummed by
+	 * segment(). This reads the same way as queues > 1 even with one queue.
+	 */
+	static bool vnetHdr;
+
+	/**
+	 * Split a frame read with IFF_VNET_HDR into frames that fit the MTU
+	 *
+	 * TCP super-frames are segmented, UDP super-frames are sent as IP
+	 * fragments, and checksums left to us by the kernel are filled in.
+	 *
+	 * @param frame Frame as read, starting with its struct virtio_net_hdr (may be modified)
+	 * @param len Length of frame including virtio header
+	 * @param mtu Maximum length of each resulting frame after its 14-byte Ethernet header
+	 * @param buf Buffer of at least mtu + 14 bytes to build segments in
+	 * @param handler Function to call with each resulting Ethernet frame
+	 * @param arg First argument to handler
+	 * @return Number of frames passed to handler (0 if frame was dropped)
+	 */
+	static unsigned int segment(uint8_t *frame,unsigned int len,unsigned int mtu,uint8_t *buf,void (*handler)(void *,const uint8_t *,unsigned int),void *arg);
+
 private:
+	struct _Queue;
+
+	void _queueMain(_Queue *q);
+	void _deliver(const uint8_t *frame,unsigned int len);
+	static void _deliverSegment(void *tap,const uint8_t *frame,unsigned int len);
+
 	void (*_handler)(void *,void *,uint64_t,const MAC &,const MAC &,unsigned int,unsigned int,const void *,unsigned int);
 	void *_arg;
 	uint64_t _nwid;
@@ -84,6 +140,8 @@ private:
 	std::vector<MulticastGroup> _multicastGroups;
 	unsigned int _mtu;
 	int _fd;
+	std::vector<_Queue *> _queues; // empty if _fd is read by threadMain()
+	bool _vnetHdr;
 	int _shutdownSignalPipe[2];
 	volatile bool _enabled;
 };
@@ -32,6 +32,7 @@
 #include <string.h>
 
 #include <list>
+#include <vector>
 #include <stdexcept>
 
 #if defined(_WIN32) || defined(_WIN64)
@@ -67,13 +68,36 @@
 #ifndef IPV6_DONTFRAG
 #define IPV6_DONTFRAG 62
 #endif
+// epoll is used on Linux unless ZT_PHY_USE_SELECT is defined
+#ifndef ZT_PHY_USE_SELECT
+#define ZT_PHY_USE_EPOLL 1
+#endif
+// UDP is read and written in batches with recvmmsg()/sendmmsg() unless ZT_PHY_NO_MMSG is defined
+#ifndef ZT_PHY_NO_MMSG
+#define ZT_PHY_USE_MMSG 1
+#endif
+#endif
+
+#ifdef ZT_PHY_USE_EPOLL
+#include <sys/epoll.h>
+#endif
+#ifdef ZT_PHY_USE_MMSG
+#include <pthread.h>
+#include <atomic>
+#define ZT_PHY_UDP_BATCH 32
+#define ZT_PHY_UDP_BATCH_MAX_DATAGRAM 16384
 #endif
 
 #define ZT_PHY_SOCKFD_TYPE int
 #define ZT_PHY_SOCKFD_NULL (-1)
 #define ZT_PHY_SOCKFD_VALID(s) ((s) > -1)
 #define ZT_PHY_CLOSE_SOCKET(s) ::close(s)
+#ifdef ZT_PHY_USE_EPOLL
+#define ZT_PHY_MAX_SOCKETS 1048576
+#define ZT_PHY_EPOLL_MAX_EVENTS 256
+#else
 #define ZT_PHY_MAX_SOCKETS (FD_SETSIZE)
+#endif
 #define ZT_PHY_MAX_INTERCEPTS ZT_PHY_MAX_SOCKETS
 #define ZT_PHY_SOCKADDR_STORAGE_TYPE struct sockaddr_storage
 
@@ -130,6 +154,17 @@ typedef void PhySocket;
  * handler, and in that case close() can be told not to call handlers to
  * prevent recursion.
  *
+ * On Linux poll() is backed by epoll and only visits sockets that are
+ * actually ready, so cost does not grow with the number of idle sockets and
+ * there is no FD_SETSIZE limit. UDP sockets are edge-triggered and drained
+ * until the kernel has nothing left. Define ZT_PHY_USE_SELECT to fall back
+ * to select() everywhere.
+ *
+ * Also on Linux, UDP datagrams are received ZT_PHY_UDP_BATCH at a time with
+ * recvmmsg(). Datagrams larger than ZT_PHY_UDP_BATCH_MAX_DATAGRAM are dropped
+ * in this mode. Sends made with udpSendBatched() from inside a handler are
+ * queued and written with sendmmsg() when poll() finishes dispatching.
+ *
  * This isn't thread-safe with the exception of whack(), which is safe to
  * call from another thread to abort poll().
  */
@@ -158,15 +193,25 @@ private:
 		ZT_PHY_SOCKFD_TYPE sock;
 		void *uptr; // user-settable pointer
 		ZT_PHY_SOCKADDR_STORAGE_TYPE saddr; // remote for TCP_OUT and TCP_IN, local for TCP_LISTEN, RAW, and UDP
+#ifdef ZT_PHY_USE_EPOLL
+		uint32_t events; // currently registered epoll events
+		typename std::list<PhySocketImpl>::iterator self; // position in _socks, for erasing without a scan
+#endif
 	};
 
 	std::list<PhySocketImpl> _socks;
+#ifdef ZT_PHY_USE_EPOLL
+	int _epfd;
+	std::vector<typename std::list<PhySocketImpl>::iterator> _closed; // erased at the end of poll()
+	std::vector<PhySocketImpl *> _udpBacklog; // UDP sockets that hit the per-poll read limit
+#else
 	fd_set _readfds;
 	fd_set _writefds;
 #if defined(_WIN32) || defined(_WIN64)
 	fd_set _exceptfds;
 #endif
 	long _nfds;
+#endif
 
 	ZT_PHY_SOCKFD_TYPE _whackReceiveSocket;
 	ZT_PHY_SOCKFD_TYPE _whackSendSocket;
@@ -174,6 +219,29 @@ private:
 	bool _noDelay;
 	bool _noCheck;
 
+#ifdef ZT_PHY_USE_MMSG
+	// Allocated on first use so Phy<> instances without UDP sockets don't pay for it
+	struct _MmsgState
+	{
+		struct mmsghdr recvHdrs[ZT_PHY_UDP_BATCH];
+		struct iovec recvIov[ZT_PHY_UDP_BATCH];
+		struct sockaddr_storage recvFrom[ZT_PHY_UDP_BATCH];
+		char recvBuf[ZT_PHY_UDP_BATCH][ZT_PHY_UDP_BATCH_MAX_DATAGRAM];
+		struct mmsghdr sendHdrs[ZT_PHY_UDP_BATCH];
+		struct iovec sendIov[ZT_PHY_UDP_BATCH];
+		struct sockaddr_storage sendTo[ZT_PHY_UDP_BATCH];
+		PhySocketImpl *sendSock[ZT_PHY_UDP_BATCH];
+		char sendBuf[ZT_PHY_UDP_BATCH][ZT_PHY_UDP_BATCH_MAX_DATAGRAM];
+		unsigned int sendCount;
+	};
+	_MmsgState *_mmsg;
+	// Set by poll() while it dispatches. Other threads may call udpSendBatched()
+	// at any time, so _inPoll is atomic and _pollThread is only read after it
+	// has been seen true, and only rewritten if a different thread starts polling.
+	pthread_t _pollThread;
+	std::atomic<bool> _inPoll;
+#endif
+
 public:
 	/**
 	 * @param handler Pointer of type HANDLER_PTR_TYPE to handler
@@ -183,8 +251,10 @@ public:
 	Phy(HANDLER_PTR_TYPE handler,bool noDelay,bool noCheck) :
 		_handler(handler)
 	{
+#ifndef ZT_PHY_USE_EPOLL
 		FD_ZERO(&_readfds);
 		FD_ZERO(&_writefds);
+#endif
 
 #if defined(_WIN32) || defined(_WIN64)
 		FD_ZERO(&_exceptfds);
@@ -220,11 +290,32 @@ public:
 			throw std::runtime_error("unable to create pipes for select() abort");
 #endif // Windows or not
 
+#ifdef ZT_PHY_USE_EPOLL
+		_epfd = ::epoll_create1(EPOLL_CLOEXEC);
+		if (_epfd < 0) {
+			::close(pipes[0]);
+			::close(pipes[1]);
+			throw std::runtime_error("unable to create epoll instance");
+		}
+		{
+			struct epoll_event ev;
+			memset(&ev,0,sizeof(ev));
+			ev.events = EPOLLIN;
+			ev.data.ptr = (void *)0; // NULL marks the whack pipe
+			::epoll_ctl(_epfd,EPOLL_CTL_ADD,pipes[0],&ev);
+		}
+#else
 		_nfds = (pipes[0] > pipes[1]) ? (long)pipes[0] : (long)pipes[1];
+#endif
 		_whackReceiveSocket = pipes[0];
 		_whackSendSocket = pipes[1];
 		_noDelay = noDelay;
 		_noCheck = noCheck;
+#ifdef ZT_PHY_USE_MMSG
+		_mmsg = (_MmsgState *)0;
+		_pollThread = pthread_self();
+		_inPoll.store(false,std::memory_order_relaxed);
+#endif
 	}
 
 	~Phy()
@@ -235,6 +326,12 @@ public:
 		}
 		ZT_PHY_CLOSE_SOCKET(_whackReceiveSocket);
 		ZT_PHY_CLOSE_SOCKET(_whackSendSocket);
+#ifdef ZT_PHY_USE_EPOLL
+		::close(_epfd);
+#endif
+#ifdef ZT_PHY_USE_MMSG
+		delete _mmsg;
+#endif
 	}
 
 	/**
@@ -305,14 +402,15 @@ public:
 			return (PhySocket *)0;
 		}
 		PhySocketImpl &sws = _socks.back();
-		if ((long)fd > _nfds)
-			_nfds = (long)fd;
-		FD_SET(fd,&_readfds);
 		sws.type = ZT_PHY_SOCKET_UNIX_IN; /* TODO: Type was changed to allow for CBs with new RPC model */
 		sws.sock = fd;
 		sws.uptr = uptr;
 		memset(&(sws.saddr),0,sizeof(struct sockaddr_storage));
 		// no sockaddr for this socket type, leave saddr null
+		if (!_ioAdd(sws,true,false)) {
+			_socks.pop_back();
+			return (PhySocket *)0;
+		}
 		return (PhySocket *)&sws;
 	}
 
@@ -410,14 +508,16 @@ public:
 		}
 		PhySocketImpl &sws = _socks.back();
 
-		if ((long)s > _nfds)
-			_nfds = (long)s;
-		FD_SET(s,&_readfds);
 		sws.type = ZT_PHY_SOCKET_UDP;
 		sws.sock = s;
 		sws.uptr = uptr;
 		memset(&(sws.saddr),0,sizeof(struct sockaddr_storage));
 		memcpy(&(sws.saddr),localAddress,(localAddress->sa_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in));
+		if (!_ioAdd(sws,true,false)) {
+			ZT_PHY_CLOSE_SOCKET(s);
+			_socks.pop_back();
+			return (PhySocket *)0;
+		}
 
 		return (PhySocket *)&sws;
 	}
@@ -459,6 +559,43 @@ public:
 #endif
 	}
 
+	/**
+	 * Send a UDP packet, possibly deferring it to be sent with others
+	 *
+	 * When called from a handler on the thread running poll(), the packet is
+	 * copied into a queue that is written with one sendmmsg() per socket once
+	 * poll() has dispatched everything. In that case true means queued, and a
+	 * later send failure is not reported. Anywhere else, and on platforms
+	 * without sendmmsg(), this is the same as udpSend().
+	 *
+	 * Don't combine with setIp4UdpTtl(), which would apply at flush time.
+	 *
+	 * @param sock UDP socket
+	 * @param remoteAddress Destination address (must be correct type for socket)
+	 * @param data Data to send
+	 * @param len Length of packet
+	 * @return True if packet was queued or appears to have been sent successfully
+	 */
+	inline bool udpSendBatched(PhySocket *sock,const struct sockaddr *remoteAddress,const void *data,unsigned long len)
+	{
+#ifdef ZT_PHY_USE_MMSG
+		if ((len <= ZT_PHY_UDP_BATCH_MAX_DATAGRAM)&&(_inPoll.load(std::memory_order_acquire))&&(pthread_equal(pthread_self(),_pollThread))) {
+			if ((!_mmsg)&&(!_mmsgInit()))
+				return udpSend(sock,remoteAddress,data,len);
+			if (_mmsg->sendCount >= ZT_PHY_UDP_BATCH)
+				_udpFlush();
+			const unsigned int i = _mmsg->sendCount++;
+			memcpy(_mmsg->sendBuf[i],data,len);
+			_mmsg->sendIov[i].iov_len = len;
+			memcpy(&(_mmsg->sendTo[i]),remoteAddress,(remoteAddress->sa_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in));
+			_mmsg->sendHdrs[i].msg_hdr.msg_namelen = (remoteAddress->sa_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+			_mmsg->sendSock[i] = reinterpret_cast<PhySocketImpl *>(sock);
+			return true;
+		}
+#endif
+		return udpSend(sock,remoteAddress,data,len);
+	}
+
 #ifdef __UNIX_LIKE__
 	/**
 	 * Listen for connections on a Unix domain socket
@@ -504,14 +641,16 @@ public:
 		}
 		PhySocketImpl &sws = _socks.back();
 
-		if ((long)s > _nfds)
-			_nfds = (long)s;
-		FD_SET(s,&_readfds);
 		sws.type = ZT_PHY_SOCKET_UNIX_LISTEN;
 		sws.sock = s;
 		sws.uptr = uptr;
 		memset(&(sws.saddr),0,sizeof(struct sockaddr_storage));
 		memcpy(&(sws.saddr),&sun,sizeof(struct sockaddr_un));
+		if (!_ioAdd(sws,true,false)) {
+			ZT_PHY_CLOSE_SOCKET(s);
+			_socks.pop_back();
+			return (PhySocket *)0;
+		}
 
 		return (PhySocket *)&sws;
 	}
@@ -570,14 +709,16 @@ public:
 		}
 		PhySocketImpl &sws = _socks.back();
 
-		if ((long)s > _nfds)
-			_nfds = (long)s;
-		FD_SET(s,&_readfds);
 		sws.type = ZT_PHY_SOCKET_TCP_LISTEN;
 		sws.sock = s;
 		sws.uptr = uptr;
 		memset(&(sws.saddr),0,sizeof(struct sockaddr_storage));
 		memcpy(&(sws.saddr),localAddress,(localAddress->sa_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in));
+		if (!_ioAdd(sws,true,false)) {
+			ZT_PHY_CLOSE_SOCKET(s);
+			_socks.pop_back();
+			return (PhySocket *)0;
+		}
 
 		return (PhySocket *)&sws;
 	}
@@ -655,22 +796,21 @@ public:
 		}
 		PhySocketImpl &sws = _socks.back();
 
-		if ((long)s > _nfds)
-			_nfds = (long)s;
-		if (connected) {
-			FD_SET(s,&_readfds);
-			sws.type = ZT_PHY_SOCKET_TCP_OUT_CONNECTED;
-		} else {
-			FD_SET(s,&_writefds);
-#if defined(_WIN32) || defined(_WIN64)
-			FD_SET(s,&_exceptfds);
-#endif
-			sws.type = ZT_PHY_SOCKET_TCP_OUT_PENDING;
-		}
+		sws.type = (connected) ? ZT_PHY_SOCKET_TCP_OUT_CONNECTED : ZT_PHY_SOCKET_TCP_OUT_PENDING;
 		sws.sock = s;
 		sws.uptr = uptr;
 		memset(&(sws.saddr),0,sizeof(struct sockaddr_storage));
 		memcpy(&(sws.saddr),remoteAddress,(remoteAddress->sa_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in));
+		if (!_ioAdd(sws,connected,!connected)) {
+			ZT_PHY_CLOSE_SOCKET(s);
+			_socks.pop_back();
+			connected = false;
+			return (PhySocket *)0;
+		}
+#if defined(_WIN32) || defined(_WIN64)
+		if (!connected)
+			FD_SET(s,&_exceptfds);
+#endif
 
 		if ((callConnectHandler)&&(connected)) {
 			try {
@@ -818,12 +958,7 @@ public:
 	 */
 	inline void setNotifyWritable(PhySocket *sock,bool notifyWritable)
 	{
-		PhySocketImpl &sws = *(reinterpret_cast<PhySocketImpl *>(sock));
-		if (notifyWritable) {
-			FD_SET(sws.sock,&_writefds);
-		} else {
-			FD_CLR(sws.sock,&_writefds);
-		}
+		_ioSetWritable(*(reinterpret_cast<PhySocketImpl *>(sock)),notifyWritable);
 	}
 
 	/**
@@ -838,12 +973,7 @@ public:
 	 */
 	inline void setNotifyReadable(PhySocket *sock,bool notifyReadable)
 	{
-		PhySocketImpl &sws = *(reinterpret_cast<PhySocketImpl *>(sock));
-		if (notifyReadable) {
-			FD_SET(sws.sock,&_readfds);
-		} else {
-			FD_CLR(sws.sock,&_readfds);
-		}
+		_ioSetReadable(*(reinterpret_cast<PhySocketImpl *>(sock)),notifyReadable);
 	}
 
 	/**
@@ -859,6 +989,47 @@ public:
 	{
 		char buf[131072];
 		struct sockaddr_storage ss;
+
+#ifdef ZT_PHY_USE_EPOLL
+		struct epoll_event events[ZT_PHY_EPOLL_MAX_EVENTS];
+
+		// Finish draining UDP sockets that were cut short last time, without waiting
+		std::vector<PhySocketImpl *> backlog;
+		backlog.swap(_udpBacklog);
+
+		const int n = ::epoll_wait(_epfd,events,ZT_PHY_EPOLL_MAX_EVENTS,(backlog.size() > 0) ? 0 : ((timeout > 0) ? (int)timeout : -1));
+
+#ifdef ZT_PHY_USE_MMSG
+		if (!pthread_equal(_pollThread,pthread_self()))
+			_pollThread = pthread_self();
+		_inPoll.store(true,std::memory_order_release);
+#endif
+
+		for(typename std::vector<PhySocketImpl *>::iterator s(backlog.begin());s!=backlog.end();++s)
+			_process(**s,true,false,buf,ss);
+
+		for(int i=0;i<n;++i) {
+			PhySocketImpl *s = reinterpret_cast<PhySocketImpl *>(events[i].data.ptr);
+			if (!s) {
+				char tmp[16];
+				::read(_whackReceiveSocket,tmp,16);
+				continue;
+			}
+			// Errors and hangups are handed to the read or connect path, which notices and closes
+			const uint32_t ev = events[i].events;
+			_process(*s,((ev & (EPOLLIN|EPOLLERR|EPOLLHUP)) != 0),((ev & (EPOLLOUT|EPOLLERR|EPOLLHUP)) != 0),buf,ss);
+		}
+
+#ifdef ZT_PHY_USE_MMSG
+		_inPoll.store(false,std::memory_order_release);
+		if ((_mmsg)&&(_mmsg->sendCount))
+			_udpFlush();
+#endif
+
+		for(typename std::vector<typename std::list<PhySocketImpl>::iterator>::iterator c(_closed.begin());c!=_closed.end();++c)
+			_socks.erase(*c);
+		_closed.clear();
+#else // select()
 		struct timeval tv;
 		fd_set rfds,wfds,efds;
 
@@ -884,172 +1055,32 @@ public:
 #endif
 		}
 
-		for(typename std::list<PhySocketImpl>::iterator s(_socks.begin());s!=_socks.end();) {
-			switch (s->type) {
-
-				case ZT_PHY_SOCKET_TCP_OUT_PENDING:
-#if defined(_WIN32) || defined(_WIN64)
-					if (FD_ISSET(s->sock,&efds)) {
-						this->close((PhySocket *)&(*s),true);
-					} else // ... if
-#endif
-					if (FD_ISSET(s->sock,&wfds)) {
-						socklen_t slen = sizeof(ss);
-						if (::getpeername(s->sock,(struct sockaddr *)&ss,&slen) != 0) {
-							this->close((PhySocket *)&(*s),true);
-						} else {
-							s->type = ZT_PHY_SOCKET_TCP_OUT_CONNECTED;
-							FD_SET(s->sock,&_readfds);
-							FD_CLR(s->sock,&_writefds);
-#if defined(_WIN32) || defined(_WIN64)
-							FD_CLR(s->sock,&_exceptfds);
+#ifdef ZT_PHY_USE_MMSG
+		if (!pthread_equal(_pollThread,pthread_self()))
+			_pollThread = pthread_self();
+		_inPoll.store(true,std::memory_order_release);
 #endif
-							try {
-								_handler->phyOnTcpConnect((PhySocket *)&(*s),&(s->uptr),true);
-							} catch ( ... ) {}
-						}
-					}
-					break;
 
-				case ZT_PHY_SOCKET_TCP_OUT_CONNECTED:
-				case ZT_PHY_SOCKET_TCP_IN: {
-					ZT_PHY_SOCKFD_TYPE sock = s->sock; // if closed, s->sock becomes invalid as s is no longer dereferencable
-					if (FD_ISSET(sock,&rfds)) {
-						long n = (long)::recv(sock,buf,sizeof(buf),0);
-						if (n <= 0) {
-							this->close((PhySocket *)&(*s),true);
-						} else {
-							try {
-								_handler->phyOnTcpData((PhySocket *)&(*s),&(s->uptr),(void *)buf,(unsigned long)n);
-							} catch ( ... ) {}
-						}
-					}
-					if ((FD_ISSET(sock,&wfds))&&(FD_ISSET(sock,&_writefds))) {
-						try {
-							_handler->phyOnTcpWritable((PhySocket *)&(*s),&(s->uptr));
-						} catch ( ... ) {}
-					}
-				}	break;
-
-				case ZT_PHY_SOCKET_TCP_LISTEN:
-					if (FD_ISSET(s->sock,&rfds)) {
-						memset(&ss,0,sizeof(ss));
-						socklen_t slen = sizeof(ss);
-						ZT_PHY_SOCKFD_TYPE newSock = ::accept(s->sock,(struct sockaddr *)&ss,&slen);
-						if (ZT_PHY_SOCKFD_VALID(newSock)) {
-							if (_socks.size() >= ZT_PHY_MAX_SOCKETS) {
-								ZT_PHY_CLOSE_SOCKET(newSock);
-							} else {
+		for(typename std::list<PhySocketImpl>::iterator s(_socks.begin());s!=_socks.end();) {
 #if defined(_WIN32) || defined(_WIN64)
-								{ BOOL f = (_noDelay ? TRUE : FALSE); setsockopt(newSock,IPPROTO_TCP,TCP_NODELAY,(char *)&f,sizeof(f)); }
-								{ u_long iMode=1; ioctlsocket(newSock,FIONBIO,&iMode); }
-#else
-								{ int f = (_noDelay ? 1 : 0); setsockopt(newSock,IPPROTO_TCP,TCP_NODELAY,(char *)&f,sizeof(f)); }
-								fcntl(newSock,F_SETFL,O_NONBLOCK);
+			if ((s->type == ZT_PHY_SOCKET_TCP_OUT_PENDING)&&(FD_ISSET(s->sock,&efds))) {
+				this->close((PhySocket *)&(*s),true);
+			} else // ... if
 #endif
-								_socks.push_back(PhySocketImpl());
-								PhySocketImpl &sws = _socks.back();
-								FD_SET(newSock,&_readfds);
-								if ((long)newSock > _nfds)
-									_nfds = (long)newSock;
-								sws.type = ZT_PHY_SOCKET_TCP_IN;
-								sws.sock = newSock;
-								sws.uptr = (void *)0;
-								memcpy(&(sws.saddr),&ss,sizeof(struct sockaddr_storage));
-								try {
-									_handler->phyOnTcpAccept((PhySocket *)&(*s),(PhySocket *)&(_socks.back()),&(s->uptr),&(sws.uptr),(const struct sockaddr *)&(sws.saddr));
-								} catch ( ... ) {}
-							}
-						}
-					}
-					break;
-
-				case ZT_PHY_SOCKET_UDP:
-					if (FD_ISSET(s->sock,&rfds)) {
-						for(int k=0;k<1024;++k) {
-							memset(&ss,0,sizeof(ss));
-							socklen_t slen = sizeof(ss);
-							long n = (long)::recvfrom(s->sock,buf,sizeof(buf),0,(struct sockaddr *)&ss,&slen);
-							if (n > 0) {
-								try {
-									_handler->phyOnDatagram((PhySocket *)&(*s),&(s->uptr),(const struct sockaddr *)&(s->saddr),(const struct sockaddr *)&ss,(void *)buf,(unsigned long)n);
-								} catch ( ... ) {}
-							} else if (n < 0)
-								break;
-						}
-					}
-					break;
-
-				case ZT_PHY_SOCKET_UNIX_IN: {
-#ifdef __UNIX_LIKE__
-					ZT_PHY_SOCKFD_TYPE sock = s->sock; // if closed, s->sock becomes invalid as s is no longer dereferencable
-					if ((FD_ISSET(sock,&wfds))&&(FD_ISSET(sock,&_writefds))) {
-						try {
-							_handler->phyOnUnixWritable((PhySocket *)&(*s),&(s->uptr),false);
-						} catch ( ... ) {}
-					}
-					if (FD_ISSET(sock,&rfds)) {
-						long n = (long)::read(sock,buf,sizeof(buf));
-						if (n <= 0) {
-							this->close((PhySocket *)&(*s),true);
-						} else {
-							try {
-								_handler->phyOnUnixData((PhySocket *)&(*s),&(s->uptr),(void *)buf,(unsigned long)n);
-							} catch ( ... ) {}
-						}
-					}
-#endif // __UNIX_LIKE__
-				}	break;
-
-				case ZT_PHY_SOCKET_UNIX_LISTEN:
-#ifdef __UNIX_LIKE__
-					if (FD_ISSET(s->sock,&rfds)) {
-						memset(&ss,0,sizeof(ss));
-						socklen_t slen = sizeof(ss);
-						ZT_PHY_SOCKFD_TYPE newSock = ::accept(s->sock,(struct sockaddr *)&ss,&slen);
-						if (ZT_PHY_SOCKFD_VALID(newSock)) {
-							if (_socks.size() >= ZT_PHY_MAX_SOCKETS) {
-								ZT_PHY_CLOSE_SOCKET(newSock);
-							} else {
-								fcntl(newSock,F_SETFL,O_NONBLOCK);
-								_socks.push_back(PhySocketImpl());
-								PhySocketImpl &sws = _socks.back();
-								FD_SET(newSock,&_readfds);
-								if ((long)newSock > _nfds)
-									_nfds = (long)newSock;
-								sws.type = ZT_PHY_SOCKET_UNIX_IN;
-								sws.sock = newSock;
-								sws.uptr = (void *)0;
-								memcpy(&(sws.saddr),&ss,sizeof(struct sockaddr_storage));
-								try {
-									//_handler->phyOnUnixAccept((PhySocket *)&(*s),(PhySocket *)&(_socks.back()),&(s->uptr),&(sws.uptr));
-								} catch ( ... ) {}
-							}
-						}
-					}
-#endif // __UNIX_LIKE__
-					break;
-
-				case ZT_PHY_SOCKET_FD: {
-					ZT_PHY_SOCKFD_TYPE sock = s->sock;
-					const bool readable = ((FD_ISSET(sock,&rfds))&&(FD_ISSET(sock,&_readfds)));
-					const bool writable = ((FD_ISSET(sock,&wfds))&&(FD_ISSET(sock,&_writefds)));
-					if ((readable)||(writable)) {
-						try {
-							//_handler->phyOnFileDescriptorActivity((PhySocket *)&(*s),&(s->uptr),readable,writable);
-						} catch ( ... ) {}
-					}
-				}	break;
-
-				default:
-					break;
-
-			}
+			if (s->type != ZT_PHY_SOCKET_CLOSED)
+				_process(*s,(FD_ISSET(s->sock,&rfds) != 0),(FD_ISSET(s->sock,&wfds) != 0),buf,ss);
 
 			if (s->type == ZT_PHY_SOCKET_CLOSED)
 				_socks.erase(s++);
 			else ++s;
 		}
+
+#ifdef ZT_PHY_USE_MMSG
+		_inPoll.store(false,std::memory_order_release);
+		if ((_mmsg)&&(_mmsg->sendCount))
+			_udpFlush();
+#endif
+#endif // ZT_PHY_USE_EPOLL or select()
 	}
 
 	/**
@@ -1064,10 +1095,11 @@ public:
 		if (sws.type == ZT_PHY_SOCKET_CLOSED)
 			return;
 
-		FD_CLR(sws.sock,&_readfds);
-		FD_CLR(sws.sock,&_writefds);
-#if defined(_WIN32) || defined(_WIN64)
-		FD_CLR(sws.sock,&_exceptfds);
+		_ioRemove(sws);
+
+#ifdef ZT_PHY_USE_MMSG
+		if ((sws.type == ZT_PHY_SOCKET_UDP)&&(_mmsg)&&(_mmsg->sendCount))
+			_udpFlush(); // nothing queued may refer to this socket once it is closed
 #endif
 
 		if (sws.type != ZT_PHY_SOCKET_FD)
@@ -1106,6 +1138,9 @@ public:
 		// Causes entry to be deleted from list in poll(), ignored elsewhere
 		sws.type = ZT_PHY_SOCKET_CLOSED;
 
+#ifdef ZT_PHY_USE_EPOLL
+		_closed.push_back(sws.self);
+#else
 		if ((long)sws.sock >= (long)_nfds) {
 			long nfds = (long)_whackSendSocket;
 			if ((long)_whackReceiveSocket > nfds)
@@ -1116,6 +1151,364 @@ public:
 			}
 			_nfds = nfds;
 		}
+#endif
+	}
+
+private:
+	/*
+	 * Readiness interest. These keep either the select() fd sets or the epoll
+	 * interest list in sync with what each socket wants to be notified about.
+	 * _ioAdd() is always called on the socket that was just pushed to _socks.
+	 */
+
+#ifdef ZT_PHY_USE_EPOLL
+	inline bool _ioAdd(PhySocketImpl &sws,bool readable,bool writable)
+	{
+		sws.self = --_socks.end();
+		sws.events = (readable ? (uint32_t)EPOLLIN : 0) | (writable ? (uint32_t)EPOLLOUT : 0);
+		if (sws.type == ZT_PHY_SOCKET_UDP)
+			sws.events |= EPOLLET; // drained until EAGAIN in _process()
+		struct epoll_event ev;
+		memset(&ev,0,sizeof(ev));
+		ev.events = sws.events;
+		ev.data.ptr = (void *)&sws;
+		return (::epoll_ctl(_epfd,EPOLL_CTL_ADD,sws.sock,&ev) == 0);
+	}
+
+	inline void _ioModify(PhySocketImpl &sws,uint32_t events)
+	{
+		if ((sws.type == ZT_PHY_SOCKET_CLOSED)||(events == sws.events))
+			return;
+		sws.events = events;
+		struct epoll_event ev;
+		memset(&ev,0,sizeof(ev));
+		ev.events = events;
+		ev.data.ptr = (void *)&sws;
+		::epoll_ctl(_epfd,EPOLL_CTL_MOD,sws.sock,&ev);
+	}
+
+	inline void _ioSetReadable(PhySocketImpl &sws,bool readable) { _ioModify(sws,readable ? (sws.events | EPOLLIN) : (sws.events & ~((uint32_t)EPOLLIN))); }
+	inline void _ioSetWritable(PhySocketImpl &sws,bool writable) { _ioModify(sws,writable ? (sws.events | EPOLLOUT) : (sws.events & ~((uint32_t)EPOLLOUT))); }
+	inline bool _ioWantsReadable(const PhySocketImpl &sws) const { return ((sws.events & EPOLLIN) != 0); }
+	inline bool _ioWantsWritable(const PhySocketImpl &sws) const { return ((sws.events & EPOLLOUT) != 0); }
+
+	inline void _ioRemove(PhySocketImpl &sws)
+	{
+		struct epoll_event ev; // ignored, but pre-2.6.9 kernels want it non-NULL
+		memset(&ev,0,sizeof(ev));
+		::epoll_ctl(_epfd,EPOLL_CTL_DEL,sws.sock,&ev);
+		for(typename std::vector<PhySocketImpl *>::iterator b(_udpBacklog.begin());b!=_udpBacklog.end();++b) {
+			if (*b == &sws) {
+				_udpBacklog.erase(b);
+				break;
+			}
+		}
+	}
+#else // select()
+	inline bool _ioAdd(PhySocketImpl &sws,bool readable,bool writable)
+	{
+		if ((long)sws.sock > _nfds)
+			_nfds = (long)sws.sock;
+		if (readable)
+			FD_SET(sws.sock,&_readfds);
+		if (writable)
+			FD_SET(sws.sock,&_writefds);
+		return true;
+	}
+
+	inline void _ioSetReadable(PhySocketImpl &sws,bool readable)
+	{
+		if (readable) {
+			FD_SET(sws.sock,&_readfds);
+		} else {
+			FD_CLR(sws.sock,&_readfds);
+		}
+	}
+
+	inline void _ioSetWritable(PhySocketImpl &sws,bool writable)
+	{
+		if (writable) {
+			FD_SET(sws.sock,&_writefds);
+		} else {
+			FD_CLR(sws.sock,&_writefds);
+		}
+	}
+
+	inline bool _ioWantsReadable(const PhySocketImpl &sws) const { return (FD_ISSET(sws.sock,&_readfds) != 0); }
+	inline bool _ioWantsWritable(const PhySocketImpl &sws) const { return (FD_ISSET(sws.sock,&_writefds) != 0); }
+
+	inline void _ioRemove(PhySocketImpl &sws)
+	{
+		FD_CLR(sws.sock,&_readfds);
+		FD_CLR(sws.sock,&_writefds);
+#if defined(_WIN32) || defined(_WIN64)
+		FD_CLR(sws.sock,&_exceptfds);
+#endif
+	}
+#endif // ZT_PHY_USE_EPOLL or select()
+
+#ifdef ZT_PHY_USE_MMSG
+	inline bool _mmsgInit()
+	{
+		try {
+			_mmsg = new _MmsgState;
+		} catch ( ... ) {
+			_mmsg = (_MmsgState *)0;
+			return false;
+		}
+		memset(_mmsg->recvHdrs,0,sizeof(_mmsg->recvHdrs));
+		memset(_mmsg->sendHdrs,0,sizeof(_mmsg->sendHdrs));
+		for(unsigned int i=0;i<ZT_PHY_UDP_BATCH;++i) {
+			_mmsg->recvIov[i].iov_base = (void *)_mmsg->recvBuf[i];
+			_mmsg->recvIov[i].iov_len = ZT_PHY_UDP_BATCH_MAX_DATAGRAM;
+			_mmsg->recvHdrs[i].msg_hdr.msg_iov = &(_mmsg->recvIov[i]);
+			_mmsg->recvHdrs[i].msg_hdr.msg_iovlen = 1;
+			_mmsg->recvHdrs[i].msg_hdr.msg_name = (void *)&(_mmsg->recvFrom[i]);
+			_mmsg->sendIov[i].iov_base = (void *)_mmsg->sendBuf[i];
+			_mmsg->sendHdrs[i].msg_hdr.msg_iov = &(_mmsg->sendIov[i]);
+			_mmsg->sendHdrs[i].msg_hdr.msg_iovlen = 1;
+			_mmsg->sendHdrs[i].msg_hdr.msg_name = (void *)&(_mmsg->sendTo[i]);
+		}
+		_mmsg->sendCount = 0;
+		return true;
+	}
+
+	/*
+	 * Read up to 1024 datagrams from a UDP socket ZT_PHY_UDP_BATCH at a time.
+	 * Returns true if the limit was hit and more may be waiting.
+	 */
+	inline bool _udpReadBatches(PhySocketImpl *const s)
+	{
+		if ((!_mmsg)&&(!_mmsgInit()))
+			return false;
+		for(int k=0;k<1024;k+=ZT_PHY_UDP_BATCH) {
+			for(unsigned int i=0;i<ZT_PHY_UDP_BATCH;++i) {
+				_mmsg->recvHdrs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+				_mmsg->recvHdrs[i].msg_hdr.msg_flags = 0;
+			}
+			const int n = ::recvmmsg(s->sock,_mmsg->recvHdrs,ZT_PHY_UDP_BATCH,MSG_DONTWAIT,(struct timespec *)0);
+			if (n <= 0)
+				return false;
+			for(int i=0;i<n;++i) {
+				if ((_mmsg->recvHdrs[i].msg_len == 0)||((_mmsg->recvHdrs[i].msg_hdr.msg_flags & MSG_TRUNC) != 0))
+					continue;
+				try {
+					_handler->phyOnDatagram((PhySocket *)s,&(s->uptr),(const struct sockaddr *)&(s->saddr),(const struct sockaddr *)&(_mmsg->recvFrom[i]),(void *)_mmsg->recvBuf[i],(unsigned long)_mmsg->recvHdrs[i].msg_len);
+				} catch ( ... ) {}
+				if (s->type == ZT_PHY_SOCKET_CLOSED)
+					return false;
+			}
+			if (n < ZT_PHY_UDP_BATCH)
+				return false;
+		}
+		return true;
+	}
+
+	/*
+	 * Write everything queued by udpSendBatched(), one sendmmsg() per run of
+	 * packets on the same socket. A packet the kernel refuses is dropped, the
+	 * same as a failed sendto() would be.
+	 */
+	inline void _udpFlush()
+	{
+		const unsigned int count = _mmsg->sendCount;
+		_mmsg->sendCount = 0;
+		unsigned int i = 0;
+		while (i < count) {
+			PhySocketImpl *const s = _mmsg->sendSock[i];
+			unsigned int j = i + 1;
+			while ((j < count)&&(_mmsg->sendSock[j] == s))
+				++j;
+			while (i < j) {
+				const int n = ::sendmmsg(s->sock,&(_mmsg->sendHdrs[i]),j - i,0);
+				i += (n > 0) ? (unsigned int)n : 1;
+			}
+		}
+	}
+#endif // ZT_PHY_USE_MMSG
+
+	/*
+	 * Handle readiness on one socket. Called from poll() for each socket that
+	 * select() or epoll reported. The socket may be closed by a handler while
+	 * in here, in which case its type becomes ZT_PHY_SOCKET_CLOSED.
+	 */
+	inline void _process(PhySocketImpl &sws,const bool readable,const bool writable,char *buf,struct sockaddr_storage &ss)
+	{
+		PhySocketImpl *const s = &sws;
+		switch (s->type) {
+
+			case ZT_PHY_SOCKET_TCP_OUT_PENDING:
+				if (writable) {
+					socklen_t slen = sizeof(ss);
+					if (::getpeername(s->sock,(struct sockaddr *)&ss,&slen) != 0) {
+						this->close((PhySocket *)s,true);
+					} else {
+						s->type = ZT_PHY_SOCKET_TCP_OUT_CONNECTED;
+						_ioSetReadable(*s,true);
+						_ioSetWritable(*s,false);
+#if defined(_WIN32) || defined(_WIN64)
+						FD_CLR(s->sock,&_exceptfds);
+#endif
+						try {
+							_handler->phyOnTcpConnect((PhySocket *)s,&(s->uptr),true);
+						} catch ( ... ) {}
+					}
+				}
+				break;
+
+			case ZT_PHY_SOCKET_TCP_OUT_CONNECTED:
+			case ZT_PHY_SOCKET_TCP_IN:
+				if (readable) {
+					long n = (long)::recv(s->sock,buf,131072,0);
+					if (n <= 0) {
+						this->close((PhySocket *)s,true);
+					} else {
+						try {
+							_handler->phyOnTcpData((PhySocket *)s,&(s->uptr),(void *)buf,(unsigned long)n);
+						} catch ( ... ) {}
+					}
+				}
+				if ((writable)&&(s->type != ZT_PHY_SOCKET_CLOSED)&&(_ioWantsWritable(*s))) {
+					try {
+						_handler->phyOnTcpWritable((PhySocket *)s,&(s->uptr));
+					} catch ( ... ) {}
+				}
+				break;
+
+			case ZT_PHY_SOCKET_TCP_LISTEN:
+				if (readable) {
+					memset(&ss,0,sizeof(ss));
+					socklen_t slen = sizeof(ss);
+					ZT_PHY_SOCKFD_TYPE newSock = ::accept(s->sock,(struct sockaddr *)&ss,&slen);
+					if (ZT_PHY_SOCKFD_VALID(newSock)) {
+						if (_socks.size() >= ZT_PHY_MAX_SOCKETS) {
+							ZT_PHY_CLOSE_SOCKET(newSock);
+						} else {
+#if defined(_WIN32) || defined(_WIN64)
+							{ BOOL f = (_noDelay ? TRUE : FALSE); setsockopt(newSock,IPPROTO_TCP,TCP_NODELAY,(char *)&f,sizeof(f)); }
+							{ u_long iMode=1; ioctlsocket(newSock,FIONBIO,&iMode); }
+#else
+							{ int f = (_noDelay ? 1 : 0); setsockopt(newSock,IPPROTO_TCP,TCP_NODELAY,(char *)&f,sizeof(f)); }
+							fcntl(newSock,F_SETFL,O_NONBLOCK);
+#endif
+							_socks.push_back(PhySocketImpl());
+							PhySocketImpl &sws = _socks.back();
+							sws.type = ZT_PHY_SOCKET_TCP_IN;
+							sws.sock = newSock;
+							sws.uptr = (void *)0;
+							memcpy(&(sws.saddr),&ss,sizeof(struct sockaddr_storage));
+							if (!_ioAdd(sws,true,false)) {
+								ZT_PHY_CLOSE_SOCKET(newSock);
+								_socks.pop_back();
+							} else {
+								try {
+									_handler->phyOnTcpAccept((PhySocket *)s,(PhySocket *)&sws,&(s->uptr),&(sws.uptr),(const struct sockaddr *)&(sws.saddr));
+								} catch ( ... ) {}
+							}
+						}
+					}
+				}
+				break;
+
+			case ZT_PHY_SOCKET_UDP:
+				if (readable) {
+					bool more = true;
+#ifdef ZT_PHY_USE_MMSG
+					more = _udpReadBatches(s);
+#else
+					for(int k=0;k<1024;++k) {
+						memset(&ss,0,sizeof(ss));
+						socklen_t slen = sizeof(ss);
+						long n = (long)::recvfrom(s->sock,buf,131072,0,(struct sockaddr *)&ss,&slen);
+						if (n > 0) {
+							try {
+								_handler->phyOnDatagram((PhySocket *)s,&(s->uptr),(const struct sockaddr *)&(s->saddr),(const struct sockaddr *)&ss,(void *)buf,(unsigned long)n);
+							} catch ( ... ) {}
+							if (s->type == ZT_PHY_SOCKET_CLOSED) {
+								more = false;
+								break;
+							}
+						} else if (n < 0) {
+							more = false;
+							break;
+						}
+					}
+#endif
+#ifdef ZT_PHY_USE_EPOLL
+					// Edge-triggered, so there will be no new event for what is still queued
+					if (more)
+						_udpBacklog.push_back(s);
+#else
+					(void)more;
+#endif
+				}
+				break;
+
+			case ZT_PHY_SOCKET_UNIX_IN: {
+#ifdef __UNIX_LIKE__
+				if ((writable)&&(_ioWantsWritable(*s))) {
+					try {
+						_handler->phyOnUnixWritable((PhySocket *)s,&(s->uptr),false);
+					} catch ( ... ) {}
+				}
+				if ((readable)&&(s->type != ZT_PHY_SOCKET_CLOSED)) {
+					long n = (long)::read(s->sock,buf,131072);
+					if (n <= 0) {
+						this->close((PhySocket *)s,true);
+					} else {
+						try {
+							_handler->phyOnUnixData((PhySocket *)s,&(s->uptr),(void *)buf,(unsigned long)n);
+						} catch ( ... ) {}
+					}
+				}
+#endif // __UNIX_LIKE__
+			}	break;
+
+			case ZT_PHY_SOCKET_UNIX_LISTEN:
+#ifdef __UNIX_LIKE__
+				if (readable) {
+					memset(&ss,0,sizeof(ss));
+					socklen_t slen = sizeof(ss);
+					ZT_PHY_SOCKFD_TYPE newSock = ::accept(s->sock,(struct sockaddr *)&ss,&slen);
+					if (ZT_PHY_SOCKFD_VALID(newSock)) {
+						if (_socks.size() >= ZT_PHY_MAX_SOCKETS) {
+							ZT_PHY_CLOSE_SOCKET(newSock);
+						} else {
+							fcntl(newSock,F_SETFL,O_NONBLOCK);
+							_socks.push_back(PhySocketImpl());
+							PhySocketImpl &sws = _socks.back();
+							sws.type = ZT_PHY_SOCKET_UNIX_IN;
+							sws.sock = newSock;
+							sws.uptr = (void *)0;
+							memcpy(&(sws.saddr),&ss,sizeof(struct sockaddr_storage));
+							if (!_ioAdd(sws,true,false)) {
+								ZT_PHY_CLOSE_SOCKET(newSock);
+								_socks.pop_back();
+							} else {
+								try {
+									//_handler->phyOnUnixAccept((PhySocket *)s,(PhySocket *)&sws,&(s->uptr),&(sws.uptr));
+								} catch ( ... ) {}
+							}
+						}
+					}
+				}
+#endif // __UNIX_LIKE__
+				break;
+
+			case ZT_PHY_SOCKET_FD: {
+				const bool r = ((readable)&&(_ioWantsReadable(*s)));
+				const bool w = ((writable)&&(_ioWantsWritable(*s)));
+				if ((r)||(w)) {
+					try {
+						//_handler->phyOnFileDescriptorActivity((PhySocket *)s,&(s->uptr),r,w);
+					} catch ( ... ) {}
+				}
+			}	break;
+
+			default:
+				break;
+
+		}
 	}
 };
 
@@ -33,7 +33,9 @@
 #include <iostream>
 #include <string>
 #include <vector>
+#include <set>
 #include <thread>
+#include <algorithm>
 
 #include "node/Constants.hpp"
 #include "node/Hashtable.hpp"
@@ -54,25 +56,58 @@
 #include "node/CertificateOfMembership.hpp"
 #include "node/Node.hpp"
 #include "node/IncomingPacket.hpp"
+#include "node/Topology.hpp"
+#include "node/Network.hpp"
+#include "node/Switch.hpp"
+#include "node/Trace.hpp"
+#include "node/Multicaster.hpp"
+#include "node/MulticastGroup.hpp"
+
+#include "controller/EmbeddedNetworkController.hpp"
+#include "controller/FileDB.hpp"
+#include "controller/MappedDB.hpp"
 
 #include "osdep/OSUtils.hpp"
 #include "osdep/Phy.hpp"
 #include "osdep/PortMapper.hpp"
 #include "osdep/Thread.hpp"
 
+#include "service/OneService.hpp"
+
+#include "version.h"
+
 #ifdef ZT_USE_X64_ASM_SALSA2012
 #include "ext/x64-salsa2012-asm/salsa2012.h"
 #endif
 #ifdef ZT_USE_ARM32_NEON_ASM_SALSA2012
 #include "ext/arm32-neon-salsa2012-asm/salsa2012.h"
 #endif
+#if defined(ZT_SALSA20_AVX2) || defined(ZT_POLY1305_AVX2)
+#include <x86intrin.h>
+#endif
 
 #ifdef __WINDOWS__
 #include <tchar.h>
 #endif
 
+#ifdef ZT_PHY_USE_EPOLL
+#include <sys/resource.h>
+#endif
+
+#ifdef __LINUX__
+#include "osdep/LinuxEthernetTap.hpp"
+#endif
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
 using namespace ZeroTier;
 
+// Set from ZT_SELFTEST_BENCH in the environment: longer benchmarks only run
+// when this is true, otherwise they make a few passes to check correctness
+static bool testBenchmarks = false;
+
 //////////////////////////////////////////////////////////////////////////////
 
 #define KNOWN_GOOD_IDENTITY "8e4df28b72:0:ac3d46abe0c21f3cfe7a6c8d6a85cfcffcb82fbd55af6a4d6350657c68200843fa2e16f9418bbd9702cae365f2af5fb4c420908b803a681d4daef6114d78a2d7:bd8dd6e4ce7022d2f812797a80c6ee8ad180dc4ebf301dec8b06d1be08832bddd63a2f1cfa7b2c504474c75bdc8898ba476ef92e8e2d0509f8441985171ff16e"
@@ -147,6 +182,60 @@ static const C25519TestVector C25519_TEST_VECTORS[ZT_NUM_C25519_TEST_VECTORS] =
 
 //////////////////////////////////////////////////////////////////////////////
 
+#if defined(ZT_SALSA20_AVX2) || defined(ZT_POLY1305_AVX2)
+// Cycles per byte of Salsa20/12 (poly == false) or Poly1305 over len byte inputs
+static double cryptoCyclesPerByte(bool poly,unsigned char *bb,unsigned int len)
+{
+	Salsa20 s20("12345678123456781234567812345678","12345678");
+	unsigned char mac[16];
+	const unsigned int iterations = (256 * 1048576) / len;
+	const uint64_t start = __rdtsc();
+	for(unsigned int i=0;i<iterations;++i) {
+		if (poly)
+			Poly1305::compute(mac,bb,len,bb + len);
+		else s20.crypt12(bb,bb,len);
+	}
+	const uint64_t end = __rdtsc();
+	return ((double)(end - start) / ((double)iterations * (double)len));
+}
+#endif
+
+#define ZT_TEST_ED25519_BATCH 70
+#define ZT_TEST_ED25519_BENCH 1000
+
+static void testBenchmarkEd25519(const char *backend,const C25519::Pair &kp,const unsigned char *msg,unsigned int len)
+{
+	std::cout << "[crypto] Benchmarking Ed25519 ECC signatures (" << backend << ")... "; std::cout.flush();
+	std::vector<C25519::Signature> sigs(ZT_TEST_ED25519_BENCH);
+	uint64_t st = OSUtils::now();
+	for(unsigned int k=0;k<ZT_TEST_ED25519_BENCH;++k)
+		C25519::sign(kp.priv,kp.pub,msg,len,sigs[k].data);
+	uint64_t et = OSUtils::now();
+	const double signTime = (double)(et - st);
+
+	unsigned int ok = 0;
+	st = OSUtils::now();
+	for(unsigned int k=0;k<ZT_TEST_ED25519_BENCH;++k)
+		ok += C25519::verify(kp.pub,msg,len,sigs[k]) ? 1 : 0;
+	et = OSUtils::now();
+	const double verifyTime = (double)(et - st);
+
+	st = OSUtils::now();
+	C25519::VerifyBatch batch;
+	for(unsigned int k=0;k<ZT_TEST_ED25519_BENCH;++k)
+		batch.verify(kp.pub,msg,len,sigs[k].data);
+	ok += batch.run() ? 1 : 0;
+	et = OSUtils::now();
+	const double batchTime = (double)(et - st);
+
+	std::cout << ((double)ZT_TEST_ED25519_BENCH / (signTime / 1000.0)) << " signatures/second, "
+		<< ((double)ZT_TEST_ED25519_BENCH / (verifyTime / 1000.0)) << " verifications/second, "
+		<< ((double)ZT_TEST_ED25519_BENCH / (batchTime / 1000.0)) << " batched verifications/second";
+	if (ok != (ZT_TEST_ED25519_BENCH + 1))
+		std::cout << " (verification FAILED)";
+	std::cout << std::endl;
+}
+
 static int testCrypto()
 {
 	static unsigned char buf1[16384];
@@ -192,6 +281,30 @@ static int testCrypto()
 	}
 	std::cout << "PASS" << std::endl;
 
+#ifdef ZT_SALSA20_AVX2
+	if (Salsa20::useAVX2) {
+		std::cout << "[crypto] Testing Salsa20 AVX2 against SSE... "; std::cout.flush();
+		for(unsigned int len=0;len<=2112;len+=(len < 600) ? 1 : 37) {
+			for(unsigned int k=0;k<(len + 100);++k)
+				buf1[k] = (unsigned char)rand();
+			for(int rounds=12;rounds<=20;rounds+=8) {
+				Salsa20 a("12345678123456781234567812345678","12345678"),b("12345678123456781234567812345678","12345678");
+				Salsa20::useAVX2 = false;
+				if (rounds == 12) { a.crypt12(buf1,buf2,len); a.crypt12(buf1 + len,buf2 + len,100); } else { a.crypt20(buf1,buf2,len); a.crypt20(buf1 + len,buf2 + len,100); }
+				Salsa20::useAVX2 = true;
+				if (rounds == 12) { b.crypt12(buf1,buf3,len); b.crypt12(buf1 + len,buf3 + len,100); } else { b.crypt20(buf1,buf3,len); b.crypt20(buf1 + len,buf3 + len,100); }
+				if (memcmp(buf2,buf3,len + 100)) {
+					std::cout << "FAIL (Salsa20/" << rounds << ", " << len << " bytes)" << std::endl;
+					return -1;
+				}
+			}
+		}
+		std::cout << "PASS" << std::endl;
+	} else {
+		std::cout << "[crypto] Salsa20 AVX2: not supported by this CPU" << std::endl;
+	}
+#endif
+
 #ifdef ZT_SALSA20_SSE
 	std::cout << "[crypto] Salsa20 SSE: ENABLED" << std::endl;
 #else
@@ -289,6 +402,28 @@ static int testCrypto()
 	}
 	std::cout << "PASS" << std::endl;
 
+#ifdef ZT_POLY1305_AVX2
+	if (Poly1305::useAVX2) {
+		std::cout << "[crypto] Testing Poly1305 AVX2 against scalar... "; std::cout.flush();
+		for(unsigned int len=0;len<=4096;len+=(len < 600) ? 1 : 37) {
+			unsigned char mac1[16],mac2[16];
+			for(unsigned int k=0;k<(len + 32);++k)
+				buf1[k] = (unsigned char)rand();
+			if ((len & 7) == 0)
+				memset(buf1,0xff,len); // exercise limb carries with maximal blocks
+			Poly1305::useAVX2 = false;
+			Poly1305::compute(mac1,buf1,len,buf1 + len);
+			Poly1305::useAVX2 = true;
+			Poly1305::compute(mac2,buf1,len,buf1 + len);
+			if (memcmp(mac1,mac2,16)) {
+				std::cout << "FAIL (" << len << " bytes)" << std::endl;
+				return -1;
+			}
+		}
+		std::cout << "PASS" << std::endl;
+	}
+#endif
+
 	std::cout << "[crypto] Benchmarking Poly1305... "; std::cout.flush();
 	{
 		unsigned char *bb = (unsigned char *)::malloc(1234567);
@@ -305,6 +440,38 @@ static int testCrypto()
 		::free((void *)bb);
 	}
 
+#if defined(ZT_SALSA20_AVX2) || defined(ZT_POLY1305_AVX2)
+	if (testBenchmarks) {
+		unsigned char *bb = (unsigned char *)::malloc(65536 + 32);
+		for(unsigned int i=0;i<(65536 + 32);++i)
+			bb[i] = (unsigned char)i;
+		const unsigned int lens[2] = { 1400,65536 };
+		for(unsigned int l=0;l<2;++l) {
+#ifdef ZT_SALSA20_AVX2
+			const bool s20avx2 = Salsa20::useAVX2;
+			Salsa20::useAVX2 = false;
+			std::cout << "[crypto] Salsa20/12 cycles/byte (" << lens[l] << " bytes): SSE " << cryptoCyclesPerByte(false,bb,lens[l]);
+			if (s20avx2) {
+				Salsa20::useAVX2 = true;
+				std::cout << ", AVX2 " << cryptoCyclesPerByte(false,bb,lens[l]);
+			}
+			std::cout << std::endl;
+#endif
+#ifdef ZT_POLY1305_AVX2
+			const bool polyavx2 = Poly1305::useAVX2;
+			Poly1305::useAVX2 = false;
+			std::cout << "[crypto] Poly1305 cycles/byte (" << lens[l] << " bytes): scalar " << cryptoCyclesPerByte(true,bb,lens[l]);
+			if (polyavx2) {
+				Poly1305::useAVX2 = true;
+				std::cout << ", AVX2 " << cryptoCyclesPerByte(true,bb,lens[l]);
+			}
+			std::cout << std::endl;
+#endif
+		}
+		::free((void *)bb);
+	}
+#endif
+
 	/*
 	for(unsigned int d=8;d<=10;++d) {
 		for(int k=0;k<8;++k) {
@@ -419,14 +586,106 @@ static int testCrypto()
 	}
 	std::cout << "PASS" << std::endl;
 
-	std::cout << "[crypto] Benchmarking Ed25519 ECC signatures... "; std::cout.flush();
-	st = OSUtils::now();
-	for(int k=0;k<1000;++k) {
-		C25519::Signature sig;
-		C25519::sign(didntSign.priv,didntSign.pub,buf1,sizeof(buf1),sig.data);
+#ifdef ZT_USE_FAST_X64_ED25519
+	std::cout << "[crypto] Testing Ed25519 amd64 assembly against portable code... "; std::cout.flush();
+	for(unsigned int i=0;i<32;++i) {
+		C25519::Pair p1 = C25519::generate();
+		for(unsigned int k=0;k<sizeof(buf1);++k)
+			buf1[k] = (unsigned char)rand();
+		C25519::useFastEd25519 = false;
+		C25519::Signature sig1 = C25519::sign(p1,buf1,sizeof(buf1));
+		C25519::useFastEd25519 = true;
+		C25519::Signature sig2 = C25519::sign(p1,buf1,sizeof(buf1));
+		if (memcmp(sig1.data,sig2.data,ZT_C25519_SIGNATURE_LEN)) {
+			std::cout << "FAIL (1)" << std::endl;
+			return -1;
+		}
+		for(unsigned int k=0;k<16;++k) {
+			if (k > 0)
+				sig2.data[rand() % 64] ^= (unsigned char)(1 << (rand() & 7)); // digest is checked before either backend runs
+			C25519::useFastEd25519 = false;
+			const bool v1 = C25519::verify(p1.pub,buf1,sizeof(buf1),sig2);
+			C25519::useFastEd25519 = true;
+			const bool v2 = C25519::verify(p1.pub,buf1,sizeof(buf1),sig2);
+			if ((v1 != v2)||((k == 0)&&(!v1))) {
+				std::cout << "FAIL (2)" << std::endl;
+				return -1;
+			}
+		}
+	}
+	std::cout << "PASS" << std::endl;
+#endif
+
+	std::cout << "[crypto] Testing Ed25519 batch verification... "; std::cout.flush();
+	{
+		C25519::Pair bkp[4];
+		for(int k=0;k<4;++k)
+			bkp[k] = C25519::generate();
+		std::vector<C25519::Signature> bsigs;
+		for(unsigned int k=0;k<ZT_TEST_ED25519_BATCH;++k) {
+			buf1[0] = (unsigned char)k;
+			bsigs.push_back(C25519::sign(bkp[k & 3],buf1,sizeof(buf1)));
+		}
+		static const unsigned int badIndexes[3] = { 0,37,ZT_TEST_ED25519_BATCH }; // last one means none are bad
+		for(unsigned int b=0;b<3;++b) {
+			const unsigned int bad = badIndexes[b];
+			C25519::VerifyBatch batch;
+			for(unsigned int k=0;k<ZT_TEST_ED25519_BATCH;++k) {
+				C25519::Signature sig(bsigs[k]);
+				if (k == bad)
+					sig.data[40] ^= 0x01;
+				buf1[0] = (unsigned char)k;
+				if (!batch.verify(bkp[k & 3].pub,buf1,sizeof(buf1),sig.data)) {
+					std::cout << "FAIL (1)" << std::endl;
+					return -1;
+				}
+			}
+			if (batch.run() != (bad >= ZT_TEST_ED25519_BATCH)) {
+				std::cout << "FAIL (2)" << std::endl;
+				return -1;
+			}
+			for(unsigned int k=0;k<ZT_TEST_ED25519_BATCH;++k) {
+				C25519::Signature sig(bsigs[k]);
+				if (k == bad)
+					sig.data[40] ^= 0x01;
+				buf1[0] = (unsigned char)k;
+				if (batch.verify(bkp[k & 3].pub,buf1,sizeof(buf1),sig.data) != (k != bad)) {
+					std::cout << "FAIL (3)" << std::endl;
+					return -1;
+				}
+			}
+		}
+		buf1[0] = 0;
+		C25519::VerifyBatch batch;
+		if (batch.verify(bkp[0].pub,buf1,sizeof(buf1),bsigs[1].data)) { // wrong message digest is caught when queueing
+			std::cout << "FAIL (4)" << std::endl;
+			return -1;
+		}
+		// After run() a checked (signature, key) pair must only be accepted for its own message
+		C25519::VerifyBatch batch2;
+		if ((!batch2.verify(bkp[0].pub,buf1,sizeof(buf1),bsigs[0].data))||(!batch2.run())||(!batch2.verify(bkp[0].pub,buf1,sizeof(buf1),bsigs[0].data))) {
+			std::cout << "FAIL (5)" << std::endl;
+			return -1;
+		}
+		buf1[0] = 1;
+		if (batch2.verify(bkp[0].pub,buf1,sizeof(buf1),bsigs[0].data)) {
+			std::cout << "FAIL (6)" << std::endl;
+			return -1;
+		}
+		buf1[0] = 0;
+	}
+	std::cout << "PASS" << std::endl;
+
+	if (testBenchmarks) {
+#ifdef ZT_USE_FAST_X64_ED25519
+		C25519::useFastEd25519 = false;
+		testBenchmarkEd25519("portable",didntSign,buf1,256); // about the size of a credential
+		C25519::useFastEd25519 = true;
+		testBenchmarkEd25519("amd64 asm",didntSign,buf1,256);
+#else
+		testBenchmarkEd25519("portable",didntSign,buf1,256);
+#endif
 	}
-	et = OSUtils::now();
-	std::cout << ((double)(et - st) / 50.0) << "ms per signature." << std::endl;
 
 	return 0;
 }
@@ -597,6 +856,29 @@ static int testCertificate()
 	return 0;
 }
 
+// Two-pass (encrypt, then MAC) armoring as Packet::armor() did it before it was fused, for reference and comparison
+static void twoPassArmor(Packet &p,const unsigned char *key)
+{
+	static const unsigned char zero[32] = { 0 };
+	uint8_t *const d = reinterpret_cast<uint8_t *>(p.unsafeData());
+	uint8_t mangledKey[32];
+	p.setCipher(ZT_PROTO_CIPHER_SUITE__C25519_POLY1305_SALSA2012);
+	for(unsigned int i=0;i<18;++i)
+		mangledKey[i] = key[i] ^ d[i];
+	mangledKey[18] = key[18] ^ (d[ZT_PACKET_IDX_FLAGS] & 0xf8);
+	mangledKey[19] = key[19] ^ (unsigned char)(p.size() & 0xff);
+	mangledKey[20] = key[20] ^ (unsigned char)((p.size() >> 8) & 0xff);
+	for(unsigned int i=21;i<32;++i)
+		mangledKey[i] = key[i];
+	Salsa20 s20(mangledKey,d + ZT_PACKET_IDX_IV);
+	uint64_t macKey[4];
+	s20.crypt12(zero,macKey,sizeof(macKey));
+	s20.crypt12(d + ZT_PACKET_IDX_VERB,d + ZT_PACKET_IDX_VERB,p.size() - ZT_PACKET_IDX_VERB);
+	uint64_t mac[2];
+	Poly1305::compute(mac,d + ZT_PACKET_IDX_VERB,p.size() - ZT_PACKET_IDX_VERB,macKey);
+	memcpy(d + ZT_PACKET_IDX_MAC,mac,8);
+}
+
 static int testPacket()
 {
 	unsigned char salsaKey[32];
@@ -637,6 +919,131 @@ static int testPacket()
 	}
 
 	std::cout << "PASS" << std::endl;
+
+	std::cout << "[packet] Testing fused armor() against two-pass armoring... "; std::cout.flush();
+	for(int fast=0;fast<2;++fast) {
+#ifdef ZT_SALSA20_AVX2
+		const bool avx2 = Salsa20::useAVX2;
+		if (fast) // with AVX2 off, x64 builds fall back to the fast single pass ASM keystream
+			Salsa20::useAVX2 = false;
+#endif
+		for(unsigned int len=ZT_PACKET_IDX_PAYLOAD;len<=2800;len+=(len < 1100) ? 1 : 97) {
+			a.reset(Address(0x1122334455ULL),Address(0x6677889900ULL),Packet::VERB_FRAME);
+			while (a.size() < len)
+				a.append((uint8_t)rand());
+			b = a;
+			a.armor(salsaKey,true);
+			twoPassArmor(b,salsaKey);
+			if (a != b) {
+				std::cout << "FAIL (" << len << " bytes)" << std::endl;
+				return -1;
+			}
+			if ((!a.dearmor(salsaKey))||(a.cipher() != ZT_PROTO_CIPHER_SUITE__C25519_POLY1305_SALSA2012)) {
+				std::cout << "FAIL (dearmor, " << len << " bytes)" << std::endl;
+				return -1;
+			}
+			a[len - 1] ^= 1;
+			a.armor(salsaKey,true);
+			a[len - 1] ^= 1;
+			b = a;
+			if (a.dearmor(salsaKey)) {
+				std::cout << "FAIL (dearmor accepted corrupted packet, " << len << " bytes)" << std::endl;
+				return -1;
+			}
+			if (a != b) {
+				std::cout << "FAIL (dearmor modified rejected packet, " << len << " bytes)" << std::endl;
+				return -1;
+			}
+		}
+#ifdef ZT_SALSA20_AVX2
+		Salsa20::useAVX2 = avx2;
+#endif
+	}
+	std::cout << "PASS" << std::endl;
+
+	if (testBenchmarks) {
+		const unsigned int lens[3] = { 64,1400,8000 };
+		for(unsigned int l=0;l<3;++l) {
+			const unsigned int iterations = 200000000 / (lens[l] + 2000);
+			std::cout << "[packet] Benchmarking armor() with " << lens[l] << " byte packets... "; std::cout.flush();
+			a.reset(Address(0x1122334455ULL),Address(0x6677889900ULL),Packet::VERB_FRAME);
+			while (a.size() < lens[l])
+				a.append((uint8_t)rand());
+			int64_t twoPassTime = 0x7fffffff,fusedTime = 0x7fffffff;
+			for(int r=0;r<3;++r) { // best of 3, interleaved so both see the same conditions
+				int64_t start = OSUtils::now();
+				for(unsigned int k=0;k<iterations;++k)
+					twoPassArmor(a,salsaKey);
+				twoPassTime = std::min(twoPassTime,OSUtils::now() - start);
+				start = OSUtils::now();
+				for(unsigned int k=0;k<iterations;++k)
+					a.armor(salsaKey,true);
+				fusedTime = std::min(fusedTime,OSUtils::now() - start);
+			}
+			std::cout << "two-pass: " << (((double)twoPassTime * 1000000.0) / (double)iterations) << " ns/packet (" << (((double)lens[l] * (double)iterations) / ((double)twoPassTime * 1000.0)) << " MB/s); ";
+			std::cout << "fused: " << (((double)fusedTime * 1000000.0) / (double)iterations) << " ns/packet (" << (((double)lens[l] * (double)iterations) / ((double)fusedTime * 1000.0)) << " MB/s)" << std::endl;
+		}
+	}
+
+	std::cout << "[packet] Testing/benchmarking FRAME assembly from 3 segments (1500 bytes)... "; std::cout.flush();
+	{
+		// Mirrors lwip_eth_tx() handing a pbuf chain to Switch::onLocalEthernet(): either linearize
+		// the chain into a stack buffer and append that, or append the segments straight into the packet
+		unsigned char seg0[66],seg1[512],seg2[922];
+		unsigned char linear[ZT_MAX_MTU];
+		for(unsigned int i=0;i<sizeof(seg0);++i) seg0[i] = (unsigned char)i;
+		for(unsigned int i=0;i<sizeof(seg1);++i) seg1[i] = (unsigned char)(i * 3);
+		for(unsigned int i=0;i<sizeof(seg2);++i) seg2[i] = (unsigned char)(i * 7);
+		ZT_FrameSegment segs[3];
+		segs[0].data = seg0; segs[0].len = sizeof(seg0);
+		segs[1].data = seg1; segs[1].len = sizeof(seg1);
+		segs[2].data = seg2; segs[2].len = sizeof(seg2);
+		const unsigned int iterations = (testBenchmarks) ? 500000 : 16;
+
+		a.reset(Address(),Address(),Packet::VERB_FRAME);
+		a.append((uint64_t)0x8056c2e21c000001ULL);
+		a.append((uint16_t)0x0800);
+		const unsigned int headerLen = a.size();
+		b = a;
+
+		uint64_t linearCopied = 0;
+		int64_t start = OSUtils::now();
+		for(unsigned int k=0;k<iterations;++k) {
+			a.setSize(headerLen);
+			linear[0] = (unsigned char)k; // keep the copies from being hoisted out of the loop
+			unsigned int ptr = 0;
+			for(unsigned int s=0;s<3;++s) {
+				memcpy(linear + ptr,segs[s].data,segs[s].len);
+				ptr += segs[s].len;
+			}
+			a.append(linear,ptr);
+			linearCopied += ptr * 2;
+		}
+		int64_t linearTime = OSUtils::now() - start;
+
+		uint64_t gatherCopied = 0;
+		start = OSUtils::now();
+		for(unsigned int k=0;k<iterations;++k) {
+			b.setSize(headerLen);
+			for(unsigned int s=0;s<3;++s) {
+				b.append(segs[s].data,segs[s].len);
+				gatherCopied += segs[s].len;
+			}
+		}
+		int64_t gatherTime = OSUtils::now() - start;
+
+		if (a != b) {
+			std::cout << "FAIL (gathered packet differs)" << std::endl;
+			return -1;
+		}
+		if (testBenchmarks) {
+			std::cout << "linearized: " << (linearCopied / iterations) << " bytes copied/frame, " << (((double)linearTime * 1000000.0) / (double)iterations) << " ns/frame; ";
+			std::cout << "gathered: " << (gatherCopied / iterations) << " bytes copied/frame, " << (((double)gatherTime * 1000000.0) / (double)iterations) << " ns/frame" << std::endl;
+		} else {
+			std::cout << "PASS" << std::endl;
+		}
+	}
+
 	return 0;
 }
 
@@ -936,78 +1343,2122 @@ static int testOther()
 	return 0;
 }
 
-#define ZT_TEST_PHY_NUM_UDP_PACKETS 10000
-#define ZT_TEST_PHY_UDP_PACKET_SIZE 1000
-#define ZT_TEST_PHY_NUM_VALID_TCP_CONNECTS 10
-#define ZT_TEST_PHY_NUM_INVALID_TCP_CONNECTS 2
-#define ZT_TEST_PHY_TCP_MESSAGE_SIZE 1000000
-#define ZT_TEST_PHY_TIMEOUT_MS 20000
-static unsigned long phyTestUdpPacketCount = 0;
-static unsigned long phyTestTcpByteCount = 0;
-static unsigned long phyTestTcpConnectSuccessCount = 0;
-static unsigned long phyTestTcpConnectFailCount = 0;
-static unsigned long phyTestTcpAcceptCount = 0;
-struct TestPhyHandlers;
-static Phy<TestPhyHandlers *> *testPhyInstance = (Phy<TestPhyHandlers *> *)0;
-struct TestPhyHandlers
+// Rounds of an n-element benchmark needed to total about ops operations (one unless benchmarking)
+static inline unsigned long testBenchRounds(unsigned long ops,unsigned long n)
 {
-	inline void phyOnDatagram(PhySocket *sock,void **uptr,const struct sockaddr *localAddr,const struct sockaddr *from,void *data,unsigned long len)
-	{
-		++phyTestUdpPacketCount;
-	}
+	if (!testBenchmarks)
+		return 1;
+	return (ops / n) ? (ops / n) : 1;
+}
+// Prints one field of a benchmark line: ms milliseconds spent on ops operations, in ns per operation
+static void testBenchField(const char *label,int64_t ms,double ops)
+{
+	std::cout << label << ((double)ms * 1000000.0 / ops) << "ns";
+}
 
-	inline void phyOnTcpConnect(PhySocket *sock,void **uptr,bool success)
-	{
-		if (success) {
-			++phyTestTcpConnectSuccessCount;
-		} else {
-			++phyTestTcpConnectFailCount;
+static inline uint64_t testHashtableKey(uint64_t x)
+{
+	// xorshift64 is a permutation of nonzero integers, so keys are distinct and nonzero
+	x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+	return x;
+}
+
+#define ZT_TEST_HASHTABLE_OPS 4000000
+
+static int testHashtable()
+{
+	// Each size is run enough times to total about ZT_TEST_HASHTABLE_OPS of each operation
+	static const unsigned long sizes[3] = { 10000,100000,1000000 };
+	for(unsigned int si=0;si<3;++si) {
+		const unsigned long n = sizes[si];
+		const unsigned long rounds = testBenchRounds(ZT_TEST_HASHTABLE_OPS,n);
+		std::cout << "[hashtable] Testing/benchmarking " << n << " entries..."; std::cout.flush();
+		int64_t tInsert = 0,tLookup = 0,tIterate = 0,tErase = 0;
+		unsigned long misses = 0;
+		for(unsigned long r=0;r<rounds;++r) {
+			Hashtable<uint64_t,uint64_t> ht;
+			const uint64_t seed = 0x9e3779b97f4a7c15ULL + r;
+
+			uint64_t k = seed;
+			int64_t start = OSUtils::now();
+			for(unsigned long i=0;i<n;++i) {
+				k = testHashtableKey(k);
+				ht.set(k,(uint64_t)i);
+			}
+			tInsert += OSUtils::now() - start;
+			if (ht.size() != n) {
+				std::cout << " FAILED (size mismatch after insert)" << std::endl;
+				return -1;
+			}
+
+			k = seed;
+			start = OSUtils::now();
+			for(unsigned long i=0;i<n;++i) {
+				k = testHashtableKey(k);
+				const uint64_t *const v = ht.get(k);
+				if ((!v)||(*v != (uint64_t)i)) {
+					std::cout << " FAILED (lookup of entry " << i << ")" << std::endl;
+					return -1;
+				}
+				if (ht.get(k ^ 0x8000000000000000ULL)) // almost always absent
+					++misses;
+			}
+			tLookup += OSUtils::now() - start;
+
+			uint64_t sum = 0;
+			start = OSUtils::now();
+			{
+				Hashtable<uint64_t,uint64_t>::Iterator it(ht);
+				uint64_t *kp = (uint64_t *)0;
+				uint64_t *vp = (uint64_t *)0;
+				while (it.next(kp,vp))
+					sum += *vp;
+			}
+			tIterate += OSUtils::now() - start;
+			if (sum != ((uint64_t)n * (uint64_t)(n - 1)) / 2) {
+				std::cout << " FAILED (iteration missed entries)" << std::endl;
+				return -1;
+			}
+
+			// Erase every other key, then the rest, leaving tombstones behind for the second pass
+			start = OSUtils::now();
+			for(unsigned int pass=0;pass<2;++pass) {
+				k = seed;
+				for(unsigned long i=0;i<n;++i) {
+					k = testHashtableKey(k);
+					if (((i & 1) == pass)&&(!ht.erase(k))) {
+						std::cout << " FAILED (erase of entry " << i << ")" << std::endl;
+						return -1;
+					}
+				}
+			}
+			tErase += OSUtils::now() - start;
+			if (!ht.empty()) {
+				std::cout << " FAILED (not empty after erase)" << std::endl;
+				return -1;
+			}
+		}
+		if (misses > ((n * rounds) / 1000)) {
+			std::cout << " FAILED (absent keys found)" << std::endl;
+			return -1;
 		}
+		if (!testBenchmarks) {
+			std::cout << " PASS" << std::endl;
+			continue;
+		}
+		const double ops = (double)n * (double)rounds;
+		testBenchField(" insert ",tInsert,ops);
+		testBenchField(", lookup (hit+miss) ",tLookup,ops);
+		testBenchField(", iterate ",tIterate,ops);
+		testBenchField(", erase ",tErase,ops);
+		std::cout << std::endl;
 	}
 
-	inline void phyOnTcpAccept(PhySocket *sockL,PhySocket *sockN,void **uptrL,void **uptrN,const struct sockaddr *from)
+	std::cout << "[hashtable] Testing erase during iteration and copies... "; std::cout.flush();
 	{
-		++phyTestTcpAcceptCount;
-		*uptrN = new std::string(ZT_TEST_PHY_TCP_MESSAGE_SIZE,(char)0xff);
-		testPhyInstance->setNotifyWritable(sockN,true);
+		Hashtable<uint64_t,std::string> ht;
+		for(unsigned long i=1;i<=5000;++i)
+			ht[i] = std::string((size_t)(i % 40),'x');
+		Hashtable<uint64_t,std::string>::Iterator it(ht);
+		uint64_t *kp = (uint64_t *)0;
+		std::string *vp = (std::string *)0;
+		unsigned long seen = 0;
+		while (it.next(kp,vp)) {
+			++seen;
+			if ((*kp % 3) == 0)
+				ht.erase(*kp);
+		}
+		const Hashtable<uint64_t,std::string> ht2(ht);
+		Hashtable<uint64_t,std::string> ht3;
+		ht3 = ht2;
+		if ((seen != 5000)||(ht.size() != (5000 - 1666))||(ht2.size() != ht.size())||(ht3.size() != ht.size())) {
+			std::cout << "FAILED (size mismatch)" << std::endl;
+			return -1;
+		}
+		for(unsigned long i=1;i<=5000;++i) {
+			const std::string *const v = ht3.get(i);
+			if (((i % 3) == 0) ? (v != (const std::string *)0) : ((!v)||(v->length() != (i % 40)))) {
+				std::cout << "FAILED (entry " << i << " wrong)" << std::endl;
+				return -1;
+			}
+		}
 	}
+	std::cout << "PASS" << std::endl;
 
-	inline void phyOnTcpClose(PhySocket *sock,void **uptr)
-	{
-		delete (std::string *)*uptr; // delete testMessage if any
-	}
+	return 0;
+}
 
-	inline void phyOnTcpData(PhySocket *sock,void **uptr,void *data,unsigned long len)
+#define ZT_TEST_TOPOLOGY_NUM_PEERS 256
+#define ZT_TEST_TOPOLOGY_LOOKUPS 8000000
+
+static int testTopologyStateGet(ZT_Node *,void *,void *,enum ZT_StateObjectType type,const uint64_t id[2],void *data,unsigned int maxlen)
+{
+	// Use a fixed identity so the test node doesn't have to generate one
+	if ((type == ZT_STATE_OBJECT_IDENTITY_SECRET)&&(strlen(KNOWN_GOOD_IDENTITY) < maxlen)) {
+		memcpy(data,KNOWN_GOOD_IDENTITY,strlen(KNOWN_GOOD_IDENTITY));
+		return (int)strlen(KNOWN_GOOD_IDENTITY);
+	}
+	return -1;
+}
+static void testTopologyStatePut(ZT_Node *,void *,void *,enum ZT_StateObjectType,const uint64_t [2],const void *,int) {}
+static int testTopologyWirePacketSend(ZT_Node *,void *,void *,int64_t,const struct sockaddr_storage *,const void *,unsigned int,unsigned int) { return -1; }
+static void testTopologyVirtualNetworkFrame(ZT_Node *,void *,void *,uint64_t,void **,uint64_t,uint64_t,unsigned int,unsigned int,const void *,unsigned int) {}
+static int testTopologyVirtualNetworkConfig(ZT_Node *,void *,void *,uint64_t,void **,enum ZT_VirtualNetworkConfigOperation,const ZT_VirtualNetworkConfig *) { return 0; }
+static void testTopologyEvent(ZT_Node *,void *,void *,enum ZT_Event,const void *) {}
+// A node with the stub callbacks above, optionally overriding how it sends packets and stores state
+static Node *testMakeNode(ZT_WirePacketSendFunction wirePacketSend = testTopologyWirePacketSend,ZT_StatePutFunction statePut = testTopologyStatePut,ZT_StateGetFunction stateGet = testTopologyStateGet)
+{
+	ZT_Node_Callbacks cb;
+	memset(&cb,0,sizeof(cb));
+	cb.version = 0;
+	cb.statePutFunction = statePut;
+	cb.stateGetFunction = stateGet;
+	cb.wirePacketSendFunction = wirePacketSend;
+	cb.virtualNetworkFrameFunction = testTopologyVirtualNetworkFrame;
+	cb.virtualNetworkConfigFunction = testTopologyVirtualNetworkConfig;
+	cb.eventCallback = testTopologyEvent;
+	return new Node((void *)0,(void *)0,&cb,OSUtils::now());
+}
+// Deletes a test's node, and the Switch, Topology and Trace it gave rr if any, however the test returns
+class TestNodeCleanup
+{
+public:
+	TestNodeCleanup(Node *const &node,RuntimeEnvironment *rr = (RuntimeEnvironment *)0) : _node(node),_rr(rr) {}
+	~TestNodeCleanup()
 	{
-		phyTestTcpByteCount += len;
+		if (_rr) {
+			delete _rr->sw;
+			delete _rr->topology;
+			delete _rr->t;
+		}
+		delete _node;
+	}
+private:
+	TestNodeCleanup(const TestNodeCleanup &);
+	TestNodeCleanup &operator=(const TestNodeCleanup &);
+	Node *const &_node;
+	RuntimeEnvironment *const _rr;
+};
+struct _TestTopologyCountPeers
+{
+	_TestTopologyCountPeers() : n(0) {}
+	inline void operator()(Topology &t,const SharedPtr<Peer> &p) { ++n; }
+	unsigned long n;
+};
+static int testTopology()
+{
+	Node *const node = testMakeNode();
+	RuntimeEnvironment rr(node);
+	TestNodeCleanup cleanup(node,&rr);
+	rr.identity = node->identity();
+	Topology *const topology = rr.topology = new Topology(&rr,(void *)0);
+
+	std::cout << "[topology] Adding " << ZT_TEST_TOPOLOGY_NUM_PEERS << " peers... "; std::cout.flush();
+	std::vector<Address> addrs;
+	std::vector<InetAddress> phys;
+	const unsigned long upstreams = (unsigned long)topology->allPeers().size();
+	while (addrs.size() < ZT_TEST_TOPOLOGY_NUM_PEERS) {
+		uint8_t pub[ZT_C25519_PUBLIC_KEY_LEN];
+		Utils::getSecureRandom(pub,sizeof(pub));
+		char idstr[256],pubhex[256];
+		Utils::hex(pub,sizeof(pub),pubhex);
+		OSUtils::ztsnprintf(idstr,sizeof(idstr),"%.10llx:0:%s",(unsigned long long)((((uint64_t)rand() << 32) ^ (uint64_t)rand()) & 0xfeffffffffULL),pubhex);
+		Identity id;
+		if ((!id.fromString(idstr))||(id.address() == rr.identity.address())||(std::find(addrs.begin(),addrs.end(),id.address()) != addrs.end()))
+			continue;
+		SharedPtr<Peer> p(new Peer(&rr,rr.identity,id));
+		if (topology->addPeer((void *)0,p) != p) {
+			std::cout << "FAILED (new peer not added)" << std::endl;
+			return -1;
+		}
+		if (topology->addPeer((void *)0,SharedPtr<Peer>(new Peer(&rr,rr.identity,id))) != p) {
+			std::cout << "FAILED (existing peer replaced)" << std::endl;
+			return -1;
+		}
+		addrs.push_back(id.address());
+		phys.push_back(InetAddress((uint32_t)rand(),(unsigned int)(rand() & 0xffff)));
+	}
+	_TestTopologyCountPeers cnt;
+	topology->eachPeer<_TestTopologyCountPeers &>(cnt);
+	if ((cnt.n != (upstreams + ZT_TEST_TOPOLOGY_NUM_PEERS))||(topology->allPeers().size() != (upstreams + ZT_TEST_TOPOLOGY_NUM_PEERS))) {
+		std::cout << "FAILED (eachPeer() or allPeers() count mismatch)" << std::endl;
+		return -1;
 	}
+	for(unsigned long i=0;i<addrs.size();++i) {
+		const SharedPtr<Peer> p(topology->getPeer((void *)0,addrs[i]));
+		if ((!p)||(p->address() != addrs[i])||(topology->getPeerNoCache(addrs[i]) != p)||(topology->getIdentity((void *)0,addrs[i]) != p->identity())) {
+			char tmp[16];
+			std::cout << "FAILED (lookup of " << addrs[i].toString(tmp) << " failed)" << std::endl;
+			return -1;
+		}
+		if (topology->getPath(0,phys[i]) != topology->getPath(0,phys[i])) {
+			std::cout << "FAILED (getPath() did not return canonical path)" << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "PASS" << std::endl;
 
-	inline void phyOnTcpWritable(PhySocket *sock,void **uptr)
-	{
-		std::string *testMessage = (std::string *)*uptr;
-		if ((testMessage)&&(testMessage->length() > 0)) {
-			long sent = testPhyInstance->streamSend(sock,(const void *)testMessage->data(),(unsigned long)testMessage->length(),true);
-			if (sent > 0)
-				testMessage->erase(0,sent);
+	// Readers hammer getPeer() and getPath() at random, which is what packet
+	// processing threads do for every packet.
+	static const unsigned int threadCounts[4] = { 1,4,16,64 };
+	for(unsigned int tc=0;tc<4;++tc) {
+		const unsigned int nthreads = threadCounts[tc];
+		const unsigned int perThread = (testBenchmarks) ? (ZT_TEST_TOPOLOGY_LOOKUPS / (nthreads * 2)) : 1000;
+		std::cout << "[topology] Testing/benchmarking random peer/path lookups from " << nthreads << " threads... "; std::cout.flush();
+		volatile unsigned long found = 0;
+		std::vector<std::thread> threads;
+		const int64_t start = OSUtils::now();
+		for(unsigned int t=0;t<nthreads;++t) {
+			threads.push_back(std::thread([topology,&addrs,&phys,&found,perThread,t]() {
+				uint64_t x = 0x9e3779b97f4a7c15ULL * (uint64_t)(t + 1);
+				unsigned long f = 0;
+				for(unsigned int k=0;k<perThread;++k) {
+					x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+					const unsigned long i = (unsigned long)(x % ZT_TEST_TOPOLOGY_NUM_PEERS);
+					if (topology->getPeer((void *)0,addrs[i]))
+						++f;
+					if (topology->getPath(0,phys[i]))
+						++f;
+				}
+				__sync_fetch_and_add(&found,f);
+			}));
 		}
-		if ((!testMessage)||(!testMessage->length())) {
-			testPhyInstance->close(sock,true);
+		for(unsigned int t=0;t<nthreads;++t)
+			threads[t].join();
+		const int64_t end = OSUtils::now();
+		if (found != ((unsigned long)nthreads * perThread * 2)) {
+			std::cout << "FAILED (lookups missed)" << std::endl;
+			return -1;
 		}
+		if (testBenchmarks)
+			std::cout << ((double)nthreads * perThread * 2 / ((double)(end - start) / 1000.0) / 1000000.0) << " million lookups/second" << std::endl;
+		else std::cout << "PASS" << std::endl;
 	}
 
-#ifdef __UNIX_LIKE__
-	inline void phyOnUnixAccept(PhySocket *sockL,PhySocket *sockN,void **uptrL,void **uptrN) {}
-	inline void phyOnUnixClose(PhySocket *sock,void **uptr) {}
-	inline void phyOnUnixData(PhySocket *sock,void **uptr,void *data,unsigned long len) {}
-	inline void phyOnUnixWritable(PhySocket *sock,void **uptr,bool b) {}
-#endif // __UNIX_LIKE__
+	return 0;
+}
 
-	inline void phyOnFileDescriptorActivity(PhySocket *sock,void **uptr,bool readable,bool writable) {}
-};
-static int testPhy()
+#define ZT_TEST_NETWORK_RULES_PORTS 300
+#define ZT_TEST_NETWORK_RULES_FLOWS 64
+#define ZT_TEST_NETWORK_RULES_FRAMES 2000000
+
+static void testNetworkRulesFrame(uint8_t *frame,unsigned int flow)
 {
-	char udpTestPayload[ZT_TEST_PHY_UDP_PACKET_SIZE];
-	memset(udpTestPayload,0xff,sizeof(udpTestPayload));
+	// Minimal IPv4/TCP header; the destination port selects which rule (if any) drops the frame
+	memset(frame,0,40);
+	frame[0] = 0x45;
+	frame[9] = 6;
+	frame[12] = 10; frame[15] = (uint8_t)(flow + 1);
+	frame[16] = 10; frame[19] = 1;
+	const unsigned int sport = 40000 + flow;
+	const unsigned int dport = 10000 + ((flow * 7) % (ZT_TEST_NETWORK_RULES_PORTS * 2));
+	frame[20] = (uint8_t)(sport >> 8); frame[21] = (uint8_t)sport;
+	frame[22] = (uint8_t)(dport >> 8); frame[23] = (uint8_t)dport;
+}
+
+static int testNetworkRules()
+{
+	Node *const node = testMakeNode();
+	RuntimeEnvironment rr(node);
+	TestNodeCleanup cleanup(node);
+	rr.identity = node->identity();
+
+	const uint64_t nwid = (rr.identity.address().toInt() << 24) | 0x000001ULL;
+	SharedPtr<Network> nw(new Network(&rr,(void *)0,nwid,(void *)0,(const NetworkConfig *)0));
+
+	// Drop TCP to every other port in a block of ZT_TEST_NETWORK_RULES_PORTS*2,
+	// accept everything else: a few hundred rules, as large networks tend to have
+	NetworkConfig *const nconf = new NetworkConfig();
+	nconf->networkId = nwid;
+	nconf->issuedTo = rr.identity.address();
+	nconf->timestamp = 1;
+	nconf->revision = 1;
+	for(unsigned int i=0;i<ZT_TEST_NETWORK_RULES_PORTS;++i) {
+		ZT_VirtualNetworkRule *r = &(nconf->rules[nconf->ruleCount++]);
+		r->t = ZT_NETWORK_RULE_MATCH_IP_PROTOCOL;
+		r->v.ipProtocol = 6;
+		r = &(nconf->rules[nconf->ruleCount++]);
+		r->t = ZT_NETWORK_RULE_MATCH_IP_DEST_PORT_RANGE;
+		r->v.port[0] = r->v.port[1] = (uint16_t)(10000 + (i * 2));
+		nconf->rules[nconf->ruleCount++].t = ZT_NETWORK_RULE_ACTION_DROP;
+	}
+	nconf->rules[nconf->ruleCount++].t = ZT_NETWORK_RULE_ACTION_ACCEPT;
+
+	std::cout << "[network] Testing " << nconf->ruleCount << " compiled rules... "; std::cout.flush();
+	const int setResult = nw->setConfiguration((void *)0,*nconf,false);
+	delete nconf;
+	if (setResult != 2) {
+		std::cout << "FAILED (setConfiguration() rejected config)" << std::endl;
+		return -1;
+	}
+
+	const Address dest(rr.identity.address().toInt() ^ 1ULL);
+	const MAC macSource(nw->mac()),macDest(0x32aabbccddeeULL);
+	uint8_t frames[ZT_TEST_NETWORK_RULES_FLOWS][40];
+	bool expected[ZT_TEST_NETWORK_RULES_FLOWS];
+	for(unsigned int f=0;f<ZT_TEST_NETWORK_RULES_FLOWS;++f) {
+		testNetworkRulesFrame(frames[f],f);
+		const unsigned int dport = ((unsigned int)frames[f][22] << 8) | (unsigned int)frames[f][23];
+		expected[f] = ((dport & 1) != 0);
+	}
+	for(unsigned int pass=0;pass<2;++pass) { // second pass is answered from the flow cache
+		for(unsigned int f=0;f<ZT_TEST_NETWORK_RULES_FLOWS;++f) {
+			if (nw->filterOutgoingPacket((void *)0,true,rr.identity.address(),dest,macSource,macDest,frames[f],40,ZT_ETHERTYPE_IPV4,0) != expected[f]) {
+				std::cout << "FAILED (wrong verdict for flow " << f << " on pass " << pass << ")" << std::endl;
+				return -1;
+			}
+		}
+	}
+	const uint8_t arp[28] = { 0 };
+	if (!nw->filterOutgoingPacket((void *)0,true,rr.identity.address(),dest,macSource,macDest,arp,sizeof(arp),ZT_ETHERTYPE_ARP,0)) {
+		std::cout << "FAILED (ARP not accepted)" << std::endl;
+		return -1;
+	}
+	std::cout << "PASS" << std::endl;
+
+	if (!testBenchmarks)
+		return 0;
+
+	std::cout << "[network] Benchmarking filterOutgoingPacket() with " << ZT_TEST_NETWORK_RULES_FLOWS << " flows... "; std::cout.flush();
+	unsigned long accepted = 0;
+	const int64_t start = OSUtils::now();
+	for(unsigned int i=0;i<ZT_TEST_NETWORK_RULES_FRAMES;++i) {
+		const unsigned int f = i % ZT_TEST_NETWORK_RULES_FLOWS;
+		if (nw->filterOutgoingPacket((void *)0,true,rr.identity.address(),dest,macSource,macDest,frames[f],40,ZT_ETHERTYPE_IPV4,0))
+			++accepted;
+	}
+	const int64_t end = OSUtils::now();
+	std::cout << ((double)(end - start) * 1000000.0 / (double)ZT_TEST_NETWORK_RULES_FRAMES) << " ns/frame (" << accepted << " accepted)" << std::endl;
+
+	return 0;
+}
+
+#define ZT_TEST_FRAGMENT_MTU 1400
+#define ZT_TEST_FRAGMENT_SOURCES 50
+#define ZT_TEST_FRAGMENT_PACKETS_PER_SOURCE 4
+
+// A fragmented packet as it would appear on the wire: head first, then fragments
+static std::vector< std::vector<uint8_t> > testFragmentedPacket(const Address &dest,const Address &src)
+{
+	Packet p(dest,src,Packet::VERB_HELLO); // garbage HELLOs fail authentication and are discarded after reassembly
+	uint8_t junk[3000];
+	Utils::getSecureRandom(junk,sizeof(junk));
+	p.append(junk,sizeof(junk));
+	p.setFragmented(true);
+	std::vector< std::vector<uint8_t> > wire;
+	wire.push_back(std::vector<uint8_t>(reinterpret_cast<const uint8_t *>(p.data()),reinterpret_cast<const uint8_t *>(p.data()) + ZT_TEST_FRAGMENT_MTU));
+	const unsigned int fragPayload = ZT_TEST_FRAGMENT_MTU - ZT_PROTO_MIN_FRAGMENT_LENGTH;
+	const unsigned int totalFragments = 1 + ((p.size() - ZT_TEST_FRAGMENT_MTU) + fragPayload - 1) / fragPayload;
+	unsigned int fragStart = ZT_TEST_FRAGMENT_MTU;
+	for(unsigned int fno=1;fno<totalFragments;++fno) {
+		const unsigned int chunk = std::min(p.size() - fragStart,fragPayload);
+		Packet::Fragment frag(p,fragStart,chunk,fno,totalFragments);
+		wire.push_back(std::vector<uint8_t>(reinterpret_cast<const uint8_t *>(frag.data()),reinterpret_cast<const uint8_t *>(frag.data()) + frag.size()));
+		fragStart += chunk;
+	}
+	return wire;
+}
+
+static int testFragmentReassembly()
+{
+	Node *const node = testMakeNode();
+	TestNodeCleanup cleanup(node);
+	const Address me(node->identity().address());
+	volatile int64_t nextDeadline = 0;
+	ZT_NodeStatus before,after;
+
+	std::vector<InetAddress> phys;
+	std::vector<Address> senders;
+	for(unsigned int i=0;i<=ZT_TEST_FRAGMENT_SOURCES;++i) {
+		phys.push_back(InetAddress((uint32_t)(0x0a000001 + i),9993));
+		senders.push_back(Address(0x0100000000ULL + (uint64_t)i));
+	}
+
+	// Every source has several packets in flight at once and delivers each
+	// one's pieces in reverse, so all of them are partially received together.
+	std::cout << "[fragments] Testing " << (ZT_TEST_FRAGMENT_SOURCES * ZT_TEST_FRAGMENT_PACKETS_PER_SOURCE) << " concurrent reassemblies from " << ZT_TEST_FRAGMENT_SOURCES << " sources... "; std::cout.flush();
+	std::vector< std::vector< std::vector<uint8_t> > > packets;
+	std::vector<unsigned int> packetSource;
+	for(unsigned int s=0;s<ZT_TEST_FRAGMENT_SOURCES;++s) {
+		for(unsigned int k=0;k<ZT_TEST_FRAGMENT_PACKETS_PER_SOURCE;++k) {
+			packets.push_back(testFragmentedPacket(me,senders[s]));
+			packetSource.push_back(s);
+		}
+	}
+	node->status(&before);
+	for(unsigned int piece=0;piece<packets[0].size();++piece) {
+		for(unsigned long i=0;i<packets.size();++i) {
+			const std::vector<uint8_t> &w = packets[i][packets[i].size() - (piece + 1)];
+			node->processWirePacket((void *)0,OSUtils::now(),-1,reinterpret_cast<const struct sockaddr_storage *>(&(phys[packetSource[i]])),w.data(),(unsigned int)w.size(),&nextDeadline);
+		}
+	}
+	node->status(&after);
+	if ((after.fragmentsReassembled - before.fragmentsReassembled) != packets.size()) {
+		std::cout << "FAILED (reassembled " << (after.fragmentsReassembled - before.fragmentsReassembled) << " of " << packets.size() << ")" << std::endl;
+		return -1;
+	}
+	if (after.fragmentsEvicted != before.fragmentsEvicted) {
+		std::cout << "FAILED (" << (after.fragmentsEvicted - before.fragmentsEvicted) << " evicted)" << std::endl;
+		return -1;
+	}
+	std::cout << "PASS" << std::endl;
+
+	// One source floods the queue with heads whose fragments never come while
+	// the others each have one packet in flight.
+	std::cout << "[fragments] Testing reassembly while one source floods incomplete packets... "; std::cout.flush();
+	packets.clear();
+	packetSource.clear();
+	for(unsigned int s=0;s<ZT_TEST_FRAGMENT_SOURCES;++s) {
+		packets.push_back(testFragmentedPacket(me,senders[s]));
+		packetSource.push_back(s);
+	}
+	node->status(&before);
+	for(unsigned long i=0;i<packets.size();++i) {
+		const std::vector<uint8_t> &w = packets[i][0];
+		node->processWirePacket((void *)0,OSUtils::now(),-1,reinterpret_cast<const struct sockaddr_storage *>(&(phys[packetSource[i]])),w.data(),(unsigned int)w.size(),&nextDeadline);
+	}
+	for(unsigned int f=0;f<(ZT_RX_QUEUE_SIZE * 4);++f) {
+		const std::vector< std::vector<uint8_t> > flood(testFragmentedPacket(me,senders[ZT_TEST_FRAGMENT_SOURCES]));
+		node->processWirePacket((void *)0,OSUtils::now(),-1,reinterpret_cast<const struct sockaddr_storage *>(&(phys[ZT_TEST_FRAGMENT_SOURCES])),flood[0].data(),(unsigned int)flood[0].size(),&nextDeadline);
+	}
+	for(unsigned long i=0;i<packets.size();++i) {
+		for(unsigned int piece=1;piece<packets[i].size();++piece) {
+			const std::vector<uint8_t> &w = packets[i][piece];
+			node->processWirePacket((void *)0,OSUtils::now(),-1,reinterpret_cast<const struct sockaddr_storage *>(&(phys[packetSource[i]])),w.data(),(unsigned int)w.size(),&nextDeadline);
+		}
+	}
+	node->status(&after);
+	if ((after.fragmentsReassembled - before.fragmentsReassembled) != packets.size()) {
+		std::cout << "FAILED (reassembled " << (after.fragmentsReassembled - before.fragmentsReassembled) << " of " << packets.size() << ")" << std::endl;
+		return -1;
+	}
+	if ((after.fragmentsEvicted - before.fragmentsEvicted) < ((ZT_RX_QUEUE_SIZE * 4) - ZT_RX_QUEUE_MAX_PER_SOURCE)) {
+		std::cout << "FAILED (flood not evicted)" << std::endl;
+		return -1;
+	}
+	std::cout << "PASS (" << (after.fragmentsEvicted - before.fragmentsEvicted) << " flood packets evicted)" << std::endl;
+
+	return 0;
+}
+
+#define ZT_TEST_TXQUEUE_ARRIVALS 4000000
+static unsigned long testTxQueueSent = 0;
+static int testTxQueueWirePacketSend(ZT_Node *,void *,void *,int64_t,const struct sockaddr_storage *,const void *,unsigned int,unsigned int)
+{
+	++testTxQueueSent;
+	return 0;
+}
+// A peer with a random identity and a live direct path, as if it had just answered our HELLO
+static SharedPtr<Peer> testTxQueuePeer(RuntimeEnvironment &rr,Topology *topology,const Address &addr)
+{
+	uint8_t pub[ZT_C25519_PUBLIC_KEY_LEN];
+	Utils::getSecureRandom(pub,sizeof(pub));
+	char idstr[256],pubhex[256],tmp[16];
+	Utils::hex(pub,sizeof(pub),pubhex);
+	OSUtils::ztsnprintf(idstr,sizeof(idstr),"%s:0:%s",addr.toString(tmp),pubhex);
+	Identity id;
+	id.fromString(idstr);
+	const SharedPtr<Peer> p(topology->addPeer((void *)0,SharedPtr<Peer>(new Peer(&rr,rr.identity,id))));
+	const SharedPtr<Path> path(topology->getPath(0,InetAddress((uint32_t)(0x0a000001 + ((addr.toInt() & 0xffff) << 8)),9993)));
+	path->received(rr.node->now());
+	p->received((void *)0,path,0,rr.node->prng(),Packet::VERB_OK,0,Packet::VERB_HELLO,true,0);
+	return p;
+}
+static void testTxQueueSend(RuntimeEnvironment &rr,const Address &dest)
+{
+	Packet outp(dest,rr.identity.address(),Packet::VERB_NOP);
+	outp.append((uint64_t)rr.node->prng());
+	rr.sw->send((void *)0,outp,true);
+}
+static int testTxQueue()
+{
+	Node *const node = testMakeNode(testTxQueueWirePacketSend);
+	RuntimeEnvironment rr(node);
+	TestNodeCleanup cleanup(node,&rr);
+	rr.identity = node->identity();
+	rr.t = new Trace(&rr);
+	rr.topology = new Topology(&rr,(void *)0);
+	rr.sw = new Switch(&rr);
+
+	std::cout << "[txqueue] Testing per-destination and total limits... "; std::cout.flush();
+	// One destination queues more than its share; only its newest packets are kept
+	const Address a(0x0100000001ULL);
+	for(unsigned int i=0;i<(ZT_TX_QUEUE_MAX_PER_DEST * 2);++i)
+		testTxQueueSend(rr,a);
+	testTxQueueSent = 0;
+	rr.sw->doAnythingWaitingForPeer((void *)0,testTxQueuePeer(rr,rr.topology,a));
+	if (testTxQueueSent != ZT_TX_QUEUE_MAX_PER_DEST) {
+		std::cout << "FAILED (" << testTxQueueSent << " of " << ZT_TX_QUEUE_MAX_PER_DEST << " sent on arrival)" << std::endl;
+		return -1;
+	}
+	testTxQueueSent = 0;
+	rr.sw->doAnythingWaitingForPeer((void *)0,rr.topology->getPeer((void *)0,a));
+	if (testTxQueueSent != 0) {
+		std::cout << "FAILED (packets sent twice)" << std::endl;
+		return -1;
+	}
+
+	// A full queue drops the oldest packets first, whoever they are for
+	const Address b(0x0100000002ULL);
+	for(unsigned int i=0;i<3;++i)
+		testTxQueueSend(rr,b);
+	std::vector<Address> many;
+	for(unsigned int i=0;i<ZT_TX_QUEUE_SIZE;++i) {
+		many.push_back(Address(0x0200000000ULL + (uint64_t)i));
+		testTxQueueSend(rr,many.back());
+	}
+	testTxQueueSent = 0;
+	rr.sw->doAnythingWaitingForPeer((void *)0,testTxQueuePeer(rr,rr.topology,b));
+	if (testTxQueueSent != 0) {
+		std::cout << "FAILED (oldest packets not evicted)" << std::endl;
+		return -1;
+	}
+	rr.sw->doAnythingWaitingForPeer((void *)0,testTxQueuePeer(rr,rr.topology,many.back()));
+	if (testTxQueueSent != 1) {
+		std::cout << "FAILED (newest packet evicted)" << std::endl;
+		return -1;
+	}
+
+	// Anything left over expires
+	const Address c(0x0100000003ULL);
+	testTxQueueSend(rr,c);
+	rr.sw->doTimerTasks((void *)0,node->now() + ZT_TRANSMIT_QUEUE_TIMEOUT + 1);
+	testTxQueueSent = 0;
+	rr.sw->doAnythingWaitingForPeer((void *)0,testTxQueuePeer(rr,rr.topology,c));
+	if (testTxQueueSent != 0) {
+		std::cout << "FAILED (packet did not expire)" << std::endl;
+		return -1;
+	}
+	std::cout << "PASS" << std::endl;
+
+	if (!testBenchmarks)
+		return 0;
+
+	for(unsigned int i=0;i<ZT_TX_QUEUE_SIZE;++i)
+		testTxQueueSend(rr,Address(many[i].toInt() + 0x0100000000ULL));
+	std::cout << "[txqueue] Benchmarking peer arrival with " << ZT_TX_QUEUE_SIZE << " packets queued for others... "; std::cout.flush();
+	const SharedPtr<Peer> arriving(rr.topology->getPeer((void *)0,a));
+	const int64_t start = OSUtils::now();
+	for(unsigned long i=0;i<ZT_TEST_TXQUEUE_ARRIVALS;++i)
+		rr.sw->doAnythingWaitingForPeer((void *)0,arriving);
+	const int64_t end = OSUtils::now();
+	std::cout << ((double)(end - start) * 1000000.0) / (double)ZT_TEST_TXQUEUE_ARRIVALS << " ns/arrival" << std::endl;
+
+	return 0;
+}
+
+#define ZT_TEST_HELLO_STORM_PEERS 16
+static std::vector<uint8_t> testHelloStormCache;
+static std::set<uint32_t> testHelloStormReplied;
+static int testHelloStormStateGet(ZT_Node *n,void *uptr,void *tptr,enum ZT_StateObjectType type,const uint64_t id[2],void *data,unsigned int maxlen)
+{
+	if ((type == ZT_STATE_OBJECT_IDENTITY_CACHE)&&(!testHelloStormCache.empty())&&(testHelloStormCache.size() <= maxlen)) {
+		memcpy(data,testHelloStormCache.data(),testHelloStormCache.size());
+		return (int)testHelloStormCache.size();
+	}
+	return testTopologyStateGet(n,uptr,tptr,type,id,data,maxlen);
+}
+static void testHelloStormStatePut(ZT_Node *,void *,void *,enum ZT_StateObjectType type,const uint64_t [2],const void *data,int len)
+{
+	if ((type == ZT_STATE_OBJECT_IDENTITY_CACHE)&&(len > 0))
+		testHelloStormCache.assign(reinterpret_cast<const uint8_t *>(data),reinterpret_cast<const uint8_t *>(data) + len);
+}
+static int testHelloStormWirePacketSend(ZT_Node *,void *,void *,int64_t,const struct sockaddr_storage *addr,const void *,unsigned int,unsigned int)
+{
+	// Peers are all at 10.0.x.1, anything else is the node contacting its roots
+	const InetAddress *const ia = reinterpret_cast<const InetAddress *>(addr);
+	if ((ia->ss_family == AF_INET)&&((Utils::ntoh((uint32_t)reinterpret_cast<const struct sockaddr_in *>(ia)->sin_addr.s_addr) >> 24) == 10))
+		testHelloStormReplied.insert(Utils::ntoh((uint32_t)reinterpret_cast<const struct sockaddr_in *>(ia)->sin_addr.s_addr));
+	return 0;
+}
+// Sends every HELLO and waits until each peer has been answered, returns false on timeout
+static bool testHelloStormReplay(Node *node,const std::vector<InetAddress> &phys,const std::vector< std::vector<uint8_t> > &hellos,int64_t &ioTime,int64_t &totalTime)
+{
+	volatile int64_t nextDeadline = 0;
+	testHelloStormReplied.clear();
+	const int64_t start = OSUtils::now();
+	for(unsigned long i=0;i<hellos.size();++i)
+		node->processWirePacket((void *)0,OSUtils::now(),-1,reinterpret_cast<const struct sockaddr_storage *>(&(phys[i])),hellos[i].data(),(unsigned int)hellos[i].size(),&nextDeadline);
+	ioTime = OSUtils::now() - start;
+	while (testHelloStormReplied.size() < ZT_TEST_HELLO_STORM_PEERS) {
+		if ((OSUtils::now() - start) > 60000)
+			return false;
+		Thread::sleep(1);
+		node->processBackgroundTasks((void *)0,OSUtils::now(),&nextDeadline);
+	}
+	totalTime = OSUtils::now() - start;
+	return true;
+}
+static int testHelloStorm()
+{
+	testHelloStormCache.clear();
+	Node *node = testMakeNode(testHelloStormWirePacketSend,testHelloStormStatePut,testHelloStormStateGet);
+	TestNodeCleanup cleanup(node);
+	const Identity me(node->identity());
+	ZT_NodeStatus status;
+
+	std::cout << "[hellostorm] Generating " << ZT_TEST_HELLO_STORM_PEERS << " peer identities... "; std::cout.flush();
+	std::vector<Identity> ids;
+	std::vector<InetAddress> phys;
+	for(unsigned int i=0;i<ZT_TEST_HELLO_STORM_PEERS;++i) {
+		ids.push_back(Identity());
+		ids.back().generate();
+		phys.push_back(InetAddress(Utils::hton((uint32_t)(0x0a000001 + (i << 8))),9993)); // one per rate gate bucket
+	}
+	std::cout << "done" << std::endl;
+
+	// What _doHELLO() used to do inline on the I/O thread for each new peer
+	int64_t inlineTime = OSUtils::now();
+	std::vector< std::vector<uint8_t> > hellos;
+	for(unsigned int i=0;i<ZT_TEST_HELLO_STORM_PEERS;++i) {
+		uint8_t key[ZT_PEER_SECRET_KEY_LENGTH];
+		if ((!me.agree(ids[i],key,ZT_PEER_SECRET_KEY_LENGTH))||(!ids[i].locallyValidate())) {
+			std::cout << "FAILED (generated identity invalid)" << std::endl;
+			return -1;
+		}
+		Packet outp(me.address(),ids[i].address(),Packet::VERB_HELLO);
+		outp.append((unsigned char)ZT_PROTO_VERSION);
+		outp.append((unsigned char)ZEROTIER_ONE_VERSION_MAJOR);
+		outp.append((unsigned char)ZEROTIER_ONE_VERSION_MINOR);
+		outp.append((uint16_t)ZEROTIER_ONE_VERSION_REVISION);
+		outp.append((int64_t)OSUtils::now());
+		ids[i].serialize(outp,false);
+		outp.armor(key,false);
+		hellos.push_back(std::vector<uint8_t>(reinterpret_cast<const uint8_t *>(outp.data()),reinterpret_cast<const uint8_t *>(outp.data()) + outp.size()));
+	}
+	inlineTime = OSUtils::now() - inlineTime;
+
+	// An identity whose address wasn't derived from its key, with a MAC nobody could have made
+	std::vector<uint8_t> bogus;
+	{
+		uint8_t pub[ZT_C25519_PUBLIC_KEY_LEN],key[ZT_PEER_SECRET_KEY_LENGTH];
+		Utils::getSecureRandom(pub,sizeof(pub));
+		Utils::getSecureRandom(key,sizeof(key));
+		char idstr[256],pubhex[256];
+		Utils::hex(pub,sizeof(pub),pubhex);
+		OSUtils::ztsnprintf(idstr,sizeof(idstr),"0123456789:0:%s",pubhex);
+		Identity bid;
+		bid.fromString(idstr);
+		Packet outp(me.address(),bid.address(),Packet::VERB_HELLO);
+		outp.append((unsigned char)ZT_PROTO_VERSION);
+		outp.append((unsigned char)ZEROTIER_ONE_VERSION_MAJOR);
+		outp.append((unsigned char)ZEROTIER_ONE_VERSION_MINOR);
+		outp.append((uint16_t)ZEROTIER_ONE_VERSION_REVISION);
+		outp.append((int64_t)OSUtils::now());
+		bid.serialize(outp,false);
+		outp.armor(key,false);
+		bogus.assign(reinterpret_cast<const uint8_t *>(outp.data()),reinterpret_cast<const uint8_t *>(outp.data()) + outp.size());
+	}
+
+	std::cout << "[hellostorm] Replaying a reconnect storm of " << ZT_TEST_HELLO_STORM_PEERS << " new peers... "; std::cout.flush();
+	int64_t ioTime = 0,totalTime = 0;
+	{
+		volatile int64_t nextDeadline = 0;
+		const InetAddress bogusPhy(Utils::hton((uint32_t)0xc0a80001),9993);
+		node->processWirePacket((void *)0,OSUtils::now(),-1,reinterpret_cast<const struct sockaddr_storage *>(&bogusPhy),bogus.data(),(unsigned int)bogus.size(),&nextDeadline);
+	}
+	if (!testHelloStormReplay(node,phys,hellos,ioTime,totalTime)) {
+		std::cout << "FAILED (answered " << testHelloStormReplied.size() << " of " << ZT_TEST_HELLO_STORM_PEERS << ")" << std::endl;
+		return -1;
+	}
+	node->status(&status);
+	if ((status.identitiesValidated != ZT_TEST_HELLO_STORM_PEERS)||(status.identityCacheHits != 0)||(status.identityValidationsFailed != 1)) {
+		std::cout << "FAILED (" << status.identitiesValidated << " validated, " << status.identityCacheHits << " cached, " << status.identityValidationsFailed << " failed)" << std::endl;
+		return -1;
+	}
+	std::cout << "PASS (I/O thread busy " << ioTime << "ms, all answered after " << totalTime << "ms, inline validation would take " << inlineTime << "ms)" << std::endl;
+
+	{
+		// The cache is saved from background tasks, at most once per save interval
+		volatile int64_t nextDeadline = 0;
+		node->processBackgroundTasks((void *)0,OSUtils::now() + ZT_IDENTITY_VALIDATOR_CACHE_SAVE_INTERVAL,&nextDeadline);
+	}
+	delete node;
+	node = (Node *)0;
+	if (testHelloStormCache.size() != (1 + (ZT_TEST_HELLO_STORM_PEERS * 16))) {
+		std::cout << "[hellostorm] FAILED (identity cache not saved)" << std::endl;
+		return -1;
+	}
+
+	std::cout << "[hellostorm] Replaying the same storm after a restart with a saved identity cache... "; std::cout.flush();
+	node = testMakeNode(testHelloStormWirePacketSend,testHelloStormStatePut,testHelloStormStateGet);
+	if (!testHelloStormReplay(node,phys,hellos,ioTime,totalTime)) {
+		std::cout << "FAILED (answered " << testHelloStormReplied.size() << " of " << ZT_TEST_HELLO_STORM_PEERS << ")" << std::endl;
+		return -1;
+	}
+	node->status(&status);
+	if ((status.identitiesValidated != ZT_TEST_HELLO_STORM_PEERS)||(status.identityCacheHits != ZT_TEST_HELLO_STORM_PEERS)||(status.identityValidationsFailed != 0)) {
+		std::cout << "FAILED (" << status.identitiesValidated << " validated, " << status.identityCacheHits << " cached, " << status.identityValidationsFailed << " failed)" << std::endl;
+		return -1;
+	}
+	std::cout << "PASS (I/O thread busy " << ioTime << "ms, all answered after " << totalTime << "ms)" << std::endl;
+
+	return 0;
+}
+
+#define ZT_TEST_MULTICAST_OPS 1000000
+#define ZT_TEST_MULTICAST_GATHER_LIMIT 32
+
+// Runs gather() and checks that results are distinct, known, and don't include the asker
+static int testMulticasterGather(Multicaster &mc,const uint64_t nwid,const MulticastGroup &mg,const Address &asker,const std::set<Address> &members,unsigned int limit,unsigned int expectAdded)
+{
+	Buffer<ZT_PROTO_MAX_PACKET_LENGTH> b;
+	const unsigned int added = mc.gather(asker,nwid,mg,b,limit);
+	if ((added != expectAdded)||(b.at<uint32_t>(0) != (uint32_t)members.size())||(b.at<uint16_t>(4) != (uint16_t)added)) {
+		std::cout << "FAILED (gathered " << added << " of " << expectAdded << ", " << b.at<uint32_t>(0) << " of " << members.size() << " known)" << std::endl;
+		return -1;
+	}
+	std::set<Address> seen;
+	for(unsigned int i=0;i<added;++i) {
+		const Address a(b.field(6 + (i * ZT_ADDRESS_LENGTH),ZT_ADDRESS_LENGTH),ZT_ADDRESS_LENGTH);
+		if ((a == asker)||(!members.count(a))||(!seen.insert(a).second)) {
+			std::cout << "FAILED (bad or repeated member in gather results)" << std::endl;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int testMulticaster()
+{
+	Node *const node = testMakeNode();
+	RuntimeEnvironment rr(node);
+	TestNodeCleanup cleanup(node);
+	rr.identity = node->identity();
+	const uint64_t nwid = 0x8056c2e21c000001ULL;
+	const MulticastGroup mg(MulticastGroup::deriveMulticastGroupForAddressResolution(InetAddress((uint32_t)0x0a000001,0)));
+	const int64_t now = node->now();
+
+	std::cout << "[multicast] Testing member add/remove/expire and gather... "; std::cout.flush();
+	{
+		Multicaster mc(&rr);
+		std::set<Address> members;
+		for(uint64_t i=1;i<=1000;++i) {
+			mc.add((void *)0,now,nwid,mg,Address(0x0100000000ULL + i));
+			members.insert(Address(0x0100000000ULL + i));
+		}
+		mc.add((void *)0,now,nwid,mg,Address(0x0100000001ULL)); // duplicate
+		for(uint64_t i=2;i<=1000;i+=2) {
+			mc.remove(nwid,mg,Address(0x0100000000ULL + i));
+			members.erase(Address(0x0100000000ULL + i));
+		}
+		mc.remove(nwid,mg,Address(0x0100000002ULL)); // no longer a member
+		if (testMulticasterGather(mc,nwid,mg,Address(0x0100000001ULL),members,1000,499))
+			return -1;
+		for(unsigned int k=0;k<100;++k) {
+			if (testMulticasterGather(mc,nwid,mg,Address(0x0200000000ULL),members,ZT_TEST_MULTICAST_GATHER_LIMIT,ZT_TEST_MULTICAST_GATHER_LIMIT))
+				return -1;
+		}
+
+		// Refresh half of what's left, then expire the rest
+		std::set<Address> refreshed;
+		for(uint64_t i=1;i<=1000;i+=4) {
+			mc.add((void *)0,now + ZT_MULTICAST_LIKE_EXPIRE,nwid,mg,Address(0x0100000000ULL + i));
+			refreshed.insert(Address(0x0100000000ULL + i));
+		}
+		mc.clean(now + ZT_MULTICAST_LIKE_EXPIRE + 1);
+		if (testMulticasterGather(mc,nwid,mg,Address(0x0200000000ULL),refreshed,1000,(unsigned int)refreshed.size()))
+			return -1;
+		for(std::set<Address>::const_iterator a(refreshed.begin());a!=refreshed.end();++a)
+			mc.remove(nwid,mg,*a);
+		if (testMulticasterGather(mc,nwid,mg,Address(0x0200000000ULL),std::set<Address>(),1000,0))
+			return -1;
+	}
+	std::cout << "PASS" << std::endl;
+
+	// Each size is run enough times to total about ZT_TEST_MULTICAST_OPS adds and removes
+	static const unsigned long sizes[2] = { 10000,100000 };
+	for(unsigned int si=0;si<2;++si) {
+		const unsigned long n = sizes[si];
+		const unsigned long rounds = testBenchRounds(ZT_TEST_MULTICAST_OPS,n);
+		const unsigned long gathers = (testBenchmarks) ? (ZT_TEST_MULTICAST_OPS / 10 / rounds) : 100;
+		std::cout << "[multicast] Testing/benchmarking " << n << " members..."; std::cout.flush();
+		int64_t tAdd = 0,tRefresh = 0,tGather = 0,tRemove = 0;
+		unsigned long gathered = 0;
+		for(unsigned long r=0;r<rounds;++r) {
+			Multicaster mc(&rr);
+
+			int64_t start = OSUtils::now();
+			for(unsigned long i=0;i<n;++i)
+				mc.add((void *)0,now,nwid,mg,Address(0x0100000000ULL + (uint64_t)i));
+			tAdd += OSUtils::now() - start;
+
+			start = OSUtils::now();
+			for(unsigned long i=0;i<n;++i)
+				mc.add((void *)0,now,nwid,mg,Address(0x0100000000ULL + (uint64_t)i));
+			tRefresh += OSUtils::now() - start;
+
+			Buffer<ZT_PROTO_MAX_PACKET_LENGTH> b;
+			start = OSUtils::now();
+			for(unsigned long i=0;i<gathers;++i) {
+				b.clear();
+				gathered += mc.gather(Address(),nwid,mg,b,ZT_TEST_MULTICAST_GATHER_LIMIT);
+			}
+			tGather += OSUtils::now() - start;
+
+			start = OSUtils::now();
+			for(unsigned long i=0;i<n;++i)
+				mc.remove(nwid,mg,Address(0x0100000000ULL + (uint64_t)i));
+			tRemove += OSUtils::now() - start;
+		}
+		if (gathered != (rounds * gathers * ZT_TEST_MULTICAST_GATHER_LIMIT)) {
+			std::cout << " FAILED (gather returned too few members)" << std::endl;
+			return -1;
+		}
+		if (!testBenchmarks) {
+			std::cout << " PASS" << std::endl;
+			continue;
+		}
+		const double ops = (double)(n * rounds);
+		testBenchField(" add ",tAdd,ops);
+		testBenchField(", refresh ",tRefresh,ops);
+		std::cout << ", gather(" << ZT_TEST_MULTICAST_GATHER_LIMIT << ")";
+		testBenchField(" ",tGather,(double)(rounds * gathers));
+		testBenchField(", remove ",tRemove,ops);
+		std::cout << std::endl;
+	}
+
+	return 0;
+}
+#ifdef __UNIX_LIKE__
+
+// Scratch directory under $TMPDIR (or /tmp), removed with its contents when it goes out of scope
+class TestTempDir
+{
+public:
+	TestTempDir(const char *prefix)
+	{
+		const char *const t = getenv("TMPDIR");
+		std::string p(((t)&&(*t)) ? t : "/tmp");
+		p.push_back(ZT_PATH_SEPARATOR);
+		p.append(prefix);
+		p.append("-XXXXXX");
+		std::vector<char> b(p.begin(),p.end());
+		b.push_back((char)0);
+		if (mkdtemp(b.data()))
+			path = b.data();
+	}
+	~TestTempDir()
+	{
+		if (!path.empty())
+			OSUtils::rmDashRf(path.c_str());
+	}
+	inline std::string sub(const char *name) const { return path + ZT_PATH_SEPARATOR_S + name; }
+
+	std::string path;
+
+private:
+	TestTempDir(const TestTempDir &) {}
+	const TestTempDir &operator=(const TestTempDir &) { return *this; }
+};
+
+#define ZT_TEST_RX_WORKER_THREADS 4
+#define ZT_TEST_RX_WORKER_SOURCES 7
+#define ZT_TEST_RX_WORKER_PACKETS 256
+#define ZT_TEST_RX_WORKER_BURST 16
+#define ZT_TEST_RX_WORKER_WINDOW 256
+
+class TestRxWorkersService
+{
+public:
+	TestRxWorkersService(OneService *s) : svc(s) {}
+	inline void threadMain() throw() { svc->run(); }
+	OneService *const svc;
+};
+
+// HELLO from 'me' carrying 'seq' as its timestamp, which OK(HELLO) echoes back
+static void testRxWorkersHello(const Identity &me,const Identity &server,const uint8_t *key,int64_t seq,int fd,const struct sockaddr_in &to)
+{
+	Packet outp(server.address(),me.address(),Packet::VERB_HELLO);
+	outp.append((unsigned char)ZT_PROTO_VERSION);
+	outp.append((unsigned char)ZEROTIER_ONE_VERSION_MAJOR);
+	outp.append((unsigned char)ZEROTIER_ONE_VERSION_MINOR);
+	outp.append((uint16_t)ZEROTIER_ONE_VERSION_REVISION);
+	outp.append(seq);
+	me.serialize(outp,false);
+	outp.armor(key,false);
+	sendto(fd,outp.data(),outp.size(),0,(const struct sockaddr *)&to,sizeof(to));
+}
+
+// Gets the echoed sequence number of the next OK(HELLO) waiting on fd, false if there's none
+static bool testRxWorkersReply(int fd,const uint8_t *key,int64_t &seq)
+{
+	char buf[ZT_PROTO_MAX_PACKET_LENGTH];
+	for(;;) {
+		const ssize_t n = recv(fd,buf,sizeof(buf),MSG_DONTWAIT);
+		if (n < 0)
+			return false;
+		if (n < ZT_PROTO_MIN_PACKET_LENGTH)
+			continue;
+		Packet pkt(buf,(unsigned int)n);
+		if ((!pkt.dearmor(key))||(pkt.verb() != Packet::VERB_OK)||(pkt.size() < (ZT_PROTO_VERB_HELLO__OK__IDX_TIMESTAMP + 8))||(pkt[ZT_PROTO_VERB_OK_IDX_IN_RE_VERB] != Packet::VERB_HELLO))
+			continue; // anything else the service sends us, e.g. its own HELLO
+		seq = pkt.at<int64_t>(ZT_PROTO_VERB_HELLO__OK__IDX_TIMESTAMP);
+		return true;
+	}
+}
+
+static int testRxWorkers()
+{
+	std::cout << "[rxworkers] Starting service with " << ZT_TEST_RX_WORKER_THREADS << " RX worker threads... "; std::cout.flush();
+	TestTempDir home("zt-selftest-rxworkers");
+	if (home.path.empty()) {
+		std::cout << "FAILED (unable to create home directory)" << std::endl;
+		return -1;
+	}
+
+	// Each source is its own UDP socket, so the service sees a distinct physical path for each
+	struct sockaddr_in lo;
+	memset(&lo,0,sizeof(lo));
+	lo.sin_family = AF_INET;
+	lo.sin_addr.s_addr = Utils::hton((uint32_t)0x7f000001);
+	int fds[ZT_TEST_RX_WORKER_SOURCES];
+	for(int i=0;i<ZT_TEST_RX_WORKER_SOURCES;++i) {
+		fds[i] = socket(AF_INET,SOCK_DGRAM,0);
+		bind(fds[i],(const struct sockaddr *)&lo,sizeof(lo));
+	}
+
+	// Bind the service to loopback only, on a port the kernel just handed out
+	struct sockaddr_in to;
+	socklen_t tolen = sizeof(to);
+	const int spare = socket(AF_INET,SOCK_DGRAM,0);
+	bind(spare,(const struct sockaddr *)&lo,sizeof(lo));
+	getsockname(spare,(struct sockaddr *)&to,&tolen);
+	close(spare);
+	char tmp[512];
+	OSUtils::ztsnprintf(tmp,sizeof(tmp),"{\"settings\":{\"rxWorkerThreads\":%d,\"bind\":[\"127.0.0.1/%u\"],\"portMappingEnabled\":false,\"allowTcpFallbackRelay\":false,\"softwareUpdate\":\"disable\"}}",ZT_TEST_RX_WORKER_THREADS,(unsigned int)Utils::ntoh((uint16_t)to.sin_port));
+	OSUtils::writeFile(home.sub("local.conf").c_str(),tmp);
+
+	OneService *const svc = OneService::newInstance(home.path.c_str(),0);
+	TestRxWorkersService runner(svc);
+	Thread thread = Thread::start(&runner);
+
+	int result = -1;
+	Identity me,server;
+	uint8_t key[ZT_PEER_SECRET_KEY_LENGTH];
+	int64_t seq;
+	me.generate();
+	std::string serverPublic;
+	int64_t start = OSUtils::now();
+	while ((!OSUtils::readFile(home.sub("identity.public").c_str(),serverPublic))&&((OSUtils::now() - start) < 30000))
+		Thread::sleep(10);
+
+	// The first HELLO from a new identity is validated in the background and may
+	// wait in the RX queue, so make sure the service knows us before checking order
+	bool known = false;
+	if ((server.fromString(serverPublic.c_str()))&&(me.agree(server,key,ZT_PEER_SECRET_KEY_LENGTH))) {
+		start = OSUtils::now();
+		while ((!known)&&((OSUtils::now() - start) < 30000)) {
+			testRxWorkersHello(me,server,key,ZT_TEST_RX_WORKER_PACKETS,fds[0],to);
+			Thread::sleep(100);
+			while (testRxWorkersReply(fds[0],key,seq))
+				known = true;
+		}
+	}
+	if (!known) {
+		std::cout << "FAILED (service never answered)" << std::endl;
+	} else {
+		std::cout << "OK" << std::endl;
+
+		std::cout << "[rxworkers] Sending " << ZT_TEST_RX_WORKER_PACKETS << " HELLOs from each of " << ZT_TEST_RX_WORKER_SOURCES << " sources... "; std::cout.flush();
+		int64_t next[ZT_TEST_RX_WORKER_SOURCES];
+		unsigned long sent = 0,received = 0,reordered = 0;
+		for(int i=0;i<ZT_TEST_RX_WORKER_SOURCES;++i)
+			next[i] = 0;
+		start = OSUtils::now();
+		// Sources send in bursts so several packets from each are in flight at once
+		for(int64_t n=0;n<=ZT_TEST_RX_WORKER_PACKETS;n+=ZT_TEST_RX_WORKER_BURST) {
+			if (n < ZT_TEST_RX_WORKER_PACKETS) {
+				for(int i=0;i<ZT_TEST_RX_WORKER_SOURCES;++i) {
+					for(int64_t k=n;k<(n + ZT_TEST_RX_WORKER_BURST);++k,++sent)
+						testRxWorkersHello(me,server,key,k,fds[i],to);
+				}
+			}
+			// Collect replies, holding back while too many are outstanding (and at the end until all are in)
+			while ((OSUtils::now() - start) < 30000) {
+				for(int i=0;i<ZT_TEST_RX_WORKER_SOURCES;++i) {
+					while (testRxWorkersReply(fds[i],key,seq)) {
+						if (seq == ZT_TEST_RX_WORKER_PACKETS)
+							continue; // late answer to the warm-up HELLO
+						if (seq != next[i])
+							++reordered;
+						next[i] = seq + 1;
+						++received;
+					}
+				}
+				if ((sent - received) <= ((n < ZT_TEST_RX_WORKER_PACKETS) ? ZT_TEST_RX_WORKER_WINDOW : 0))
+					break;
+				Thread::sleep(1);
+			}
+		}
+		const int64_t elapsed = OSUtils::now() - start;
+		if ((received != sent)||(reordered != 0)) {
+			std::cout << "FAILED (" << received << " of " << sent << " answered, " << reordered << " out of order)" << std::endl;
+		} else {
+			std::cout << "PASS (all answered in per-source order in " << elapsed << "ms)" << std::endl;
+			result = 0;
+		}
+	}
+
+	svc->terminate();
+	Thread::join(thread);
+	delete svc;
+	for(int i=0;i<ZT_TEST_RX_WORKER_SOURCES;++i)
+		close(fds[i]);
+	return result;
+}
+
+#endif // __UNIX_LIKE__
+
+#define ZT_TEST_COMPRESSION_FRAMES 200000
+
+// Fills buf with something resembling text protocol traffic
+static void testCompressionText(uint8_t *buf,unsigned int len,uint64_t &x)
+{
+	static const char *const words[16] = { "GET ","/index.html ","HTTP/1.1\r\n","Host: ","example.com\r\n","Accept: ","text/html","application/json",", ","Content-Length: ","\r\n","{\"id\":","\"name\":\"","\"},","200 OK","Connection: keep-alive\r\n" };
+	unsigned int ptr = 0;
+	while (ptr < len) {
+		x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+		const char *w = ((x >> 8) & 3) ? words[x & 15] : "0123456789" + (x % 10);
+		while ((*w)&&(ptr < len))
+			buf[ptr++] = (uint8_t)*(w++);
+	}
+}
+
+static int testFrameCompression()
+{
+	Node *const node = testMakeNode();
+	RuntimeEnvironment rr(node);
+	TestNodeCleanup cleanup(node,&rr);
+	rr.identity = node->identity();
+	rr.t = new Trace(&rr);
+	Topology *const topology = rr.topology = new Topology(&rr,(void *)0);
+	const SharedPtr<Peer> peer(testTxQueuePeer(rr,topology,Address(0x0100000001ULL)));
+	uint64_t x = 0x9e3779b97f4a7c15ULL;
+
+	static uint8_t text[9000],junk[9000];
+	testCompressionText(text,sizeof(text),x);
+	for(unsigned int i=0;i<sizeof(junk);++i) { // fixed seed so the probe test below always sees the same bytes
+		x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+		junk[i] = (uint8_t)(x >> 32);
+	}
+
+	std::cout << "[compression] Testing in-place frame compression... "; std::cout.flush();
+	{
+		static const unsigned int lens[4] = { 40,1400,4000,9000 }; // 9000 is too big to stage and falls back to compress()
+		for(unsigned int l=0;l<4;++l) {
+			for(unsigned int t=0;t<2;++t) {
+				const uint8_t *const data = (t) ? junk : text;
+				Packet a(peer->address(),rr.identity.address(),Packet::VERB_FRAME);
+				a.append((uint64_t)0x8056c2e21c000001ULL);
+				a.append((uint16_t)0x0800);
+				Packet b(a);
+				a.append(data,lens[l]);
+				memcpy(b.appendStaged(lens[l]),data,lens[l]);
+				const unsigned int cl = b.finishStaged(lens[l],true);
+				const bool shouldShrink = ((!t)&&(lens[l] > 40));
+				if ((shouldShrink != (cl != 0))||(b.compressed() != (cl != 0))||((cl)&&(b.size() != (cl + ZT_PACKET_IDX_PAYLOAD)))) {
+					std::cout << "FAILED (" << lens[l] << " byte " << ((t) ? "random" : "text") << " frame compressed to " << cl << ")" << std::endl;
+					return -1;
+				}
+				if ((!b.uncompress())||(a != b)) {
+					std::cout << "FAILED (" << lens[l] << " byte " << ((t) ? "random" : "text") << " frame corrupted)" << std::endl;
+					return -1;
+				}
+			}
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[compression] Testing adaptive backoff... "; std::cout.flush();
+	{
+		ZT_PeerCompressionStats cs;
+		if ((peer->shouldCompressFrame(junk,1400))||(!peer->shouldCompressFrame(text,1400))) {
+			std::cout << "FAILED (probe misclassified frame)" << std::endl;
+			return -1;
+		}
+		peer->frameCompressed(1400,600);
+		peer->compressionStats(cs);
+		if ((cs.backoff != 0)||(cs.framesCompressed != 1)||(cs.framesSkipped != 1)||(cs.bytesIn != 1400)||(cs.bytesOut != 600)) {
+			std::cout << "FAILED (stats wrong after compressing)" << std::endl;
+			return -1;
+		}
+		// Each failure skips twice as many frames as the last, up to the limit
+		for(unsigned int expect=1;expect<=ZT_PEER_COMPRESSION_MAX_BACKOFF;expect*=2) {
+			peer->frameCompressed(1400,0);
+			for(unsigned int k=0;k<expect;++k) {
+				if (peer->shouldCompressFrame(text,1400)) {
+					std::cout << "FAILED (not backing off)" << std::endl;
+					return -1;
+				}
+			}
+			if (!peer->shouldCompressFrame(text,1400)) {
+				std::cout << "FAILED (backed off too long)" << std::endl;
+				return -1;
+			}
+		}
+		peer->frameCompressed(1400,0);
+		peer->compressionStats(cs);
+		if (cs.backoff != ZT_PEER_COMPRESSION_MAX_BACKOFF) {
+			std::cout << "FAILED (backoff " << cs.backoff << " exceeds limit)" << std::endl;
+			return -1;
+		}
+		peer->frameCompressed(1400,1399); // too little gain still counts as incompressible
+		for(unsigned int k=0;k<ZT_PEER_COMPRESSION_MAX_BACKOFF;++k)
+			peer->shouldCompressFrame(text,1400);
+		peer->frameCompressed(1400,700);
+		peer->compressionStats(cs);
+		if (cs.backoff != 0) {
+			std::cout << "FAILED (backoff not reset)" << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+	if (!testBenchmarks)
+		return 0;
+
+	// Compare what compressing every frame (the old behavior) costs against the adaptive path
+	static const char *const kinds[3] = { "text","random","mixed" };
+	for(unsigned int kind=0;kind<3;++kind) {
+		std::cout << "[compression] Benchmarking 1400 byte " << kinds[kind] << " frames... "; std::cout.flush();
+		const SharedPtr<Peer> p(testTxQueuePeer(rr,topology,Address(0x0200000000ULL + kind)));
+		uint64_t alwaysBytes = 0,adaptiveBytes = 0;
+		int64_t alwaysTime = 0,adaptiveTime = 0;
+		Packet outp(p->address(),rr.identity.address(),Packet::VERB_FRAME);
+		outp.append((uint64_t)0x8056c2e21c000001ULL);
+		outp.append((uint16_t)0x0800);
+		const unsigned int headerLen = outp.size();
+		for(unsigned int pass=0;pass<2;++pass) {
+			const int64_t start = OSUtils::now();
+			for(unsigned int k=0;k<ZT_TEST_COMPRESSION_FRAMES;++k) {
+				const uint8_t *const data = ((kind == 1)||((kind == 2)&&(k & 1))) ? junk : text;
+				const uint8_t *const frame = data + ((k * 61) % (sizeof(text) - 1400));
+				outp.setSize(headerLen);
+				outp[ZT_PACKET_IDX_VERB] = (uint8_t)Packet::VERB_FRAME;
+				if (pass) {
+					const unsigned int payloadLen = (outp.size() - ZT_PACKET_IDX_PAYLOAD) + 1400;
+					memcpy(outp.appendStaged(1400),frame,1400);
+					const bool tryCompress = p->shouldCompressFrame(frame,1400);
+					const unsigned int cl = outp.finishStaged(1400,tryCompress);
+					if (tryCompress)
+						p->frameCompressed(payloadLen,cl);
+					adaptiveBytes += outp.size();
+				} else {
+					outp.append(frame,1400);
+					outp.compress();
+					alwaysBytes += outp.size();
+				}
+			}
+			((pass) ? adaptiveTime : alwaysTime) = OSUtils::now() - start;
+		}
+		ZT_PeerCompressionStats cs;
+		p->compressionStats(cs);
+		std::cout << "always: " << (((double)alwaysTime * 1000000.0) / (double)ZT_TEST_COMPRESSION_FRAMES) << " ns/frame, " << (alwaysBytes / ZT_TEST_COMPRESSION_FRAMES) << " bytes/frame; ";
+		std::cout << "adaptive: " << (((double)adaptiveTime * 1000000.0) / (double)ZT_TEST_COMPRESSION_FRAMES) << " ns/frame, " << (adaptiveBytes / ZT_TEST_COMPRESSION_FRAMES) << " bytes/frame (" << cs.framesCompressed << " compressed, " << cs.framesIncompressible << " incompressible, " << cs.framesSkipped << " skipped)" << std::endl;
+	}
+
+	return 0;
+}
+
+static int testIPAllocator()
+{
+	// A /16 pool holds 65536 addresses less the 256 ending in .255
+	const uint32_t first = 0x0a010000;
+	const uint32_t last = 0x0a01ffff;
+	const unsigned long capacity = 65536 - 256;
+
+	std::cout << "[controller] Testing IPAllocator by filling a /16 pool... "; std::cout.flush();
+	IPAllocator ipa;
+	ipa.insert(InetAddress("10.2.0.1/0")); // outside the pool
+	ipa.insert(InetAddress("fd00:0:0:0:0:0:0:1/0"));
+	std::vector<uint32_t> allocated;
+	uint64_t x = 0x1234;
+	uint32_t ip = 0;
+	const int64_t start = OSUtils::now();
+	while (ipa.findFreeIpv4(first,last,first + (uint32_t)((x = (x * 6364136223846793005ULL) + 1442695040888963407ULL) >> 33) % (last - first),ip)) {
+		const InetAddress ia(Utils::hton(ip),0);
+		if ((ip < first)||(ip > last)||((ip & 0xff) == 0xff)||(ipa.contains(ia))) {
+			std::cout << "FAILED! (bad or duplicate address)" << std::endl;
+			return -1;
+		}
+		ipa.insert(ia);
+		allocated.push_back(ip);
+		if (allocated.size() > capacity)
+			break;
+	}
+	const int64_t fillTime = OSUtils::now() - start;
+	std::vector<InetAddress> all;
+	ipa.list(all);
+	if ((allocated.size() != capacity)||(ipa.size() != (capacity + 2))||(all.size() != ipa.size())||(ipa.ipv4Ranges() != 257)||(!ipa.contains(InetAddress("fd00:0:0:0:0:0:0:1/0")))) {
+		std::cout << "FAILED! (pool not filled to capacity)" << std::endl;
+		return -1;
+	}
+	// Release every seventh address, then the same addresses should be found again and nothing more
+	for(unsigned long i=0;i<allocated.size();i+=7)
+		ipa.erase(InetAddress(Utils::hton(allocated[i]),0));
+	std::set<uint32_t> reallocated;
+	while (ipa.findFreeIpv4(first,last,first + (uint32_t)(reallocated.size() * 4099) % (last - first),ip)) {
+		if (!reallocated.insert(ip).second)
+			break;
+		ipa.insert(InetAddress(Utils::hton(ip),0));
+	}
+	for(unsigned long i=0;i<allocated.size();i+=7) {
+		if (!reallocated.count(allocated[i])) {
+			std::cout << "FAILED! (released address not found again)" << std::endl;
+			return -1;
+		}
+	}
+	if ((reallocated.size() != ((allocated.size() + 6) / 7))||(ipa.size() != (capacity + 2))) {
+		std::cout << "FAILED! (wrong number of addresses found again)" << std::endl;
+		return -1;
+	}
+	std::cout << "PASS" << std::endl;
+
+	if (!testBenchmarks)
+		return 0;
+
+	// Compare with probing up to 1000 consecutive addresses from the same start points, as the controller used to
+	std::cout << "[controller] Benchmarking filling a /16 pool... "; std::cout.flush();
+	std::set<uint32_t> probed;
+	unsigned long failures = 0;
+	x = 0x1234;
+	const int64_t probeStart = OSUtils::now();
+	for(unsigned long i=0;i<capacity;++i) {
+		uint32_t k = (uint32_t)((x = (x * 6364136223846793005ULL) + 1442695040888963407ULL) >> 33) % (last - first);
+		bool found = false;
+		for(unsigned int trial=0;trial<1000;++trial) {
+			const uint32_t a = first + (k++ % (last - first));
+			if (((a & 0xff) != 0xff)&&(probed.insert(a).second)) {
+				found = true;
+				break;
+			}
+		}
+		if (!found)
+			++failures;
+	}
+	const int64_t probeTime = OSUtils::now() - probeStart;
+	std::cout << "IPAllocator: " << (((double)fillTime * 1000000.0) / (double)capacity) << "ns/address, " << capacity << " assigned; probing: " << (((double)probeTime * 1000000.0) / (double)capacity) << "ns/address, " << (capacity - failures) << " assigned" << std::endl;
+
+	return 0;
+}
+
+#ifdef __UNIX_LIKE__
+
+#define ZT_TEST_CONTROLLER_MEMBERS 100000
+
+// Resident heap (anonymous) memory in KiB, or 0 where this can't be read
+static unsigned long testControllerHeapKiB()
+{
+#ifdef __LINUX__
+#ifdef __GLIBC__
+	malloc_trim(0);
+#endif
+	std::string st;
+	if (OSUtils::readFile("/proc/self/status",st)) {
+		const std::string::size_type p = st.find("RssAnon:");
+		if (p != std::string::npos)
+			return strtoul(st.c_str() + p + 8,(char **)0,10);
+	}
+#endif
+	return 0;
+}
+
+static void testControllerMember(const uint64_t nwid,const uint64_t id,nlohmann::json &m)
+{
+	char tmp[256];
+	m = nlohmann::json::object();
+	OSUtils::ztsnprintf(tmp,sizeof(tmp),"%.10llx",(unsigned long long)id);
+	m["id"] = tmp;
+	m["address"] = tmp;
+	OSUtils::ztsnprintf(tmp,sizeof(tmp),"%.16llx",(unsigned long long)nwid);
+	m["nwid"] = tmp;
+	m["objtype"] = "member";
+	m["creationTime"] = 1500000000000ULL;
+	DB::initMember(m);
+	m["authorized"] = ((id % 4) != 0);
+	m["activeBridge"] = ((id % 1000) == 0);
+	if ((id % 4) == 0)
+		m["lastDeauthorizedTime"] = 1500000000000ULL + id;
+	else m["lastAuthorizedTime"] = 1500000000000ULL + id;
+	OSUtils::ztsnprintf(tmp,sizeof(tmp),"10.%u.%u.%u",(unsigned int)((id >> 16) & 0xff),(unsigned int)((id >> 8) & 0xff),(unsigned int)(id & 0xff));
+	m["ipAssignments"].push_back(tmp);
+	std::string identity;
+	OSUtils::ztsnprintf(tmp,sizeof(tmp),"%.10llx:0:",(unsigned long long)id);
+	identity = tmp;
+	uint64_t x = id + 1;
+	for(int i=0;i<8;++i) {
+		x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+		OSUtils::ztsnprintf(tmp,sizeof(tmp),"%.16llx",(unsigned long long)x);
+		identity.append(tmp);
+	}
+	m["identity"] = identity;
+	m["vMajor"] = 1;
+	m["vMinor"] = 2;
+	m["vRev"] = 12;
+	m["vProto"] = 9;
+}
+
+static bool testControllerSummary(DB &db,const uint64_t nwid,const unsigned long total,const unsigned long authorized)
+{
+	DB::NetworkSummaryInfo ns;
+	return ((db.summary(nwid,ns))&&(ns.totalMemberCount == total)&&(ns.authorizedMemberCount == authorized)&&(ns.allocatedIps.size() == total));
+}
+
+static int testControllerDB()
+{
+	Identity myId;
+	myId.fromString(KNOWN_GOOD_IDENTITY);
+	const uint64_t nwid = (myId.address().toInt() << 24) | 1;
+	TestTempDir tmpDir("zt-selftest-controller");
+	if (tmpDir.path.empty()) {
+		std::cout << "[controller] Unable to create temporary directory, FAILED!" << std::endl;
+		return -1;
+	}
+	const std::string filePathStr(tmpDir.sub("file.d")),mappedPathStr(tmpDir.sub("mapped.d"));
+	const char *const filePath = filePathStr.c_str();
+	const char *const mappedPath = mappedPathStr.c_str();
+	char tmp[64];
+
+	nlohmann::json network;
+	OSUtils::ztsnprintf(tmp,sizeof(tmp),"%.16llx",(unsigned long long)nwid);
+	network["id"] = tmp;
+	network["nwid"] = tmp;
+	DB::initNetwork(network);
+
+	std::cout << "[controller] Testing MappedDB member store (log, compaction, torn log, reload)... "; std::cout.flush();
+	{
+		// Enough members to cross the compaction threshold once, leaving the rest in the log
+		const unsigned long count = ZT_MAPPEDDB_COMPACT_THRESHOLD + 1000;
+		unsigned long authorized = 0;
+		MappedDB *db = new MappedDB((EmbeddedNetworkController *)0,myId,mappedPath);
+		nlohmann::json n(network),m;
+		db->save((nlohmann::json *)0,n);
+		for(unsigned long i=1;i<=count;++i) {
+			testControllerMember(nwid,i,m);
+			db->save((nlohmann::json *)0,m);
+			if ((i % 4) != 0)
+				++authorized;
+		}
+		// Authorize 8 (was deauthorized), erase 9 (was authorized)
+		nlohmann::json nw2,m8,m9;
+		db->get(nwid,nw2,8,m8);
+		nlohmann::json orig8(m8);
+		m8["authorized"] = true;
+		db->save(&orig8,m8);
+		db->eraseMember(nwid,9);
+		if (!testControllerSummary(*db,nwid,count - 1,authorized)) {
+			std::cout << "FAILED! (summary after writes)" << std::endl;
+			return -1;
+		}
+
+		for(int pass=0;pass<4;++pass) {
+			if (pass == 1) {
+				// Tear the last log record as if the controller died mid-write
+				std::string log;
+				OSUtils::readFile((std::string(mappedPath) + ZT_PATH_SEPARATOR_S "members.log").c_str(),log);
+				log.append("\x00\x00\x01\x00garbage",11);
+				OSUtils::writeFile((std::string(mappedPath) + ZT_PATH_SEPARATOR_S "members.log").c_str(),log);
+			} else if (pass == 2) {
+				db->compact();
+			} else if (pass == 3) {
+				nlohmann::json orig,m10;
+				db->get(nwid,nw2,10,m10);
+				orig = m10;
+				m10["name"] = "ten";
+				db->save(&orig,m10);
+			}
+			delete db;
+			db = new MappedDB((EmbeddedNetworkController *)0,myId,mappedPath);
+
+			nlohmann::json m7,fresh7,m10;
+			std::vector<nlohmann::json> all;
+			testControllerMember(nwid,7,fresh7);
+			if ((!testControllerSummary(*db,nwid,count - 1,authorized))||(!db->get(nwid,nw2,7,m7))||(m7["identity"] != fresh7["identity"])||(!db->get(nwid,nw2,8,m8))||(!OSUtils::jsonBool(m8["authorized"],false))||(db->get(nwid,nw2,9,m9))||(!db->get(nwid,nw2,all))||(all.size() != (count - 1))) {
+				std::cout << "FAILED! (reload " << pass << ")" << std::endl;
+				return -1;
+			}
+			if ((pass == 3)&&((!db->get(nwid,nw2,10,m10))||(OSUtils::jsonString(m10["name"],"") != "ten"))) {
+				std::cout << "FAILED! (update after compaction)" << std::endl;
+				return -1;
+			}
+		}
+
+		db->eraseNetwork(nwid);
+		delete db;
+		db = new MappedDB((EmbeddedNetworkController *)0,myId,mappedPath);
+		if ((db->hasNetwork(nwid))||(db->get(nwid,nw2,7,m))) {
+			std::cout << "FAILED! (erase network)" << std::endl;
+			return -1;
+		}
+		delete db;
+	}
+	OSUtils::rmDashRf(mappedPath);
+	std::cout << "PASS" << std::endl;
+
+	// Without ZT_SELFTEST_BENCH both stores are only compared at a small size
+	const unsigned long members = (testBenchmarks) ? ZT_TEST_CONTROLLER_MEMBERS : 2000;
+	std::cout << "[controller] Testing/benchmarking " << members << " members... "; std::cout.flush();
+	{
+		int64_t saveTime[2],loadTime[2];
+		unsigned long heap[2];
+		unsigned long authorized = 0;
+		for(int t=0;t<2;++t) {
+			DB *db;
+			if (t == 0)
+				db = new FileDB((EmbeddedNetworkController *)0,myId,filePath);
+			else db = new MappedDB((EmbeddedNetworkController *)0,myId,mappedPath);
+			nlohmann::json n(network),m;
+			db->save((nlohmann::json *)0,n);
+			authorized = 0;
+			const int64_t start = OSUtils::now();
+			for(unsigned long i=1;i<=members;++i) {
+				testControllerMember(nwid,i,m);
+				db->save((nlohmann::json *)0,m);
+				if ((i % 4) != 0)
+					++authorized;
+			}
+			saveTime[t] = OSUtils::now() - start;
+			delete db;
+		}
+
+		// MappedDB first so FileDB's freed heap can't hide MappedDB's growth
+		DB *dbs[2] = { (DB *)0,(DB *)0 };
+		for(int t=1;t>=0;--t) {
+			const unsigned long heapBefore = testControllerHeapKiB();
+			const int64_t start = OSUtils::now();
+			if (t == 0)
+				dbs[t] = new FileDB((EmbeddedNetworkController *)0,myId,filePath);
+			else dbs[t] = new MappedDB((EmbeddedNetworkController *)0,myId,mappedPath);
+			loadTime[t] = OSUtils::now() - start;
+			heap[t] = testControllerHeapKiB() - heapBefore;
+		}
+
+		if ((!testControllerSummary(*dbs[0],nwid,members,authorized))||(!testControllerSummary(*dbs[1],nwid,members,authorized))) {
+			std::cout << "FAILED! (summary)" << std::endl;
+			return -1;
+		}
+		DB::NetworkSummaryInfo ns[2];
+		dbs[0]->summary(nwid,ns[0]);
+		dbs[1]->summary(nwid,ns[1]);
+		if ((ns[0].activeBridges != ns[1].activeBridges)||(ns[0].allocatedIps != ns[1].allocatedIps)||(ns[0].mostRecentDeauthTime != ns[1].mostRecentDeauthTime)) {
+			std::cout << "FAILED! (summaries differ)" << std::endl;
+			return -1;
+		}
+		int64_t getTime[2];
+		for(int t=0;t<2;++t) {
+			nlohmann::json nw2,m;
+			const int64_t start = OSUtils::now();
+			for(unsigned long i=1;i<=members;++i) {
+				if (!dbs[t]->get(nwid,nw2,i,m)) {
+					std::cout << "FAILED! (get)" << std::endl;
+					return -1;
+				}
+			}
+			getTime[t] = OSUtils::now() - start;
+		}
+		for(unsigned long i=1;i<=members;i+=97) {
+			nlohmann::json nw2,m[2];
+			dbs[0]->get(nwid,nw2,i,m[0]);
+			dbs[1]->get(nwid,nw2,i,m[1]);
+			if (m[0] != m[1]) {
+				std::cout << "FAILED! (members differ)" << std::endl;
+				return -1;
+			}
+		}
+
+		if (testBenchmarks) {
+			const char *const names[2] = { "FileDB","MappedDB" };
+			for(int t=0;t<2;++t) {
+				std::cout << ((t) ? "; " : "") << names[t] << ": save " << (((double)saveTime[t] * 1000.0) / (double)members) << "us/member, load " << loadTime[t] << "ms, heap +" << (heap[t] / 1024) << "MiB, get " << (((double)getTime[t] * 1000.0) / (double)members) << "us/member";
+			}
+			std::cout << " (members.db " << (OSUtils::getFileSize((std::string(mappedPath) + ZT_PATH_SEPARATOR_S "members.db").c_str()) / 1048576) << "MiB)" << std::endl;
+		} else std::cout << "PASS" << std::endl;
+
+		delete dbs[0];
+		delete dbs[1];
+	}
+
+	return 0;
+}
+
+#define ZT_TEST_CONTROLLER_CONFIG_MEMBERS 512
+
+class TestControllerSender : public NetworkController::Sender
+{
+public:
+	TestControllerSender(const Identity &id) : signingId(id),configs(0),errors(0) {}
+	~TestControllerSender()
+	{
+		for(std::map< uint64_t,NetworkConfig * >::iterator k(kept.begin());k!=kept.end();++k)
+			delete k->second;
+	}
+
+	virtual void ncSendConfig(uint64_t nwid,uint64_t requestPacketId,const Address &destination,const NetworkConfig &nc,bool sendLegacyFormatConfig)
+	{
+		// Serialize and sign like Node does for a config that fits in one chunk, then keep
+		// it without its timestamp so configs can be compared across requests
+		Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> *const d = new Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY>();
+		if (nc.toDictionary(*d,sendLegacyFormatConfig))
+			signingId.sign(d->data(),d->sizeBytes());
+		std::string c(d->data(),d->sizeBytes());
+		const std::string::size_type ts = c.find("\n" ZT_NETWORKCONFIG_DICT_KEY_TIMESTAMP "=");
+		if (ts != std::string::npos)
+			c.erase(ts,c.find('\n',ts + 1) - ts);
+		{
+			Mutex::Lock _l(lock);
+			last[destination.toInt()] = c;
+			lastTimestamp[destination.toInt()] = nc.timestamp;
+			std::map< uint64_t,NetworkConfig * >::iterator k(kept.find(destination.toInt()));
+			if (k != kept.end()) {
+				if (!k->second)
+					k->second = new NetworkConfig();
+				*(k->second) = nc;
+			}
+		}
+		delete d;
+		++configs;
+	}
+	virtual void ncSendRevocation(const Address &destination,const Revocation &rev) {}
+	virtual void ncSendError(uint64_t nwid,uint64_t requestPacketId,const Address &destination,NetworkController::ErrorCode errorCode) { ++errors; }
+
+	const Identity &signingId;
+	std::map< uint64_t,std::string > last;
+	std::map< uint64_t,int64_t > lastTimestamp;
+	std::map< uint64_t,NetworkConfig * > kept; // whole configs are kept for addresses added here (with NULL)
+	Mutex lock;
+	std::atomic<unsigned long> configs;
+	std::atomic<unsigned long> errors;
+};
+
+static bool testControllerConfigCachePost(EmbeddedNetworkController &c,const std::vector<std::string> &path,const char *body)
+{
+	std::map<std::string,std::string> urlArgs,headers;
+	std::string responseBody,responseContentType;
+	return (c.handleControlPlaneHttpPOST(path,urlArgs,headers,std::string(body),responseBody,responseContentType) == 200);
+}
+
+// Returns milliseconds taken or -1 on failure or timeout
+static int64_t testControllerConfigCacheRequests(EmbeddedNetworkController &c,TestControllerSender &sender,const uint64_t nwid,const std::vector<Identity> &ids,const Dictionary<ZT_NETWORKCONFIG_METADATA_DICT_CAPACITY> &metaData)
+{
+	const unsigned long expect = sender.configs + (unsigned long)ids.size();
+	const int64_t start = OSUtils::now();
+	for(std::vector<Identity>::const_iterator id(ids.begin());id!=ids.end();++id)
+		c.request(nwid,InetAddress(),0,*id,metaData);
+	while (sender.configs < expect) {
+		if ((sender.errors)||((OSUtils::now() - start) > 60000))
+			return -1;
+		Thread::sleep(1);
+	}
+	return OSUtils::now() - start;
+}
+
+static bool testControllerConfigCacheStats(EmbeddedNetworkController &c,const uint64_t hits,const uint64_t misses)
+{
+	std::vector<std::string> path;
+	std::map<std::string,std::string> urlArgs,headers;
+	std::string responseBody,responseContentType;
+	c.handleControlPlaneHttpGET(path,urlArgs,headers,std::string(),responseBody,responseContentType);
+	nlohmann::json st(OSUtils::jsonParse(responseBody));
+	return ((OSUtils::jsonInt(st["configCacheHits"],~0ULL) == hits)&&(OSUtils::jsonInt(st["configCacheMisses"],~0ULL) == misses));
+}
+
+// True if a member with config 'receiver' would accept the credentials in 'sender' (timestamp checks of Membership)
+template<typename C>
+static bool testControllerCredentialTimestampValid(const NetworkConfig &receiver,const C &cred)
+{
+	const int64_t ts = cred.timestamp();
+	return (((ts >= receiver.timestamp) ? (ts - receiver.timestamp) : (receiver.timestamp - ts)) <= receiver.credentialTimeMaxDelta);
+}
+static bool testControllerCredentialsAccepted(const NetworkConfig &receiver,const NetworkConfig &sender)
+{
+	if (!receiver.com.agreesWith(sender.com))
+		return false;
+	for(unsigned int i=0;i<sender.capabilityCount;++i) {
+		if (!testControllerCredentialTimestampValid(receiver,sender.capabilities[i]))
+			return false;
+	}
+	for(unsigned int i=0;i<sender.tagCount;++i) {
+		if (!testControllerCredentialTimestampValid(receiver,sender.tags[i]))
+			return false;
+	}
+	for(unsigned int i=0;i<sender.certificateOfOwnershipCount;++i) {
+		if (!testControllerCredentialTimestampValid(receiver,sender.certificatesOfOwnership[i]))
+			return false;
+	}
+	return true;
+}
+
+static int testControllerConfigCache()
+{
+	Identity myId;
+	myId.fromString(KNOWN_GOOD_IDENTITY);
+	const uint64_t nwid = (myId.address().toInt() << 24) | 2;
+	const char *const dbPath = "selftest-controller-cache.d";
+	const unsigned long n = (testBenchmarks) ? ZT_TEST_CONTROLLER_CONFIG_MEMBERS : 64;
+	char tmp[64];
+	OSUtils::rmDashRf(dbPath);
+
+	// Member identities only need to parse since the controller does not validate them
+	std::vector<Identity> ids;
+	for(unsigned long i=1;i<=n;++i) {
+		nlohmann::json m;
+		testControllerMember(nwid,i,m);
+		ids.push_back(Identity(OSUtils::jsonString(m["identity"],"").c_str()));
+	}
+
+	Dictionary<ZT_NETWORKCONFIG_METADATA_DICT_CAPACITY> metaData;
+	metaData.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_VERSION,(uint64_t)ZT_NETWORKCONFIG_VERSION);
+	metaData.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_RULES_ENGINE_REV,(uint64_t)ZT_RULES_ENGINE_REVISION);
+
+	TestControllerSender sender(myId);
+	sender.kept[ids[0].address().toInt()] = (NetworkConfig *)0;
+	sender.kept[ids[1].address().toInt()] = (NetworkConfig *)0;
+	EmbeddedNetworkController *c = new EmbeddedNetworkController((Node *)0,dbPath);
+	c->init(myId,&sender);
+
+	// A private network with auto-assigned IPv4 addresses, two capabilities and two default tags (default
+	// capabilities only go to members created by their first request, so members here are given both)
+	std::vector<std::string> path;
+	path.push_back("network");
+	OSUtils::ztsnprintf(tmp,sizeof(tmp),"%.16llx",(unsigned long long)nwid);
+	path.push_back(tmp);
+	bool ok = testControllerConfigCachePost(*c,path,
+		"{\"name\":\"cache\",\"private\":true,\"v4AssignMode\":{\"zt\":true},"
+		"\"routes\":[{\"target\":\"10.99.0.0/16\"}],\"ipAssignmentPools\":[{\"ipRangeStart\":\"10.99.0.1\",\"ipRangeEnd\":\"10.99.255.254\"}],"
+		"\"rules\":[{\"type\":\"ACTION_ACCEPT\"}],"
+		"\"capabilities\":[{\"id\":1,\"default\":true,\"rules\":[{\"type\":\"ACTION_ACCEPT\"}]},{\"id\":2,\"default\":true,\"rules\":[{\"type\":\"ACTION_DROP\"}]}],"
+		"\"tags\":[{\"id\":10,\"default\":1},{\"id\":11,\"default\":2}]}");
+	path.push_back("member");
+	path.push_back(std::string());
+	for(unsigned long i=0;i<n;++i) {
+		path[3] = ids[i].address().toString(tmp);
+		ok &= testControllerConfigCachePost(*c,path,"{\"authorized\":true,\"capabilities\":[1,2]}");
+	}
+
+	int64_t built = -1,cached = -1;
+	std::cout << "[controller] Testing cached network configs (reuse, credential agreement, member and network invalidation)... "; std::cout.flush();
+	if (ok) {
+		// First requests build and sign, repeats resend what was signed with a new timestamp
+		ok = (testControllerConfigCacheRequests(*c,sender,nwid,ids,metaData) >= 0);
+		const std::map< uint64_t,std::string > first(sender.last);
+		const std::map< uint64_t,int64_t > firstTimestamp(sender.lastTimestamp);
+		Thread::sleep(2);
+		cached = testControllerConfigCacheRequests(*c,sender,nwid,ids,metaData);
+		ok &= ((cached >= 0)&&(testControllerConfigCacheStats(*c,n,n))&&(sender.last == first));
+		for(unsigned long i=0;i<n;++i)
+			ok &= (sender.lastTimestamp[ids[i].address().toInt()] > firstTimestamp.find(ids[i].address().toInt())->second);
+
+		if (ok) {
+			// Changing a member rebuilds only that member's config
+			path[3] = ids[0].address().toString(tmp);
+			ok = testControllerConfigCachePost(*c,path,"{\"tags\":[[10,5],[11,2]]}");
+			ok &= (testControllerConfigCacheRequests(*c,sender,nwid,ids,metaData) >= 0);
+			ok &= ((testControllerConfigCacheStats(*c,(n * 2) - 1,n + 1))&&(sender.last[ids[0].address().toInt()] != first.find(ids[0].address().toInt())->second));
+			for(unsigned long i=1;i<n;++i)
+				ok &= (sender.last[ids[i].address().toInt()] == first.find(ids[i].address().toInt())->second);
+		}
+		if (ok) {
+			// Member 0 now has freshly signed credentials while member 1 was resent its cached config,
+			// whose COM, capabilities and tags keep their old timestamps under a new config timestamp.
+			// Each must still accept the other's credentials.
+			Mutex::Lock _l(sender.lock);
+			const NetworkConfig *const fresh = sender.kept[ids[0].address().toInt()];
+			const NetworkConfig *const reused = sender.kept[ids[1].address().toInt()];
+			ok = ((fresh)&&(reused)&&(reused->com.timestamp() < reused->timestamp)&&(reused->tagCount == 2)&&(reused->capabilityCount == 2));
+			ok = ((ok)&&(testControllerCredentialsAccepted(*fresh,*reused))&&(testControllerCredentialsAccepted(*reused,*fresh)));
+		}
+		if (ok) {
+			// Changing the network rebuilds everyone's (and unlike the first requests this saves no member changes)
+			path.resize(2);
+			ok = testControllerConfigCachePost(*c,path,"{\"name\":\"cache2\"}");
+			built = testControllerConfigCacheRequests(*c,sender,nwid,ids,metaData);
+			ok &= (built >= 0);
+			ok &= testControllerConfigCacheStats(*c,(n * 2) - 1,(n * 2) + 1);
+			for(unsigned long i=1;i<n;++i)
+				ok &= (sender.last[ids[i].address().toInt()] != first.find(ids[i].address().toInt())->second);
+		}
+	}
+	delete c;
+	OSUtils::rmDashRf(dbPath);
+	if (!ok) {
+		std::cout << "FAILED!" << std::endl;
+		return -1;
+	}
+	std::cout << "PASS" << std::endl;
+
+	if (testBenchmarks)
+		std::cout << "[controller] Benchmarking config requests from " << n << " members... built and signed: " << ((double)built / (double)n) << "ms/request, cached: " << ((double)cached / (double)n) << "ms/request" << std::endl;
+
+	return 0;
+}
+
+#define ZT_TEST_CONTROLLER_LOAD_REQUESTS 4096
+
+// Returns requests/second or -1.0 on failure or timeout
+static double testControllerLoadRound(EmbeddedNetworkController &c,TestControllerSender &sender,const std::vector<uint64_t> &nwids,const std::vector<Identity> &ids,const Dictionary<ZT_NETWORKCONFIG_METADATA_DICT_CAPACITY> &metaData,uint64_t &packetId)
+{
+	// Requests arrive interleaved across networks the way they would from many nodes at once
+	const unsigned long total = (unsigned long)(nwids.size() * ids.size());
+	const unsigned long expect = sender.configs + total;
+	const int64_t start = OSUtils::now();
+	for(std::vector<Identity>::const_iterator id(ids.begin());id!=ids.end();++id) {
+		for(std::vector<uint64_t>::const_iterator nwid(nwids.begin());nwid!=nwids.end();++nwid)
+			c.request(*nwid,InetAddress(),++packetId,*id,metaData);
+	}
+	while (sender.configs < expect) {
+		if ((sender.errors)||((OSUtils::now() - start) > 120000))
+			return -1.0;
+		Thread::sleep(1);
+	}
+	return ((double)total / ((double)std::max(OSUtils::now() - start,(int64_t)1) / 1000.0));
+}
+
+// Replays synthetic config requests from new members joining and then refreshing, spread over some number of networks
+static bool testControllerLoad(const Identity &myId,const unsigned long requests,const unsigned long networkCount,double &join,double &refresh)
+{
+	const char *const dbPath = "selftest-controller-load.d";
+	const unsigned long n = requests / networkCount;
+	char tmp[256];
+	OSUtils::rmDashRf(dbPath);
+
+	std::vector<Identity> ids;
+	for(unsigned long i=1;i<=n;++i) {
+		nlohmann::json m;
+		testControllerMember(0,i,m);
+		ids.push_back(Identity(OSUtils::jsonString(m["identity"],"").c_str()));
+	}
+
+	Dictionary<ZT_NETWORKCONFIG_METADATA_DICT_CAPACITY> metaData;
+	metaData.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_VERSION,(uint64_t)ZT_NETWORKCONFIG_VERSION);
+	metaData.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_RULES_ENGINE_REV,(uint64_t)ZT_RULES_ENGINE_REVISION);
+
+	TestControllerSender sender(myId);
+	EmbeddedNetworkController *c = new EmbeddedNetworkController((Node *)0,dbPath);
+	c->init(myId,&sender);
+
+	// Public networks so members are added on their first request, each with its own IPv4 pool
+	bool ok = true;
+	std::vector<uint64_t> nwids;
+	std::vector<std::string> path;
+	path.push_back("network");
+	path.push_back(std::string());
+	for(unsigned long k=0;k<networkCount;++k) {
+		nwids.push_back((myId.address().toInt() << 24) | (0x100 + k));
+		OSUtils::ztsnprintf(tmp,sizeof(tmp),"%.16llx",(unsigned long long)nwids.back());
+		path[1] = tmp;
+		OSUtils::ztsnprintf(tmp,sizeof(tmp),
+			"{\"name\":\"load\",\"private\":false,\"v4AssignMode\":{\"zt\":true},"
+			"\"routes\":[{\"target\":\"10.%lu.0.0/16\"}],\"ipAssignmentPools\":[{\"ipRangeStart\":\"10.%lu.0.1\",\"ipRangeEnd\":\"10.%lu.255.254\"}],"
+			"\"rules\":[{\"type\":\"ACTION_ACCEPT\"}]}",k,k,k);
+		ok &= testControllerConfigCachePost(*c,path,tmp);
+	}
+
+	uint64_t packetId = 0;
+	join = refresh = -1.0;
+	if (ok) {
+		join = testControllerLoadRound(*c,sender,nwids,ids,metaData,packetId);
+		Thread::sleep(1100); // the controller ignores genuine requests from a member more often than once a second
+		refresh = testControllerLoadRound(*c,sender,nwids,ids,metaData,packetId);
+		ok = ((join > 0.0)&&(refresh > 0.0));
+	}
+	if (ok) {
+		// Changing one network should push new configs to its online members and no one else's
+		const unsigned long expect = sender.configs + n;
+		OSUtils::ztsnprintf(tmp,sizeof(tmp),"%.16llx",(unsigned long long)nwids[0]);
+		path[1] = tmp;
+		ok = testControllerConfigCachePost(*c,path,"{\"name\":\"load2\"}");
+		const int64_t start = OSUtils::now();
+		while ((ok)&&(sender.configs < expect)) {
+			if ((sender.errors)||((OSUtils::now() - start) > 60000))
+				ok = false;
+			Thread::sleep(1);
+		}
+		Thread::sleep(100);
+		ok &= ((sender.configs == expect)&&(!sender.errors));
+	}
+
+	delete c;
+	OSUtils::rmDashRf(dbPath);
+	return ok;
+}
+
+static int testControllerLoad()
+{
+	Identity myId;
+	myId.fromString(KNOWN_GOOD_IDENTITY);
+	double join1 = 0.0,refresh1 = 0.0,joinN = 0.0,refreshN = 0.0;
+	const unsigned long requests = (testBenchmarks) ? ZT_TEST_CONTROLLER_LOAD_REQUESTS : 256;
+
+	std::cout << "[controller] Testing " << requests << " synthetic config requests in 1 and 16 networks... "; std::cout.flush();
+	if ((!testControllerLoad(myId,requests,1,join1,refresh1))||(!testControllerLoad(myId,requests,16,joinN,refreshN))) {
+		std::cout << "FAILED!" << std::endl;
+		return -1;
+	}
+	std::cout << "PASS" << std::endl;
+
+	if (testBenchmarks)
+		std::cout << "[controller] Benchmarking synthetic config requests with " << std::max(std::thread::hardware_concurrency(),1U) << " workers... 1 network: join " << join1 << "/second, refresh " << refresh1 << "/second; 16 networks: join " << joinN << "/second, refresh " << refreshN << "/second" << std::endl;
+
+	return 0;
+}
+
+#endif // __UNIX_LIKE__
+
+#ifdef __LINUX__
+#define ZT_TEST_TAP_MTU 1500
+#define ZT_TEST_TAP_MSS 1000
+#define ZT_TEST_TAP_PAYLOAD 4500
+#define ZT_TEST_TAP_BENCH_FRAMES 20000
+
+static void testTapOffloadHandler(void *arg,const uint8_t *frame,unsigned int len)
+{
+	reinterpret_cast< std::vector<std::string> * >(arg)->push_back(std::string(reinterpret_cast<const char *>(frame),len));
+}
+static void testTapOffloadNullHandler(void *arg,const uint8_t *frame,unsigned int len)
+{
+	*reinterpret_cast<unsigned long *>(arg) += len;
+}
+static unsigned int testTapOffloadSum(const uint8_t *p,unsigned int len,uint64_t sum)
+{
+	for(unsigned int i=0;i<len;i+=2)
+		sum += ((uint64_t)p[i] << 8) | (uint64_t)(((i + 1) < len) ? p[i + 1] : 0);
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return (unsigned int)sum;
+}
+// Builds virtio header + Ethernet + IP + TCP/UDP header + payload, returns length
+static unsigned int testTapOffloadFrame(uint8_t *f,bool v6,bool udp,const uint8_t *payload,unsigned int plen)
+{
+	memset(f,0,128);
+	const unsigned int l3 = 10 + 14;
+	const unsigned int l4 = l3 + ((v6) ? 40 : 20);
+	const unsigned int l4hlen = (udp) ? 8 : 20;
+	f[0] = 1; // NEEDS_CSUM
+	f[1] = (udp) ? 3 : ((v6) ? 4 : 1);
+	const uint16_t gsoSize = ZT_TEST_TAP_MSS,csumStart = (uint16_t)(l4 - 10),csumOffset = (udp) ? 6 : 16;
+	memcpy(f + 4,&gsoSize,2);
+	memcpy(f + 6,&csumStart,2);
+	memcpy(f + 8,&csumOffset,2);
+	f[10 + 12] = (v6) ? 0x86 : 0x08;
+	f[10 + 13] = (v6) ? 0xdd : 0x00;
+	const unsigned int l4len = l4hlen + plen;
+	uint64_t pseudo = (udp ? 17 : 6) + l4len;
+	if (v6) {
+		f[l3] = 0x60;
+		f[l3 + 4] = (uint8_t)(l4len >> 8); f[l3 + 5] = (uint8_t)l4len;
+		f[l3 + 6] = (udp) ? 17 : 6;
+		f[l3 + 7] = 64;
+		for(int i=0;i<32;++i) f[l3 + 8 + i] = (uint8_t)(0xfd + i);
+		pseudo += testTapOffloadSum(f + l3 + 8,32,0);
+	} else {
+		f[l3] = 0x45;
+		f[l3 + 2] = (uint8_t)((20 + l4len) >> 8); f[l3 + 3] = (uint8_t)(20 + l4len);
+		f[l3 + 4] = 0x12; f[l3 + 5] = 0x34;
+		f[l3 + 6] = 0x40; // DF
+		f[l3 + 8] = 64;
+		f[l3 + 9] = (udp) ? 17 : 6;
+		f[l3 + 12] = 10; f[l3 + 15] = 1;
+		f[l3 + 16] = 10; f[l3 + 19] = 2;
+		pseudo += testTapOffloadSum(f + l3 + 12,8,0);
+	}
+	f[l4] = 0x12; f[l4 + 1] = 0x34; f[l4 + 2] = 0x56; f[l4 + 3] = 0x78;
+	if (udp) {
+		f[l4 + 4] = (uint8_t)(l4len >> 8); f[l4 + 5] = (uint8_t)l4len;
+	} else {
+		f[l4 + 4] = 0xff; f[l4 + 5] = 0xff; f[l4 + 6] = 0xfe; f[l4 + 7] = 0x00; // sequence wraps mid-frame
+		f[l4 + 12] = 0x50;
+		f[l4 + 13] = 0x80 | 0x10 | 0x08 | 0x01; // CWR ACK PSH FIN
+	}
+	const unsigned int ps = testTapOffloadSum((const uint8_t *)0,0,pseudo); // kernel leaves pseudo-header sum in checksum field
+	f[l4 + csumOffset] = (uint8_t)(ps >> 8);
+	f[l4 + csumOffset + 1] = (uint8_t)ps;
+	memcpy(f + l4 + l4hlen,payload,plen);
+	return l4 + l4hlen + plen;
+}
+
+static int testTapOffload()
+{
+	static uint8_t payload[65536];
+	static uint8_t frame[65536 + 256];
+	static uint8_t buf[ZT_MAX_MTU + 64];
+	for(unsigned int i=0;i<sizeof(payload);++i)
+		payload[i] = (uint8_t)rand();
+
+	for(int v6=0;v6<2;++v6) {
+		std::cout << "[tap] Testing TSO segmentation (IPv" << ((v6) ? 6 : 4) << ")... "; std::cout.flush();
+		std::vector<std::string> segs;
+		const unsigned int len = testTapOffloadFrame(frame,v6 != 0,false,payload,ZT_TEST_TAP_PAYLOAD);
+		const unsigned int n = LinuxEthernetTap::segment(frame,len,ZT_TEST_TAP_MTU,buf,&testTapOffloadHandler,&segs);
+		if ((n != ((ZT_TEST_TAP_PAYLOAD + ZT_TEST_TAP_MSS - 1) / ZT_TEST_TAP_MSS))||(segs.size() != n)) {
+			std::cout << "FAIL (1)" << std::endl;
+			return -1;
+		}
+		std::string data;
+		for(unsigned int k=0;k<n;++k) {
+			const uint8_t *const f = reinterpret_cast<const uint8_t *>(segs[k].data());
+			const unsigned int l4 = 14 + ((v6) ? 40 : 20);
+			const unsigned int tcpLen = (unsigned int)segs[k].size() - l4;
+			uint64_t pseudo = 6 + tcpLen;
+			if (v6) {
+				if ((((unsigned int)f[18] << 8) | f[19]) != tcpLen) {
+					std::cout << "FAIL (2)" << std::endl;
+					return -1;
+				}
+				pseudo += testTapOffloadSum(f + 22,32,0);
+			} else {
+				if (((((unsigned int)f[16] << 8) | f[17]) != (tcpLen + 20))||((((unsigned int)f[18] << 8) | f[19]) != (0x1234 + k))||(testTapOffloadSum(f + 14,20,0) != 0xffff)) {
+					std::cout << "FAIL (2)" << std::endl;
+					return -1;
+				}
+				pseudo += testTapOffloadSum(f + 26,8,0);
+			}
+			const uint32_t seq = ((uint32_t)f[l4 + 4] << 24) | ((uint32_t)f[l4 + 5] << 16) | ((uint32_t)f[l4 + 6] << 8) | (uint32_t)f[l4 + 7];
+			const bool last = (k == (n - 1));
+			if ((seq != (0xfffffe00U + (uint32_t)data.size()))||((segs[k].size() - 14) > ZT_TEST_TAP_MTU)||(testTapOffloadSum(f + l4,tcpLen,pseudo) != 0xffff)) {
+				std::cout << "FAIL (3)" << std::endl;
+				return -1;
+			}
+			if ((((f[l4 + 13] & 0x09) != 0) != last)||(((f[l4 + 13] & 0x80) != 0) != (k == 0))||((f[l4 + 13] & 0x10) == 0)) {
+				std::cout << "FAIL (4)" << std::endl;
+				return -1;
+			}
+			data.append(segs[k].data() + l4 + 20,tcpLen - 20);
+		}
+		if ((data.size() != ZT_TEST_TAP_PAYLOAD)||(memcmp(data.data(),payload,ZT_TEST_TAP_PAYLOAD))) {
+			std::cout << "FAIL (5)" << std::endl;
+			return -1;
+		}
+		std::cout << "PASS (" << n << " segments)" << std::endl;
+	}
+
+	std::cout << "[tap] Testing UFO fragmentation and checksum offload (IPv4)... "; std::cout.flush();
+	{
+		std::vector<std::string> frags;
+		const unsigned int len = testTapOffloadFrame(frame,false,true,payload,ZT_TEST_TAP_PAYLOAD);
+		const unsigned int n = LinuxEthernetTap::segment(frame,len,ZT_TEST_TAP_MTU,buf,&testTapOffloadHandler,&frags);
+		std::string dgram;
+		for(unsigned int k=0;k<n;++k) {
+			const uint8_t *const f = reinterpret_cast<const uint8_t *>(frags[k].data());
+			const unsigned int fo = ((unsigned int)f[20] << 8) | f[21];
+			if (((fo & 0x1fff) * 8 != dgram.size())||(((fo & 0x2000) != 0) != (k != (n - 1)))||(fo & 0x4000)||((frags[k].size() - 14) > ZT_TEST_TAP_MTU)||(testTapOffloadSum(f + 14,20,0) != 0xffff)) {
+				std::cout << "FAIL (1)" << std::endl;
+				return -1;
+			}
+			dgram.append(frags[k].data() + 34,frags[k].size() - 34);
+		}
+		const uint8_t *const f = reinterpret_cast<const uint8_t *>(frags[0].data());
+		const uint64_t pseudo = 17 + dgram.size() + testTapOffloadSum(f + 26,8,0);
+		if ((n < 2)||(dgram.size() != (8 + ZT_TEST_TAP_PAYLOAD))||(testTapOffloadSum(reinterpret_cast<const uint8_t *>(dgram.data()),(unsigned int)dgram.size(),pseudo) != 0xffff)||(memcmp(dgram.data() + 8,payload,ZT_TEST_TAP_PAYLOAD))) {
+			std::cout << "FAIL (2)" << std::endl;
+			return -1;
+		}
+		std::cout << "PASS (" << n << " fragments)" << std::endl;
+	}
+
+	if (!testBenchmarks)
+		return 0;
+
+	std::cout << "[tap] Benchmarking TSO segmentation of 64KiB frames... "; std::cout.flush();
+	{
+		const unsigned int plen = 65535 - 40;
+		unsigned long bytes = 0;
+		const unsigned int len = testTapOffloadFrame(frame,false,false,payload,plen); // TCP super-frames are not modified
+		const uint64_t st = OSUtils::now();
+		for(unsigned int k=0;k<ZT_TEST_TAP_BENCH_FRAMES;++k)
+			LinuxEthernetTap::segment(frame,len,ZT_TEST_TAP_MTU,buf,&testTapOffloadNullHandler,&bytes);
+		const uint64_t et = OSUtils::now();
+		std::cout << ((double)bytes * 8.0 / ((double)(et - st) / 1000.0) / 1000000000.0) << " Gbit/s" << std::endl;
+	}
+
+	return 0;
+}
+#endif // __LINUX__
+
+#define ZT_TEST_PHY_NUM_UDP_PACKETS 10000
+#define ZT_TEST_PHY_UDP_PACKET_SIZE 1000
+#define ZT_TEST_PHY_NUM_VALID_TCP_CONNECTS 10
+#define ZT_TEST_PHY_NUM_INVALID_TCP_CONNECTS 2
+#define ZT_TEST_PHY_TCP_MESSAGE_SIZE 1000000
+#define ZT_TEST_PHY_TIMEOUT_MS 20000
+#define ZT_TEST_PHY_NUM_IDLE_TCP_CONNECTS 1500
+static unsigned long phyTestUdpPacketCount = 0;
+static unsigned long phyTestTcpByteCount = 0;
+static unsigned long phyTestTcpConnectSuccessCount = 0;
+static unsigned long phyTestTcpConnectFailCount = 0;
+static unsigned long phyTestTcpAcceptCount = 0;
+static bool phyTestIdleConnections = false;
+static unsigned long phyTestUdpEchoCount = 0;
+struct TestPhyHandlers;
+static Phy<TestPhyHandlers *> *testPhyInstance = (Phy<TestPhyHandlers *> *)0;
+struct TestPhyHandlers
+{
+	inline void phyOnDatagram(PhySocket *sock,void **uptr,const struct sockaddr *localAddr,const struct sockaddr *from,void *data,unsigned long len)
+	{
+		++phyTestUdpPacketCount;
+		if (reinterpret_cast<unsigned char *>(data)[0] == 0x01) {
+			// Echo request, answer from inside the handler so the reply can be batched
+			reinterpret_cast<unsigned char *>(data)[0] = 0x02;
+			testPhyInstance->udpSendBatched(sock,from,data,len);
+		} else if (reinterpret_cast<unsigned char *>(data)[0] == 0x02) {
+			++phyTestUdpEchoCount;
+		}
+	}
+
+	inline void phyOnTcpConnect(PhySocket *sock,void **uptr,bool success)
+	{
+		if (success) {
+			++phyTestTcpConnectSuccessCount;
+		} else {
+			++phyTestTcpConnectFailCount;
+		}
+	}
+
+	inline void phyOnTcpAccept(PhySocket *sockL,PhySocket *sockN,void **uptrL,void **uptrN,const struct sockaddr *from)
+	{
+		++phyTestTcpAcceptCount;
+		if (phyTestIdleConnections)
+			return;
+		*uptrN = new std::string(ZT_TEST_PHY_TCP_MESSAGE_SIZE,(char)0xff);
+		testPhyInstance->setNotifyWritable(sockN,true);
+	}
+
+	inline void phyOnTcpClose(PhySocket *sock,void **uptr)
+	{
+		delete (std::string *)*uptr; // delete testMessage if any
+	}
+
+	inline void phyOnTcpData(PhySocket *sock,void **uptr,void *data,unsigned long len)
+	{
+		phyTestTcpByteCount += len;
+	}
+
+	inline void phyOnTcpWritable(PhySocket *sock,void **uptr)
+	{
+		std::string *testMessage = (std::string *)*uptr;
+		if ((testMessage)&&(testMessage->length() > 0)) {
+			long sent = testPhyInstance->streamSend(sock,(const void *)testMessage->data(),(unsigned long)testMessage->length(),true);
+			if (sent > 0)
+				testMessage->erase(0,sent);
+		}
+		if ((!testMessage)||(!testMessage->length())) {
+			testPhyInstance->close(sock,true);
+		}
+	}
+
+#ifdef __UNIX_LIKE__
+	inline void phyOnUnixAccept(PhySocket *sockL,PhySocket *sockN,void **uptrL,void **uptrN) {}
+	inline void phyOnUnixClose(PhySocket *sock,void **uptr) {}
+	inline void phyOnUnixData(PhySocket *sock,void **uptr,void *data,unsigned long len) {}
+	inline void phyOnUnixWritable(PhySocket *sock,void **uptr,bool b) {}
+#endif // __UNIX_LIKE__
+
+	inline void phyOnFileDescriptorActivity(PhySocket *sock,void **uptr,bool readable,bool writable) {}
+};
+static int testPhy()
+{
+	char udpTestPayload[ZT_TEST_PHY_UDP_PACKET_SIZE];
+	memset(udpTestPayload,0xff,sizeof(udpTestPayload));
 
 	struct sockaddr_in bindaddr;
 	memset(&bindaddr,0,sizeof(bindaddr));
@@ -1046,7 +3497,7 @@ static int testPhy()
 
 	std::cout << "[phy] Testing UDP send/receive... "; std::cout.flush();
 	uint64_t timeoutAt = OSUtils::now() + ZT_TEST_PHY_TIMEOUT_MS;
-	while ((OSUtils::now() < timeoutAt)&&(phyTestUdpPacketCount < ZT_TEST_PHY_NUM_UDP_PACKETS)) {
+	while (((uint64_t)OSUtils::now() < timeoutAt)&&(phyTestUdpPacketCount < ZT_TEST_PHY_NUM_UDP_PACKETS)) {
 		if (phyTestUdpPacketsSent < ZT_TEST_PHY_NUM_UDP_PACKETS) {
 			if (!testPhyInstance->udpSend(udpListenSock,(const struct sockaddr *)&bindaddr,udpTestPayload,sizeof(udpTestPayload))) {
 				std::cout << "FAILED." << std::endl;
@@ -1057,9 +3508,30 @@ static int testPhy()
 	}
 	std::cout << "got " << phyTestUdpPacketCount << " packets, OK" << std::endl;
 
+	std::cout << "[phy] Testing UDP replies sent from handler with udpSendBatched()... "; std::cout.flush();
+	{
+		char echoPayload[ZT_TEST_PHY_UDP_PACKET_SIZE];
+		memset(echoPayload,0xff,sizeof(echoPayload));
+		echoPayload[0] = 0x01;
+		unsigned long echoSent = 0;
+		uint64_t start = OSUtils::now();
+		timeoutAt = start + ZT_TEST_PHY_TIMEOUT_MS;
+		while (((uint64_t)OSUtils::now() < timeoutAt)&&(phyTestUdpEchoCount < ZT_TEST_PHY_NUM_UDP_PACKETS)) {
+			for(int k=0;(k<16)&&(echoSent < ZT_TEST_PHY_NUM_UDP_PACKETS);++k,++echoSent)
+				testPhyInstance->udpSend(udpListenSock,(const struct sockaddr *)&bindaddr,echoPayload,sizeof(echoPayload));
+			testPhyInstance->poll(100);
+		}
+		uint64_t end = OSUtils::now();
+		if (phyTestUdpEchoCount < (ZT_TEST_PHY_NUM_UDP_PACKETS * 9) / 10) { // loopback can still drop a few under load
+			std::cout << "got " << phyTestUdpEchoCount << " replies, FAILED." << std::endl;
+			return -1;
+		}
+		std::cout << "got " << phyTestUdpEchoCount << " replies in " << (end - start) << "ms, OK" << std::endl;
+	}
+
 	std::cout << "[phy] Testing TCP... "; std::cout.flush();
 	timeoutAt = OSUtils::now() + ZT_TEST_PHY_TIMEOUT_MS;
-	while ((OSUtils::now() < timeoutAt)&&(phyTestTcpByteCount < (ZT_TEST_PHY_NUM_VALID_TCP_CONNECTS * ZT_TEST_PHY_TCP_MESSAGE_SIZE))) {
+	while (((uint64_t)OSUtils::now() < timeoutAt)&&(phyTestTcpByteCount < (ZT_TEST_PHY_NUM_VALID_TCP_CONNECTS * ZT_TEST_PHY_TCP_MESSAGE_SIZE))) {
 		if (phyTestTcpValidConnectionsAttempted < ZT_TEST_PHY_NUM_VALID_TCP_CONNECTS) {
 			++phyTestTcpValidConnectionsAttempted;
 			bool connected = false;
@@ -1081,6 +3553,52 @@ static int testPhy()
 		std::cout << "got " << phyTestTcpConnectSuccessCount << " connect successes, " << phyTestTcpConnectFailCount << " failures, and " << phyTestTcpByteCount << " bytes, OK" << std::endl;
 	}
 
+#ifdef ZT_PHY_USE_EPOLL
+	// Each idle connection is two descriptors, so this goes well past FD_SETSIZE
+	struct rlimit nofile;
+	getrlimit(RLIMIT_NOFILE,&nofile);
+	if (nofile.rlim_cur < (rlim_t)((ZT_TEST_PHY_NUM_IDLE_TCP_CONNECTS * 2) + 64)) {
+		nofile.rlim_cur = nofile.rlim_max;
+		setrlimit(RLIMIT_NOFILE,&nofile);
+	}
+	if (nofile.rlim_cur < (rlim_t)((ZT_TEST_PHY_NUM_IDLE_TCP_CONNECTS * 2) + 64)) {
+		std::cout << "[phy] Skipping idle TCP connection test, RLIMIT_NOFILE is only " << (unsigned long)nofile.rlim_cur << std::endl;
+	} else {
+		std::cout << "[phy] Testing " << ZT_TEST_PHY_NUM_IDLE_TCP_CONNECTS << " idle TCP connections... "; std::cout.flush();
+		phyTestIdleConnections = true;
+		const unsigned long acceptsBefore = phyTestTcpAcceptCount;
+		for(unsigned long i=0;i<ZT_TEST_PHY_NUM_IDLE_TCP_CONNECTS;++i) {
+			bool connected = false;
+			testPhyInstance->tcpConnect((const struct sockaddr *)&bindaddr,connected,(void *)0,true);
+			if ((i % 64) == 0)
+				testPhyInstance->poll(1);
+		}
+		timeoutAt = OSUtils::now() + ZT_TEST_PHY_TIMEOUT_MS;
+		while (((uint64_t)OSUtils::now() < timeoutAt)&&((phyTestTcpAcceptCount - acceptsBefore) < ZT_TEST_PHY_NUM_IDLE_TCP_CONNECTS))
+			testPhyInstance->poll(100);
+		if ((phyTestTcpAcceptCount - acceptsBefore) < ZT_TEST_PHY_NUM_IDLE_TCP_CONNECTS) {
+			std::cout << "accepted " << (phyTestTcpAcceptCount - acceptsBefore) << ", FAILED." << std::endl;
+			return -1;
+		}
+		std::cout << testPhyInstance->count() << " sockets open, OK" << std::endl;
+
+		std::cout << "[phy] Benchmarking UDP receive with " << testPhyInstance->count() << " sockets open... "; std::cout.flush();
+		const unsigned long udpBefore = phyTestUdpPacketCount;
+		const unsigned long udpPackets = (testBenchmarks) ? ZT_TEST_PHY_NUM_UDP_PACKETS : 100;
+		unsigned long polls = 0;
+		uint64_t start = OSUtils::now();
+		timeoutAt = start + ZT_TEST_PHY_TIMEOUT_MS;
+		while (((uint64_t)OSUtils::now() < timeoutAt)&&((phyTestUdpPacketCount - udpBefore) < udpPackets)) {
+			testPhyInstance->udpSend(udpListenSock,(const struct sockaddr *)&bindaddr,udpTestPayload,sizeof(udpTestPayload));
+			testPhyInstance->poll(100);
+			++polls;
+		}
+		uint64_t end = OSUtils::now();
+		std::cout << (phyTestUdpPacketCount - udpBefore) << " packets in " << polls << " polls, " << ((double)(end - start) * 1000.0 / (double)polls) << " us/poll" << std::endl;
+		phyTestIdleConnections = false;
+	}
+#endif
+
 	return 0;
 }
 
@@ -1140,13 +3658,34 @@ int main(int argc,char **argv)
 	std::cout << "[info] sizeof(NetworkConfig) == " << sizeof(ZeroTier::NetworkConfig) << std::endl;
 
 	srand((unsigned int)time(0));
+	testBenchmarks = (getenv("ZT_SELFTEST_BENCH") != (char *)0);
+	if (!testBenchmarks)
+		std::cout << "[info] set ZT_SELFTEST_BENCH to run full length benchmarks" << std::endl;
 
 	///*
 	r |= testOther();
+	r |= testHashtable();
 	r |= testCrypto();
 	r |= testPacket();
 	r |= testIdentity();
 	r |= testCertificate();
+	r |= testTopology();
+	r |= testNetworkRules();
+	r |= testFragmentReassembly();
+	r |= testTxQueue();
+	r |= testHelloStorm();
+	r |= testMulticaster();
+	r |= testFrameCompression();
+	r |= testIPAllocator();
+#ifdef __UNIX_LIKE__
+	r |= testControllerDB();
+	r |= testControllerConfigCache();
+	r |= testControllerLoad();
+	r |= testRxWorkers();
+#endif
+#ifdef __LINUX__
+	r |= testTapOffload();
+#endif
 	r |= testPhy();
 	//*/
 
@@ -57,6 +57,7 @@
 #include "../osdep/PortMapper.hpp"
 #include "../osdep/Binder.hpp"
 #include "../osdep/ManagedRoute.hpp"
+#include "../osdep/BlockingQueue.hpp"
 
 #include "OneService.hpp"
 #include "SoftwareUpdater.hpp"
@@ -162,6 +163,12 @@ namespace ZeroTier { typedef BSDEthernetTap EthernetTap; }
 // TCP activity timeout
 #define ZT_TCP_ACTIVITY_TIMEOUT 60000
 
+// Maximum number of RX worker threads (local.conf settings.rxWorkerThreads)
+#define ZT_RX_WORKER_MAX_THREADS 64
+
+// Maximum number of received packets queued for RX workers before we drop
+#define ZT_RX_WORKER_MAX_QUEUED 1024
+
 namespace ZeroTier {
 
 namespace {
@@ -281,6 +288,16 @@ static void _peerToJson(nlohmann::json &pj,const ZT_Peer *peer)
 		pa.push_back(j);
 	}
 	pj["paths"] = pa;
+
+	nlohmann::json cj;
+	cj["framesCompressed"] = peer->compression.framesCompressed;
+	cj["framesIncompressible"] = peer->compression.framesIncompressible;
+	cj["framesSkipped"] = peer->compression.framesSkipped;
+	cj["bytesIn"] = peer->compression.bytesIn;
+	cj["bytesOut"] = peer->compression.bytesOut;
+	cj["bytesTried"] = peer->compression.bytesTried;
+	cj["backoff"] = peer->compression.backoff;
+	pj["compression"] = cj;
 }
 
 static void _moonToJson(nlohmann::json &mj,const World &world)
@@ -316,6 +333,9 @@ static void SnodeVirtualNetworkFrameFunction(ZT_Node *node,void *uptr,void *tptr
 static int SnodePathCheckFunction(ZT_Node *node,void *uptr,void *tptr,uint64_t ztaddr,int64_t localSocket,const struct sockaddr_storage *remoteAddr);
 static int SnodePathLookupFunction(ZT_Node *node,void *uptr,void *tptr,uint64_t ztaddr,int family,struct sockaddr_storage *result);
 static void StapFrameHandler(void *uptr,void *tptr,uint64_t nwid,const MAC &from,const MAC &to,unsigned int etherType,unsigned int vlanId,const void *data,unsigned int len);
+#ifdef ZT_SDK
+static void StapFrameSegmentsHandler(void *uptr,void *tptr,uint64_t nwid,const MAC &from,const MAC &to,unsigned int etherType,unsigned int vlanId,const ZT_FrameSegment *segments,unsigned int segmentCount);
+#endif
 
 static int ShttpOnMessageBegin(http_parser *parser);
 static int ShttpOnUrl(http_parser *parser,const char *ptr,size_t length);
@@ -444,6 +464,41 @@ public:
 	// Deadline for the next background task service function
 	volatile int64_t _nextBackgroundTaskDeadline;
 
+	// Received wire packet handed from the I/O thread to an RX worker
+	struct RxPacket
+	{
+		int64_t sock;
+		struct sockaddr_storage from;
+		unsigned int len;
+		char data[ZT_MAX_PHYSMTU];
+	};
+
+	// RX worker: decrypts, authenticates and dispatches packets in arrival order
+	struct RxWorker
+	{
+		OneServiceImpl *parent;
+		BlockingQueue<RxPacket *> q;
+		Thread thread;
+
+		inline void threadMain()
+			throw()
+		{
+			RxPacket *p = (RxPacket *)0;
+			while (q.get(p)) {
+				parent->_processWirePacket(p->sock,&(p->from),p->data,p->len);
+				Mutex::Lock _l(parent->_rxPackets_m);
+				parent->_rxPacketFree.push_back(p);
+			}
+		}
+	};
+
+	// RX workers, empty if packets are processed inline on the I/O thread
+	unsigned int _rxWorkerThreads;
+	std::vector<RxWorker *> _rxWorkers;
+	std::vector<RxPacket *> _rxPackets;
+	std::vector<RxPacket *> _rxPacketFree;
+	Mutex _rxPackets_m;
+
 	// Configured networks
 	struct NetworkState
 	{
@@ -507,6 +562,7 @@ public:
 #endif
 		,_lastRestart(0)
 		,_nextBackgroundTaskDeadline(0)
+		,_rxWorkerThreads(0)
 		,_tcpFallbackTunnel((TcpConnection *)0)
 		,_termReason(ONE_STILL_RUNNING)
 		,_portMappingEnabled(true)
@@ -638,6 +694,15 @@ public:
 					if (cdbp.length() > 0)
 						_controllerDbPath = cdbp;
 
+					// Decrypt and process received packets on this many threads instead of the I/O thread
+					_rxWorkerThreads = (unsigned int)std::min(OSUtils::jsonInt(settings["rxWorkerThreads"],0ULL),(uint64_t)ZT_RX_WORKER_MAX_THREADS);
+
+#if defined(__LINUX__) && !defined(ZT_SDK) && !defined(ZT_USE_TEST_TAP)
+					// Read taps created from now on with this many queues/threads and/or with kernel offloads
+					LinuxEthernetTap::queues = (unsigned int)std::min(OSUtils::jsonInt(settings["tapQueues"],0ULL),(uint64_t)ZT_LINUX_TAP_MAX_QUEUES);
+					LinuxEthernetTap::vnetHdr = OSUtils::jsonBool(settings["tapOffload"],false);
+#endif
+
 					// Bind to wildcard instead of to specific interfaces (disables full tunnel capability)
 					json &bind = settings["bind"];
 					if (bind.is_array()) {
@@ -773,6 +838,15 @@ public:
 				}
 			}
 
+			// Start RX workers if enabled; packets are sharded by physical source
+			// address so each path's packets (and fragments) stay in order
+			for(unsigned int i=0;i<_rxWorkerThreads;++i) {
+				RxWorker *const w = new RxWorker();
+				w->parent = this;
+				w->thread = Thread::start(w);
+				_rxWorkers.push_back(w);
+			}
+
 			// Main I/O loop
 			_nextBackgroundTaskDeadline = 0;
 			int64_t clockShouldBe = OSUtils::now();
@@ -901,6 +975,21 @@ public:
 			_fatalErrorMessage = "unexpected exception in main thread: unknown exception";
 		}
 
+		for(std::vector<RxWorker *>::iterator w(_rxWorkers.begin());w!=_rxWorkers.end();++w)
+			(*w)->q.stop();
+		for(std::vector<RxWorker *>::iterator w(_rxWorkers.begin());w!=_rxWorkers.end();++w) {
+			Thread::join((*w)->thread);
+			delete *w;
+		}
+		_rxWorkers.clear();
+		{
+			Mutex::Lock _l(_rxPackets_m);
+			for(std::vector<RxPacket *>::iterator p(_rxPackets.begin());p!=_rxPackets.end();++p)
+				delete *p;
+			_rxPackets.clear();
+			_rxPacketFree.clear();
+		}
+
 		try {
 			Mutex::Lock _l(_tcpConnections_m);
 			while (!_tcpConnections.empty())
@@ -1138,6 +1227,14 @@ public:
 					res["publicIdentity"] = status.publicIdentity;
 					res["online"] = (bool)(status.online != 0);
 					res["tcpFallbackActive"] = (_tcpFallbackTunnel != (TcpConnection *)0);
+					json &fragments = res["fragments"];
+					fragments["reassembled"] = status.fragmentsReassembled;
+					fragments["evicted"] = status.fragmentsEvicted;
+					fragments["expired"] = status.fragmentsExpired;
+					json &identities = res["identities"];
+					identities["validated"] = status.identitiesValidated;
+					identities["cacheHits"] = status.identityCacheHits;
+					identities["failed"] = status.identityValidationsFailed;
 					res["versionMajor"] = ZEROTIER_ONE_VERSION_MAJOR;
 					res["versionMinor"] = ZEROTIER_ONE_VERSION_MINOR;
 					res["versionRev"] = ZEROTIER_ONE_VERSION_REVISION;
@@ -1674,11 +1771,38 @@ public:
 	{
 		if ((len >= 16)&&(reinterpret_cast<const InetAddress *>(from)->ipScope() == InetAddress::IP_SCOPE_GLOBAL))
 			_lastDirectReceiveFromGlobal = OSUtils::now();
+
+		if ((!_rxWorkers.empty())&&(len <= ZT_MAX_PHYSMTU)) {
+			RxPacket *p;
+			{
+				Mutex::Lock _l(_rxPackets_m);
+				if (!_rxPacketFree.empty()) {
+					p = _rxPacketFree.back();
+					_rxPacketFree.pop_back();
+				} else if (_rxPackets.size() < ZT_RX_WORKER_MAX_QUEUED) {
+					p = new RxPacket();
+					_rxPackets.push_back(p);
+				} else {
+					return; // workers are behind, drop like a full socket buffer would
+				}
+			}
+			p->sock = reinterpret_cast<int64_t>(sock);
+			memcpy(&(p->from),from,sizeof(struct sockaddr_storage)); // Phy<> uses sockaddr_storage, so it'll always be that big
+			p->len = (unsigned int)len;
+			memcpy(p->data,data,len);
+			_rxWorkers[reinterpret_cast<const InetAddress *>(from)->hashCode() % _rxWorkers.size()]->q.post(p);
+		} else {
+			_processWirePacket(reinterpret_cast<int64_t>(sock),reinterpret_cast<const struct sockaddr_storage *>(from),data,(unsigned int)len);
+		}
+	}
+
+	inline void _processWirePacket(const int64_t sock,const struct sockaddr_storage *from,const void *data,unsigned int len)
+	{
 		const ZT_ResultCode rc = _node->processWirePacket(
 			(void *)0,
 			OSUtils::now(),
-			reinterpret_cast<int64_t>(sock),
-			reinterpret_cast<const struct sockaddr_storage *>(from), // Phy<> uses sockaddr_storage, so it'll always be that big
+			sock,
+			from,
 			data,
 			len,
 			&_nextBackgroundTaskDeadline);
@@ -1945,6 +2069,10 @@ public:
 							friendlyName,
 							StapFrameHandler,
 							(void *)this);
+#ifdef ZT_SDK
+						// Lets the stack hand over chained buffers without linearizing them first
+						n.tap->_segmentsHandler = StapFrameSegmentsHandler;
+#endif
 						*nuptr = (void *)&n;
 
 						char nlcpath[256];
@@ -2113,6 +2241,9 @@ public:
 				OSUtils::ztsnprintf(dirname,sizeof(dirname),"%s" ZT_PATH_SEPARATOR_S "peers.d",_homePath.c_str());
 				OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "%.10llx.peer",dirname,(unsigned long long)id[0]);
 				break;
+			case ZT_STATE_OBJECT_IDENTITY_CACHE:
+				OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "identities.cache",_homePath.c_str());
+				break;
 			default:
 				return;
 		}
@@ -2171,6 +2302,9 @@ public:
 			case ZT_STATE_OBJECT_PEER:
 				OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "peers.d" ZT_PATH_SEPARATOR_S "%.10llx.peer",_homePath.c_str(),(unsigned long long)id[0]);
 				break;
+			case ZT_STATE_OBJECT_IDENTITY_CACHE:
+				OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "identities.cache",_homePath.c_str());
+				break;
 			default:
 				return -1;
 		}
@@ -2249,10 +2383,14 @@ public:
 		// proxy fallback, which is slow.
 
 		if ((localSocket != -1)&&(localSocket != 0)&&(_binder.isUdpSocketValid((PhySocket *)((uintptr_t)localSocket)))) {
-			if ((ttl)&&(addr->ss_family == AF_INET)) _phy.setIp4UdpTtl((PhySocket *)((uintptr_t)localSocket),ttl);
-			const bool r = _phy.udpSend((PhySocket *)((uintptr_t)localSocket),(const struct sockaddr *)addr,data,len);
-			if ((ttl)&&(addr->ss_family == AF_INET)) _phy.setIp4UdpTtl((PhySocket *)((uintptr_t)localSocket),255);
-			return ((r) ? 0 : -1);
+			if ((ttl)&&(addr->ss_family == AF_INET)) {
+				_phy.setIp4UdpTtl((PhySocket *)((uintptr_t)localSocket),ttl);
+				const bool r = _phy.udpSend((PhySocket *)((uintptr_t)localSocket),(const struct sockaddr *)addr,data,len);
+				_phy.setIp4UdpTtl((PhySocket *)((uintptr_t)localSocket),255);
+				return ((r) ? 0 : -1);
+			}
+			// Replies generated while handling received packets go out together at the end of poll()
+			return ((_phy.udpSendBatched((PhySocket *)((uintptr_t)localSocket),(const struct sockaddr *)addr,data,len)) ? 0 : -1);
 		} else {
 			return ((_binder.udpSendAll(_phy,addr,data,len,ttl)) ? 0 : -1);
 		}
@@ -2340,6 +2478,13 @@ public:
 		_node->processVirtualNetworkFrame((void *)0,OSUtils::now(),nwid,from.toInt(),to.toInt(),etherType,vlanId,data,len,&_nextBackgroundTaskDeadline);
 	}
 
+#ifdef ZT_SDK
+	inline void tapFrameSegmentsHandler(uint64_t nwid,const MAC &from,const MAC &to,unsigned int etherType,unsigned int vlanId,const ZT_FrameSegment *segments,unsigned int segmentCount)
+	{
+		_node->processVirtualNetworkFrame((void *)0,OSUtils::now(),nwid,from.toInt(),to.toInt(),etherType,vlanId,segments,segmentCount,&_nextBackgroundTaskDeadline);
+	}
+#endif
+
 	inline void onHttpRequestToServer(TcpConnection *tc)
 	{
 		char tmpn[4096];
@@ -2503,6 +2648,10 @@ static int SnodePathLookupFunction(ZT_Node *node,void *uptr,void *tptr,uint64_t
 { return reinterpret_cast<OneServiceImpl *>(uptr)->nodePathLookupFunction(ztaddr,family,result); }
 static void StapFrameHandler(void *uptr,void *tptr,uint64_t nwid,const MAC &from,const MAC &to,unsigned int etherType,unsigned int vlanId,const void *data,unsigned int len)
 { reinterpret_cast<OneServiceImpl *>(uptr)->tapFrameHandler(nwid,from,to,etherType,vlanId,data,len); }
+#ifdef ZT_SDK
+static void StapFrameSegmentsHandler(void *uptr,void *tptr,uint64_t nwid,const MAC &from,const MAC &to,unsigned int etherType,unsigned int vlanId,const ZT_FrameSegment *segments,unsigned int segmentCount)
+{ reinterpret_cast<OneServiceImpl *>(uptr)->tapFrameSegmentsHandler(nwid,from,to,etherType,vlanId,segments,segmentCount); }
+#endif
 
 static int ShttpOnMessageBegin(http_parser *parser)
 {
@@ -305,6 +305,12 @@ static volatile int select_cb_ctr;
   set_errno(sockerr); \
 } while (0)
 
+/** Called (outside of SYS_ARCH protection) after each event on socket s has been
+    accounted for, e.g. to feed an external readiness notification mechanism */
+#ifndef LWIP_SOCKET_EVENT_HOOK
+#define LWIP_SOCKET_EVENT_HOOK(s)
+#endif
+
 /* Forward declaration of some functions */
 static void event_callback(struct netconn *conn, enum netconn_evt evt, u16_t len);
 #if !LWIP_TCPIP_CORE_LOCKING
@@ -1635,6 +1641,7 @@ event_callback(struct netconn *conn, enum netconn_evt evt, u16_t len)
   if (sock->select_waiting == 0) {
     /* noone is waiting for this socket, no need to check select_cb_list */
     SYS_ARCH_UNPROTECT(lev);
+    LWIP_SOCKET_EVENT_HOOK(s);
     return;
   }
 
@@ -1684,6 +1691,38 @@ again:
     }
   }
   SYS_ARCH_UNPROTECT(lev);
+  LWIP_SOCKET_EVENT_HOOK(s);
+}
+
+/**
+ * Return the current readiness of a socket as a combination of
+ * LWIP_SOCKET_EVT_RCV, LWIP_SOCKET_EVT_SEND and LWIP_SOCKET_EVT_ERR,
+ * using the same criteria as select(). Returns -1 for an invalid socket.
+ */
+int
+lwip_socket_events(int s)
+{
+  struct lwip_sock *sock;
+  int events = 0;
+  SYS_ARCH_DECL_PROTECT(lev);
+
+  SYS_ARCH_PROTECT(lev);
+  sock = tryget_socket(s);
+  if (sock == NULL) {
+    SYS_ARCH_UNPROTECT(lev);
+    return -1;
+  }
+  if ((sock->lastdata != NULL) || (sock->rcvevent > 0)) {
+    events |= LWIP_SOCKET_EVT_RCV;
+  }
+  if (sock->sendevent != 0) {
+    events |= LWIP_SOCKET_EVT_SEND;
+  }
+  if (sock->errevent != 0) {
+    events |= LWIP_SOCKET_EVT_ERR;
+  }
+  SYS_ARCH_UNPROTECT(lev);
+  return events;
 }
 
 /**
@@ -506,6 +506,12 @@ int lwip_select(int maxfdp1, fd_set *readset, fd_set *writeset, fd_set *exceptse
 int lwip_ioctl(int s, long cmd, void *argp);
 int lwip_fcntl(int s, int cmd, int val);
 
+/* Readiness flags returned by lwip_socket_events() */
+#define LWIP_SOCKET_EVT_RCV   0x01
+#define LWIP_SOCKET_EVT_SEND  0x02
+#define LWIP_SOCKET_EVT_ERR   0x04
+int lwip_socket_events(int s);
+
 #if LWIP_COMPAT_SOCKETS
 #if LWIP_COMPAT_SOCKETS != 2
 /** @ingroup socket */
@@ -37,6 +37,7 @@
 extern int errno;
 #endif
 
+#include "ZeroTierOne.h"
 #include "Mutex.hpp"
 #include "MulticastGroup.hpp"
 #include "InetAddress.hpp"
@@ -46,6 +47,9 @@ extern int errno;
 #include "libzt.h"
 
 #include <vector>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
 extern std::vector<void*> vtaps;
 extern ZeroTier::Mutex _vtaps_lock;
 
@@ -158,6 +162,12 @@ public:
 	void (*_handler)(void *, void *, uint64_t, const ZeroTier::MAC &, const ZeroTier::MAC &, unsigned int, unsigned int,
 		const void *, unsigned int);
 
+	/**
+	 * For moving chained frames onto the ZeroTier virtual wire without linearizing them first (optional)
+	 */
+	void (*_segmentsHandler)(void *, void *, uint64_t, const ZeroTier::MAC &, const ZeroTier::MAC &, unsigned int, unsigned int,
+		const ZT_FrameSegment *, unsigned int);
+
 	void phyOnUnixClose(ZeroTier::PhySocket *sock, void **uptr);
 	void phyOnUnixData(ZeroTier::PhySocket *sock, void **uptr, void *data, ssize_t len);
 	void phyOnUnixWritable(ZeroTier::PhySocket *sock, void **uptr, bool stack_invoked);
@@ -191,6 +201,23 @@ public:
 
 	std::vector<VirtualSocket*> _VirtualSockets;
 
+	/**
+	 * Network stack interfaces (struct netif *) created for this tap, see lwip_init_interface()
+	 */
+	std::vector<void*> _netifs;
+	Mutex _netifs_m;
+
+	/**
+	 * Frames are only handed to the stack while this is set. Teardown clears
+	 * it and waits on _rxDrained until _rxInFlight (put() calls currently
+	 * handing a frame to the stack) reaches zero, so no frame referring to
+	 * this tap can enter the ingress ring after its final drain.
+	 */
+	std::atomic<bool> _rxOpen;
+	std::atomic<int> _rxInFlight;
+	std::mutex _rxDrained_m;
+	std::condition_variable _rxDrained;
+
 	Thread _thread;
 	std::string _dev; // path to Unix domain socket
 
@@ -269,6 +269,28 @@ ZT_SOCKET_API void ZTCALL zts_get_rfc4193_addr(
  */
 ZT_SOCKET_API unsigned long zts_get_peer_count();
 
+/**
+ * Counters for the ring which carries incoming frames from the ZeroTier core into the network stack
+ */
+struct zts_rx_queue_stats {
+	uint64_t enqueued; // frames accepted into the ring
+	uint64_t delivered; // frames fed into the network stack
+	uint64_t dropped; // frames dropped because the ring was full
+	uint64_t wakeups; // number of times the stack thread was signalled to drain the ring
+	uint32_t depth; // frames currently waiting
+	uint32_t high_watermark; // largest number of frames seen waiting at once
+	uint32_t capacity; // size of the ring (LWIP_RX_RING_SZ)
+};
+
+/**
+ * @brief Copies the counters of the network stack's ingress frame ring into the provided structure
+ *
+ * @usage Can be called at any time. Useful for sizing LWIP_RX_RING_SZ under load
+ * @param stats Destination structure for counters
+ * @return
+ */
+ZT_SOCKET_API void ZTCALL zts_get_rx_queue_stats(struct zts_rx_queue_stats *stats);
+
 /****************************************************************************/
 /* POSIX-like socket API                                                    */
 /****************************************************************************/
@@ -434,21 +456,123 @@ ZT_SOCKET_API struct hostent *zts_gethostbyname(const char *name);
  */
 ZT_SOCKET_API int ZTCALL zts_close(int fd);
 
+/**
+ * Event flags for zts_poll(). These share their values with the Linux POLL* flags.
+ */
+#define ZTS_POLLIN   0x001
+#define ZTS_POLLOUT  0x004
+#define ZTS_POLLERR  0x008
+#define ZTS_POLLNVAL 0x020
+
+struct zts_pollfd
+{
+	int fd;        // File descriptor (only valid for use with libzt calls), ignored if negative
+	short events;  // Requested events (ZTS_POLLIN, ZTS_POLLOUT)
+	short revents; // Returned events
+};
+
 /**
  * @brief Waits for one of a set of file descriptors to become ready to perform I/O.
  *
  * @usage Call this after zts_start() has succeeded
- * @param fds
- * @param nfds
- * @param timeout
- * @return
+ * @param fds Array of descriptors and the events of interest for each
+ * @param nfds Number of entries in fds
+ * @param timeout Milliseconds to wait, -1 to wait indefinitely, 0 to return immediately
+ * @return Number of entries with non-zero revents, 0 on timeout, -1 on failure
  */
-#if defined(__linux__)
-/*
-typedef unsigned int nfds_t;
-int zts_poll(struct pollfd *fds, nfds_t nfds, int timeout);
-*/
-#endif
+ZT_SOCKET_API int ZTCALL zts_poll(struct zts_pollfd *fds, unsigned int nfds, int timeout);
+
+/**
+ * Event flags and control operations for zts_epoll_*(). These share their
+ * values with the Linux EPOLL* flags.
+ */
+#define ZTS_EPOLLIN       0x001
+#define ZTS_EPOLLOUT      0x004
+#define ZTS_EPOLLERR      0x008
+#define ZTS_EPOLLONESHOT  (1u << 30)
+#define ZTS_EPOLLET       (1u << 31)
+
+#define ZTS_EPOLL_CTL_ADD 1
+#define ZTS_EPOLL_CTL_DEL 2
+#define ZTS_EPOLL_CTL_MOD 3
+
+typedef union zts_epoll_data
+{
+	void *ptr;
+	int fd;
+	uint32_t u32;
+	uint64_t u64;
+} zts_epoll_data_t;
+
+struct zts_epoll_event
+{
+	uint32_t events;       // ZTS_EPOLL* flags
+	zts_epoll_data_t data; // Returned unchanged with each event
+};
+
+/**
+ * @brief Create a readiness notification instance for libzt sockets
+ *
+ * Sockets are registered once with zts_epoll_ctl() and zts_epoll_wait() then
+ * only ever looks at sockets the network stack has signalled activity on,
+ * so the cost of a wait does not grow with the number of idle sockets.
+ *
+ * @usage Call this after zts_start() has succeeded
+ * @param flags Reserved, must be 0
+ * @return Instance descriptor (only valid for use with zts_epoll_* calls), or -1 on failure
+ */
+ZT_SOCKET_API int ZTCALL zts_epoll_create(int flags);
+
+/**
+ * @brief Add, modify, or remove a socket from an instance's interest list
+ *
+ * @usage Call this after zts_start() has succeeded
+ * @param epfd Instance descriptor returned by zts_epoll_create()
+ * @param op ZTS_EPOLL_CTL_ADD, ZTS_EPOLL_CTL_MOD or ZTS_EPOLL_CTL_DEL
+ * @param fd File descriptor (only valid for use with libzt calls)
+ * @param event Events of interest and user data (ignored for ZTS_EPOLL_CTL_DEL)
+ * @return 0 on success, -1 on failure
+ */
+ZT_SOCKET_API int ZTCALL zts_epoll_ctl(int epfd, int op, int fd, struct zts_epoll_event *event);
+
+/**
+ * @brief Wait for events on an instance's registered sockets
+ *
+ * Level-triggered unless ZTS_EPOLLET was given. ZTS_EPOLLERR is always reported.
+ *
+ * @usage Call this after zts_start() has succeeded
+ * @param epfd Instance descriptor returned by zts_epoll_create()
+ * @param events Array receiving ready events
+ * @param maxevents Capacity of events
+ * @param timeout Milliseconds to wait, -1 to wait indefinitely, 0 to return immediately
+ * @return Number of events written, 0 on timeout, -1 on failure
+ */
+ZT_SOCKET_API int ZTCALL zts_epoll_wait(int epfd, struct zts_epoll_event *events, int maxevents, int timeout);
+
+/**
+ * @brief Return a host file descriptor that is readable while an instance has pending events
+ *
+ * This lets an instance be plugged into a host event loop (select/poll/epoll/kqueue
+ * on real descriptors). When it becomes readable, call zts_epoll_wait() with a zero
+ * timeout; do not read from the descriptor directly. It is an eventfd on Linux and
+ * the read end of a pipe elsewhere, and is closed by zts_epoll_close().
+ *
+ * @usage Call this after zts_start() has succeeded
+ * @param epfd Instance descriptor returned by zts_epoll_create()
+ * @return Host file descriptor, or -1 on failure (or if unsupported on this platform)
+ */
+ZT_SOCKET_API int ZTCALL zts_epoll_eventfd(int epfd);
+
+/**
+ * @brief Destroy an instance created with zts_epoll_create()
+ *
+ * Any thread blocked in zts_epoll_wait() on the instance returns -1 with EBADF.
+ *
+ * @usage Call this after zts_start() has succeeded
+ * @param epfd Instance descriptor returned by zts_epoll_create()
+ * @return 0 on success, -1 on failure
+ */
+ZT_SOCKET_API int ZTCALL zts_epoll_close(int epfd);
 
 /**
  * @brief Monitor multiple file descriptors, waiting until one or more of the file descriptors become "ready"
@@ -588,6 +712,28 @@ ZT_SOCKET_API int ZTCALL zts_read(int fd, void *buf, size_t len);
  */
 ZT_SOCKET_API int ZTCALL zts_write(int fd, const void *buf, size_t len);
 
+/**
+ * @brief Read bytes from socket into a set of buffers (scatter)
+ *
+ * @usage Call this after zts_start() has succeeded
+ * @param fd File descriptor (only valid for use with libzt calls)
+ * @param iov Array of buffers to fill, in order
+ * @param iovcnt Number of buffers in iov
+ * @return Total number of bytes read, or -1 on failure
+ */
+ZT_SOCKET_API ssize_t ZTCALL zts_readv(int fd, const struct iovec *iov, int iovcnt);
+
+/**
+ * @brief Write bytes from a set of buffers to socket (gather)
+ *
+ * @usage Call this after zts_start() has succeeded
+ * @param fd File descriptor (only valid for use with libzt calls)
+ * @param iov Array of buffers to send, in order
+ * @param iovcnt Number of buffers in iov
+ * @return Total number of bytes written, or -1 on failure
+ */
+ZT_SOCKET_API ssize_t ZTCALL zts_writev(int fd, const struct iovec *iov, int iovcnt);
+
 /**
  * @brief Shut down some aspect of a socket (read, write, or both)
  *
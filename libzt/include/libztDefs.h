@@ -97,15 +97,21 @@ struct sockaddr_ll {
 /* The following three quantities are related and govern how incoming frames are fed into the 
 network stack's core:
 
-Every LWIP_GUARDED_BUF_CHECK_INTERVAL milliseconds, a callback will be called from the core and 
-will input a maximum of LWIP_FRAMES_HANDLED_PER_CORE_CALL frames before returning control back
-to the core. Meanwhile, incoming frames from the ZeroTier wire will be allocated and their 
-pointers will be cached in the receive frame buffer of the size LWIP_MAX_GUARDED_RX_BUF_SZ to 
-await the next callback from the core */
-
-#define LWIP_GUARDED_BUF_CHECK_INTERVAL	50 // in ms
-#define LWIP_MAX_GUARDED_RX_BUF_SZ	1024 // number of frame pointers that can be cached waiting for receipt into core
-#define LWIP_FRAMES_HANDLED_PER_CORE_CALL 16 // How many frames are handled per call from core
+Incoming frames from the ZeroTier wire are allocated as pbufs and their pointers are pushed onto a 
+lock-free ring of LWIP_RX_RING_SZ entries. The first push into an idle ring posts a callback to the 
+core's thread which inputs a maximum of LWIP_FRAMES_HANDLED_PER_CORE_CALL frames before re-posting 
+itself and returning control back to the core. Every LWIP_RX_RING_WATCHDOG_INTERVAL milliseconds 
+the driver checks for frames left behind by a callback which could not be posted (tcpip mbox full). 
+Frames arriving while the ring is full are dropped and counted, see zts_get_rx_queue_stats() */
+
+#define LWIP_RX_RING_WATCHDOG_INTERVAL 50 // in ms
+#define LWIP_RX_RING_SZ	1024 // number of frame pointers that can wait for receipt into core (must be a power of two)
+#define LWIP_FRAMES_HANDLED_PER_CORE_CALL 64 // How many frames are handled per call from core
+
+/* Outgoing frames made of at most this many pbufs are handed to the ZeroTier core as a list of 
+segments and copied only once, directly into the outgoing ZeroTier packet. Longer chains are 
+linearized first */
+#define LWIP_TX_MAX_FRAME_SEGMENTS 16
 
 typedef signed char err_t;
 
@@ -202,6 +208,17 @@ typedef signed char err_t;
  */
 #define ZT_UDP_RX_BUF_SZ ZT_MAX_MTU * 10
 
+/**
+ * Stack scratch buffer used by zts_readv() to gather a datagram spread over
+ * several vectors. Larger (reassembled) datagrams fall back to the heap.
+ */
+#define ZT_READV_SCRATCH_SZ ZT_MAX_MTU
+
+/**
+ * Largest datagram zts_readv() will receive into multiple vectors
+ */
+#define ZT_READV_MAX_DATAGRAM_SZ 65535
+
 /**
  * Send buffer size for the network stack
  * By default picoTCP sets them to 16834, this is good for embedded-scale
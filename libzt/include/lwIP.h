@@ -42,6 +42,8 @@ namespace ZeroTier {
   struct InetAddress;
 }
 
+struct zts_rx_queue_stats;
+
 /**
  * @brief Initialize network stack semaphores, threads, and timers.
  *
@@ -69,7 +71,7 @@ void lwip_start_dhcp(void *netif);
 /**
  * @brief Set up an interface in the network stack for the VirtualTap.
  *
- * @param
+ * @usage Safe to call from any thread, the netif is added while holding the lwIP core
  * @param tapref Reference to VirtualTap that will be responsible for sending and receiving data
  * @param mac Virtual hardware address for this ZeroTier VirtualTap interface
  * @param ip Virtual IP address for this ZeroTier VirtualTap interface
@@ -77,10 +79,20 @@ void lwip_start_dhcp(void *netif);
  */
 void lwip_init_interface(void *tapref, const ZeroTier::MAC &mac, const ZeroTier::InetAddress &ip);
 
+/**
+ * @brief Removes and frees all network stack interfaces belonging to a VirtualTap
+ *
+ * @usage Called from the VirtualTap destructor. Blocks until the interfaces have been removed under the lwIP core
+ * @param tapref Reference to VirtualTap whose interfaces should be removed
+ * @return
+ */
+void lwip_remove_interfaces(void *tapref);
+
 /**
  * @brief Called from the stack, outbound ethernet frames from the network stack enter the ZeroTier virtual wire here.
  *
- * @usage This shall only be called from the stack or the stack driver. Not the application thread.
+ * @usage This shall only be called from the stack or the stack driver with the core held. With LWIP_TCPIP_CORE_LOCKING
+ *        this can be an application thread inside zts_send() etc, so the frame handlers must be thread-safe.
  * @param netif Transmits an outgoing Ethernet fram from the network stack onto the ZeroTier virtual wire
  * @param p A pointer to the beginning of a chain pf struct pbufs
  * @return
@@ -102,4 +114,22 @@ err_t lwip_eth_tx(struct netif *netif, struct pbuf *p);
 void lwip_eth_rx(VirtualTap *tap, const ZeroTier::MAC &from, const ZeroTier::MAC &to, unsigned int etherType,
 	const void *data, unsigned int len);
 
+/**
+ * @brief Feeds frames waiting in the ingress ring into the stack
+ *
+ * @usage This shall only be called from the tcpip thread. It is posted automatically by lwip_eth_rx()
+ * @param arg Unused
+ * @return
+ */
+void lwip_rx_drain(void *arg);
+
+/**
+ * @brief Copies the ingress ring counters into the provided structure
+ *
+ * @usage Can be called from any thread
+ * @param stats Destination structure for counters
+ * @return
+ */
+void lwip_get_rx_queue_stats(struct zts_rx_queue_stats *stats);
+
 #endif // _H
@@ -50,9 +50,13 @@
 #endif
 
 /*
- * Provides core locking machinery
+ * Provides core locking machinery. When enabled, socket API calls lock the
+ * core and run on the calling thread instead of round-tripping a message
+ * through the tcpip thread. Configure with cmake -DLIBZT_TCPIP_CORE_LOCKING=1
  */
+#ifndef LWIP_TCPIP_CORE_LOCKING
 #define LWIP_TCPIP_CORE_LOCKING     0
+#endif
 
 /*
  * Provides a macro to spoof the names of the lwip socket functions
@@ -582,6 +586,16 @@ happening sooner than they should.
 
 #define LWIP_SOCKET                     1//(NO_SYS==0)
 
+/**
+ * LWIP_SOCKET_EVENT_HOOK: Wakes any zts_poll()/zts_epoll_wait() callers
+ * interested in socket s (see libztEpoll.cpp)
+ */
+#ifdef __cplusplus
+extern "C"
+#endif
+void zts_socket_event(int s);
+#define LWIP_SOCKET_EVENT_HOOK(s)       zts_socket_event(s)
+
 
 /*------------------------------------------------------------------------------
 ------------------------------ Statistics Options ------------------------------
@@ -60,6 +60,7 @@ VirtualTap::VirtualTap(
 		unsigned int,unsigned int,const void *,unsigned int),
 	void *arg) :
 		_handler(handler),
+		_segmentsHandler(NULL),
 		_homePath(homePath),
 		_arg(arg),
 		_initialized(false),
@@ -69,7 +70,9 @@ VirtualTap::VirtualTap(
 		_mtu(mtu),
 		_nwid(nwid),
 		_unixListenSocket((PhySocket *)0),
-		_phy(this,false,true)
+		_phy(this,false,true),
+		_rxOpen(true),
+		_rxInFlight(0)
 {
 	vtaps.push_back((void*)this);
 
@@ -93,6 +96,14 @@ VirtualTap::~VirtualTap()
 	_phy.whack();
 	Thread::join(_thread);
 	_phy.close(_unixListenSocket,false);
+	// Stop accepting frames and wait out any put() still pushing, then let
+	// lwip_remove_interfaces() drain what is already queued for this tap
+	_rxOpen = false;
+	{
+		std::unique_lock<std::mutex> l(_rxDrained_m);
+		_rxDrained.wait(l, [this]{ return _rxInFlight == 0; });
+	}
+	lwip_remove_interfaces((void*)this);
 }
 
 void VirtualTap::setEnabled(bool en)
@@ -149,7 +160,16 @@ std::vector<InetAddress> VirtualTap::ips() const
 void VirtualTap::put(const MAC &from,const MAC &to,unsigned int etherType,
 	const void *data,unsigned int len)
 {
-	lwip_eth_rx(this, from, to, etherType, data, len);
+	_rxInFlight++;
+	if (_rxOpen) {
+		lwip_eth_rx(this, from, to, etherType, data, len);
+	}
+	// The last put() out after teardown started wakes the destructor. Taking
+	// the lock orders this with its check of _rxInFlight so the wakeup can't be lost.
+	if ((--_rxInFlight == 0) && (!_rxOpen)) {
+		std::lock_guard<std::mutex> l(_rxDrained_m);
+		_rxDrained.notify_all();
+	}
 }
 
 std::string VirtualTap::deviceName() const
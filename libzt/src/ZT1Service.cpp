@@ -34,6 +34,7 @@
 #include "ZT1Service.h"
 #include "libztDebug.h"
 #include "SysUtils.h"
+#include "lwIP.h"
 
 #include "Phy.hpp"
 #include "OneService.hpp"
@@ -515,6 +516,11 @@ unsigned long zts_get_peer_count()
 	}
 }
 
+void zts_get_rx_queue_stats(struct zts_rx_queue_stats *stats)
+{
+	lwip_get_rx_queue_stats(stats);
+}
+
 bool _ipv6_in_subnet(ZeroTier::InetAddress *subnet, ZeroTier::InetAddress *addr)
 {
 	ZeroTier::InetAddress r(addr);
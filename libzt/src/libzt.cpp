@@ -37,6 +37,7 @@
 #include "lwip/netdb.h"
 
 #include <string.h>
+#include <stdlib.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -45,6 +46,7 @@ extern "C" {
 int platform_adjusted_socket_family(int family);
 void fix_addr_socket_family(struct sockaddr *addr);
 bool zts_ready();
+void zts_epoll_forget(int fd);
 
 int zts_socket(int socket_family, int socket_type, int protocol)
 {
@@ -143,7 +145,11 @@ struct hostent *zts_gethostbyname(const char *name)
 
 int zts_close(int fd)
 {
-	return !zts_ready() ? -1 : lwip_close(fd);
+	if (!zts_ready()) {
+		return -1;
+	}
+	zts_epoll_forget(fd);
+	return lwip_close(fd);
 }
 
 int zts_select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds,
@@ -219,6 +225,84 @@ int zts_write(int fd, const void *buf, size_t len)
 	return !zts_ready() ? -1 : lwip_write(fd, buf, len);
 }
 
+ssize_t zts_readv(int fd, const struct iovec *iov, int iovcnt)
+{
+	if (!zts_ready()) {
+		return -1;
+	}
+	if (!iov || iovcnt <= 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	int type = 0;
+	socklen_t optlen = sizeof(type);
+	if (lwip_getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &optlen) < 0) {
+		return -1;
+	}
+	if (type != SOCK_STREAM) {
+		// The stack has no scatter receive, and a datagram must be consumed in a
+		// single call, so unless there's only one vector receive it whole into a
+		// scratch buffer and spread it over the vectors.
+		size_t total = 0;
+		for (int i=0; i<iovcnt; i++) {
+			total += iov[i].iov_len;
+		}
+		if (total == iov[0].iov_len) {
+			return lwip_recv(fd, iov[0].iov_base, iov[0].iov_len, 0);
+		}
+		if (total > ZT_READV_MAX_DATAGRAM_SZ) {
+			total = ZT_READV_MAX_DATAGRAM_SZ;
+		}
+		char scratch[ZT_READV_SCRATCH_SZ];
+		char *tmp = scratch;
+		if (total > sizeof(scratch)) {
+			tmp = (char *)malloc(total);
+			if (!tmp) {
+				errno = ENOMEM;
+				return -1;
+			}
+		}
+		int r = lwip_recv(fd, tmp, total, 0);
+		size_t off = 0;
+		for (int i=0; r > 0 && i<iovcnt && off < (size_t)r; i++) {
+			size_t n = iov[i].iov_len < (size_t)r - off ? iov[i].iov_len : (size_t)r - off;
+			memcpy(iov[i].iov_base, tmp + off, n);
+			off += n;
+		}
+		if (tmp != scratch) {
+			free(tmp);
+		}
+		return r;
+	}
+	// Block only for the first vector, then take whatever else is already queued.
+	// A later vector coming up empty is not an error, so don't let it clobber errno.
+	const int saved_errno = errno;
+	ssize_t total = 0;
+	for (int i=0; i<iovcnt; i++) {
+		if (!iov[i].iov_len) {
+			continue;
+		}
+		int r = lwip_recv(fd, iov[i].iov_base, iov[i].iov_len, total ? MSG_DONTWAIT : 0);
+		if (r < 0) {
+			if (total) {
+				errno = saved_errno;
+				return total;
+			}
+			return -1;
+		}
+		total += r;
+		if ((size_t)r < iov[i].iov_len) {
+			break;
+		}
+	}
+	return total;
+}
+
+ssize_t zts_writev(int fd, const struct iovec *iov, int iovcnt)
+{
+	return !zts_ready() ? -1 : lwip_writev(fd, iov, iovcnt);
+}
+
 int zts_shutdown(int fd, int how)
 {
 	return !zts_ready() ? -1 : lwip_shutdown(fd, how);
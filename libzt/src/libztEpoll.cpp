@@ -0,0 +1,577 @@
+/*
+ * ZeroTier SDK - Network Virtualization Everywhere
+ * Copyright (C) 2011-2018  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+/**
+ * @file
+ *
+ * Readiness notification (zts_poll, zts_epoll_*) for libzt sockets
+ *
+ * lwIP calls zts_socket_event() (via LWIP_SOCKET_EVENT_HOOK) whenever the
+ * receive, send or error state of a socket changes. Each watched socket keeps
+ * the list of waiters (epoll instances, or a temporary one for zts_poll) that
+ * are interested in it, and an event simply queues the socket on those waiters'
+ * ready lists and wakes them. A wait therefore only examines sockets that have
+ * actually seen activity, regardless of how many are registered.
+ */
+
+#include "libztDefs.h"
+
+#include "lwip/sockets.h"
+
+#include <string.h>
+
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#include <unistd.h>
+#elif !defined(_WIN32)
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <list>
+#include <map>
+#include <mutex>
+#include <vector>
+
+// Same values as in libzt.h (which can't be included alongside the lwIP socket headers)
+#define ZTS_POLLIN   0x001
+#define ZTS_POLLOUT  0x004
+#define ZTS_POLLERR  0x008
+#define ZTS_POLLNVAL 0x020
+
+#define ZTS_EPOLLIN       0x001
+#define ZTS_EPOLLOUT      0x004
+#define ZTS_EPOLLERR      0x008
+#define ZTS_EPOLLONESHOT  (1u << 30)
+#define ZTS_EPOLLET       (1u << 31)
+
+#define ZTS_EPOLL_CTL_ADD 1
+#define ZTS_EPOLL_CTL_DEL 2
+#define ZTS_EPOLL_CTL_MOD 3
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct zts_pollfd
+{
+	int fd;
+	short events;
+	short revents;
+};
+
+typedef union zts_epoll_data
+{
+	void *ptr;
+	int fd;
+	uint32_t u32;
+	uint64_t u64;
+} zts_epoll_data_t;
+
+struct zts_epoll_event
+{
+	uint32_t events;
+	zts_epoll_data_t data;
+};
+
+int zts_ready();
+
+#ifdef __cplusplus
+}
+#endif
+
+namespace {
+
+struct Waiter;
+
+struct Interest
+{
+	uint32_t events;
+	zts_epoll_data_t data;
+	bool armed; // false once a ZTS_EPOLLONESHOT event has fired, until ZTS_EPOLL_CTL_MOD
+	bool queued; // on Waiter::ready
+};
+
+/**
+ * Something blocked on (or registered for) events on a set of sockets
+ */
+struct Waiter
+{
+	Waiter() : closed(false), waiting(0), notifyFd(-1), signalFd(-1), signalled(false) {}
+
+	std::map<int,Interest> interest;
+	std::list<int> ready;
+	std::condition_variable cv;
+	bool closed;
+	int waiting;
+
+	// Optional host descriptor pair for zts_epoll_eventfd() (the same eventfd twice on Linux)
+	int notifyFd;
+	int signalFd;
+	bool signalled;
+
+	void queue(int fd,Interest &i)
+	{
+		if (!i.queued) {
+			i.queued = true;
+			ready.push_back(fd);
+		}
+		cv.notify_all();
+		signal();
+	}
+
+	void signal()
+	{
+#if !defined(_WIN32)
+		if ((signalFd >= 0)&&(!signalled)) {
+			signalled = true;
+#if defined(__linux__)
+			uint64_t one = 1;
+			if (::write(signalFd,&one,sizeof(one))) {}
+#else
+			char one = 1;
+			if (::write(signalFd,&one,1)) {}
+#endif
+		}
+#endif
+	}
+
+	void drain()
+	{
+#if !defined(_WIN32)
+		if ((notifyFd >= 0)&&(signalled)) {
+			signalled = false;
+			char buf[64];
+			while (::read(notifyFd,buf,sizeof(buf)) > 0) {}
+		}
+#endif
+	}
+};
+
+// Everything here, including the state of every Waiter, is guarded by _m. Lock
+// order is _m then lwIP's SYS_ARCH protection; lwIP releases the latter before
+// running LWIP_SOCKET_EVENT_HOOK, so events never arrive with it held.
+std::mutex _m;
+std::map<int,std::vector<Waiter *> > _watchers; // socket -> waiters interested in it
+std::map<int,Waiter *> _instances; // epfd -> instance
+int _nextEpfd = 1;
+std::atomic<int> _watchCount(0); // lets the hook skip the lock when nothing is registered
+
+void _watch(int fd,Waiter *w)
+{
+	_watchers[fd].push_back(w);
+	++_watchCount;
+}
+
+void _unwatch(int fd,Waiter *w)
+{
+	std::map<int,std::vector<Waiter *> >::iterator ws(_watchers.find(fd));
+	if (ws == _watchers.end())
+		return;
+	for(std::vector<Waiter *>::iterator i(ws->second.begin());i!=ws->second.end();++i) {
+		if (*i == w) {
+			ws->second.erase(i);
+			--_watchCount;
+			break;
+		}
+	}
+	if (ws->second.empty())
+		_watchers.erase(ws);
+}
+
+/**
+ * Translate lwIP readiness into ZTS_EPOLL* flags, or return -1 if fd is not a valid socket
+ */
+int _readiness(int fd)
+{
+	const int e = lwip_socket_events(fd);
+	if (e < 0)
+		return -1;
+	return ((e & LWIP_SOCKET_EVT_RCV) ? ZTS_EPOLLIN : 0) |
+		((e & LWIP_SOCKET_EVT_SEND) ? ZTS_EPOLLOUT : 0) |
+		((e & LWIP_SOCKET_EVT_ERR) ? ZTS_EPOLLERR : 0);
+}
+
+/**
+ * Events from readiness r (as returned by _readiness) that i should report
+ */
+uint32_t _wanted(const Interest &i,int r)
+{
+	if (!i.armed)
+		return 0;
+	if (r < 0)
+		return ZTS_EPOLLERR;
+	return (uint32_t)r & ((i.events & (ZTS_EPOLLIN|ZTS_EPOLLOUT)) | ZTS_EPOLLERR);
+}
+
+/**
+ * Pull up to maxevents ready events off w's ready list (caller holds _m)
+ *
+ * Level-triggered sockets that are still ready go back to the end of the
+ * list, everything else is dropped until the next event on it.
+ */
+int _collect(Waiter *w,struct zts_epoll_event *events,int maxevents)
+{
+	int n = 0;
+	size_t todo = w->ready.size();
+	while ((todo--)&&(n < maxevents)) {
+		const int fd = w->ready.front();
+		w->ready.pop_front();
+		std::map<int,Interest>::iterator i(w->interest.find(fd));
+		if (i == w->interest.end())
+			continue;
+		const int r = _readiness(fd);
+		const uint32_t ev = _wanted(i->second,r);
+		if (!ev) {
+			i->second.queued = false;
+			continue;
+		}
+		events[n].events = ev;
+		events[n].data = i->second.data;
+		++n;
+		if (i->second.events & ZTS_EPOLLONESHOT) {
+			i->second.armed = false;
+			i->second.queued = false;
+		} else if ((i->second.events & ZTS_EPOLLET)||(r < 0)) {
+			i->second.queued = false;
+		} else {
+			w->ready.push_back(fd);
+		}
+	}
+	if (w->ready.empty())
+		w->drain();
+	else w->signal();
+	return n;
+}
+
+/**
+ * Block on w->cv until something is queued on w or it is closed
+ *
+ * @return False if deadline passed first (only if timeout >= 0)
+ */
+bool _wait(std::unique_lock<std::mutex> &l,Waiter *w,int timeout,const std::chrono::steady_clock::time_point &deadline)
+{
+	while ((!w->closed)&&(w->ready.empty())) {
+		if (timeout < 0) {
+			w->cv.wait(l);
+		} else if (w->cv.wait_until(l,deadline) == std::cv_status::timeout) {
+			return ((w->closed)||(!w->ready.empty()));
+		}
+	}
+	return true;
+}
+
+std::chrono::steady_clock::time_point _deadline(int timeout)
+{
+	return std::chrono::steady_clock::now() + std::chrono::milliseconds((timeout > 0) ? timeout : 0);
+}
+
+} // anonymous namespace
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void zts_socket_event(int s)
+{
+	if (!_watchCount.load())
+		return;
+	std::lock_guard<std::mutex> l(_m);
+	std::map<int,std::vector<Waiter *> >::iterator ws(_watchers.find(s));
+	if (ws == _watchers.end())
+		return;
+	// Most events (e.g. data being consumed) don't make anything newly ready
+	const int r = _readiness(s);
+	for(std::vector<Waiter *>::iterator w(ws->second.begin());w!=ws->second.end();++w) {
+		std::map<int,Interest>::iterator i((*w)->interest.find(s));
+		if ((i != (*w)->interest.end())&&(_wanted(i->second,r)))
+			(*w)->queue(s,i->second);
+	}
+}
+
+/**
+ * Called by zts_close() so that a closed (and possibly soon reused) descriptor
+ * does not stay registered anywhere
+ */
+void zts_epoll_forget(int fd)
+{
+	if (!_watchCount.load())
+		return;
+	std::lock_guard<std::mutex> l(_m);
+	std::map<int,std::vector<Waiter *> >::iterator ws(_watchers.find(fd));
+	if (ws == _watchers.end())
+		return;
+	std::vector<Waiter *> waiters(ws->second);
+	for(std::vector<Waiter *>::iterator w(waiters.begin());w!=waiters.end();++w) {
+		(*w)->interest.erase(fd);
+		_unwatch(fd,*w);
+	}
+}
+
+int zts_poll(struct zts_pollfd *fds, unsigned int nfds, int timeout)
+{
+	if (!zts_ready())
+		return -1;
+	if ((!fds)&&(nfds)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	// Register first and scan under the lock, so an event landing between
+	// the scan and the wait can't be missed.
+	Waiter w;
+	int n = 0;
+	bool expired = false;
+	const std::chrono::steady_clock::time_point deadline(_deadline(timeout));
+	std::unique_lock<std::mutex> l(_m);
+	if (timeout != 0) {
+		for(unsigned int k=0;k<nfds;++k) {
+			if (fds[k].fd < 0)
+				continue;
+			std::map<int,Interest>::iterator i(w.interest.find(fds[k].fd));
+			if (i == w.interest.end()) {
+				i = w.interest.insert(std::pair<int,Interest>(fds[k].fd,Interest())).first;
+				i->second.events = 0;
+				i->second.armed = true;
+				i->second.queued = false;
+				_watch(fds[k].fd,&w);
+			}
+			if (fds[k].events & ZTS_POLLIN)
+				i->second.events |= ZTS_EPOLLIN;
+			if (fds[k].events & ZTS_POLLOUT)
+				i->second.events |= ZTS_EPOLLOUT;
+		}
+	}
+	for(;;) {
+		n = 0;
+		for(unsigned int k=0;k<nfds;++k) {
+			fds[k].revents = 0;
+			if (fds[k].fd < 0)
+				continue;
+			const int r = _readiness(fds[k].fd);
+			if (r < 0) {
+				fds[k].revents = ZTS_POLLNVAL;
+			} else {
+				if ((r & ZTS_EPOLLIN)&&(fds[k].events & ZTS_POLLIN))
+					fds[k].revents |= ZTS_POLLIN;
+				if ((r & ZTS_EPOLLOUT)&&(fds[k].events & ZTS_POLLOUT))
+					fds[k].revents |= ZTS_POLLOUT;
+				if (r & ZTS_EPOLLERR)
+					fds[k].revents |= ZTS_POLLERR;
+			}
+			if (fds[k].revents)
+				++n;
+		}
+		if ((n)||(timeout == 0)||(expired))
+			break;
+		w.ready.clear();
+		for(std::map<int,Interest>::iterator i(w.interest.begin());i!=w.interest.end();++i)
+			i->second.queued = false;
+		expired = !_wait(l,&w,timeout,deadline); // if so, scan once more and return
+	}
+	for(std::map<int,Interest>::iterator i(w.interest.begin());i!=w.interest.end();++i)
+		_unwatch(i->first,&w);
+	return n;
+}
+
+int zts_epoll_create(int flags)
+{
+	if (!zts_ready())
+		return -1;
+	if (flags != 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	std::lock_guard<std::mutex> l(_m);
+	const int epfd = _nextEpfd++;
+	_instances[epfd] = new Waiter();
+	return epfd;
+}
+
+int zts_epoll_ctl(int epfd, int op, int fd, struct zts_epoll_event *event)
+{
+	if (!zts_ready())
+		return -1;
+	std::lock_guard<std::mutex> l(_m);
+	std::map<int,Waiter *>::iterator inst(_instances.find(epfd));
+	if ((inst == _instances.end())||(inst->second->closed)||(lwip_socket_events(fd) < 0)) {
+		errno = EBADF;
+		return -1;
+	}
+	Waiter *w = inst->second;
+	std::map<int,Interest>::iterator i(w->interest.find(fd));
+	switch(op) {
+		case ZTS_EPOLL_CTL_ADD:
+		case ZTS_EPOLL_CTL_MOD:
+			if (!event) {
+				errno = EINVAL;
+				return -1;
+			}
+			if ((op == ZTS_EPOLL_CTL_ADD)&&(i != w->interest.end())) {
+				errno = EEXIST;
+				return -1;
+			}
+			if ((op == ZTS_EPOLL_CTL_MOD)&&(i == w->interest.end())) {
+				errno = ENOENT;
+				return -1;
+			}
+			if (op == ZTS_EPOLL_CTL_ADD) {
+				i = w->interest.insert(std::pair<int,Interest>(fd,Interest())).first;
+				i->second.queued = false;
+				_watch(fd,w);
+			}
+			i->second.events = event->events;
+			i->second.data = event->data;
+			i->second.armed = true;
+			// Report whatever it is already ready for
+			if (_wanted(i->second,_readiness(fd)))
+				w->queue(fd,i->second);
+			return 0;
+		case ZTS_EPOLL_CTL_DEL:
+			if (i == w->interest.end()) {
+				errno = ENOENT;
+				return -1;
+			}
+			w->interest.erase(i); // stale entries on w->ready are skipped by _collect()
+			_unwatch(fd,w);
+			return 0;
+	}
+	errno = EINVAL;
+	return -1;
+}
+
+int zts_epoll_wait(int epfd, struct zts_epoll_event *events, int maxevents, int timeout)
+{
+	if (!zts_ready())
+		return -1;
+	if ((!events)||(maxevents <= 0)) {
+		errno = EINVAL;
+		return -1;
+	}
+	std::unique_lock<std::mutex> l(_m);
+	std::map<int,Waiter *>::iterator inst(_instances.find(epfd));
+	if ((inst == _instances.end())||(inst->second->closed)) {
+		errno = EBADF;
+		return -1;
+	}
+	Waiter *w = inst->second;
+	const std::chrono::steady_clock::time_point deadline(_deadline(timeout));
+	++w->waiting;
+	int n = 0;
+	for(;;) {
+		n = _collect(w,events,maxevents);
+		if ((n)||(timeout == 0)||(w->closed)||(!_wait(l,w,timeout,deadline)))
+			break;
+	}
+	const bool closed = w->closed;
+	if ((--w->waiting == 0)&&(closed))
+		delete w;
+	if (closed) {
+		errno = EBADF;
+		return -1;
+	}
+	return n;
+}
+
+int zts_epoll_eventfd(int epfd)
+{
+	if (!zts_ready())
+		return -1;
+	std::lock_guard<std::mutex> l(_m);
+	std::map<int,Waiter *>::iterator inst(_instances.find(epfd));
+	if ((inst == _instances.end())||(inst->second->closed)) {
+		errno = EBADF;
+		return -1;
+	}
+	Waiter *w = inst->second;
+	if (w->notifyFd >= 0)
+		return w->notifyFd;
+#if defined(__linux__)
+	const int efd = eventfd(0,EFD_NONBLOCK|EFD_CLOEXEC);
+	if (efd < 0)
+		return -1;
+	w->notifyFd = w->signalFd = efd;
+#elif !defined(_WIN32)
+	int p[2];
+	if (::pipe(p) < 0)
+		return -1;
+	for(int k=0;k<2;++k) {
+		fcntl(p[k],F_SETFL,fcntl(p[k],F_GETFL) | O_NONBLOCK);
+		fcntl(p[k],F_SETFD,FD_CLOEXEC);
+	}
+	w->notifyFd = p[0];
+	w->signalFd = p[1];
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+	for(std::list<int>::iterator fd(w->ready.begin());fd!=w->ready.end();++fd) {
+		std::map<int,Interest>::iterator i(w->interest.find(*fd));
+		if ((i != w->interest.end())&&(_wanted(i->second,_readiness(*fd)))) {
+			w->signal();
+			break;
+		}
+	}
+	return w->notifyFd;
+}
+
+int zts_epoll_close(int epfd)
+{
+	if (!zts_ready())
+		return -1;
+	std::lock_guard<std::mutex> l(_m);
+	std::map<int,Waiter *>::iterator inst(_instances.find(epfd));
+	if (inst == _instances.end()) {
+		errno = EBADF;
+		return -1;
+	}
+	Waiter *w = inst->second;
+	_instances.erase(inst);
+	for(std::map<int,Interest>::iterator i(w->interest.begin());i!=w->interest.end();++i)
+		_unwatch(i->first,w);
+	w->interest.clear();
+#if !defined(_WIN32)
+	if (w->notifyFd >= 0)
+		::close(w->notifyFd);
+	if ((w->signalFd >= 0)&&(w->signalFd != w->notifyFd))
+		::close(w->signalFd);
+#endif
+	w->notifyFd = w->signalFd = -1;
+	w->closed = true;
+	if (w->waiting) {
+		w->cv.notify_all(); // the last waiter to leave deletes it
+	} else {
+		delete w;
+	}
+	return 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -36,12 +36,46 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <errno.h>
+#include <stdlib.h>
 
 #include "libzt.h"
 #include "libztDefs.h"
 
 #include <jni.h>
 
+/**
+ * Largest byte[] transfer that is staged on the stack before falling back to malloc()
+ */
+#define ZT_JNI_BOUNCE_BUF_SZ 4096
+
+/**
+ * Maximum number of ByteBuffers accepted by readv()/writev()
+ */
+#define ZT_JNI_MAX_IOV 64
+
+/**
+ * Native staging area for the byte[] variants of the I/O calls
+ */
+struct BounceBuffer
+{
+	BounceBuffer(jint len) :
+		ptr((len <= ZT_JNI_BOUNCE_BUF_SZ) ? stack : (jbyte *)malloc(len))
+	{
+		if (!ptr) {
+			errno = ENOMEM;
+		}
+	}
+	~BounceBuffer()
+	{
+		if (ptr != stack) {
+			free(ptr);
+		}
+	}
+	jbyte stack[ZT_JNI_BOUNCE_BUF_SZ];
+	jbyte *ptr;
+};
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -50,6 +84,9 @@ namespace ZeroTier {
 
 	void ss2zta(JNIEnv *env, struct sockaddr_storage *ss, jobject addr);
 	void zta2ss(JNIEnv *env, struct sockaddr_storage *ss, jobject addr);
+	bool array_range_ok(JNIEnv *env, jbyteArray buf, jint off, jint len);
+	jbyte *direct_range(JNIEnv *env, jobject buf, jint off, jint len);
+	int direct_iov(JNIEnv *env, jobjectArray bufs, struct iovec *iov);
 
 	/****************************************************************************/
 	/* ZeroTier service controls                                                */
@@ -279,63 +316,229 @@ namespace ZeroTier {
 		return zts_ioctl(fd, request, argp);
 	}
 
-	JNIEXPORT jint JNICALL Java_zerotier_ZeroTier_send(JNIEnv *env, jobject thisObj, jint fd, jarray buf, jint len, int flags)
+	/*
+	 * byte[] I/O. Only the [off, off+len) region of the array is copied, and only
+	 * in the direction the data actually travels: into native memory for sends,
+	 * back into the array (and only the bytes received) for receives.
+	 */
+
+	JNIEXPORT jint JNICALL Java_zerotier_ZeroTier_send_1range(JNIEnv *env, jobject thisObj,
+		jint fd, jbyteArray buf, jint off, jint len, jint flags)
 	{
-		jbyte *body = (*env).GetByteArrayElements((_jbyteArray *)buf, 0);
-		int w = zts_send(fd, body, len, flags);
-		(*env).ReleaseByteArrayElements((_jbyteArray *)buf, body, 0);
-		return w;
+		if (!array_range_ok(env, buf, off, len)) {
+			return -1;
+		}
+		BounceBuffer body(len);
+		if (!body.ptr) {
+			return -1;
+		}
+		(*env).GetByteArrayRegion(buf, off, len, body.ptr);
+		return zts_send(fd, body.ptr, len, flags);
 	}
 
-	JNIEXPORT jint JNICALL Java_zerotier_ZeroTier_sendto(
-		JNIEnv *env, jobject thisObj, jint fd, jarray buf, jint len, jint flags, jobject addr)
+	JNIEXPORT jint JNICALL Java_zerotier_ZeroTier_sendto_1range(JNIEnv *env, jobject thisObj,
+		jint fd, jbyteArray buf, jint off, jint len, jint flags, jobject addr)
 	{
-		jbyte *body = (*env).GetByteArrayElements((_jbyteArray *)buf, 0);
+		if (!array_range_ok(env, buf, off, len)) {
+			return -1;
+		}
+		BounceBuffer body(len);
+		if (!body.ptr) {
+			return -1;
+		}
+		(*env).GetByteArrayRegion(buf, off, len, body.ptr);
 		struct sockaddr_storage ss;
 		zta2ss(env, &ss, addr);
 		socklen_t addrlen = ss.ss_family == AF_INET ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6);
-		int w = zts_sendto(fd, body, len, flags, (struct sockaddr *)&ss, addrlen);
-		(*env).ReleaseByteArrayElements((_jbyteArray *)buf, body, 0);
-		return w;
+		return zts_sendto(fd, body.ptr, len, flags, (struct sockaddr *)&ss, addrlen);
 	}
 
-	JNIEXPORT jint JNICALL Java_zerotier_ZeroTier_recv(JNIEnv *env, jobject thisObj,
-		jint fd, jarray buf, jint len, jint flags)
+	JNIEXPORT jint JNICALL Java_zerotier_ZeroTier_recv_1range(JNIEnv *env, jobject thisObj,
+		jint fd, jbyteArray buf, jint off, jint len, jint flags)
 	{
-		jbyte *body = (*env).GetByteArrayElements((_jbyteArray *)buf, 0);
-		int r = zts_recv(fd, body, len, flags);
-		(*env).ReleaseByteArrayElements((_jbyteArray *)buf, body, 0);
+		if (!array_range_ok(env, buf, off, len)) {
+			return -1;
+		}
+		BounceBuffer body(len);
+		if (!body.ptr) {
+			return -1;
+		}
+		int r = zts_recv(fd, body.ptr, len, flags);
+		if (r > 0) {
+			(*env).SetByteArrayRegion(buf, off, r, body.ptr);
+		}
 		return r;
 	}
 
-	JNIEXPORT jint JNICALL Java_zerotier_ZeroTier_recvfrom(
-		JNIEnv *env, jobject thisObj, jint fd, jbyteArray buf, jint len, jint flags, jobject addr)
+	JNIEXPORT jint JNICALL Java_zerotier_ZeroTier_recvfrom_1range(JNIEnv *env, jobject thisObj,
+		jint fd, jbyteArray buf, jint off, jint len, jint flags, jobject addr)
 	{
+		if (!array_range_ok(env, buf, off, len)) {
+			return -1;
+		}
+		BounceBuffer body(len);
+		if (!body.ptr) {
+			return -1;
+		}
 		socklen_t addrlen = sizeof(struct sockaddr_storage);
 		struct sockaddr_storage ss;
-		jbyte *body = (*env).GetByteArrayElements((_jbyteArray *)buf, 0);
-		int r = zts_recvfrom(fd, body, len, flags, (struct sockaddr *)&ss, &addrlen);
-		(*env).ReleaseByteArrayElements((_jbyteArray *)buf, body, 0);	
-		ss2zta(env, &ss, addr);
+		int r = zts_recvfrom(fd, body.ptr, len, flags, (struct sockaddr *)&ss, &addrlen);
+		if (r > 0) {
+			(*env).SetByteArrayRegion(buf, off, r, body.ptr);
+		}
+		if (r >= 0) {
+			ss2zta(env, &ss, addr);
+		}
 		return r;
 	}
 
+	JNIEXPORT jint JNICALL Java_zerotier_ZeroTier_read_1range(JNIEnv *env, jobject thisObj,
+		jint fd, jbyteArray buf, jint off, jint len)
+	{
+		if (!array_range_ok(env, buf, off, len)) {
+			return -1;
+		}
+		BounceBuffer body(len);
+		if (!body.ptr) {
+			return -1;
+		}
+		int r = zts_read(fd, body.ptr, len);
+		if (r > 0) {
+			(*env).SetByteArrayRegion(buf, off, r, body.ptr);
+		}
+		return r;
+	}
+
+	JNIEXPORT jint JNICALL Java_zerotier_ZeroTier_write_1range(JNIEnv *env, jobject thisObj,
+		jint fd, jbyteArray buf, jint off, jint len)
+	{
+		if (!array_range_ok(env, buf, off, len)) {
+			return -1;
+		}
+		BounceBuffer body(len);
+		if (!body.ptr) {
+			return -1;
+		}
+		(*env).GetByteArrayRegion(buf, off, len, body.ptr);
+		return zts_write(fd, body.ptr, len);
+	}
+
+	JNIEXPORT jint JNICALL Java_zerotier_ZeroTier_send(JNIEnv *env, jobject thisObj, jint fd, jarray buf, jint len, int flags)
+	{
+		return Java_zerotier_ZeroTier_send_1range(env, thisObj, fd, (jbyteArray)buf, 0, len, flags);
+	}
+
+	JNIEXPORT jint JNICALL Java_zerotier_ZeroTier_sendto(
+		JNIEnv *env, jobject thisObj, jint fd, jarray buf, jint len, jint flags, jobject addr)
+	{
+		return Java_zerotier_ZeroTier_sendto_1range(env, thisObj, fd, (jbyteArray)buf, 0, len, flags, addr);
+	}
+
+	JNIEXPORT jint JNICALL Java_zerotier_ZeroTier_recv(JNIEnv *env, jobject thisObj,
+		jint fd, jarray buf, jint len, jint flags)
+	{
+		return Java_zerotier_ZeroTier_recv_1range(env, thisObj, fd, (jbyteArray)buf, 0, len, flags);
+	}
+
+	JNIEXPORT jint JNICALL Java_zerotier_ZeroTier_recvfrom(
+		JNIEnv *env, jobject thisObj, jint fd, jbyteArray buf, jint len, jint flags, jobject addr)
+	{
+		return Java_zerotier_ZeroTier_recvfrom_1range(env, thisObj, fd, buf, 0, len, flags, addr);
+	}
+
 	JNIEXPORT jint JNICALL Java_zerotier_ZeroTier_read(JNIEnv *env, jobject thisObj,
 		jint fd, jarray buf, jint len)
 	{
-		jbyte *body = (*env).GetByteArrayElements((_jbyteArray *)buf, 0);
-		int r = zts_read(fd, body, len);
-		(*env).ReleaseByteArrayElements((_jbyteArray *)buf, body, 0);
-		return r;
+		return Java_zerotier_ZeroTier_read_1range(env, thisObj, fd, (jbyteArray)buf, 0, len);
 	}
 
 	JNIEXPORT jint JNICALL Java_zerotier_ZeroTier_write(JNIEnv *env, jobject thisObj,
 		jint fd, jarray buf, jint len)
 	{
-		jbyte *body = (*env).GetByteArrayElements((_jbyteArray *)buf, 0);
-		int w = zts_write(fd, body, len);
-		(*env).ReleaseByteArrayElements((_jbyteArray *)buf, body, 0);
-		return w;
+		return Java_zerotier_ZeroTier_write_1range(env, thisObj, fd, (jbyteArray)buf, 0, len);
+	}
+
+	/*
+	 * Direct java.nio.ByteBuffer I/O. The buffer's native address is handed to
+	 * the stack as-is, so no copy is made on the JNI side at all.
+	 */
+
+	JNIEXPORT jint JNICALL Java_zerotier_ZeroTier_send_1direct(JNIEnv *env, jobject thisObj,
+		jint fd, jobject buf, jint off, jint len, jint flags)
+	{
+		jbyte *body = direct_range(env, buf, off, len);
+		return body ? zts_send(fd, body, len, flags) : -1;
+	}
+
+	JNIEXPORT jint JNICALL Java_zerotier_ZeroTier_sendto_1direct(JNIEnv *env, jobject thisObj,
+		jint fd, jobject buf, jint off, jint len, jint flags, jobject addr)
+	{
+		jbyte *body = direct_range(env, buf, off, len);
+		if (!body) {
+			return -1;
+		}
+		struct sockaddr_storage ss;
+		zta2ss(env, &ss, addr);
+		socklen_t addrlen = ss.ss_family == AF_INET ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6);
+		return zts_sendto(fd, body, len, flags, (struct sockaddr *)&ss, addrlen);
+	}
+
+	JNIEXPORT jint JNICALL Java_zerotier_ZeroTier_recv_1direct(JNIEnv *env, jobject thisObj,
+		jint fd, jobject buf, jint off, jint len, jint flags)
+	{
+		jbyte *body = direct_range(env, buf, off, len);
+		return body ? zts_recv(fd, body, len, flags) : -1;
+	}
+
+	JNIEXPORT jint JNICALL Java_zerotier_ZeroTier_recvfrom_1direct(JNIEnv *env, jobject thisObj,
+		jint fd, jobject buf, jint off, jint len, jint flags, jobject addr)
+	{
+		jbyte *body = direct_range(env, buf, off, len);
+		if (!body) {
+			return -1;
+		}
+		socklen_t addrlen = sizeof(struct sockaddr_storage);
+		struct sockaddr_storage ss;
+		int r = zts_recvfrom(fd, body, len, flags, (struct sockaddr *)&ss, &addrlen);
+		if (r >= 0) {
+			ss2zta(env, &ss, addr);
+		}
+		return r;
+	}
+
+	JNIEXPORT jint JNICALL Java_zerotier_ZeroTier_read_1direct(JNIEnv *env, jobject thisObj,
+		jint fd, jobject buf, jint off, jint len)
+	{
+		jbyte *body = direct_range(env, buf, off, len);
+		return body ? zts_read(fd, body, len) : -1;
+	}
+
+	JNIEXPORT jint JNICALL Java_zerotier_ZeroTier_write_1direct(JNIEnv *env, jobject thisObj,
+		jint fd, jobject buf, jint off, jint len)
+	{
+		jbyte *body = direct_range(env, buf, off, len);
+		return body ? zts_write(fd, body, len) : -1;
+	}
+
+	/*
+	 * Vectored I/O over arrays of direct ByteBuffers. Each buffer contributes
+	 * the bytes between its position and limit; positions are not advanced.
+	 */
+
+	JNIEXPORT jint JNICALL Java_zerotier_ZeroTier_writev(JNIEnv *env, jobject thisObj,
+		jint fd, jobjectArray bufs)
+	{
+		struct iovec iov[ZT_JNI_MAX_IOV];
+		int iovcnt = direct_iov(env, bufs, iov);
+		return iovcnt < 0 ? -1 : zts_writev(fd, iov, iovcnt);
+	}
+
+	JNIEXPORT jint JNICALL Java_zerotier_ZeroTier_readv(JNIEnv *env, jobject thisObj,
+		jint fd, jobjectArray bufs)
+	{
+		struct iovec iov[ZT_JNI_MAX_IOV];
+		int iovcnt = direct_iov(env, bufs, iov);
+		return iovcnt < 0 ? -1 : zts_readv(fd, iov, iovcnt);
 	}
 
 	JNIEXPORT jint JNICALL Java_zerotier_ZeroTier_shutdown(
@@ -388,6 +591,60 @@ void ss2zta(JNIEnv *env, struct sockaddr_storage *ss, jobject addr)
 	}
 }
 
+bool array_range_ok(JNIEnv *env, jbyteArray buf, jint off, jint len)
+{
+	if (!buf || off < 0 || len < 0 || off > (*env).GetArrayLength(buf) - len) {
+		errno = EINVAL;
+		return false;
+	}
+	return true;
+}
+
+jbyte *direct_range(JNIEnv *env, jobject buf, jint off, jint len)
+{
+	jbyte *addr = buf ? (jbyte *)(*env).GetDirectBufferAddress(buf) : NULL;
+	// Heap (non-direct) buffers have no stable native address
+	if (!addr || off < 0 || len < 0 || (jlong)off + len > (*env).GetDirectBufferCapacity(buf)) {
+		errno = EINVAL;
+		return NULL;
+	}
+	return addr + off;
+}
+
+int direct_iov(JNIEnv *env, jobjectArray bufs, struct iovec *iov)
+{
+	static jmethodID position = NULL;
+	static jmethodID limit = NULL;
+	jsize n = bufs ? (*env).GetArrayLength(bufs) : 0;
+	if (n <= 0 || n > ZT_JNI_MAX_IOV) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (!position) {
+		jclass c = (*env).FindClass("java/nio/Buffer");
+		if (!c) {
+			return -1;
+		}
+		limit = (*env).GetMethodID(c, "limit", "()I");
+		position = (*env).GetMethodID(c, "position", "()I");
+	}
+	for (jsize i=0; i<n; i++) {
+		jobject b = (*env).GetObjectArrayElement(bufs, i);
+		jint pos = b ? (*env).CallIntMethod(b, position) : 0;
+		jint lim = b ? (*env).CallIntMethod(b, limit) : 0;
+		jbyte *base = direct_range(env, b, pos, lim - pos);
+		if (b) {
+			(*env).DeleteLocalRef(b);
+		}
+		if (!base) {
+			return -1;
+		}
+		iov[i].iov_base = base;
+		iov[i].iov_len = lim - pos;
+	}
+	return n;
+}
+
 void zta2ss(JNIEnv *env, struct sockaddr_storage *ss, jobject addr)
 {
 	jclass c = (*env).GetObjectClass(addr);
@@ -58,6 +58,7 @@ class VirtualTap;
 #include "lwip/sys.h"
 #include "lwip/tcp.h"
 #include "lwip/priv/tcp_priv.h" /* for tcp_debug_print_pcbs() */
+#include "lwip/priv/tcpip_priv.h" /* for tcpip_api_call() */
 #include "lwip/timeouts.h"
 #include "lwip/stats.h"
 #include "lwip/ethip6.h"
@@ -68,6 +69,8 @@ class VirtualTap;
 
 #include "lwIP.h"
 
+#include <atomic>
+
 #if defined(_WIN32)
 #include <time.h>
 void ms_sleep(unsigned long ms) 
@@ -76,13 +79,36 @@ void ms_sleep(unsigned long ms)
 }
 #endif
 
-struct netif lwipInterfaces[10];
-int lwipInterfacesCount = 0;
-
-ZeroTier::Mutex _rx_input_lock_m;
-struct pbuf* lwip_frame_rxbuf[LWIP_MAX_GUARDED_RX_BUF_SZ];
-int lwip_frame_rxbuf_tot = 0;
+// Each VirtualTap owns the netifs created for it (see VirtualTap::_netifs), this only counts them
+std::atomic<int> lwipInterfacesCount(0);
 
+/*
+ * Ingress frame ring. Frames arriving from the ZeroTier virtual wire are
+ * allocated as pbufs on the VirtualTap I/O thread and pushed here without
+ * taking a lock. The first push into an idle ring posts a preallocated
+ * callback message to the tcpip thread, which drains the ring in batches of
+ * LWIP_FRAMES_HANDLED_PER_CORE_CALL. Slots carry a sequence number so any
+ * number of producers can push while the tcpip thread is the only consumer.
+ * Each frame remembers the VirtualTap it arrived on so it is only offered to
+ * that tap's netifs.
+ */
+struct lwip_rx_slot {
+	std::atomic<size_t> seq;
+	struct pbuf *p;
+	VirtualTap *tap;
+};
+
+static struct lwip_rx_slot lwip_rx_ring[LWIP_RX_RING_SZ];
+static std::atomic<size_t> lwip_rx_ring_head(0); // next position to push
+static std::atomic<size_t> lwip_rx_ring_tail(0); // next position to pop
+static std::atomic<bool> lwip_rx_drain_pending(false);
+static struct tcpip_callback_msg *lwip_rx_drain_msg = NULL;
+
+static std::atomic<uint64_t> lwip_rx_enqueued(0);
+static std::atomic<uint64_t> lwip_rx_delivered(0);
+static std::atomic<uint64_t> lwip_rx_dropped(0);
+static std::atomic<uint64_t> lwip_rx_wakeups(0);
+static std::atomic<size_t> lwip_rx_high_watermark(0);
 
 bool lwip_driver_initialized = false;
 ZeroTier::Mutex driver_m;
@@ -111,83 +137,180 @@ static void tcpip_init_done(void *arg)
 	sys_sem_t *sem;
 	sem = (sys_sem_t *)arg;
 	//netif_set_up(&lwipdev);
-	lwip_driver_initialized = true;
-	driver_m.unlock();
+	lwip_rx_drain_msg = tcpip_callbackmsg_new(lwip_rx_drain, NULL);
 	// sys_timeout(5000, tcp_timeout, NULL);
 	sys_sem_signal(sem);
 }
 
-void my_tcpip_callback(void *arg)
+static void lwip_rx_ring_init()
+{
+	for (size_t i=0; i<LWIP_RX_RING_SZ; i++) {
+		lwip_rx_ring[i].seq.store(i, std::memory_order_relaxed);
+		lwip_rx_ring[i].p = NULL;
+		lwip_rx_ring[i].tap = NULL;
+	}
+}
+
+static size_t lwip_rx_ring_depth()
+{
+	size_t head = lwip_rx_ring_head.load(std::memory_order_acquire);
+	size_t tail = lwip_rx_ring_tail.load(std::memory_order_acquire);
+	return head > tail ? head - tail : 0;
+}
+
+// May be called from any thread. Returns false if the ring is full.
+static bool lwip_rx_ring_push(struct pbuf *p, VirtualTap *tap)
+{
+	size_t pos = lwip_rx_ring_head.load(std::memory_order_relaxed);
+	while (true) {
+		struct lwip_rx_slot *slot = &lwip_rx_ring[pos & (LWIP_RX_RING_SZ-1)];
+		size_t seq = slot->seq.load(std::memory_order_acquire);
+		intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+		if (dif == 0) {
+			if (lwip_rx_ring_head.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed)) {
+				slot->p = p;
+				slot->tap = tap;
+				slot->seq.store(pos+1, std::memory_order_release);
+				break;
+			}
+		}
+		else if (dif < 0) {
+			return false;
+		}
+		else {
+			pos = lwip_rx_ring_head.load(std::memory_order_relaxed);
+		}
+	}
+	lwip_rx_enqueued++;
+	size_t depth = lwip_rx_ring_depth();
+	size_t hwm = lwip_rx_high_watermark.load(std::memory_order_relaxed);
+	while (depth > hwm && !lwip_rx_high_watermark.compare_exchange_weak(hwm, depth, std::memory_order_relaxed)) {}
+	return true;
+}
+
+// Only called with the core held (tcpip thread or LOCK_TCPIP_CORE). Returns NULL if the ring is empty.
+static struct pbuf *lwip_rx_ring_pop(VirtualTap **tap)
+{
+	size_t pos = lwip_rx_ring_tail.load(std::memory_order_relaxed);
+	struct lwip_rx_slot *slot = &lwip_rx_ring[pos & (LWIP_RX_RING_SZ-1)];
+	size_t seq = slot->seq.load(std::memory_order_acquire);
+	if ((intptr_t)seq - (intptr_t)(pos+1) < 0) {
+		return NULL;
+	}
+	struct pbuf *p = slot->p;
+	*tap = slot->tap;
+	slot->p = NULL;
+	slot->tap = NULL;
+	slot->seq.store(pos+LWIP_RX_RING_SZ, std::memory_order_release);
+	lwip_rx_ring_tail.store(pos+1, std::memory_order_release);
+	return p;
+}
+
+// Schedule a drain on the tcpip thread unless one is already pending. Never blocks.
+static void lwip_rx_ring_notify()
+{
+	if (lwip_rx_drain_pending.exchange(true, std::memory_order_acq_rel)) {
+		return;
+	}
+	if (lwip_rx_drain_msg == NULL || tcpip_trycallback(lwip_rx_drain_msg) != ERR_OK) {
+		// tcpip mbox is full, main_thread's watchdog will retry
+		lwip_rx_drain_pending.store(false, std::memory_order_release);
+		return;
+	}
+	lwip_rx_wakeups++;
+}
+
+// Packet routing logic. Inputs packet into the correct netif of the tap it arrived on depending on protocol type
+static void lwip_input_frame(struct pbuf *p, VirtualTap *tap)
 {
-	ZeroTier::Mutex::Lock _l(_rx_input_lock_m);
-	int loop_score = LWIP_FRAMES_HANDLED_PER_CORE_CALL; // max num of packets to read per polling call
-	// TODO: Optimize (use Ringbuffer)
-	int pkt_num = 0;
-	int count_initial = lwip_frame_rxbuf_tot;
-	while (lwip_frame_rxbuf_tot > 0 && loop_score > 0) {
-		struct pbuf *p = lwip_frame_rxbuf[pkt_num];
-		pkt_num++;
-		// Packet routing logic. Inputs packet into correct lwip netif interface depending on protocol type
-		struct ip_hdr *iphdr;
+	struct netif *dest = NULL;
+	struct ip_hdr *iphdr;
+	{
+		ZeroTier::Mutex::Lock _l(tap->_netifs_m);
 		switch (((struct eth_hdr *)p->payload)->type)
 		{
 #ifdef LIBZT_IPV6
 			case PP_HTONS(ETHTYPE_IPV6): {
-				iphdr = (struct ip_hdr *)((char *)p->payload + SIZEOF_ETH_HDR);
-				for (int i=0; i<lwipInterfacesCount; i++) {
-					if (lwipInterfaces[i].output_ip6 && lwipInterfaces[i].output_ip6 == ethip6_output) {
-						if (lwipInterfaces[i].input(p, &lwipInterfaces[i]) != ERR_OK) {
-							DEBUG_ERROR("packet input error (ipv6, p=%p, netif=%p)", p, &lwipInterfaces[i]);
-							break;
-						}
+				for (size_t i=0; i<tap->_netifs.size(); i++) {
+					struct netif *n = (struct netif *)tap->_netifs[i];
+					if (n->output_ip6 && n->output_ip6 == ethip6_output) {
+						dest = n;
+						break;
 					}
-				}	
+				}
 			} break;
 #endif
 #ifdef LIBZT_IPV4
 			case PP_HTONS(ETHTYPE_IP): {
 				iphdr = (struct ip_hdr *)((char *)p->payload + SIZEOF_ETH_HDR);
-				for (int i=0; i<lwipInterfacesCount; i++) {
-					if (lwipInterfaces[i].output &&  lwipInterfaces[i].output == etharp_output) {
-						//if (lwipInterfaces[i].ip_addr.addr == iphdr->dest.addr || ip4_addr_isbroadcast_u32(iphdr->dest.addr, &lwipInterfaces[i])) {
-						if (lwipInterfaces[i].ip_addr.u_addr.ip4.addr == iphdr->dest.addr || ip4_addr_isbroadcast_u32(iphdr->dest.addr, &lwipInterfaces[i])) {
-							if (lwipInterfaces[i].input(p, &lwipInterfaces[i]) != ERR_OK) {
-								DEBUG_ERROR("packet input error (ipv4, p=%p, netif=%p)", p, &lwipInterfaces[i]);
-								break;
-							}
+				for (size_t i=0; i<tap->_netifs.size(); i++) {
+					struct netif *n = (struct netif *)tap->_netifs[i];
+					if (n->output && n->output == etharp_output) {
+						if (n->ip_addr.u_addr.ip4.addr == iphdr->dest.addr || ip4_addr_isbroadcast_u32(iphdr->dest.addr, n)) {
+							dest = n;
+							break;
 						}
 					}
 				}
 			} break;
 #endif
 			case PP_HTONS(ETHTYPE_ARP): {
-				for (int i=0; i<lwipInterfacesCount; i++) {
-					if (lwipInterfaces[i].state) {
-						pbuf_ref(p);
-						if (lwipInterfaces[i].input(p, &lwipInterfaces[i]) != ERR_OK) {
-							DEBUG_ERROR("packet input error (arp, p=%p, netif=%p)", p, &lwipInterfaces[i]);
-						}
-						break;
-					}
+				if (tap->_netifs.size()) {
+					dest = (struct netif *)tap->_netifs[0];
 				}
-				break;
 			} break;
 			default:
 				break;
 		}
-		lwip_frame_rxbuf_tot--;;
+	}
+	if (dest == NULL) {
+		pbuf_free(p);
+		return;
+	}
+	// We are already on the tcpip thread, so skip the extra mbox hop that netif->input (tcpip_input) would take
+	if (ethernet_input(p, dest) != ERR_OK) {
+		DEBUG_ERROR("packet input error (p=%p, netif=%p)", p, dest);
+		pbuf_free(p);
+	}
+}
+
+void lwip_rx_drain(void *arg)
+{
+	// Clear the flag before draining so a push racing with the end of this drain schedules another one
+	lwip_rx_drain_pending.exchange(false, std::memory_order_acq_rel);
+	struct pbuf *p;
+	VirtualTap *tap;
+	int loop_score = LWIP_FRAMES_HANDLED_PER_CORE_CALL; // max num of frames to input per callback
+	while (loop_score > 0 && (p = lwip_rx_ring_pop(&tap)) != NULL) {
+		lwip_input_frame(p, tap);
+		lwip_rx_delivered++;
 		loop_score--;
 	}
-	int count_final = count_initial - lwip_frame_rxbuf_tot;
-	// move pbuf frame pointer address buffer by the number of frames successfully fed into the stack core
-	memmove(lwip_frame_rxbuf, lwip_frame_rxbuf + count_final, sizeof(lwip_frame_rxbuf) - count_final);
+	// Yield to other tcpip messages (timers, socket API calls) before handling the next batch
+	if (lwip_rx_ring_depth() > 0) {
+		lwip_rx_ring_notify();
+	}
+}
+
+void lwip_get_rx_queue_stats(struct zts_rx_queue_stats *stats)
+{
+	if (stats == NULL) {
+		return;
+	}
+	stats->enqueued = lwip_rx_enqueued.load();
+	stats->delivered = lwip_rx_delivered.load();
+	stats->dropped = lwip_rx_dropped.load();
+	stats->wakeups = lwip_rx_wakeups.load();
+	stats->depth = (uint32_t)lwip_rx_ring_depth();
+	stats->high_watermark = (uint32_t)lwip_rx_high_watermark.load();
+	stats->capacity = LWIP_RX_RING_SZ;
 }
 
 // main thread which starts the initialization process
 static void main_thread(void *arg)
 {
 	sys_sem_t sem;
-	LWIP_UNUSED_ARG(arg);
+	sys_sem_t *init_sem = (sys_sem_t *)arg;
 	if (sys_sem_new(&sem, 0) != ERR_OK) {
 		DEBUG_ERROR("failed to create semaphore");
 	}
@@ -195,16 +318,19 @@ static void main_thread(void *arg)
 	tcpip_init(tcpip_init_done, &sem);
 	sys_sem_wait(&sem);
 	DEBUG_EXTRA("stack thread init complete");
+	sys_sem_signal(init_sem);
 
 	while(1) {
 #if defined(_WIN32)
-		ms_sleep(LWIP_GUARDED_BUF_CHECK_INTERVAL);
+		ms_sleep(LWIP_RX_RING_WATCHDOG_INTERVAL);
 #else
-		usleep(LWIP_GUARDED_BUF_CHECK_INTERVAL*1000);
+		usleep(LWIP_RX_RING_WATCHDOG_INTERVAL*1000);
 #endif
-		// Handle incoming packets from the core's thread context.
-		// If you feed frames into the core directly you will violate the core's thread model
-		tcpip_callback_with_block(my_tcpip_callback, NULL, 1);
+		// Frames are normally drained as soon as they are pushed. This only recovers
+		// from a wakeup that could not be posted because the tcpip mbox was full.
+		if (lwip_rx_ring_depth() > 0) {
+			lwip_rx_ring_notify();
+		}
 	}
 	sys_sem_wait(&sem); // block forever
 }
@@ -212,15 +338,25 @@ static void main_thread(void *arg)
 // initialize the lwIP stack
 void lwip_driver_init()
 {
-	driver_m.lock(); // unlocked from callback indicating completion of driver init
+	// Held until the stack is up so that concurrent callers also wait for it
+	ZeroTier::Mutex::Lock _l(driver_m);
 	if (lwip_driver_initialized == true) {
 		return;
 	}
 #if defined(_WIN32)
 	sys_init(); // required for win32 initializtion of critical sections
 #endif
+	lwip_rx_ring_init();
+	sys_sem_t init_sem;
+	if (sys_sem_new(&init_sem, 0) != ERR_OK) {
+		DEBUG_ERROR("failed to create semaphore");
+		return;
+	}
 	sys_thread_new("main_thread", main_thread,
-		NULL, DEFAULT_THREAD_STACKSIZE, DEFAULT_THREAD_PRIO);
+		&init_sem, DEFAULT_THREAD_STACKSIZE, DEFAULT_THREAD_PRIO);
+	sys_sem_wait(&init_sem);
+	sys_sem_free(&init_sem);
+	lwip_driver_initialized = true;
 }
 
 err_t lwip_eth_tx(struct netif *netif, struct pbuf *p)
@@ -228,27 +364,50 @@ err_t lwip_eth_tx(struct netif *netif, struct pbuf *p)
 	struct pbuf *q;
 	char buf[ZT_MAX_MTU+32];
 	char *bufptr;
-	int totalLength = 0;
+	int totalLength = p->tot_len;
 
 	VirtualTap *tap = (VirtualTap*)netif->state;
-	bufptr = buf;
-	for (q = p; q != NULL; q = q->next) {
-		memcpy(bufptr, q->payload, q->len);
-		bufptr += q->len;
-		totalLength += q->len;
-	}
 	struct eth_hdr *ethhdr;
-	ethhdr = (struct eth_hdr *)buf;
-
 	ZeroTier::MAC src_mac;
 	ZeroTier::MAC dest_mac;
-	src_mac.setTo(ethhdr->src.addr, 6);
-	dest_mac.setTo(ethhdr->dest.addr, 6);
 
-	char *data = buf + sizeof(struct eth_hdr);
-	int len = totalLength - sizeof(struct eth_hdr);
-	int proto = ZeroTier::Utils::ntoh((uint16_t)ethhdr->type);
-	tap->_handler(tap->_arg, NULL, tap->_nwid, src_mac, dest_mac, proto, 0, data, len);
+	if (tap->_segmentsHandler && p->len >= sizeof(struct eth_hdr) && pbuf_clen(p) <= LWIP_TX_MAX_FRAME_SEGMENTS) {
+		// Pass the chain through as-is, the core copies it once into the outgoing packet
+		ZT_FrameSegment segments[LWIP_TX_MAX_FRAME_SEGMENTS];
+		unsigned int segmentCount = 0;
+		ethhdr = (struct eth_hdr *)p->payload;
+		if (p->len > sizeof(struct eth_hdr)) {
+			segments[segmentCount].data = (char *)p->payload + sizeof(struct eth_hdr);
+			segments[segmentCount].len = p->len - sizeof(struct eth_hdr);
+			segmentCount++;
+		}
+		for (q = p->next; q != NULL; q = q->next) {
+			if (q->len > 0) {
+				segments[segmentCount].data = q->payload;
+				segments[segmentCount].len = q->len;
+				segmentCount++;
+			}
+		}
+		src_mac.setTo(ethhdr->src.addr, 6);
+		dest_mac.setTo(ethhdr->dest.addr, 6);
+		int proto = ZeroTier::Utils::ntoh((uint16_t)ethhdr->type);
+		tap->_segmentsHandler(tap->_arg, NULL, tap->_nwid, src_mac, dest_mac, proto, 0, segments, segmentCount);
+	}
+	else {
+		bufptr = buf;
+		for (q = p; q != NULL; q = q->next) {
+			memcpy(bufptr, q->payload, q->len);
+			bufptr += q->len;
+		}
+		ethhdr = (struct eth_hdr *)buf;
+		src_mac.setTo(ethhdr->src.addr, 6);
+		dest_mac.setTo(ethhdr->dest.addr, 6);
+
+		char *data = buf + sizeof(struct eth_hdr);
+		int len = totalLength - sizeof(struct eth_hdr);
+		int proto = ZeroTier::Utils::ntoh((uint16_t)ethhdr->type);
+		tap->_handler(tap->_arg, NULL, tap->_nwid, src_mac, dest_mac, proto, 0, data, len);
+	}
 
 	if (ZT_MSG_TRANSFER == true) {
 		char flagbuf[32];
@@ -285,6 +444,11 @@ void lwip_eth_rx(VirtualTap *tap, const ZeroTier::MAC &from, const ZeroTier::MAC
 			ZeroTier::Utils::ntoh(ethhdr.type), beautify_eth_proto_nums(ZeroTier::Utils::ntoh(ethhdr.type)), flagbuf);
 	}
 
+	if (lwipInterfacesCount <= 0) {
+		DEBUG_ERROR("there are no netifs set up to handle this packet. ignoring.");
+		return;
+	}
+
 	p = pbuf_alloc(PBUF_RAW, len+sizeof(struct eth_hdr), PBUF_POOL);
 	if (p != NULL) {
 		const char *dataptr = reinterpret_cast<const char *>(data);
@@ -292,6 +456,7 @@ void lwip_eth_rx(VirtualTap *tap, const ZeroTier::MAC &from, const ZeroTier::MAC
 		q = p;
 		if (q->len < sizeof(ethhdr)) {
 			DEBUG_ERROR("dropped packet: first pbuf smaller than ethernet header");
+			pbuf_free(p);
 			return;
 		}
 		memcpy(q->payload,&ethhdr,sizeof(ethhdr));
@@ -308,16 +473,13 @@ void lwip_eth_rx(VirtualTap *tap, const ZeroTier::MAC &from, const ZeroTier::MAC
 		return;
 	}
 
-	if (lwipInterfacesCount <= 0) {
-		DEBUG_ERROR("there are no netifs set up to handle this packet. ignoring.");
+	if (!lwip_rx_ring_push(p, tap)) {
+		lwip_rx_dropped++;
+		DEBUG_ERROR("dropped packet: ingress ring full, adjust LWIP_RX_RING_SZ");
+		pbuf_free(p);
 		return;
 	}
-	Mutex::Lock _l(_rx_input_lock_m);
-	if (lwip_frame_rxbuf_tot == LWIP_MAX_GUARDED_RX_BUF_SZ) {
-		DEBUG_ERROR("guarded receive buffer full, adjust MAX_GUARDED_RX_BUF_SZ or LWIP_GUARDED_BUF_CHECK_INTERVAL");
-	}
-	lwip_frame_rxbuf[lwip_frame_rxbuf_tot] = p;
-	lwip_frame_rxbuf_tot += 1;
+	lwip_rx_ring_notify();
 }
 
 /*
@@ -355,13 +517,11 @@ static void netif_status_callback(struct netif *netif)
 	);
 }
 
-ZeroTier::MAC _mac;
-
 static err_t netif_init_4(struct netif *netif)
 {
 	netif->hwaddr_len = 6;
-	netif->name[0]    = 'e';
-	netif->name[1]    = '0'+lwipInterfacesCount;
+	netif->name[0]    = 'z';
+	netif->name[1]    = 't'; // lwIP numbers each netif itself (netif->num)
 	netif->linkoutput = lwip_eth_tx;
 	netif->output     = etharp_output;
 	netif->mtu        = ZT_MAX_MTU;
@@ -371,7 +531,7 @@ static err_t netif_init_4(struct netif *netif)
 		| NETIF_FLAG_IGMP
 		| NETIF_FLAG_LINK_UP
 		| NETIF_FLAG_UP;
-	_mac.copyTo(netif->hwaddr, netif->hwaddr_len);
+	((VirtualTap *)netif->state)->_mac.copyTo(netif->hwaddr, netif->hwaddr_len);
 	netif->hwaddr_len = sizeof(netif->hwaddr);
 	return ERR_OK;
 }
@@ -379,8 +539,8 @@ static err_t netif_init_4(struct netif *netif)
 static err_t netif_init_6(struct netif *netif)
 {
 	netif->hwaddr_len = 6;
-	netif->name[0]    = 'e';
-	netif->name[1]    = '0'+lwipInterfacesCount;
+	netif->name[0]    = 'z';
+	netif->name[1]    = 't'; // lwIP numbers each netif itself (netif->num)
 	netif->linkoutput = lwip_eth_tx;
 	netif->output     = etharp_output;
 	netif->output_ip6 = ethip6_output;
@@ -390,43 +550,120 @@ static err_t netif_init_6(struct netif *netif)
 		| NETIF_FLAG_ETHERNET
 		| NETIF_FLAG_IGMP
 		| NETIF_FLAG_MLD6;
-	_mac.copyTo(netif->hwaddr, netif->hwaddr_len);
+	((VirtualTap *)netif->state)->_mac.copyTo(netif->hwaddr, netif->hwaddr_len);
 	netif->hwaddr_len = sizeof(netif->hwaddr);
 	return ERR_OK;
 }
 
-void lwip_init_interface(void *tapref, const ZeroTier::MAC &mac, const ZeroTier::InetAddress &ip)
+/*
+ * Interfaces are added and removed from VirtualTap/service threads but netif_*
+ * calls must hold the core. tcpip_api_call() takes the core lock and runs the
+ * callback in place when LWIP_TCPIP_CORE_LOCKING is enabled, otherwise it
+ * posts the callback to the tcpip thread and waits for it to finish.
+ */
+struct lwip_interface_call {
+	struct tcpip_api_call_data call; // must be first
+	VirtualTap *tap;
+	const ZeroTier::InetAddress *ip;
+};
+
+static err_t lwip_init_interface_cb(struct tcpip_api_call_data *call)
 {
+	struct lwip_interface_call *ctx = (struct lwip_interface_call *)call;
+	const ZeroTier::InetAddress &ip = *(ctx->ip);
 	char ipbuf[INET6_ADDRSTRLEN], nmbuf[INET6_ADDRSTRLEN];
 	char macbuf[ZT_MAC_ADDRSTRLEN];
-	struct netif *lwipdev = &lwipInterfaces[lwipInterfacesCount];
-	_mac = mac;
+	struct netif *lwipdev = new struct netif;
+	struct netif *added = NULL;
+	memset(lwipdev, 0, sizeof(struct netif));
 
 	if (ip.isV4()) {
-		static ip4_addr_t ipaddr, netmask, gw;
+		ip4_addr_t ipaddr, netmask, gw;
 		IP4_ADDR(&gw,127,0,0,1);
 		ipaddr.addr = *((u32_t *)ip.rawIpData());
 		netmask.addr = *((u32_t *)ip.netmask().rawIpData());
 		netif_set_status_callback(lwipdev, netif_status_callback);
-		netif_add(lwipdev, &ipaddr, &netmask, &gw, NULL, netif_init_4, tcpip_input);
-		lwipdev->state = tapref;
-		mac2str(macbuf, ZT_MAC_ADDRSTRLEN, lwipdev->hwaddr);
-		DEBUG_INFO("initialized netif as [mac=%s, addr=%s, nm=%s]", macbuf, ip.toString(ipbuf), ip.netmask().toString(nmbuf));
+		added = netif_add(lwipdev, &ipaddr, &netmask, &gw, (void *)ctx->tap, netif_init_4, tcpip_input);
+		if (added) {
+			mac2str(macbuf, ZT_MAC_ADDRSTRLEN, lwipdev->hwaddr);
+			DEBUG_INFO("initialized netif as [mac=%s, addr=%s, nm=%s]", macbuf, ip.toString(ipbuf), ip.netmask().toString(nmbuf));
+		}
 	}
 	if (ip.isV6())
 	{
-		static ip6_addr_t ipaddr;
+		ip6_addr_t ipaddr;
 		memcpy(&(ipaddr.addr), ip.rawIpData(), sizeof(ipaddr.addr));
-		netif_add(lwipdev, NULL, NULL, NULL, NULL, netif_init_6, tcpip_input);
-		netif_ip6_addr_set(lwipdev, 1, &ipaddr);
-		lwipdev->state = tapref;
-		netif_ip6_addr_set_state(lwipdev, 1, IP6_ADDR_TENTATIVE);
-		netif_set_status_callback(lwipdev, netif_status_callback);
-		netif_set_default(lwipdev);
-		netif_set_up(lwipdev);
-		netif_set_link_up(lwipdev);
-		mac2str(macbuf, ZT_MAC_ADDRSTRLEN, lwipdev->hwaddr);
-		DEBUG_INFO("initialized netif as [mac=%s, addr=%s]", macbuf, ip.toString(ipbuf));
+		added = netif_add(lwipdev, NULL, NULL, NULL, (void *)ctx->tap, netif_init_6, tcpip_input);
+		if (added) {
+			netif_ip6_addr_set(lwipdev, 1, &ipaddr);
+			netif_ip6_addr_set_state(lwipdev, 1, IP6_ADDR_TENTATIVE);
+			netif_set_status_callback(lwipdev, netif_status_callback);
+			netif_set_default(lwipdev);
+			netif_set_up(lwipdev);
+			netif_set_link_up(lwipdev);
+			mac2str(macbuf, ZT_MAC_ADDRSTRLEN, lwipdev->hwaddr);
+			DEBUG_INFO("initialized netif as [mac=%s, addr=%s]", macbuf, ip.toString(ipbuf));
+		}
+	}
+	if (added == NULL) {
+		// Neither an IPv4 nor an IPv6 address, or lwIP refused the netif
+		delete lwipdev;
+		return ERR_VAL;
+	}
+	{
+		ZeroTier::Mutex::Lock _l(ctx->tap->_netifs_m);
+		ctx->tap->_netifs.push_back((void *)lwipdev);
 	}
 	lwipInterfacesCount++;
+	return ERR_OK;
+}
+
+void lwip_init_interface(void *tapref, const ZeroTier::MAC &mac, const ZeroTier::InetAddress &ip)
+{
+	struct lwip_interface_call ctx;
+	ctx.tap = (VirtualTap *)tapref;
+	ctx.ip = &ip;
+	if (tcpip_api_call(lwip_init_interface_cb, &ctx.call) != ERR_OK) {
+		DEBUG_ERROR("failed to set up netif");
+	}
+}
+
+static err_t lwip_remove_interfaces_cb(struct tcpip_api_call_data *call)
+{
+	struct lwip_interface_call *ctx = (struct lwip_interface_call *)call;
+	// Feed in anything still queued so no frame refers to this tap after it is gone.
+	// The tap has already stopped calling lwip_eth_rx() (see ~VirtualTap), so nothing
+	// for it can be pushed after this, and holding the core keeps this from racing
+	// lwip_rx_drain() for the consumer side.
+	struct pbuf *p;
+	VirtualTap *tap;
+	while ((p = lwip_rx_ring_pop(&tap)) != NULL) {
+		lwip_input_frame(p, tap);
+		lwip_rx_delivered++;
+	}
+	std::vector<void*> netifs;
+	{
+		ZeroTier::Mutex::Lock _l(ctx->tap->_netifs_m);
+		netifs.swap(ctx->tap->_netifs);
+	}
+	for (size_t i=0; i<netifs.size(); i++) {
+		struct netif *n = (struct netif *)netifs[i];
+		netif_remove(n);
+		delete n;
+		lwipInterfacesCount--;
+	}
+	return ERR_OK;
+}
+
+void lwip_remove_interfaces(void *tapref)
+{
+	if (lwip_driver_initialized == false) {
+		return;
+	}
+	struct lwip_interface_call ctx;
+	ctx.tap = (VirtualTap *)tapref;
+	ctx.ip = NULL;
+	if (tcpip_api_call(lwip_remove_interfaces_cb, &ctx.call) != ERR_OK) {
+		DEBUG_ERROR("failed to remove netifs");
+	}
 }
@@ -171,6 +171,11 @@ int gettimeofday(struct timeval *tv, struct timezone *tz)
 
 #define DETAILS_STR_LEN        128
 
+#define PERF_PINGPONG_ROUNDS   1000
+#define PERF_PINGPONG_MSG_SZ   64
+#define PERF_BULK_SZ           16 * ONE_MEGABYTE
+#define PERF_BULK_CHUNK_SZ     16384
+
 // If running a self test, use libzt calls
 #if defined(__SELFTEST__)
 #define _SOCKET zts_socket
@@ -1743,95 +1748,164 @@ void udp_server_sustained_6(UDP_UNIT_TEST_SIG_6)
 /* PERFORMANCE (between library instances)                                  */
 /****************************************************************************/
 
-// Maintain transfer for cnt OR cnt
-void tcp_client_perf_4(TCP_UNIT_TEST_SIG_4)
+// Read exactly len bytes, returns false if the connection went away
+bool perf_read_all(int fd, char *buf, int len)
 {
-	fprintf(stderr, "\n\n\ntcp_client_perf_4\n");
-	/*
-	int w=0, fd, err;
-	int total_test_sz          = cnt;
-	int arbitrary_chunk_sz_max = MAX_RX_BUF_SZ;
-	int arbitrary_chunk_sz_min = 512;
-
-	char rbuf[arbitrary_chunk_sz_max];
-
-	for (int i=arbitrary_chunk_sz_min; (i*2) < arbitrary_chunk_sz_max; i*=2) {
+	int r = 0, n;
+	while (r < len) {
+#if defined(_WIN32)
+		n = _RECV(fd, &buf[r], len - r, 0);
+#else
+		n = _READ(fd, &buf[r], len - r);
+#endif
+		if (n <= 0) {
+			return false;
+		}
+		r += n;
+	}
+	return true;
+}
 
-		if ((fd = _SOCKET(AF_INET, SOCK_STREAM, 0)) < 0)
-			DEBUG_ERROR("error creating ZeroTier socket");
-		if ((err = _CONNECT(fd, (const struct sockaddr *)addr, sizeof(addr))) < 0)
-			DEBUG_ERROR("error connecting to remote host (%d)", err);
+// Write exactly len bytes, returns false if the connection went away
+bool perf_write_all(int fd, char *buf, int len)
+{
+	int w = 0, n;
+	while (w < len) {
+#if defined(_WIN32)
+		n = _SEND(fd, &buf[w], len - w, 0);
+#else
+		n = _WRITE(fd, &buf[w], len - w);
+#endif
+		if (n <= 0) {
+			return false;
+		}
+		w += n;
+	}
+	return true;
+}
 
-		DEBUG_TEST("[TX] Testing (%d) byte chunks: ", i);
+// Small message round trips followed by a one-way bulk transfer. Every call here goes through the
+// socket API so the numbers show the per-call cost of reaching the lwIP core (message passing to the
+// tcpip thread, or taking the core lock when built with LIBZT_TCPIP_CORE_LOCKING=1)
+void tcp_client_perf_4(TCP_UNIT_TEST_SIG_4)
+{
+	std::string testname = "tcp_client_perf_4";
+	fprintf(stderr, "\n\n%s (ts=%lu)\n", testname.c_str(), get_now_ts());
+	fprintf(stderr, "connect to remote host with IPv4 address, measure ping-pong latency and bulk throughput.\n");
+	int fd, err = 0;
+	bool ok = true;
+	char msgbuf[PERF_PINGPONG_MSG_SZ];
+	char *txbuf = (char*)malloc(PERF_BULK_CHUNK_SZ);
+	generate_random_data(msgbuf, PERF_PINGPONG_MSG_SZ, 0, 9);
+	generate_random_data(txbuf, PERF_BULK_CHUNK_SZ, 0, 9);
 
-		int chunk_sz   = i;
-		long int start_time = get_now_ts();
-		w = 0;
+#if !defined(_WIN32)
+	signal(SIGPIPE, SIG_IGN);
+#endif
+	if ((fd = _SOCKET(AF_INET, SOCK_STREAM, 0)) < 0) {
+		DEBUG_ERROR("error creating ZeroTier socket");
+		free(txbuf);
+		*passed = false;
+		return;
+	}
+	if ((err = _CONNECT(fd, (const struct sockaddr *)addr, sizeof(*addr))) < 0) {
+		DEBUG_ERROR("error connecting to remote host (%d)", err);
+		_CLOSE(fd);
+		free(txbuf);
+		*passed = false;
+		return;
+	}
+	int flag = 1;
+	_SETSOCKOPT(fd, IPPROTO_TCP, TCP_NODELAY, (char *)&flag, sizeof(int));
+	// Ping-pong
+	long int pp_ti = get_now_ts();
+	for (int i=0; ok && i<PERF_PINGPONG_ROUNDS; i++) {
+		ok = perf_write_all(fd, msgbuf, PERF_PINGPONG_MSG_SZ) && perf_read_all(fd, msgbuf, PERF_PINGPONG_MSG_SZ);
+	}
+	long int pp_tf = get_now_ts();
+	// Bulk
+	long int bulk_ti = get_now_ts();
+	for (int w=0; ok && w<PERF_BULK_SZ; w+=PERF_BULK_CHUNK_SZ) {
+		ok = perf_write_all(fd, txbuf, PERF_BULK_CHUNK_SZ);
+	}
+	char ack;
+	ok = ok && perf_read_all(fd, &ack, 1); // server has read everything
+	long int bulk_tf = get_now_ts();
+	err = _CLOSE(fd);
 
-		// TX
-		while (w < total_test_sz)
-			w += _WRITE(fd, rbuf, chunk_sz);
-		
-		long int end_time = get_now_ts();
-		float ts_delta = (end_time - start_time) / (float)1000;
-		float rate = (float)total_test_sz / (float)ts_delta;
-		sprintf(details, "tot=%d, dt=%.2f, rate=%.2f MB/s", w, ts_delta, (rate / float(ONE_MEGABYTE) ));
-		_CLOSE(fd);		
-	}	
-	*passed = (w == total_test_sz && !err) ? TEST_PASSED : TEST_FAILED;
-	*/
+	float rtt_us = (pp_tf - pp_ti) * 1000 / (float)PERF_PINGPONG_ROUNDS;
+	float bulk_dt = (bulk_tf - bulk_ti) / (float)1000;
+	float bulk_rate = (float)PERF_BULK_SZ / bulk_dt;
+	sprintf(details, "%s, rounds=%d, msg_sz=%d, rtt=%.1f us, bulk=%d, dt=%.2f, rate=%.2f MB/s",
+		testname.c_str(), PERF_PINGPONG_ROUNDS, PERF_PINGPONG_MSG_SZ, rtt_us, PERF_BULK_SZ, bulk_dt, (bulk_rate / float(ONE_MEGABYTE)));
+	*passed = (ok && err>=0);
+	free(txbuf);
 }
 
-// Maintain transfer for cnt OR cnt
 void tcp_server_perf_4(TCP_UNIT_TEST_SIG_4)
 {
-	fprintf(stderr, "\n\n\ntcp_server_perf_4\n");
-	/*
-	int r=0, fd, client_fd, err;
-	int total_test_sz          = cnt;
-	int arbitrary_chunk_sz_max = MAX_RX_BUF_SZ;
-	int arbitrary_chunk_sz_min = 512;
-
-	char rbuf[arbitrary_chunk_sz_max];
-
-	for (int i=arbitrary_chunk_sz_min; (i*2) < arbitrary_chunk_sz_max; i*=2) {
-		DEBUG_ERROR("TESTING chunk size = %d", i);
-		if ((fd = _SOCKET(AF_INET, SOCK_STREAM, 0)) < 0)
-			DEBUG_ERROR("error creating ZeroTier socket");
-		if ((err = _BIND(fd, (struct sockaddr *)addr, (socklen_t)sizeof(struct sockaddr_in)) < 0))
-			DEBUG_ERROR("error binding to interface (%d)", err);
-		if ((err = _LISTEN(fd, 1)) < 0)
-			DEBUG_ERROR("error placing socket in _LISTENING state (%d)", err);
-		if ((client_fd = _ACCEPT(fd, (struct sockaddr *)&addr, (socklen_t *)sizeof(addr))) < 0)
-			DEBUG_ERROR("error accepting connection (%d)", err);
-
-		DEBUG_TEST("[RX] Testing (%d) byte chunks: ", i);
-
-		int chunk_sz   = i;
-		long int start_time = get_now_ts();
-		r = 0;
-
-		// RX
-		while (r < total_test_sz)
-			r += _READ(client_fd, rbuf, chunk_sz);
-		
-		long int end_time = get_now_ts();
-
-		float ts_delta = (end_time - start_time) / (float)1000;
-		float rate = (float)total_test_sz / (float)ts_delta;
-
-		sprintf(details, "tot=%d, dt=%.2f, rate=%.2f MB/s", r, ts_delta, (rate / float(ONE_MEGABYTE) ));		
+	std::string testname = "tcp_server_perf_4";
+	fprintf(stderr, "\n\n%s (ts=%lu)\n", testname.c_str(), get_now_ts());
+	fprintf(stderr, "accept connection from host with IPv4 address, echo ping-pong messages then sink bulk transfer.\n");
+	int fd, client_fd, err = 0;
+	bool ok = true;
+	char msgbuf[PERF_PINGPONG_MSG_SZ];
+	char *rxbuf = (char*)malloc(PERF_BULK_CHUNK_SZ);
 
+	if ((fd = _SOCKET(AF_INET, SOCK_STREAM, 0)) < 0) {
+		DEBUG_ERROR("error creating ZeroTier socket");
+		free(rxbuf);
+		*passed = false;
+		return;
+	}
+	if ((err = _BIND(fd, (struct sockaddr *)addr, (socklen_t)sizeof(*addr)) < 0)) {
+		DEBUG_ERROR("error binding to interface (%d)", err);
 		_CLOSE(fd);
-		_CLOSE(client_fd);
+		free(rxbuf);
+		*passed = false;
+		return;
 	}
-	*passed = (r == total_test_sz && !err) ? TEST_PASSED : TEST_FAILED;
-	*/
-}
-
-
-
+	if ((err = _LISTEN(fd, 1)) < 0) {
+		DEBUG_ERROR("error placing socket in _LISTENING state (%d)", err);
+		_CLOSE(fd);
+		free(rxbuf);
+		*passed = false;
+		return;
+	}
+	struct sockaddr_storage client;
+	socklen_t client_addrlen = sizeof(sockaddr_storage);
+	if ((client_fd = _ACCEPT(fd, (struct sockaddr *)&client, &client_addrlen)) < 0) {
+		DEBUG_ERROR("error accepting connection (%d)", client_fd);
+		_CLOSE(fd);
+		free(rxbuf);
+		*passed = false;
+		return;
+	}
+	int flag = 1;
+	_SETSOCKOPT(client_fd, IPPROTO_TCP, TCP_NODELAY, (char *)&flag, sizeof(int));
+	// Ping-pong
+	for (int i=0; ok && i<PERF_PINGPONG_ROUNDS; i++) {
+		ok = perf_read_all(client_fd, msgbuf, PERF_PINGPONG_MSG_SZ) && perf_write_all(client_fd, msgbuf, PERF_PINGPONG_MSG_SZ);
+	}
+	// Bulk
+	long int bulk_ti = get_now_ts();
+	for (int r=0; ok && r<PERF_BULK_SZ; r+=PERF_BULK_CHUNK_SZ) {
+		ok = perf_read_all(client_fd, rxbuf, PERF_BULK_CHUNK_SZ);
+	}
+	long int bulk_tf = get_now_ts();
+	char ack = 1;
+	ok = ok && perf_write_all(client_fd, &ack, 1);
+	sleep(ARTIFICIAL_SOCKET_LINGER);
+	err = _CLOSE(client_fd);
+	err = _CLOSE(fd) < 0 ? -1 : err;
 
+	float bulk_dt = (bulk_tf - bulk_ti) / (float)1000;
+	float bulk_rate = (float)PERF_BULK_SZ / bulk_dt;
+	sprintf(details, "%s, rounds=%d, bulk=%d, dt=%.2f, rate=%.2f MB/s",
+		testname.c_str(), PERF_PINGPONG_ROUNDS, PERF_BULK_SZ, bulk_dt, (bulk_rate / float(ONE_MEGABYTE)));
+	*passed = (ok && err>=0);
+	free(rxbuf);
+}
 
 /****************************************************************************/
 /* PERFORMANCE (between library and native)                                 */
@@ -3258,6 +3332,25 @@ for (int i=0; i<num_repeats; i++)
 		RECORD_RESULTS(passed, details, &results);
 		port++;
 
+	// TCP 4 ping-pong latency and bulk throughput
+
+		ipv = 4;
+		subtest_start_time_offset+=subtest_expected_duration;
+		subtest_expected_duration = 60;
+
+		if (mode == TEST_MODE_SERVER) {
+			str2addr(local_ipstr, port, ipv, (struct sockaddr *)&local_addr);
+			wait_until_tplus_s(selftest_start_time, subtest_start_time_offset);
+			tcp_server_perf_4((struct sockaddr_in *)&local_addr, op, cnt, details, &passed); 
+		}
+		else if (mode == TEST_MODE_CLIENT) {
+			str2addr(remote_ipstr, port, ipv, (struct sockaddr *)&remote_addr);
+			wait_until_tplus_s(selftest_start_time, subtest_start_time_offset+5);
+			tcp_client_perf_4((struct sockaddr_in *)&remote_addr, op, cnt, details, &passed); 
+		}
+		RECORD_RESULTS(passed, details, &results);
+		port++;
+
 // IPV6
 
 		// UDP 6 client/server